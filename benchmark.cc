@@ -0,0 +1,844 @@
+//
+// benchmark.cc - Timings of the batched kernels of vecmat3 against the
+//                equivalent loops over single vectors and matrices
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// Usage: benchmark [number of elements] [repetitions]
+//
+// Build with e.g.
+//   make benchmark CXXFLAGS="-O3 -march=native -fno-math-errno -fopenmp"
+//
+
+#include "vecmat3.h"
+#include "vecmat3batch.h"
+#include "vecmat3pbc.h"
+#include "vecmat3cells.h"
+#include "vecmat3half.h"
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> VectorArray;
+typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> MatrixArray;
+
+// Wall clock time in seconds
+static double now()
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9*t.tv_nsec;
+#endif
+}
+
+// Prints the time per element of 'reps' calls to a kernel
+#define TIME(label, reps, num, kernel)                                  \
+    {                                                                   \
+        double start = now();                                           \
+        for (int rep = 0; rep < (reps); rep++) {                        \
+            kernel;                                                     \
+        }                                                               \
+        double elapsed = now() - start;                                 \
+        std::cout << std::setw(44) << std::left << (label)              \
+                  << std::setw(10) << std::right << std::fixed          \
+                  << std::setprecision(3)                               \
+                  << 1e9*elapsed/((double)(reps)*(num)) << " ns\n";     \
+    }
+
+// Keeps the compiler from optimizing away unused results
+static double checksum = 0;
+
+static void benchmarkRotation( std::size_t num, int reps )
+{
+    std::cout << "Rotating " << num << " vectors:\n";
+    Matrix R = Rodrigues(Vector(0.1, -0.2, 0.3));
+    std::vector<Vector> x(num), y(num);
+    std::vector<Matrix> Rs(num);
+    VectorArray xs(num), ys(num);
+    MatrixArray Ra(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        y[n] = x[n];
+        ys.set(n, x[n]);
+        xs.set(n, x[n]);
+        Rs[n] = Rodrigues(0.001*n*x[n]);
+        Ra.set(n, Rs[n]);
+    }
+
+    TIME("scalar loop y[n] = R*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] = R*x[n]);
+    checksum += y[num-1].x;
+    TIME("rotate(R, x, y, num)", reps, num,
+         vecmat3::rotate(R, &x[0], &y[0], num));
+    checksum += y[num-1].x;
+    TIME("scalar loop y[n] = Transpose(R)*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] = MTVmult(R, x[n]));
+    checksum += y[num-1].x;
+    TIME("unrotate(R, x, y, num)", reps, num,
+         vecmat3::unrotate(R, &x[0], &y[0], num));
+    checksum += y[num-1].x;
+    TIME("expression on arrays ys = R*xs", reps, num,
+         ys = R*xs);
+    checksum += ys.x[num-1];
+    TIME("rotate(R, xs, ys)", reps, num,
+         vecmat3::rotate(R, xs, ys));
+    checksum += ys.x[num-1];
+    TIME("scalar loop y[n] = Rs[n]*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] = Rs[n]*x[n]);
+    checksum += y[num-1].x;
+    TIME("rotate(Rs, x, y, num)", reps, num,
+         vecmat3::rotate(&Rs[0], &x[0], &y[0], num));
+    checksum += y[num-1].x;
+    TIME("expression on arrays ys = Ra*xs", reps, num,
+         ys = Ra*xs);
+    checksum += ys.x[num-1];
+    TIME("rotate(Ra, xs, ys)", reps, num,
+         vecmat3::rotate(Ra, xs, ys));
+    checksum += ys.x[num-1];
+}
+
+static void benchmarkInverse( std::size_t num, int reps )
+{
+    std::cout << "Inverting " << num << " matrices:\n";
+    std::vector<Matrix> m(num), minv(num);
+    std::vector<Vector> b(num), x(num);
+    MatrixArray ma(num), mainv(num);
+    VectorArray ba(num), xa(num);
+    std::vector<char> singular(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector v = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        m[n] = Rodrigues(v) + Dyadic(v, v);
+        b[n] = v;
+        ma.set(n, m[n]);
+        ba.set(n, v);
+        minv[n] = m[n];
+        mainv.set(n, m[n]);
+        x[n] = v;
+        xa.set(n, v);
+    }
+
+    TIME("scalar loop minv[n] = Inverse(m[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) minv[n] = Inverse(m[n]));
+    checksum += minv[num-1].xx;
+    TIME("invert(ma, mainv)", reps, num,
+         vecmat3::invert(ma, mainv));
+    checksum += mainv.xx[num-1];
+    TIME("invert(ma, mainv, singular)", reps, num,
+         vecmat3::invert(ma, mainv, (bool*)&singular[0]));
+    checksum += mainv.xx[num-1];
+    TIME("scalar loop x[n] = Inverse(m[n])*b[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) x[n] = Inverse(m[n])*b[n]);
+    checksum += x[num-1].x;
+    TIME("solve(ma, ba, xa)", reps, num,
+         vecmat3::solve(ma, ba, xa));
+    checksum += xa.x[num-1];
+}
+
+static void benchmarkRodrigues( std::size_t num, int reps )
+{
+    std::cout << "Building " << num << " rotation matrices:\n";
+    std::vector<Vector> v(num);
+    std::vector<Matrix> m(num);
+    VectorArray va(num);
+    MatrixArray ma(num);
+    for (std::size_t n = 0; n < num; n++) {
+        v[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        va.set(n, v[n]);
+        m[n] = Matrix(1,0,0,0,1,0,0,0,1);
+        ma.set(n, m[n]);
+    }
+
+    TIME("scalar loop m[n] = Rodrigues(v[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] = Rodrigues(v[n]));
+    checksum += m[num-1].xx;
+    TIME("Rodrigues(v, m, num)", reps, num,
+         vecmat3::Rodrigues(&v[0], &m[0], num));
+    checksum += m[num-1].xx;
+    TIME("Rodrigues(va, ma)", reps, num,
+         vecmat3::Rodrigues(va, ma));
+    checksum += ma.xx[num-1];
+}
+
+static void benchmarkQuaternion( std::size_t num, int reps )
+{
+    typedef vecmat3::Quaternion<DOUBLE> Quaternion;
+    std::cout << "Composing and interpolating " << num << " rotations:\n";
+    std::vector<Matrix> m(num), dm(num);
+    std::vector<Quaternion> q(num), dq(num), q2(num), qi(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector v = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        m[n] = Rodrigues(v);
+        dm[n] = Rodrigues(0.01*v);
+        q[n] = RodriguesQuaternion(v);
+        dq[n] = RodriguesQuaternion(0.01*v);
+        q2[n] = RodriguesQuaternion(-v);
+        qi[n] = q[n];
+    }
+
+    TIME("scalar loop m[n] *= dm[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] *= dm[n]);
+    checksum += m[num-1].xx;
+    TIME("scalar loop q[n] *= dq[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) q[n] *= dq[n]);
+    checksum += q[num-1].w;
+    TIME("scalar loop m[n].reorthogonalize()", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n].reorthogonalize());
+    checksum += m[num-1].xx;
+    TIME("scalar loop q[n].normalize()", reps, num,
+         for (std::size_t n = 0; n < num; n++) q[n].normalize());
+    checksum += q[num-1].w;
+    TIME("scalar loop qi[n] = slerp(q[n], q2[n], 0.3)", reps, num,
+         for (std::size_t n = 0; n < num; n++) qi[n] = slerp(q[n], q2[n], 0.3));
+    checksum += qi[num-1].w;
+    TIME("slerp(q, q2, 0.3, qi, num)", reps, num,
+         vecmat3::slerp(&q[0], &q2[0], 0.3, &qi[0], num));
+    checksum += qi[num-1].w;
+    TIME("scalar loop qi[n] = nlerp(q[n], q2[n], 0.3)", reps, num,
+         for (std::size_t n = 0; n < num; n++) qi[n] = nlerp(q[n], q2[n], 0.3));
+    checksum += qi[num-1].w;
+    TIME("nlerp(q, q2, 0.3, qi, num)", reps, num,
+         vecmat3::nlerp(&q[0], &q2[0], 0.3, &qi[0], num));
+    checksum += qi[num-1].w;
+}
+
+static void benchmarkPeriodic( std::size_t num, int reps )
+{
+    std::cout << "Minimum image distances of " << num << " vectors:\n";
+    vecmat3::Box<DOUBLE> box(10, 12, 14);
+    std::vector<Vector> x(num);
+    VectorArray xa(num);
+    std::vector<double> d2(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = 30*Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xa.set(n, x[n]);
+    }
+    Vector a(1, 2, 3);
+    const Vector& L = box.size();
+
+    TIME("scalar loop with rounding by floor", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             Vector d = a - x[n];
+             d.x -= L.x*std::floor(d.x/L.x + 0.5);
+             d.y -= L.y*std::floor(d.y/L.y + 0.5);
+             d.z -= L.z*std::floor(d.z/L.z + 0.5);
+             d2[n] = d.nrm2();
+         });
+    checksum += d2[num-1];
+    TIME("scalar loop d2[n] = box.dist2(a, x[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) d2[n] = box.dist2(a, x[n]));
+    checksum += d2[num-1];
+    TIME("dist2(box, a, xa, d2)", reps, num,
+         vecmat3::dist2(box, a, xa, &d2[0]));
+    checksum += d2[num-1];
+    TIME("wrap(box, x, num)", reps, num,
+         vecmat3::wrap(box, &x[0], num));
+    checksum += x[num-1].x;
+    TIME("wrap(box, xa)", reps, num,
+         vecmat3::wrap(box, xa));
+    checksum += xa.x[num-1];
+}
+
+static void benchmarkTriclinic( std::size_t num, int reps )
+{
+    std::cout << "Triclinic minimum image displacements of " << num << " pairs:\n";
+    Matrix h(10, 2, -3,
+             0, 12,  4,
+             0,  0, 14);
+    vecmat3::TriclinicBox<DOUBLE> box(h);
+    std::vector<Vector> x(num), d(num);
+    VectorArray xa(num), da(num);
+    std::vector<std::size_t> i(num), j(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = 30*Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xa.set(n, x[n]);
+        i[n] = std::rand() % num;
+        j[n] = std::rand() % num;
+    }
+    const Matrix hi = Inverse(h);
+
+    TIME("scalar loop with Inverse(h), floor and h", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             Vector s = hi*(x[i[n]] - x[j[n]]);
+             s.x -= std::floor(s.x + 0.5);
+             s.y -= std::floor(s.y + 0.5);
+             s.z -= std::floor(s.z + 0.5);
+             d[n] = h*s;
+         });
+    checksum += d[num-1].x;
+    TIME("scalar loop with box.displacement", reps, num,
+         for (std::size_t n = 0; n < num; n++)
+             d[n] = box.displacement(x[i[n]], x[j[n]]));
+    checksum += d[num-1].x;
+    TIME("displacement(box, x, i, j, d, num)", reps, num,
+         vecmat3::displacement(box, &x[0], &i[0], &j[0], &d[0], num));
+    checksum += d[num-1].x;
+    TIME("displacement(box, xa, i, j, da)", reps, num,
+         vecmat3::displacement(box, xa, &i[0], &j[0], da));
+    checksum += da.x[num-1];
+}
+
+static void benchmarkCells( std::size_t num, int reps )
+{
+    std::cout << "Finding neighbours of " << num << " particles:\n";
+    DOUBLE l = std::cbrt((double)num);  // unit density
+    DOUBLE rc = 2.5;
+    vecmat3::Box<DOUBLE> box(l, l, l);
+    std::vector<Vector> x(num);
+    VectorArray xa(num);
+    std::vector<double> d2(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = l*Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xa.set(n, x[n]);
+    }
+    std::size_t few = num < 100 ? num : 100;
+    std::size_t found = 0;
+    TIME("all pairs with dist2(box, x[n], xa, d2)", 1, few,
+         for (std::size_t n = 0; n < few; n++) {
+             vecmat3::dist2(box, x[n], xa, &d2[0]);
+             for (std::size_t m = 0; m < num; m++)
+                 found += (d2[m] < rc*rc);
+         });
+    checksum += found;
+    vecmat3::CellList<vecmat3::Box<DOUBLE> > cells(box, rc);
+    TIME("cells.build(xa)", reps, num,
+         cells.build(xa));
+    for (std::size_t n = 0; n < num; n += 100)
+        xa.x[n] += 0.5;
+    TIME("cells.update(xa)", reps, num,
+         cells.update(xa));
+    std::vector<std::size_t> i, j;
+    d2.resize(cells.pairs(i, j));  // first touch of the memory
+    TIME("cells.pairs(i, j), dist2(box, xa, i, j, d2)", 1, num,
+         cells.pairs(i, j);
+         vecmat3::dist2(box, xa, &i[0], &j[0], &d2[0], i.size()));
+    checksum += i.size();
+}
+
+// Counts the pairs closer than a cutoff
+struct PairCounter
+{
+    const VectorArray* x;
+    const vecmat3::Box<DOUBLE>* box;
+    DOUBLE rc2;
+    std::size_t count;
+    void operator()( std::size_t i, std::size_t j )
+    {
+        count += (box->dist2((*x)[i], (*x)[j]) < rc2);
+    }
+};
+
+static void benchmarkVerlet( std::size_t num, int reps )
+{
+    std::cout << "Pair loops over " << num << " particles:\n";
+    DOUBLE l = std::cbrt((double)num);
+    DOUBLE rc = 2.5, skin = 0.3;
+    vecmat3::Box<DOUBLE> box(l, l, l);
+    VectorArray xa(num);
+    for (std::size_t n = 0; n < num; n++)
+        xa.set(n, l*Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX);
+    vecmat3::CellList<vecmat3::Box<DOUBLE> > cells(box, rc);
+    cells.build(xa);
+    vecmat3::VerletList<vecmat3::Box<DOUBLE> > verlet(box, rc, skin);
+    verlet.build(xa);  // allocates the memory
+    TIME("verlet.build(xa)", 1, num,
+         verlet.build(xa));
+    TIME("verlet.update(xa) without rebuild", reps, num,
+         verlet.update(xa));
+    PairCounter counter;
+    counter.x = &xa;
+    counter.box = &box;
+    counter.rc2 = rc*rc;
+    counter.count = 0;
+    TIME("cells.forEachPair(counter)", 1, num,
+         counter = cells.forEachPair(counter));
+    checksum += counter.count;
+    counter.count = 0;
+    TIME("verlet.forEachPair(counter)", 1, num,
+         counter = verlet.forEachPair(counter));
+    checksum += counter.count;
+}
+
+// Counts the pairs closer than a cutoff in the tiles of an all-pairs kernel
+struct TileCounter
+{
+    DOUBLE rc2;
+    std::size_t* count;
+    void operator()( std::size_t, std::size_t, std::size_t ni, std::size_t nj, const DOUBLE* d2 )
+    {
+        std::size_t found = 0;
+        for (std::size_t k = 0; k < ni*nj; k++)
+            found += (d2[k] < rc2);
+        VECMAT3_OMP_PRAGMA(omp atomic)
+        *count += found;
+    }
+};
+
+static void benchmarkDistanceMatrix( std::size_t num, int reps )
+{
+    std::size_t n = num < 4000 ? num : 4000;
+    std::cout << "All-pairs distances between two sets of " << n << " vectors:\n";
+    std::vector<Vector> x(n), y(n);
+    VectorArray xa(n), ya(n);
+    for (std::size_t i = 0; i < n; i++) {
+        x[i] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        y[i] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xa.set(i, x[i]);
+        ya.set(i, y[i]);
+    }
+    std::vector<DOUBLE> d2(n*n);
+    TIME("scalar loop d2[i*n+j] = (x[i]-y[j]).nrm2()", reps, n*n,
+         for (std::size_t i = 0; i < n; i++)
+             for (std::size_t j = 0; j < n; j++)
+                 d2[i*n + j] = (x[i] - y[j]).nrm2());
+    checksum += d2[n*n-1];
+    TIME("dist2Matrix(xa, ya, d2)", reps, n*n,
+         vecmat3::dist2Matrix(xa, ya, &d2[0]));
+    checksum += d2[n*n-1];
+    TIME("distMatrix(xa, ya, d)", reps, n*n,
+         vecmat3::distMatrix(xa, ya, &d2[0]));
+    checksum += d2[n*n-1];
+    TIME("scalar loop d2[k++] = (x[i]-x[j]).nrm2()", reps, n*(n-1)/2,
+         std::size_t k = 0;
+         for (std::size_t i = 0; i < n; i++)
+             for (std::size_t j = i + 1; j < n; j++)
+                 d2[k++] = (x[i] - x[j]).nrm2());
+    checksum += d2[0];
+    TIME("dist2Matrix(xa, d2), packed", reps, n*(n-1)/2,
+         vecmat3::dist2Matrix(xa, &d2[0]));
+    checksum += d2[0];
+    std::size_t count = 0;
+    TileCounter counter;
+    counter.rc2 = 0.01;
+    counter.count = &count;
+    TIME("dist2Tiles(xa, ya, counter)", reps, n*n,
+         vecmat3::dist2Tiles(xa, ya, counter));
+    checksum += count;
+}
+
+static void benchmarkNested( std::size_t num, int reps )
+{
+    std::cout << "Evaluating " << num << " nested expressions:\n";
+    std::vector<Matrix> a(num), b(num), m(num);
+    std::vector<Vector> x(num), y(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        a[n] = Rodrigues(x[n]);
+        b[n] = Rodrigues(-0.5*x[n]);
+        m[n] = a[n];
+        y[n] = x[n];
+    }
+    Vector c(0.1, -0.2, 0.3);
+
+    TIME("m[n] = a[n]*b[n]*a[n]*b[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] = a[n]*b[n]*a[n]*b[n]);
+    checksum += m[num-1].xx;
+    TIME("same with temporaries", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             Matrix ab = a[n]*b[n];
+             Matrix aba = ab*a[n];
+             m[n] = aba*b[n];
+         });
+    checksum += m[num-1].xx;
+    TIME("m[n] = Transpose(a[n]*b[n])*(a[n]*b[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] = Transpose(a[n]*b[n])*(a[n]*b[n]));
+    checksum += m[num-1].xx;
+    TIME("same with temporaries", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             Matrix ab = a[n]*b[n];
+             m[n] = Transpose(ab)*ab;
+         });
+    checksum += m[num-1].xx;
+    TIME("y[n] = a[n]*b[n]*a[n]*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] = a[n]*b[n]*a[n]*x[n]);
+    checksum += y[num-1].x;
+    TIME("y[n] = (x[n]^c)^(y[n]^c)", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] = (x[n]^c)^(y[n]^c));
+    checksum += y[num-1].x;
+    TIME("same with temporaries", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             Vector xc = x[n]^c;
+             Vector yc = y[n]^c;
+             y[n] = xc^yc;
+         });
+    checksum += y[num-1].x;
+}
+
+static void benchmarkNoAlias( std::size_t num, int reps )
+{
+    std::cout << "Assigning " << num << " long expressions:\n";
+    std::vector<Matrix> a(num), b(num), m(num);
+    std::vector<Vector> x(num), y(num), z(num);
+    VectorArray xs(num), ys(num), zs(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        y[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        z[n] = x[n];
+        a[n] = Rodrigues(x[n]);
+        b[n] = Rodrigues(-0.5*y[n]);
+        m[n] = a[n];
+        xs.set(n, x[n]);
+        ys.set(n, y[n]);
+        zs.set(n, x[n]);
+    }
+    Matrix R = Rodrigues(Vector(0.1, -0.2, 0.3));
+    Vector c(0.1, -0.2, 0.3);
+
+    TIME("m[n] = a[n]*b[n]-b[n]*a[n]+Transpose(a[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++)
+             m[n] = a[n]*b[n] - b[n]*a[n] + Transpose(a[n]));
+    checksum += m[num-1].xx;
+    TIME("noalias(m[n]) = same", reps, num,
+         for (std::size_t n = 0; n < num; n++)
+             noalias(m[n]) = a[n]*b[n] - b[n]*a[n] + Transpose(a[n]));
+    checksum += m[num-1].xx;
+    TIME("z[n] = (x[n]^c) + a[n]*y[n] - (y[n]^x[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++)
+             z[n] = (x[n]^c) + a[n]*y[n] - (y[n]^x[n]));
+    checksum += z[num-1].x;
+    TIME("noalias(z[n]) = same", reps, num,
+         for (std::size_t n = 0; n < num; n++)
+             noalias(z[n]) = (x[n]^c) + a[n]*y[n] - (y[n]^x[n]));
+    checksum += z[num-1].x;
+    TIME("zs = (xs^c) + R*ys - (ys^xs)", reps, num,
+         zs = (xs^c) + R*ys - (ys^xs));
+    checksum += zs.x[num-1];
+    TIME("noalias(zs) = same", reps, num,
+         noalias(zs) = (xs^c) + R*ys - (ys^xs));
+    checksum += zs.x[num-1];
+}
+
+static void benchmarkFma( std::size_t num, int reps )
+{
+    std::cout << "Sums of products of " << num << " elements (VECMAT3_FMA="
+              << VECMAT3_FMA << "):\n";
+    std::vector<Matrix> a(num), b(num), m(num);
+    std::vector<Vector> x(num), y(num), z(num);
+    std::vector<double> d(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        y[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        z[n] = x[n];
+        a[n] = Rodrigues(x[n]) + Dyadic(y[n], y[n]);
+        b[n] = Rodrigues(-0.5*y[n]);
+        m[n] = a[n];
+    }
+
+    TIME("z[n] = x[n] + 0.5*y[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) z[n] = x[n] + 0.5*y[n]);
+    checksum += z[num-1].x;
+    TIME("z[n] = x[n] - a[n]*y[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) z[n] = x[n] - a[n]*y[n]);
+    checksum += z[num-1].x;
+    TIME("m[n] = b[n] + a[n]*b[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] = b[n] + a[n]*b[n]);
+    checksum += m[num-1].xx;
+    TIME("d[n] = a[n].det()", reps, num,
+         for (std::size_t n = 0; n < num; n++) d[n] = a[n].det());
+    checksum += d[num-1];
+    TIME("m[n] = Inverse(a[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] = Inverse(a[n]));
+    checksum += m[num-1].xx;
+}
+
+static void benchmarkSymMatrix( std::size_t num, int reps )
+{
+    std::cout << "Symmetric tensors of " << num << " elements:\n";
+    typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::SymmetricOp,vecmat3::Base> SymMatrix;
+    std::vector<Vector> x(num);
+    std::vector<Matrix> a(num), m(num);
+    std::vector<SymMatrix> sa(num), sm(num);
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        a[n] = Dyadic(x[n], x[n]);
+        sa[n] = a[n];
+        m[n] = a[n];
+        sm[n] = sa[n];
+    }
+    Matrix W(0);
+    SymMatrix S(0);
+
+    TIME("Matrix W += Dyadic(x[n],x[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) W += Dyadic(x[n], x[n]));
+    checksum += W.xy;
+    TIME("SymMatrix S += Dyadic(x[n],x[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) S += Dyadic(x[n], x[n]));
+    checksum += S.xy;
+    TIME("Matrix m[n] += 0.5*a[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n] += 0.5*a[n]);
+    checksum += m[num-1].xy;
+    TIME("SymMatrix sm[n] += 0.5*sa[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) sm[n] += 0.5*sa[n]);
+    checksum += sm[num-1].xy;
+}
+
+static void benchmarkStructured( std::size_t num, int reps )
+{
+    std::cout << "Structured matrices, " << num << " elements:\n";
+    std::vector<Vector> x(num), w(num), y(num, Vector(0));
+    std::vector<Matrix> a(num), b(num, Matrix(0));
+    for (std::size_t n = 0; n < num; n++) {
+        x[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        w[n] = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        a[n] = Dyadic(x[n], w[n]) + Matrix(1,0,0,0,1,0,0,0,1);
+    }
+    const Vector d(0.5, 2.0, -1.0);
+    const Matrix D = vecmat3::Diagonal(d);
+    const vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::RotZOp,vecmat3::Base> Rz = vecmat3::RotZ(0.3);
+    const Matrix R = Rz;
+
+    TIME("Matrix y[n] += Matrix(Skew(w[n]))*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] += Matrix(vecmat3::Skew(w[n]))*x[n]);
+    checksum += y[num-1].x;
+    TIME("Skew y[n] += Skew(w[n])*x[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) y[n] += vecmat3::Skew(w[n])*x[n]);
+    checksum += y[num-1].x;
+    TIME("Matrix b[n] += a[n]*D", reps, num,
+         for (std::size_t n = 0; n < num; n++) b[n] += a[n]*D);
+    checksum += b[num-1].xy;
+    TIME("Diagonal b[n] += a[n]*Diagonal(d)", reps, num,
+         for (std::size_t n = 0; n < num; n++) b[n] += a[n]*vecmat3::Diagonal(d));
+    checksum += b[num-1].xy;
+    TIME("Matrix b[n] += R*a[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) b[n] += R*a[n]);
+    checksum += b[num-1].xy;
+    TIME("RotZ b[n] += Rz*a[n]", reps, num,
+         for (std::size_t n = 0; n < num; n++) b[n] += Rz*a[n]);
+    checksum += b[num-1].xy;
+}
+
+static void benchmarkEigen( std::size_t num, int reps )
+{
+    std::cout << "Diagonalizing " << num << " symmetric matrices:\n";
+    std::vector<Matrix> m(num), v(num);
+    std::vector<Vector> l(num);
+    MatrixArray ma(num), va(num);
+    VectorArray la(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector a = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        Vector b = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        m[n] = Dyadic(a, a) + Dyadic(b, b) + Dyadic(a^b, a^b);
+        ma.set(n, m[n]);
+    }
+
+    TIME("scalar loop l[n] = eigenvalues(m[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) l[n] = vecmat3::eigenvalues(m[n]));
+    checksum += l[num-1].x;
+    TIME("eigenvalues(ma, la)", reps, num,
+         vecmat3::eigenvalues(ma, la));
+    checksum += la.x[num-1];
+    TIME("scalar loop eigensystem(m[n], l[n], v[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) vecmat3::eigensystem(m[n], l[n], v[n]));
+    checksum += v[num-1].xx;
+    TIME("eigensystem(ma, la, va)", reps, num,
+         vecmat3::eigensystem(ma, la, va));
+    checksum += va.xx[num-1];
+}
+
+static void benchmarkSvd( std::size_t num, int reps )
+{
+    std::cout << "Decomposing " << num << " matrices:\n";
+    std::vector<Matrix> m(num), u(num), v(num), r(num), p(num);
+    std::vector<Vector> s(num);
+    MatrixArray ma(num), ua(num), va(num), ra(num), pa(num);
+    VectorArray sa(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector a = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        Vector b = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        m[n] = Rodrigues(a) + 0.2*Dyadic(a, b);
+        ma.set(n, m[n]);
+    }
+
+    TIME("scalar loop svd(m[n], u[n], s[n], v[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) vecmat3::svd(m[n], u[n], s[n], v[n]));
+    checksum += s[num-1].x;
+    TIME("svd(ma, ua, sa, va)", reps, num,
+         vecmat3::svd(ma, ua, sa, va));
+    checksum += sa.x[num-1];
+    TIME("scalar loop polar(m[n], r[n], p[n])", reps, num,
+         for (std::size_t n = 0; n < num; n++) vecmat3::polar(m[n], r[n], p[n]));
+    checksum += r[num-1].xx;
+    TIME("polar(ma, ra, pa)", reps, num,
+         vecmat3::polar(ma, ra, pa));
+    checksum += ra.xx[num-1];
+}
+
+static void benchmarkReorthogonalize( std::size_t num, int reps )
+{
+    std::cout << "Reorthogonalizing " << num << " rotation matrices:\n";
+    std::vector<Matrix> m(num);
+    MatrixArray ma(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector a = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        Vector b = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        m[n] = Rodrigues(a) + 1e-8*Dyadic(a, b);
+        ma.set(n, m[n]);
+    }
+
+    TIME("scalar loop m[n].reorthogonalize()", reps, num,
+         for (std::size_t n = 0; n < num; n++) m[n].reorthogonalize());
+    checksum += m[num-1].xx;
+    TIME("reorthogonalize(ma)", reps, num,
+         vecmat3::reorthogonalize(ma));
+    checksum += ma.xx[num-1];
+    TIME("reorthogonalize(ma, NewtonGramSchmidt)", reps, num,
+         vecmat3::reorthogonalize(ma, vecmat3::NewtonGramSchmidt));
+    checksum += ma.xx[num-1];
+    TIME("reorthogonalize(ma, PolarProjection)", reps, num,
+         vecmat3::reorthogonalize(ma, vecmat3::PolarProjection));
+    checksum += ma.xx[num-1];
+    TIME("reorthogonalize(ma, GramSchmidt, 1e-12)", reps, num,
+         vecmat3::reorthogonalize(ma, vecmat3::GramSchmidt, 1e-12));
+    checksum += ma.xx[num-1];
+}
+
+static void benchmarkMixedPrecision( std::size_t num, int reps )
+{
+    typedef vecmat3::Vector<float,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> FloatArray;
+    std::cout << "Updating " << num << " single and double precision vectors:\n";
+    VectorArray xd(num), vd(num);
+    FloatArray xf(num), vf(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector x = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        Vector v = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xd.set(n, x);
+        vd.set(n, v);
+        xf.set(n, vecmat3::Convert<float>(x));
+        vf.set(n, vecmat3::Convert<float>(v));
+    }
+    const double dt = 1e-3;
+
+    TIME("axpy(dt, vd, xd), double storage", reps, num,
+         vecmat3::axpy(dt, vd, xd));
+    checksum += xd.x[num-1];
+    TIME("axpy(dt, vf, xf), float storage", reps, num,
+         vecmat3::axpy(dt, vf, xf));
+    checksum += xf.x[num-1];
+    TIME("xf = Convert<float>(...+dt*Convert<double>)", reps, num,
+         xf = vecmat3::Convert<float>(vecmat3::Convert<double>(xf) + dt*vecmat3::Convert<double>(vf)));
+    checksum += xf.x[num-1];
+    TIME("sum<double>(xd), double storage", reps, num,
+         checksum += vecmat3::sum<double>(xd).x);
+    TIME("sum<double>(xf), float storage", reps, num,
+         checksum += vecmat3::sum<double>(xf).x);
+}
+
+static void benchmarkHalf( std::size_t num, int reps )
+{
+    typedef vecmat3::Vector<float,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> FloatArray;
+    typedef vecmat3::Vector<vecmat3::Half,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> HalfArray;
+    typedef vecmat3::Vector<vecmat3::BFloat16,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> BFloat16Array;
+    std::cout << "Converting " << num << " 16-bit vectors:\n";
+    FloatArray xf(num);
+    HalfArray xh(num);
+    BFloat16Array xb(num);
+    for (std::size_t n = 0; n < num; n++) {
+        Vector x = Vector(std::rand(), std::rand(), std::rand())/(double)RAND_MAX;
+        xf.set(n, vecmat3::Convert<float>(x));
+    }
+
+    TIME("scalar loop xh.x[n] = Half(xf.x[n]), ...", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             xh.x[n] = vecmat3::Half(xf.x[n]);
+             xh.y[n] = vecmat3::Half(xf.y[n]);
+             xh.z[n] = vecmat3::Half(xf.z[n]);
+         });
+    checksum += xh.x[num-1];
+    TIME("convert(xf, xh)", reps, num,
+         vecmat3::convert(xf, xh));
+    checksum += xh.x[num-1];
+    TIME("convert(xh, xf)", reps, num,
+         vecmat3::convert(xh, xf));
+    checksum += xf.x[num-1];
+    TIME("convert(xf, xb)", reps, num,
+         vecmat3::convert(xf, xb));
+    checksum += xb.x[num-1];
+    TIME("convert(xb, xf)", reps, num,
+         vecmat3::convert(xb, xf));
+    checksum += xf.x[num-1];
+}
+
+static void benchmarkViews( std::size_t num, int reps )
+{
+    typedef vecmat3::Vector<double,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> VectorArray;
+    typedef vecmat3::Vector<double,vecmat3::Base,vecmat3::StridedOp,vecmat3::Base> VectorArrayRef;
+    std::cout << "Updating " << num << " vectors in an interleaved buffer:\n";
+    const std::size_t stride = 7;  // x, y, z, vx, vy, vz, mass
+    std::vector<double> buf(stride*num);
+    for (std::size_t i = 0; i < buf.size(); i++)
+        buf[i] = std::rand()/(double)RAND_MAX;
+    Matrix R = Rodrigues(Vector(0.1, -0.2, 0.3));
+    VectorArray x(num), v(num);
+    VectorArrayRef xv(&buf[0], num, stride), vv(&buf[3], num, stride);
+    const double dt = 1e-3;
+
+    TIME("copy in, x = R*x + dt*v, copy out", reps, num,
+         for (std::size_t n = 0; n < num; n++) {
+             x.set(n, Vector(buf[stride*n], buf[stride*n+1], buf[stride*n+2]));
+             v.set(n, Vector(buf[stride*n+3], buf[stride*n+4], buf[stride*n+5]));
+         }
+         x = R*x + dt*v;
+         for (std::size_t n = 0; n < num; n++) {
+             buf[stride*n]   = x.x[n];
+             buf[stride*n+1] = x.y[n];
+             buf[stride*n+2] = x.z[n];
+         });
+    checksum += buf[0];
+    TIME("view x = R*x + dt*v", reps, num,
+         xv = R*xv + dt*vv);
+    checksum += buf[0];
+}
+
+int main( int argc, char* argv[] )
+{
+    std::size_t num = argc > 1 ? std::atol(argv[1]) : 1000000;
+    int reps = argc > 2 ? std::atoi(argv[2]) : 20;
+    benchmarkRotation(num, reps);
+    benchmarkInverse(num, reps);
+    benchmarkRodrigues(num, reps);
+    benchmarkQuaternion(num, reps);
+    benchmarkPeriodic(num, reps);
+    benchmarkTriclinic(num, reps);
+    benchmarkCells(num, reps);
+    benchmarkVerlet(num, reps);
+    benchmarkDistanceMatrix(num, reps);
+    benchmarkNested(num, reps);
+    benchmarkNoAlias(num, reps);
+    benchmarkFma(num, reps);
+    benchmarkSymMatrix(num, reps);
+    benchmarkStructured(num, reps);
+    benchmarkEigen(num, reps);
+    benchmarkSvd(num, reps);
+    benchmarkReorthogonalize(num, reps);
+    benchmarkMixedPrecision(num, reps);
+    benchmarkHalf(num, reps);
+    benchmarkViews(num, reps);
+    std::cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
@@ -26,6 +26,12 @@
 #include <sstream>
 #include <cassert>
 #include "vecmat3.h"
+#include "vecmat3pack.h"
+#include "vecmat3batch.h"
+#include "vecmat3pbc.h"
+#include "vecmat3cells.h"
+#include "vecmat3half.h"
+#include <set>
 
 #define BOOST_TEST_MODULE vecmat3_test
 
@@ -538,6 +544,21 @@ BOOST_AUTO_TEST_CASE( scalar_in_situ_divide_matrix )
   BOOST_CHECK_CLOSE_FRACTION( D.zz,  0.25, tol );
 }
 
+BOOST_AUTO_TEST_CASE( divide_by_integer )
+{
+  // the reciprocal of an integer divisor is computed in the element type
+  Vector a(1, -2, 3);
+  Vector b = a/2;
+  BOOST_CHECK( b.x == 0.5 && b.y == -1 && b.z == 1.5 );
+  Matrix D(-1, 2, 3,
+            7, 6, 5,
+            4, 3, 1);
+  Matrix E = D/4;
+  BOOST_CHECK( E.xx == -0.25 && E.yx == 1.75 && E.zz == 0.25 );
+  vecmat3::Matrix<float> F = vecmat3::Matrix<float>(2, 0, 0, 0, 2, 0, 0, 0, 2)/2;
+  BOOST_CHECK( F.xx == 1.0f && F.yy == 1.0f && F.zz == 1.0f );
+}
+
 BOOST_AUTO_TEST_CASE( in_situ_add_matrices )
 {
   DOUBLE tol = 1e-10;
@@ -674,6 +695,1523 @@ BOOST_AUTO_TEST_CASE( inverse )
   BOOST_CHECK_CLOSE_FRACTION( B.zz, -2./7., tol );
 }
 
+BOOST_AUTO_TEST_CASE( vector_array )
+{
+  DOUBLE tol = 1e-10;
+  vecmat3::VectorArray<DOUBLE> pos(5), vel(5);
+  for (int n = 0; n < 5; n++) {
+    pos.set(n, Vector(n, 2*n, 3*n));
+    vel.set(n, Vector(1, -1, 2));
+  }
+  Vector g(0, 0, -1);
+  pos = pos + 0.5*vel + g;
+  vecmat3::VectorArray<DOUBLE> copy(pos);
+  copy -= vel;
+  copy *= 2;
+  Matrix A(0, 1, 0,
+          -1, 0, 0,
+           0, 0, 1);
+  vecmat3::VectorArray<DOUBLE> y(5);
+  y = (A*copy)^g;
+  BOOST_CHECK( pos.size() == 5 );
+  for (int n = 0; n < 5; n++) {
+    Vector p(n+0.5, 2*n-0.5, 3*n);
+    Vector c = 2*(p-Vector(1,-1,2));
+    Vector w = (A*c)^g;
+    BOOST_CHECK_CLOSE_FRACTION( pos[n].x, p.x, tol );
+    BOOST_CHECK_CLOSE_FRACTION( pos[n].y, p.y, tol );
+    BOOST_CHECK_CLOSE_FRACTION( pos[n].z, p.z, tol );
+    BOOST_CHECK_CLOSE_FRACTION( y[n].x, w.x, tol );
+    BOOST_CHECK_CLOSE_FRACTION( y[n].y, w.y, tol );
+    BOOST_CHECK_CLOSE_FRACTION( y[n].z, w.z, tol );
+  }
+  // set(n, e) stores element n of an array expression e
+  vecmat3::VectorArray<DOUBLE> twice(5);
+  vecmat3::MatrixArray<DOUBLE> dyads(5), shifted(5);
+  for (int n = 0; n < 5; n++) {
+    twice.set(n, 2*pos);
+    dyads.set(n, Dyadic(pos[n], vel[n]));
+  }
+  for (int n = 0; n < 5; n++)
+    shifted.set(n, dyads + A);
+  for (int n = 0; n < 5; n++) {
+    BOOST_CHECK( (twice[n] - Vector(2*pos[n])).nrm() == 0 );
+    BOOST_CHECK( (shifted[n] - (Dyadic(pos[n], vel[n]) + A)).nrm() == 0 );
+  }
+  // assignment between arrays of different sizes reallocates
+  vecmat3::VectorArray<DOUBLE> small(2);
+  vecmat3::MatrixArray<DOUBLE> smallm(2);
+  small = pos;
+  smallm = dyads;
+  BOOST_CHECK( small.size() == 5 && smallm.size() == 5 );
+  BOOST_CHECK( (small[4] - pos[4]).nrm() == 0 );
+  BOOST_CHECK( (smallm[4] - dyads[4]).nrm() == 0 );
+  // all arrays in an expression assigned to an array have its size
+  BOOST_CHECK( vecmat3::hasSize(pos + 0.5*vel + g, 5) );
+  BOOST_CHECK( vecmat3::hasSize((A*g)^g, 2) );
+  vecmat3::VectorArray<DOUBLE> three(3);
+  BOOST_CHECK( !vecmat3::hasSize(pos + three, 5) );
+  BOOST_CHECK( !vecmat3::hasSize(shifted*pos + g, 3) );
+}
+
+BOOST_AUTO_TEST_CASE( pack_vector_matrix )
+{
+  DOUBLE tol = 1e-10;
+  typedef vecmat3::Pack<DOUBLE,4> Pack4;
+  Vector a[4] = { Vector(0,0,0), Vector(1,2,3), Vector(-1,0,2), Vector(0.5,0.5,-1) };
+  Vector b[4] = { Vector(1,1,1), Vector(3,-1,0), Vector(2,2,2), Vector(0,1,0) };
+  Matrix m[4] = { Matrix(-1, 2, 3, 3, 2, 3, 1, 3, 1), Matrix(2, 0, 0, 1, 3, 0, 0, 1, 4),
+                  Matrix(1, 2, 0, 0, 1, 0, 3, 0, 1),  Matrix(0, 1, 0, -1, 0, 0, 0, 0, 2) };
+  vecmat3::Vector<Pack4> pa = vecmat3::gather<4>(a);
+  vecmat3::Vector<Pack4> pb = vecmat3::gather<4>(b);
+  vecmat3::Matrix<Pack4> pm = vecmat3::gather<4>(m);
+  vecmat3::Vector<Pack4> pc = (pa^pb) + 2*(pm*pb);
+  vecmat3::Matrix<Pack4> pi = Inverse(pm);
+  vecmat3::Matrix<Pack4> pr = Rodrigues(pa);
+  Pack4 pn = pa.nrm();
+  Vector c[4];
+  Matrix inv[4], rot[4];
+  scatter(pc, c);
+  scatter(pi, inv);
+  scatter(pr, rot);
+  for (int i = 0; i < 4; i++) {
+    Vector ci = (a[i]^b[i]) + 2*(m[i]*b[i]);
+    Matrix ii = Inverse(m[i]);
+    Matrix ri = Rodrigues(a[i]);
+    BOOST_CHECK_CLOSE_FRACTION( c[i].x, ci.x, tol );
+    BOOST_CHECK_CLOSE_FRACTION( c[i].y, ci.y, tol );
+    BOOST_CHECK_CLOSE_FRACTION( c[i].z, ci.z, tol );
+    BOOST_CHECK_CLOSE_FRACTION( inv[i].xy, ii.xy, tol );
+    BOOST_CHECK_CLOSE_FRACTION( inv[i].zz, ii.zz, tol );
+    BOOST_CHECK_CLOSE_FRACTION( rot[i].xx, ri.xx, tol );
+    BOOST_CHECK_CLOSE_FRACTION( rot[i].yz, ri.yz, tol );
+    BOOST_CHECK_CLOSE_FRACTION( pn[i], a[i].nrm(), tol );
+  }
+  BOOST_CHECK( pn[0] == 0 );
+  BOOST_CHECK( rot[0].xx == 1 && rot[0].xy == 0 );
+  BOOST_CHECK( any(pn > 3.5) && !all(pn > 3.5) );
+}
+
+BOOST_AUTO_TEST_CASE( batch_rotate )
+{
+  DOUBLE tol = 1e-10;
+  const int num = 7;
+  Vector x[num], y[num], z[num];
+  Matrix Rs[num];
+  vecmat3::VectorArray<DOUBLE> xs(num), ys(num), zs(num);
+  vecmat3::MatrixArray<DOUBLE> Ra(num);
+  Matrix R = Rodrigues(Vector(0.1, -0.2, 0.3));
+  for (int n = 0; n < num; n++) {
+    x[n] = Vector(n, 1-n, 2+0.5*n);
+    Rs[n] = Rodrigues(0.1*n*x[n]);
+    xs.set(n, x[n]);
+    Ra.set(n, Rs[n]);
+  }
+  vecmat3::rotate(R, x, y, num);
+  vecmat3::unrotate(Rs, y, z, num);
+  vecmat3::rotate(2*R, xs, ys);
+  vecmat3::unrotate(Ra, ys, zs);
+  vecmat3::MatrixArray<DOUBLE> Rb(Ra);
+  Rb *= 2;
+  vecmat3::VectorArray<DOUBLE> expr(num);
+  expr = Transpose(Rb)*(R*xs) - zs;
+  for (int n = 0; n < num; n++) {
+    Vector expected = Transpose(Rs[n])*(R*x[n]);
+    BOOST_CHECK_CLOSE_FRACTION( z[n].x, expected.x, tol );
+    BOOST_CHECK_CLOSE_FRACTION( z[n].y, expected.y, tol );
+    BOOST_CHECK_CLOSE_FRACTION( z[n].z, expected.z, tol );
+    BOOST_CHECK_CLOSE_FRACTION( zs[n].x, 2*expected.x, tol );
+    BOOST_CHECK_CLOSE_FRACTION( zs[n].y, 2*expected.y, tol );
+    BOOST_CHECK_CLOSE_FRACTION( zs[n].z, 2*expected.z, tol );
+    BOOST_CHECK( expr[n].nrm() < tol );
+    BOOST_CHECK( (Ra[n]-Rs[n]).nrm() == 0 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( batch_invert_solve )
+{
+  DOUBLE tol = 1e-10;
+  const int num = 6;
+  vecmat3::MatrixArray<DOUBLE> m(num), inv(num);
+  vecmat3::VectorArray<DOUBLE> b(num), x(num);
+  Matrix ms[num];
+  for (int n = 0; n < num; n++) {
+    ms[n] = Rodrigues(Vector(0.3*n, 1, -0.2*n)) 
+          + Dyadic(Vector(1, n, 2), Vector(0.5, 0, n));
+    b.set(n, Vector(n, 2, -1));
+  }
+  ms[2] = Dyadic(Vector(1, 2, 3), Vector(4, 5, 6));          // rank 1
+  ms[4] = Matrix(1, 2, 3, 4, 5, 6, 7, 8, 9 + 1e-15);         // nearly singular
+  for (int n = 0; n < num; n++)
+    m.set(n, ms[n]);
+  bool singular[num];
+  bool singular2[num];
+  BOOST_CHECK( vecmat3::invert(m, inv, singular) == 2 );
+  BOOST_CHECK( vecmat3::solve(m, b, x, singular2) == 2 );
+  for (int n = 0; n < num; n++) {
+    BOOST_CHECK( singular[n] == (n == 2 or n == 4) );
+    BOOST_CHECK( singular2[n] == singular[n] );
+    if (singular[n]) {
+      BOOST_CHECK( inv[n].nrm() == 0 );
+      BOOST_CHECK( x[n].nrm() == 0 );
+    } else {
+      Matrix expected = Inverse(ms[n]);
+      BOOST_CHECK( (inv[n] - expected).nrm() < tol*expected.nrm() );
+      BOOST_CHECK( (ms[n]*x[n] - b[n]).nrm() < tol*b[n].nrm() );
+    }
+  }
+  // in place, without mask; the compiler may contract the two kernels
+  // differently, so the results need not be bitwise equal
+  BOOST_CHECK( vecmat3::solve(m, b, b) == 2 );
+  BOOST_CHECK_SMALL( (b[1] - x[1]).nrm(), tol*x[1].nrm() );
+  BOOST_CHECK( vecmat3::invert(m, m) == 2 );
+  BOOST_CHECK_SMALL( (m[1] - inv[1]).nrm(), tol*inv[1].nrm() );
+}
+
+BOOST_AUTO_TEST_CASE( batch_rodrigues )
+{
+  DOUBLE tol = 1e-14;
+  for (DOUBLE x = -40; x < 40; x += 0.0123) {
+    DOUBLE s, c;
+    vecmat3::polySincos(x, s, c);
+    BOOST_CHECK_SMALL( s - sin(x), tol );
+    BOOST_CHECK_SMALL( c - cos(x), tol );
+  }
+  // float uses its own split of pi/2
+  for (float x = -8000; x < 8000; x += 1.37f) {
+    float s, c;
+    vecmat3::polySincos(x, s, c);
+    BOOST_CHECK_SMALL( s - sin(double(x)), 2e-7 );
+    BOOST_CHECK_SMALL( c - cos(double(x)), 2e-7 );
+  }
+  // out of range, the quadrant is not computed
+  DOUBLE s, c;
+  vecmat3::polySincos(DOUBLE(1e300), s, c);
+  vecmat3::polySincos(std::numeric_limits<DOUBLE>::quiet_NaN(), s, c);
+  BOOST_CHECK( s != s && c != c );
+  const int num = 9;
+  Vector v[num];
+  Matrix m[num];
+  vecmat3::VectorArray<DOUBLE> va(num);
+  vecmat3::MatrixArray<DOUBLE> ma(num);
+  for (int n = 0; n < num; n++) {
+    v[n] = (n == 0 ? 0 : pow(10.0, 2*n-12))*Vector(0.48, -0.6, 0.64);
+    va.set(n, v[n]);
+  }
+  vecmat3::Rodrigues(v, m, num);
+  vecmat3::Rodrigues(va, ma);
+  for (int n = 0; n < num; n++) {
+    Matrix expected = Rodrigues(v[n]);
+    BOOST_CHECK_SMALL( (m[n] - expected).nrm(), 10*tol );
+    BOOST_CHECK_SMALL( (ma[n] - m[n]).nrm(), 10*tol );
+    BOOST_CHECK_SMALL( (ma[n]*Transpose(ma[n])).nrm() - sqrt(3.0), 10*tol );
+  }
+  // small angles: R = I + W + W^2/2 + ...
+  BOOST_CHECK_CLOSE_FRACTION( ma[1].xy, -0.64e-10 - 0.144e-20, 1e-12 );
+  BOOST_CHECK_CLOSE_FRACTION( ma[1].xx, 1-0.5*(0.36+0.4096)*1e-20, 1e-15 );
+}
+
+BOOST_AUTO_TEST_CASE( quaternion )
+{
+  typedef vecmat3::Quaternion<DOUBLE> Quaternion;
+  DOUBLE tol = 1e-14;
+  Vector a(0.3, -1.2, 0.7), b(-0.5, 2, 1.5), x(1, 2, 3);
+  Quaternion p = RodriguesQuaternion(a);
+  Quaternion q = RodriguesQuaternion(b);
+  Matrix A = Rodrigues(a), B = Rodrigues(b);
+  BOOST_CHECK_SMALL( p.nrm() - 1, tol );
+  BOOST_CHECK_SMALL( (RotationMatrix(p) - A).nrm(), tol );
+  BOOST_CHECK_SMALL( (RotationMatrix(p*q) - A*B).nrm(), tol );
+  BOOST_CHECK_SMALL( (RotationMatrix(Conjugate(p)) - Transpose(A)).nrm(), tol );
+  BOOST_CHECK_SMALL( (p*x - A*x).nrm(), tol );
+  BOOST_CHECK_SMALL( (p*(q*x) - (p*q)*x).nrm(), tol );
+  BOOST_CHECK_SMALL( (RotationVector(p) - a).nrm(), tol );
+  BOOST_CHECK_SMALL( (RotationMatrix(RotationQuaternion(A*B)) - A*B).nrm(), tol );
+  // rotation by pi, where the quaternion has w=0
+  Vector c = (M_PI/sqrt(2.0))*Vector(1, -1, 0);
+  Quaternion r = RotationQuaternion(Rodrigues(c));
+  BOOST_CHECK_SMALL( r.w, tol );
+  BOOST_CHECK_SMALL( (RotationMatrix(r) - Rodrigues(c)).nrm(), tol );
+  BOOST_CHECK_SMALL( (RotationVector(r) - c).nrm() * (RotationVector(r) + c).nrm(), tol );
+  // identity
+  Quaternion one(1);
+  BOOST_CHECK( RotationVector(one).nrm() == 0 );
+  BOOST_CHECK( (RodriguesQuaternion(Vector(0,0,0)) - one).nrm() == 0 );
+  // algebra
+  Quaternion s = p;
+  s *= q;
+  BOOST_CHECK_SMALL( (s - p*q).nrm(), tol );
+  s += 2*p - q/2;
+  s -= p*2;
+  s *= 3;
+  s /= 3;
+  BOOST_CHECK_SMALL( (s - (p*q - 0.5*q)).nrm(), tol );
+  BOOST_CHECK_SMALL( (Inverse(s)*s - one).nrm(), tol );
+  BOOST_CHECK_SMALL( (-s + s).nrm(), tol );
+  BOOST_CHECK_SMALL( (s|s) - s.nrm2(), tol );
+  s.normalize();
+  BOOST_CHECK_SMALL( s.nrm() - 1, tol );
+  Quaternion v(0, x);
+  BOOST_CHECK( v[0] == 0 and v(1) == 1 and v[2] == 2 and v.z == 3 );
+  BOOST_CHECK_SMALL( (p*v*Conjugate(p) - Quaternion(0, p*x)).nrm(), tol );
+  // interpolation: slerp rotates at a constant rate, nlerp does not
+  Quaternion pq = Conjugate(p)*q;
+  for (DOUBLE t = 0; t <= 1; t += 0.125) {
+    Quaternion u = slerp(p, q, t);
+    BOOST_CHECK_SMALL( (RotationVector(Conjugate(p)*u) - t*RotationVector(pq)).nrm(), tol );
+    Quaternion w = nlerp(p, q, t);
+    BOOST_CHECK_SMALL( w.nrm() - 1, tol );
+    BOOST_CHECK_SMALL( (w - slerp(p, q, t)).nrm(), 0.1 );
+    BOOST_CHECK_SMALL( (slerp(p, -q, t) - u).nrm(), tol );
+  }
+  BOOST_CHECK_SMALL( (slerp(p, p, 0.3) - p).nrm(), tol );
+  // rotating arrays of vectors
+  vecmat3::VectorArray<DOUBLE> xs(3), ys(3);
+  for (int n = 0; n < 3; n++)
+    xs.set(n, x*n);
+  ys = p*xs;
+  BOOST_CHECK_SMALL( (ys[2] - A*(2*x)).nrm(), tol );
+}
+
+BOOST_AUTO_TEST_CASE( batch_slerp )
+{
+  typedef vecmat3::Quaternion<DOUBLE> Quaternion;
+  DOUBLE tol = 1e-14;
+  for (DOUBLE x = -40; x < 40; x += 0.0123)
+    BOOST_CHECK_SMALL( vecmat3::polyAtan(x) - atan(x), tol );
+  const int num = 8;
+  Quaternion a[num], b[num], s[num], l[num];
+  DOUBLE t[num];
+  for (int n = 0; n < num; n++) {
+    a[n] = RodriguesQuaternion(Vector(0.1*n, 1, -0.3*n));
+    b[n] = RodriguesQuaternion(Vector(1, -0.2*n, n));
+    t[n] = n/(num-1.0);
+  }
+  b[1] = a[1];
+  b[2] = -a[2];
+  vecmat3::slerp(a, b, 0.3, s, num);
+  vecmat3::nlerp(a, b, 0.3, l, num);
+  for (int n = 0; n < num; n++) {
+    BOOST_CHECK_SMALL( (s[n] - slerp(a[n], b[n], 0.3)).nrm(), tol );
+    BOOST_CHECK_SMALL( (l[n] - nlerp(a[n], b[n], 0.3)).nrm(), tol );
+  }
+  vecmat3::slerp(a, b, t, s, num);
+  vecmat3::nlerp(a, b, t, l, num);
+  for (int n = 0; n < num; n++) {
+    BOOST_CHECK_SMALL( (s[n] - slerp(a[n], b[n], t[n])).nrm(), tol );
+    BOOST_CHECK_SMALL( (l[n] - nlerp(a[n], b[n], t[n])).nrm(), tol );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( periodic_box )
+{
+  DOUBLE tol = 1e-12;
+  vecmat3::Box<DOUBLE> box(10, 20, 5);
+  BOOST_CHECK_CLOSE( box.volume(), 1000, tol );
+  Vector a(1, 19, -2.4), b(9, 1, 27.1);
+  Vector d = box.displacement(a, b);
+  BOOST_CHECK_CLOSE( d.x, 2, tol );
+  BOOST_CHECK_CLOSE( d.y, -2, tol );
+  BOOST_CHECK_CLOSE( d.z, 0.5, tol );
+  BOOST_CHECK_CLOSE( box.dist2(a, b), 8.25, tol );
+  BOOST_CHECK_CLOSE( box.dist(a, b), sqrt(8.25), tol );
+  BOOST_CHECK_CLOSE( distwithshift(a, b, box.shift(a, b)), sqrt(8.25), tol );
+  BOOST_CHECK_CLOSE( box.dist(a + Vector(0, 0, 5e3), b), sqrt(8.25), 1e-9 );
+  BOOST_CHECK_CLOSE( box.dist(2*a, b+b), 2*sqrt(8.25), tol );
+  Vector w = box.wrap(Vector(-1, 45, 5));
+  BOOST_CHECK_CLOSE( w.x, 9, tol );
+  BOOST_CHECK_CLOSE( w.y, 5, tol );
+  BOOST_CHECK_SMALL( w.z, tol );
+  BOOST_CHECK( box.wrap(Vector(-1e-20, 0, 0)).x < 10 );
+  Vector u = box.unwrap(w, Vector(-2, 38, 6));
+  BOOST_CHECK_SMALL( (u - Vector(-1, 45, 5)).nrm(), tol );
+
+  const int num = 50;
+  vecmat3::VectorArray<DOUBLE> ra(num), rb(num), da(num), ua(num);
+  Vector r[num], rr[num], rw[num], da2[num];
+  DOUBLE d2[num], d2a[num];
+  for (int n = 0; n < num; n++)
+    r[n] = Vector(0.7*n - 17, 3.1*n, -1.3*n);
+  for (int n = 0; n < num; n++) {
+    ra.set(n, r[n]);
+    rb.set(n, r[num-1-n]);
+    rr[n] = r[num-1-n];
+    rw[n] = r[n];
+  }
+  vecmat3::displacement(box, ra, rb, da);
+  vecmat3::displacement(box, r, rr, da2, num);
+  vecmat3::dist2(box, ra, rb, d2);
+  vecmat3::dist2(box, r[3], rb, d2a);
+  vecmat3::wrap(box, rw, num);
+  vecmat3::VectorArray<DOUBLE> wa(ra);
+  vecmat3::wrap(box, wa);
+  vecmat3::unwrap(box, wa, ra, ua);
+  for (int n = 0; n < num; n++) {
+    Vector dn = box.displacement(r[n], r[num-1-n]);
+    BOOST_CHECK_SMALL( (da[n] - dn).nrm(), tol );
+    BOOST_CHECK_SMALL( (da2[n] - dn).nrm(), tol );
+    BOOST_CHECK_CLOSE( d2[n], box.dist2(r[n], r[num-1-n]), tol );
+    BOOST_CHECK_CLOSE( d2a[n], box.dist2(r[3], r[num-1-n]), tol );
+    BOOST_CHECK_SMALL( (rw[n] - box.wrap(r[n])).nrm(), tol );
+    BOOST_CHECK_SMALL( (wa[n] - rw[n]).nrm(), tol );
+    BOOST_CHECK( rw[n].x >= 0 and rw[n].x < 10 and rw[n].y >= 0 and rw[n].y < 20 );
+    BOOST_CHECK( rw[n].z >= 0 and rw[n].z < 5 );
+    BOOST_CHECK_SMALL( (ua[n] - r[n]).nrm(), tol );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( triclinic_box )
+{
+  DOUBLE tol = 1e-10;
+  Matrix h(10, 2, -3,
+           0, 12,  4,
+           0,  0,  9);
+  vecmat3::TriclinicBox<DOUBLE> box(h);
+  vecmat3::TriclinicBox<DOUBLE> box2(10, 12, 9, 2, -3, 4);
+  BOOST_CHECK_SMALL( (box.shape() - box2.shape()).nrm(), tol );
+  BOOST_CHECK_SMALL( (box.invShape() - Inverse(h)).nrm(), tol );
+  BOOST_CHECK_CLOSE( box.volume(), h.det(), tol );
+  Vector w = box.width();
+  BOOST_CHECK_CLOSE( w.x, box.volume()/(h.column(1)^h.column(2)).nrm(), tol );
+  BOOST_CHECK_CLOSE( w.y, box.volume()/(h.column(2)^h.column(0)).nrm(), tol );
+  BOOST_CHECK_CLOSE( w.z, box.volume()/(h.column(0)^h.column(1)).nrm(), tol );
+  Vector s(0.25, -1.5, 3.125);
+  BOOST_CHECK_SMALL( (box.cartesian(s) - h*s).nrm(), tol );
+  BOOST_CHECK_SMALL( (box.fractional(h*s) - s).nrm(), tol );
+  // an orthorhombic triclinic box is a Box
+  vecmat3::TriclinicBox<DOUBLE> tbox(10, 20, 5, 0, 0, 0);
+  vecmat3::Box<DOUBLE> obox(10, 20, 5);
+
+  const int num = 64;
+  vecmat3::VectorArray<DOUBLE> ra(num), rb(num), da(num), wa(num), ua(num), pa(num);
+  Vector r[num], rr[num], da2[num], pa2[num];
+  DOUBLE d2[num], p2[num], p2a[num];
+  std::size_t i[num], j[num];
+  for (int n = 0; n < num; n++) {
+    r[n] = Vector(0.7*n - 17, 3.1*n - 50, 1.3*n - 40);
+    i[n] = (7*n) % num;
+    j[n] = (3*n + 5) % num;
+  }
+  for (int n = 0; n < num; n++) {
+    ra.set(n, r[n]);
+    rb.set(n, r[num-1-n]);
+    rr[n] = r[num-1-n];
+  }
+  vecmat3::displacement(box, ra, rb, da);
+  vecmat3::displacement(box, r, rr, da2, num);
+  vecmat3::dist2(box, ra, rb, d2);
+  vecmat3::displacement(box, ra, i, j, pa);
+  vecmat3::displacement(box, r, i, j, pa2, num);
+  vecmat3::dist2(box, ra, i, j, p2, num);
+  vecmat3::dist2(box, r, i, j, p2a, num);
+  wa = ra;
+  vecmat3::wrap(box, wa);
+  vecmat3::unwrap(box, wa, ra, ua);
+  for (int n = 0; n < num; n++) {
+    Vector d = r[n] - r[num-1-n];
+    // brute force search for the closest image
+    Vector best = d;
+    for (int a = -3; a <= 3; a++)
+      for (int b = -3; b <= 3; b++)
+        for (int c = -3; c <= 3; c++) {
+          Vector e = d + h*Vector(a, b, c);
+          if (e.nrm2() < best.nrm2())
+            best = e;
+        }
+    Vector dn = box.displacement(r[n], r[num-1-n]);
+    if (best.nrm() < 0.5*w.z)
+      BOOST_CHECK_SMALL( (dn - best).nrm(), tol );
+    Vector sn = box.fractional(dn);
+    BOOST_CHECK( fabs(sn.x) <= 0.5 + tol and fabs(sn.y) <= 0.5 + tol and fabs(sn.z) <= 0.5 + tol );
+    BOOST_CHECK_SMALL( (box.fractional(dn - d) - box.fractional(box.shift(r[n], r[num-1-n]))).nrm(), tol );
+    BOOST_CHECK_CLOSE( box.dist(r[n], r[num-1-n]), dn.nrm(), tol );
+    BOOST_CHECK_SMALL( (da[n] - dn).nrm(), tol );
+    BOOST_CHECK_SMALL( (da2[n] - dn).nrm(), tol );
+    BOOST_CHECK_CLOSE( d2[n], dn.nrm2(), tol );
+    Vector dp = box.displacement(r[i[n]], r[j[n]]);
+    BOOST_CHECK_SMALL( (pa[n] - dp).nrm(), tol );
+    BOOST_CHECK_SMALL( (pa2[n] - dp).nrm(), tol );
+    BOOST_CHECK_CLOSE( p2[n], dp.nrm2(), tol );
+    BOOST_CHECK_CLOSE( p2a[n], dp.nrm2(), tol );
+    Vector sw = box.fractional(wa[n]);
+    BOOST_CHECK( sw.x >= 0 and sw.x < 1 and sw.y >= 0 and sw.y < 1 and sw.z >= 0 and sw.z < 1 );
+    BOOST_CHECK_SMALL( (wa[n] - box.wrap(r[n])).nrm(), tol );
+    BOOST_CHECK_SMALL( (ua[n] - r[n]).nrm(), tol );
+    BOOST_CHECK_SMALL( (tbox.displacement(r[n], rr[n]) - obox.displacement(r[n], rr[n])).nrm(), tol );
+    BOOST_CHECK_SMALL( (tbox.wrap(r[n]) - obox.wrap(r[n])).nrm(), tol );
+  }
+}
+
+typedef std::set<std::pair<std::size_t,std::size_t> > PairSet;
+
+// Pairs (i<j) closer than rc found by checking all pairs
+template <class BOX>
+static PairSet closePairs( const BOX& box, const Vector* r, std::size_t num, DOUBLE rc )
+{
+  PairSet result;
+  for (std::size_t i = 0; i < num; i++)
+    for (std::size_t j = i + 1; j < num; j++)
+      if (box.dist2(r[i], r[j]) < rc*rc)
+        result.insert(std::make_pair(i, j));
+  return result;
+}
+
+// The same from the candidate pairs of a cell list
+template <class BOX>
+static PairSet closePairs( const vecmat3::CellList<BOX>& cells, const Vector* r, DOUBLE rc )
+{
+  PairSet result;
+  std::vector<std::size_t> i, j;
+  cells.pairs(i, j);
+  for (std::size_t n = 0; n < i.size(); n++)
+    if (cells.box().dist2(r[i[n]], r[j[n]]) < rc*rc)
+      result.insert(std::make_pair(std::min(i[n], j[n]), std::max(i[n], j[n])));
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE( cell_list )
+{
+  const std::size_t num = 400;
+  const DOUBLE rc = 2.2;
+  std::vector<Vector> r(num);
+  vecmat3::VectorArray<DOUBLE> ra(num);
+  for (std::size_t n = 0; n < num; n++) {
+    r[n] = Vector(std::fmod(7.31*n, 13.0) - 1, std::fmod(3.77*n, 11.0), std::fmod(5.13*n, 9.0) + 20);
+    ra.set(n, r[n]);
+  }
+  vecmat3::Box<DOUBLE> box(12, 11, 9);
+  vecmat3::TriclinicBox<DOUBLE> tbox(12, 11, 9, 3, -2, 1.5);
+  // 5x5x4 cells, and a grid with fewer than three cells along some edges
+  vecmat3::CellList<vecmat3::Box<DOUBLE> > cells(box, rc), coarse(box, 4.5);
+  vecmat3::CellList<vecmat3::TriclinicBox<DOUBLE> > tcells(tbox, rc);
+  BOOST_CHECK_EQUAL( cells.gridSize(0), 5u );
+  BOOST_CHECK_EQUAL( cells.gridSize(1), 5u );
+  BOOST_CHECK_EQUAL( cells.gridSize(2), 4u );
+  BOOST_CHECK_EQUAL( coarse.numCells(), 8u );
+  cells.build(&r[0], num);
+  coarse.build(&r[0], num);
+  tcells.build(ra);
+  BOOST_CHECK_EQUAL( cells.size(), num );
+  std::size_t total = 0;
+  for (std::size_t c = 0; c < cells.numCells(); c++) {
+    total += cells.count(c);
+    for (std::size_t k = 0; k < cells.count(c); k++)
+      BOOST_CHECK_EQUAL( cells.cellOf(cells.members(c)[k]), c );
+  }
+  BOOST_CHECK_EQUAL( total, num );
+  std::size_t nb[26];
+  BOOST_CHECK_EQUAL( cells.neighbourCells(0, nb), 26u );
+  BOOST_CHECK_EQUAL( cells.neighbourCells(cells.numCells() - 1, nb), 0u );
+  BOOST_CHECK_EQUAL( coarse.neighbourCells(0, nb), 7u );
+
+  PairSet exact = closePairs(box, &r[0], num, rc);
+  BOOST_CHECK( exact.size() > 100 );
+  BOOST_CHECK( closePairs(cells, &r[0], rc) == exact );
+  BOOST_CHECK( closePairs(coarse, &r[0], rc) == exact );
+  BOOST_CHECK( closePairs(tcells, &r[0], rc) == closePairs(tbox, &r[0], num, rc) );
+  std::vector<std::size_t> i, j;
+  std::size_t numpairs = cells.pairs(i, j);
+  BOOST_CHECK( numpairs < num*(num-1)/4 );
+  BOOST_CHECK_EQUAL( coarse.pairs(i, j), num*(num-1)/2 );
+
+  // incremental updates: move a few particles, and then all of them
+  for (std::size_t n = 0; n < num; n += 37)
+    r[n] += Vector(1.5, -2.5, 4.0);
+  BOOST_CHECK( cells.update(&r[0], num) > 0 );
+  BOOST_CHECK_EQUAL( cells.update(&r[0], num), 0u );
+  BOOST_CHECK( closePairs(cells, &r[0], rc) == closePairs(box, &r[0], num, rc) );
+  for (std::size_t n = 0; n < num; n++)
+    ra.set(n, r[n] + Vector(0.1*n, 0, 0));
+  for (std::size_t n = 0; n < num; n++)
+    r[n] = ra[n];
+  tcells.update(ra);
+  BOOST_CHECK( closePairs(tcells, &r[0], rc) == closePairs(tbox, &r[0], num, rc) );
+  for (std::size_t c = 0; c < cells.numCells(); c++)
+    for (std::size_t k = 0; k < cells.count(c); k++)
+      BOOST_CHECK_EQUAL( cells.cellOf(cells.members(c)[k]), c );
+
+  // no particles
+  const Vector* none = 0;
+  vecmat3::VectorArray<DOUBLE> nonea(0);
+  vecmat3::CellList<vecmat3::Box<DOUBLE> > empty(box, rc);
+  BOOST_CHECK_EQUAL( empty.pairs(i, j), 0u );
+  empty.build(none, 0);
+  BOOST_CHECK_EQUAL( empty.size(), 0u );
+  BOOST_CHECK_EQUAL( empty.update(none, 0), 0u );
+  BOOST_CHECK_EQUAL( empty.pairs(i, j), 0u );
+  empty.build(nonea);
+  BOOST_CHECK_EQUAL( empty.update(nonea), 0u );
+  BOOST_CHECK_EQUAL( empty.count(0), 0u );
+  BOOST_CHECK( closePairs(empty, none, rc).empty() );
+}
+
+// Collects the pairs of a Verlet list
+struct PairInserter
+{
+  PairSet* pairs;
+  void operator()( std::size_t i, std::size_t j )
+  {
+    pairs->insert(std::make_pair(std::min(i, j), std::max(i, j)));
+  }
+};
+
+BOOST_AUTO_TEST_CASE( verlet_list )
+{
+  const std::size_t num = 300;
+  const DOUBLE rc = 2.0, skin = 0.4;
+  std::vector<Vector> r(num);
+  vecmat3::VectorArray<DOUBLE> ra(num);
+  for (std::size_t n = 0; n < num; n++) {
+    r[n] = Vector(std::fmod(7.31*n, 12.0), std::fmod(3.77*n, 11.0), std::fmod(5.13*n, 9.0));
+    ra.set(n, r[n]);
+  }
+  vecmat3::Box<DOUBLE> box(12, 11, 9);
+  vecmat3::VerletList<vecmat3::Box<DOUBLE> > verlet(box, rc, skin);
+  vecmat3::VerletList<vecmat3::Box<DOUBLE> > full(box, rc, skin, false);
+  BOOST_CHECK( verlet.update(&r[0], num) );
+  BOOST_CHECK( full.update(ra) );
+  BOOST_CHECK_EQUAL( verlet.size(), num );
+  BOOST_CHECK_EQUAL( verlet.numBuilds(), 1u );
+  BOOST_CHECK_EQUAL( full.numPairs(), 2*verlet.numPairs() );
+  BOOST_CHECK_EQUAL( verlet.offsets()[num], verlet.numPairs() );
+  PairSet listed;
+  PairInserter insert;
+  insert.pairs = &listed;
+  verlet.forEachPair(insert);
+  BOOST_CHECK( listed == closePairs(box, &r[0], num, rc + skin) );
+  BOOST_CHECK_EQUAL( listed.size(), verlet.numPairs() );
+  for (std::size_t i = 0; i < num; i++) {
+    for (std::size_t k = 1; k < verlet.count(i); k++)
+      BOOST_CHECK( verlet.neighbours(i)[k-1] < verlet.neighbours(i)[k] );
+    for (std::size_t k = 1; k < full.count(i); k++)
+      BOOST_CHECK( full.neighbours(i)[k-1] < full.neighbours(i)[k] );
+  }
+  PairSet fullpairs;
+  insert.pairs = &fullpairs;
+  full.forEachPair(insert);
+  insert.pairs = &listed;
+  BOOST_CHECK( fullpairs == listed );
+
+  // moving less than half the skin keeps the list, also when wrapping
+  for (std::size_t n = 0; n < num; n++)
+    r[n] = box.wrap(r[n] + 0.19*Vector(std::cos(1.0*n), std::sin(1.0*n), 0.0));
+  BOOST_CHECK_EQUAL( verlet.numMoved(&r[0], num), 0u );
+  BOOST_CHECK( not verlet.update(&r[0], num) );
+  BOOST_CHECK_EQUAL( verlet.numBuilds(), 1u );
+  PairSet close = closePairs(box, &r[0], num, rc);
+  BOOST_CHECK( close.size() > 100 );
+  for (PairSet::const_iterator p = close.begin(); p != close.end(); p++)
+    BOOST_CHECK( listed.count(*p) == 1 );
+
+  // moving one particle further triggers a rebuild
+  r[17] += Vector(0, 0, 0.3);
+  BOOST_CHECK_EQUAL( verlet.numMoved(&r[0], num), 1u );
+  BOOST_CHECK( verlet.update(&r[0], num) );
+  BOOST_CHECK_EQUAL( verlet.numBuilds(), 2u );
+  BOOST_CHECK_EQUAL( verlet.numMoved(&r[0], num), 0u );
+  listed.clear();
+  verlet.forEachPair(insert);
+  BOOST_CHECK( listed == closePairs(box, &r[0], num, rc + skin) );
+
+  // as does changing the box
+  vecmat3::TriclinicBox<DOUBLE> tbox(12, 11, 9, 1, 2, -1);
+  vecmat3::VerletList<vecmat3::TriclinicBox<DOUBLE> > tverlet(tbox, rc, skin);
+  tverlet.build(&r[0], num);
+  BOOST_CHECK( not tverlet.update(&r[0], num) );
+  tverlet.setBox(vecmat3::TriclinicBox<DOUBLE>(12, 11, 9, 2, 2, -1));
+  BOOST_CHECK( tverlet.update(&r[0], num) );
+  listed.clear();
+  tverlet.forEachPair(insert);
+  BOOST_CHECK( listed == closePairs(tverlet.box(), &r[0], num, rc + skin) );
+
+  // a different number of particles counts as all moved
+  vecmat3::VerletList<vecmat3::Box<DOUBLE> > fresh(box, rc, skin);
+  BOOST_CHECK_EQUAL( fresh.numMoved(&r[0], num), num );
+  BOOST_CHECK_EQUAL( fresh.numMoved(ra), num );
+  BOOST_CHECK_EQUAL( verlet.numMoved(&r[0], num - 1), num - 1 );
+  BOOST_CHECK_EQUAL( full.numMoved(vecmat3::VectorArray<DOUBLE>(10)), 10u );
+
+  // no particles give an empty list
+  const Vector* none = 0;
+  BOOST_CHECK_EQUAL( fresh.numMoved(none, 0), 0u );
+  BOOST_CHECK( fresh.update(none, 0) );
+  BOOST_CHECK_EQUAL( fresh.size(), 0u );
+  BOOST_CHECK_EQUAL( fresh.numPairs(), 0u );
+  BOOST_CHECK( not fresh.update(vecmat3::VectorArray<DOUBLE>(0)) );
+}
+
+// Copies the tiles of an all-pairs kernel into a dense matrix
+struct TileCopier
+{
+  DOUBLE* out;
+  std::size_t columns;
+  void operator()( std::size_t i0, std::size_t j0, std::size_t ni, std::size_t nj, const DOUBLE* d )
+  {
+    for (std::size_t i = 0; i < ni; i++)
+      for (std::size_t j = 0; j < nj; j++)
+        out[(i0 + i)*columns + j0 + j] = d[i*nj + j];
+  }
+};
+
+BOOST_AUTO_TEST_CASE( distance_matrix )
+{
+  DOUBLE tol = 1e-10;
+  // sizes that are not multiples of the tile sizes
+  const std::size_t na = VECMAT3_TILE_ROWS + 37, nb = VECMAT3_TILE_COLUMNS + 100;
+  vecmat3::VectorArray<DOUBLE> a(na), b(nb);
+  for (std::size_t n = 0; n < na; n++)
+    a.set(n, Vector(std::sin(1.0*n), 2*std::cos(0.7*n), 0.01*n));
+  for (std::size_t n = 0; n < nb; n++)
+    b.set(n, Vector(std::cos(0.3*n), 0.5*n - 100, std::sin(2.0*n)));
+  std::vector<DOUBLE> d2(na*nb), d(na*nb), tiled(na*nb, -1);
+  std::vector<DOUBLE> p2(na*(na-1)/2), p(na*(na-1)/2);
+  vecmat3::dist2Matrix(a, b, &d2[0]);
+  vecmat3::distMatrix(a, b, &d[0]);
+  vecmat3::dist2Matrix(a, &p2[0]);
+  vecmat3::distMatrix(a, &p[0]);
+  TileCopier copier;
+  copier.out = &tiled[0];
+  copier.columns = nb;
+  vecmat3::distTiles(a, b, copier);
+  for (std::size_t i = 0; i < na; i++)
+    for (std::size_t j = 0; j < nb; j++) {
+      DOUBLE r2 = (a[i] - b[j]).nrm2();
+      BOOST_CHECK_CLOSE( d2[i*nb + j], r2, tol );
+      BOOST_CHECK_CLOSE( d[i*nb + j], sqrt(r2), tol );
+      BOOST_CHECK_CLOSE( tiled[i*nb + j], sqrt(r2), tol );
+    }
+  std::size_t k = 0;
+  for (std::size_t i = 0; i < na; i++)
+    for (std::size_t j = i + 1; j < na; j++, k++) {
+      BOOST_CHECK_EQUAL( vecmat3::packedIndex(i, j, na), k );
+      BOOST_CHECK_CLOSE( p2[k], (a[i] - a[j]).nrm2(), tol );
+      BOOST_CHECK_CLOSE( p[k], (a[i] - a[j]).nrm(), tol );
+    }
+
+  // with periodic boundaries
+  vecmat3::TriclinicBox<DOUBLE> box(3, 4, 5, 1, 0.5, -1);
+  vecmat3::dist2Matrix(box, a, b, &d2[0]);
+  vecmat3::distMatrix(box, a, &p[0]);
+  vecmat3::dist2Tiles(box, a, b, copier);
+  for (std::size_t i = 0; i < na; i++)
+    for (std::size_t j = 0; j < nb; j++) {
+      BOOST_CHECK_CLOSE( d2[i*nb + j], box.dist2(a[i], b[j]), tol );
+      BOOST_CHECK_CLOSE( tiled[i*nb + j], box.dist2(a[i], b[j]), tol );
+    }
+  for (std::size_t i = 0; i < na; i++)
+    for (std::size_t j = i + 1; j < na; j++)
+      BOOST_CHECK_CLOSE( p[vecmat3::packedIndex(i, j, na)], box.dist(a[i], a[j]), tol );
+}
+
+// estimated cost of evaluating one element of an expression
+template <class E>
+int costOf(const E&)
+{
+  return vecmat3::Cost<E>::value;
+}
+
+BOOST_AUTO_TEST_CASE( materialize )
+{
+  DOUBLE tol = 1e-10;
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  Matrix B(2, 0, 1,
+           0, 1, -1,
+           1, 3, 2);
+  Matrix C(0, 1, 0,
+          -1, 0, 2,
+           3, 1, 1);
+  Vector a(1, 2, 3), b(-1, 0.5, 2), c(3, -2, 1), d(0, 1, -1);
+  Matrix AB = A*B, ABC = AB*C;
+  Vector ab = a^b, cd = c^d;
+  // cheap sub-expressions are referenced, expensive ones materialized
+  BOOST_CHECK_EQUAL( costOf(A+B), 1 );
+  BOOST_CHECK_EQUAL( costOf(A*B), 5 );
+  BOOST_CHECK_EQUAL( costOf((A+B)*C), 8 );
+  BOOST_CHECK_EQUAL( costOf(A*B*C), 5 );
+  BOOST_CHECK_EQUAL( costOf(A*B*C*a), 20 );
+  BOOST_CHECK_EQUAL( costOf((a^b)^(c^d)), 3 );
+  // and the results are unchanged
+  Matrix M = A*B*C*A;
+  Matrix N = ABC*A;
+  Matrix P = Transpose(A*B)*(A*B);
+  Matrix Q = Transpose(AB)*AB;
+  Vector v = A*B*C*a;
+  Vector w = ABC*a;
+  Vector x = (a^b)^(c^d);
+  Vector y = ab^cd;
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( v[i], w[i], tol );
+    BOOST_CHECK_CLOSE( x[i], y[i], tol );
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_CLOSE( M(i,j), N(i,j), tol );
+      BOOST_CHECK_CLOSE( P(i,j), Q(i,j), tol );
+    }
+  }
+  BOOST_CHECK_CLOSE( (A*B).nrm(), AB.nrm(), tol );
+  BOOST_CHECK_CLOSE( (A*B*C).det(), ABC.det(), tol );
+  // constant sub-expressions of array expressions are evaluated once
+  vecmat3::VectorArray<DOUBLE> r(4), s(4);
+  for (int n = 0; n < 4; n++)
+    r.set(n, Vector(n, 1 - n, 2*n));
+  s = r + (A*B)*a - (r^(c^d));
+  for (int n = 0; n < 4; n++) {
+    Vector e = r[n] + AB*a - (r[n]^cd);
+    BOOST_CHECK_CLOSE( s[n].x, e.x, tol );
+    BOOST_CHECK_CLOSE( s[n].y, e.y, tol );
+    BOOST_CHECK_CLOSE( s[n].z, e.z, tol );
+  }
+}
+
+// whether an expression may be stored directly into its destination
+template <class E>
+bool directAssign(const E&)
+{
+  return vecmat3::DirectAssign<E>::value;
+}
+
+BOOST_AUTO_TEST_CASE( noalias )
+{
+  DOUBLE tol = 1e-10;
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  Matrix B(2, 0, 1,
+           0, 1, -1,
+           1, 3, 2);
+  Vector a(1, 2, 3), b(-1, 0.5, 2);
+  vecmat3::Quaternion<DOUBLE> p(1, 2, 3, 4), q(0.5, -1, 0, 2);
+  BOOST_CHECK( directAssign(2*a - b) );
+  BOOST_CHECK( directAssign(-A + 3*B) );
+  BOOST_CHECK( directAssign(p + Conjugate(q)) );
+  // materialized operands no longer refer to the destination
+  BOOST_CHECK( directAssign((A*B)*(B*A)) );
+  BOOST_CHECK( !directAssign(a^b) );
+  BOOST_CHECK( !directAssign(A*B) );
+  BOOST_CHECK( !directAssign(Transpose(A)) );
+  BOOST_CHECK( !directAssign(A*a + b) );
+  // results are unchanged when the destination occurs on the right
+  Vector c = a, u = a^b, v = 2*a - b;
+  Matrix C = A, M = A*B, N = Transpose(A), P = (M*B)*(B*M);
+  vecmat3::Quaternion<DOUBLE> r = p, s = p*q;
+  c = c^b;
+  a = 2*a - b;
+  r = r*q;
+  C = C*B;
+  A = Transpose(A);
+  B = (C*B)*(B*C);
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( c[i], u[i], tol );
+    BOOST_CHECK_CLOSE( a[i], v[i], tol );
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_CLOSE( C(i,j), M(i,j), tol );
+      BOOST_CHECK_CLOSE( A(i,j), N(i,j), tol );
+      BOOST_CHECK_CLOSE( B(i,j), P(i,j), tol );
+    }
+  }
+  for (int i = 0; i < 4; i++)
+    BOOST_CHECK_CLOSE( r[i], s[i], tol );
+  // explicit noalias() assignment
+  Vector w;
+  Matrix W;
+  vecmat3::Quaternion<DOUBLE> t;
+  vecmat3::noalias(w) = u^v;
+  vecmat3::noalias(w) += N*u;
+  vecmat3::noalias(W) = M*N;
+  vecmat3::noalias(W) -= Dyadic(u, v);
+  vecmat3::noalias(t) = s*q;
+  Vector w0 = (u^v) + N*u;
+  Matrix W0 = M*N - Dyadic(u, v);
+  vecmat3::Quaternion<DOUBLE> t0 = s*q;
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( w[i], w0[i], tol );
+    for (int j = 0; j < 3; j++)
+      BOOST_CHECK_CLOSE( W(i,j), W0(i,j), tol );
+  }
+  for (int i = 0; i < 4; i++)
+    BOOST_CHECK_CLOSE( t[i], t0[i], tol );
+  // and for arrays
+  vecmat3::VectorArray<DOUBLE> x(5), y(5);
+  vecmat3::MatrixArray<DOUBLE> X(5), Y(5);
+  for (int n = 0; n < 5; n++) {
+    x.set(n, Vector(n, 1 - n, 2*n));
+    X.set(n, (1.0*n)*M + N);
+  }
+  vecmat3::noalias(y) = M*x;
+  vecmat3::noalias(y) -= x^u;
+  vecmat3::noalias(Y) = X*N;
+  vecmat3::noalias(Y) += Transpose(X);
+  x = x^u;
+  for (int n = 0; n < 5; n++) {
+    Vector xn(n, 1 - n, 2*n), yn = M*xn - (xn^u), zn = xn^u;
+    Matrix Xn = (1.0*n)*M + N, Yn = Xn*N + Transpose(Xn);
+    for (int i = 0; i < 3; i++) {
+      BOOST_CHECK_CLOSE( y[n][i], yn[i], tol );
+      BOOST_CHECK_CLOSE( x[n][i], zn[i], tol );
+      for (int j = 0; j < 3; j++)
+        BOOST_CHECK_CLOSE( Y[n](i,j), Yn(i,j), tol );
+    }
+  }
+}
+
+// returns an unevaluated expression that refers to a, b and R
+static vecmat3::Vector<DOUBLE,
+         vecmat3::Vector<DOUBLE,Vector,vecmat3::TimesOp,Vector>,
+         vecmat3::PlusOp,
+         vecmat3::Vector<DOUBLE,Matrix,vecmat3::TimesOp,
+                         vecmat3::Vector<DOUBLE,Vector,vecmat3::TimesOp,DOUBLE> > >
+lazyExpression(const Vector& a, const Vector& b, const Matrix& R)
+{
+  return (a^b) + R*(2*a);
+}
+
+BOOST_AUTO_TEST_CASE( lazy_expression )
+{
+  DOUBLE tol = 1e-10;
+  Vector a(1, 2, 3), b(-1, 0.5, 2);
+  Matrix R(0, 1, 0,
+          -1, 0, 0,
+           0, 0, 1);
+  // sub-expressions are held by value, so the temporaries 2*a and
+  // a^b may go out of scope before the expression is evaluated
+  auto e = lazyExpression(a, b, R);
+  auto f = 0.5*(e - Transpose(R)*(3*b));
+  Vector v = e, w = f;
+  Vector v0 = (a^b) + R*(2*a);
+  Vector w0 = 0.5*(v0 - Transpose(R)*(3*b));
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( v[i], v0[i], tol );
+    BOOST_CHECK_CLOSE( w[i], w0[i], tol );
+  }
+#ifndef VECMAT3_CAPTURE_LEAVES
+  // by default, Vector and Matrix operands are referred to, so that a
+  // stored expression sees their current values
+  a = Vector(0, -1, 1);
+  R *= 2;
+  v = e;
+  w = f;
+  v0 = (a^b) + R*(2*a);
+  w0 = 0.5*(v0 - Transpose(R)*(3*b));
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( v[i], v0[i], tol );
+    BOOST_CHECK_CLOSE( w[i], w0[i], tol );
+    BOOST_CHECK_CLOSE( e(i), v0[i], tol );
+  }
+  BOOST_CHECK_CLOSE( f.nrm(), w0.nrm(), tol );
+  // also when they are operands of a product that would otherwise
+  // have been materialized
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  Vector c(3, -2, 1);
+  auto g = (A*R)*A;
+  auto h = (a^b)^c;
+  A *= 2;
+  a *= 2;
+  Matrix G = g, G0 = (A*R)*A;
+  Vector u = h, u0 = (a^b)^c;
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( u[i], u0[i], tol );
+    for (int j = 0; j < 3; j++)
+      BOOST_CHECK_CLOSE( G(i,j), G0(i,j), tol );
+  }
+  // and every time they are evaluated
+  A(0,0) = -1;
+  c.x = 4;
+  G = g;
+  G0 = (A*R)*A;
+  BOOST_CHECK_CLOSE( g.tr(), G0.tr(), tol );
+  BOOST_CHECK_CLOSE( h.nrm2(), ((a^b)^c).nrm2(), tol );
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      BOOST_CHECK_CLOSE( G(i,j), G0(i,j), tol );
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( fused_multiply_add )
+{
+  DOUBLE tol = 1e-10;
+  // a*b rounds to 1, so only a fused multiply-add sees the difference
+  DOUBLE a = 1 + std::ldexp(1.0, -30), b = 1 - std::ldexp(1.0, -30);
+  DOUBLE p = a*b;
+  BOOST_CHECK_EQUAL( p, 1 );
+  BOOST_CHECK_EQUAL( vecmat3::fmadd(a, b, -p), VECMAT3_FMA ? -std::ldexp(1.0, -60) : 0 );
+  BOOST_CHECK_EQUAL( vecmat3::fmsub(a, b, p), VECMAT3_FMA ? -std::ldexp(1.0, -60) : 0 );
+  BOOST_CHECK_EQUAL( vecmat3::fnmadd(a, b, p), VECMAT3_FMA ? std::ldexp(1.0, -60) : 0 );
+  BOOST_CHECK_EQUAL( vecmat3::fmadd(2, 3, 4), 10 );
+  // sums with products give the same results as the element-wise formulas
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  Matrix B(2, 0, 1,
+           0, 1, -1,
+           1, 3, 2);
+  Vector u(1, 2, 3), v(-1, 0.5, 2);
+  Vector w1 = u + A*v;
+  Vector w2 = A*v - u;
+  Vector w3 = u - 2.5*v;
+  Matrix M1 = B + A*B;
+  Matrix M2 = B - A*B;
+  Matrix M3 = A - Dyadic(u, v);
+  Matrix M4 = A*B - 0.5*B;
+  for (int i = 0; i < 3; i++) {
+    DOUBLE Av = A(i,0)*v[0] + A(i,1)*v[1] + A(i,2)*v[2];
+    BOOST_CHECK_CLOSE( w1[i], u[i] + Av, tol );
+    BOOST_CHECK_CLOSE( w2[i], Av - u[i], tol );
+    BOOST_CHECK_CLOSE( w3[i], u[i] - 2.5*v[i], tol );
+    for (int j = 0; j < 3; j++) {
+      DOUBLE AB = A(i,0)*B(0,j) + A(i,1)*B(1,j) + A(i,2)*B(2,j);
+      BOOST_CHECK_CLOSE( M1(i,j), B(i,j) + AB, tol );
+      BOOST_CHECK_CLOSE( M2(i,j), B(i,j) - AB, tol );
+      BOOST_CHECK_CLOSE( M3(i,j), A(i,j) - u[i]*v[j], tol );
+      BOOST_CHECK_CLOSE( M4(i,j), AB - 0.5*B(i,j), tol );
+    }
+  }
+  BOOST_CHECK_CLOSE( A.det(), -3, tol );
+  BOOST_CHECK_CLOSE( (A*B).det(), -3*B.det(), tol );
+  Matrix I = A*Inverse(A);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      BOOST_CHECK_SMALL( I(i,j) - (i==j), tol );
+  // a fused accumulation rounds only once per product
+  Matrix C(a, 0, 0,
+           0, 1, 0,
+           0, 0, 1);
+  Vector x(b, 0, 0), y(-1, 0, 0);
+  BOOST_CHECK_EQUAL( (y + C*x)[0], VECMAT3_FMA ? -std::ldexp(1.0, -60) : 0 );
+  // packs use the same multiply-adds lane by lane
+  typedef vecmat3::Pack<DOUBLE,4> Pack4;
+  Pack4 pa(a), pb(b), pp(p);
+  Pack4 pf = vecmat3::fmadd(pa, pb, -pp);
+  for (int i = 0; i < 4; i++)
+    BOOST_CHECK_EQUAL( pf[i], vecmat3::fmadd(a, b, -p) );
+}
+
+#if __cplusplus >= 201703L
+// tables built at compile time
+constexpr Matrix cxA(1, 2, 3,
+                     4, 5, 6,
+                     7, 8, 10);
+constexpr Matrix cxB(2, 0, 1,
+                     0, 1, -1,
+                     1, 3, 2);
+constexpr Vector cxa(1, 2, 3), cxb(-1, 0.5, 2);
+constexpr Matrix cxC = Transpose(cxA)*cxB - 2*Dyadic(cxa, cxb);
+constexpr Matrix cxInv = Inverse(cxA);
+constexpr Vector cxv = (cxa^cxb) + cxA*cxb - cxa/2;
+constexpr vecmat3::Quaternion<DOUBLE> cxq(0.5, 0.5, 0.5, 0.5);
+constexpr Matrix cxR = RotationMatrix(cxq);
+static_assert(cxA.det() == -3, "det() in a constant expression");
+static_assert((cxA*cxB).tr() == 47, "tr() in a constant expression");
+static_assert(cxR.xy == 0 && cxR.xz == 1, "RotationMatrix in a constant expression");
+#endif
+
+BOOST_AUTO_TEST_CASE( constexpr_tables )
+{
+#if __cplusplus >= 201703L
+  DOUBLE tol = 1e-10;
+  Matrix C = Transpose(cxA)*cxB - 2*Dyadic(cxa, cxb);
+  Matrix I = cxA*cxInv;
+  Vector v = (cxa^cxb) + cxA*cxb - cxa/2;
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( cxv[i], v[i], tol );
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_CLOSE( cxC(i,j), C(i,j), tol );
+      BOOST_CHECK_SMALL( I(i,j) - (i==j), tol );
+    }
+  }
+  // a table of constant vectors, e.g. stencil offsets, and their norms
+  constexpr Vector offsets[3] = { cxA*Vector(1, 0, 0), cxA*Vector(0, 1, 0),
+                                  cxA*Vector(0, 0, 1) };
+  constexpr DOUBLE n2[3] = { offsets[0].nrm2(), offsets[1].nrm2(),
+                             offsets[2].nrm2() };
+  for (int i = 0; i < 3; i++)
+    BOOST_CHECK_CLOSE( n2[i], cxA.column(i).nrm2(), tol );
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( sym_matrix )
+{
+  DOUBLE tol = 1e-10;
+  typedef vecmat3::SymMatrix<DOUBLE> SymMatrix;
+  BOOST_CHECK( sizeof(SymMatrix) == 6*sizeof(DOUBLE) );
+  Vector u(1, 2, 3), v(0.5, -1, 2), w(-2, 0.25, 1);
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  // accumulating dyadics, as in a virial or inertia tensor
+  SymMatrix S(Dyadic(u, u));
+  S += Dyadic(v, v);
+  S -= 0.5*Dyadic(w, w);
+  Matrix F = Dyadic(u, u) + Dyadic(v, v) - 0.5*Dyadic(w, w);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      BOOST_CHECK_CLOSE( S(i,j), F(i,j), tol );
+  // taking part in expressions
+  Matrix P = A*S + S, Q = A*F + F;
+  Vector x = S*u - w, y = F*u - w;
+  SymMatrix T = 2*S - Transpose(S)/2;
+  for (int i = 0; i < 3; i++) {
+    BOOST_CHECK_CLOSE( x[i], y[i], tol );
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_CLOSE( P(i,j), Q(i,j), tol );
+      BOOST_CHECK_CLOSE( T(i,j), 1.5*F(i,j), tol );
+    }
+  }
+  BOOST_CHECK_CLOSE( S.det(), F.det(), tol );
+  BOOST_CHECK_CLOSE( S.tr(), F.tr(), tol );
+  BOOST_CHECK_CLOSE( S.nrm(), F.nrm(), tol );
+  BOOST_CHECK_CLOSE( (S*S).tr(), F.nrm2(), tol );
+  // products of symmetric matrices are not symmetric, but S*S is
+  T = S*S;
+  Matrix FF = F*F;
+  BOOST_CHECK_CLOSE( T.xz, FF.xz, tol );
+  BOOST_CHECK_CLOSE( T.yz, FF.zy, tol );
+  // setting an element sets its mirror image
+  T(2,0) = 7;
+  BOOST_CHECK_EQUAL( T.xz, 7 );
+  BOOST_CHECK_EQUAL( T(0,2), 7 );
+  vecmat3::noalias(T) = S + Dyadic(u, u);
+  T *= 2;
+  BOOST_CHECK_CLOSE( T.yz, 2*(F.yz + u.y*u.z), tol );
+}
+
+BOOST_AUTO_TEST_CASE( structured_matrices )
+{
+  DOUBLE tol = 1e-10;
+  using vecmat3::Identity;
+  using vecmat3::Diagonal;
+  using vecmat3::Skew;
+  using vecmat3::RotX;
+  using vecmat3::RotY;
+  using vecmat3::RotZ;
+  Vector u(1, 2, 3), v(0.5, -1, 2);
+  Matrix A(1, 2, 3,
+           4, 5, 6,
+           7, 8, 10);
+  DOUBLE a = 0.3;
+  // the structured matrices have the expected elements
+  Matrix I = Identity<DOUBLE>(), D = Diagonal(u), S = Skew(u);
+  Matrix X = RotX(a), Y = RotY(a), Z = RotZ(a);
+  Matrix RX(1, 0,       0,
+            0, cos(a), -sin(a),
+            0, sin(a),  cos(a));
+  Matrix RY( cos(a), 0, sin(a),
+             0,      1, 0,
+            -sin(a), 0, cos(a));
+  Matrix RZ(cos(a), -sin(a), 0,
+            sin(a),  cos(a), 0,
+            0,       0,      1);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_EQUAL( I(i,j), i == j ? 1 : 0 );
+      BOOST_CHECK_EQUAL( D(i,j), i == j ? u[i] : 0 );
+      BOOST_CHECK_EQUAL( S(i,j), -S(j,i) );
+      BOOST_CHECK_CLOSE( X(i,j) + 1, RX(i,j) + 1, tol );
+      BOOST_CHECK_CLOSE( Y(i,j) + 1, RY(i,j) + 1, tol );
+      BOOST_CHECK_CLOSE( Z(i,j) + 1, RZ(i,j) + 1, tol );
+    }
+  // products that leave out the zero terms give the same results as
+  // those with the full matrices
+  Vector c = Skew(u)*v, d = u^v;
+  for (int i = 0; i < 3; i++)
+    BOOST_CHECK_CLOSE( c[i], d[i], tol );
+  Matrix P = A*Diagonal(u), Q = A*D;
+  Matrix R = RotZ(a)*A, RA = Z*A;
+  Matrix W = RotX(a)*RotY(a)*RotZ(a), XYZ = X*Y*Z;
+  Matrix E = Transpose(RotY(a))*RotY(a) - Identity<DOUBLE>();
+  Matrix F = A + 2*(Skew(v)*A), G = A + 2*(Matrix(Skew(v))*A);
+  Matrix H = Identity<DOUBLE>()*A*Identity<DOUBLE>();
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) {
+      BOOST_CHECK_EQUAL( P(i,j), Q(i,j) );
+      BOOST_CHECK_EQUAL( R(i,j), RA(i,j) );
+      BOOST_CHECK_CLOSE( W(i,j), XYZ(i,j), tol );
+      BOOST_CHECK_SMALL( E(i,j), tol );
+      BOOST_CHECK_CLOSE( F(i,j), G(i,j), tol );
+      BOOST_CHECK_EQUAL( H(i,j), A(i,j) );
+    }
+  // the zero pattern is known at compile time, also of products
+  typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::RotZOp,vecmat3::Base> RotZType;
+  BOOST_CHECK_EQUAL( int(vecmat3::Zeros<RotZType>::value), 0xE4 );
+  BOOST_CHECK_EQUAL( int(vecmat3::Zeros<vecmat3::Matrix<DOUBLE,RotZType,vecmat3::TimesOp,RotZType> >::value), 0xE4 );
+  BOOST_CHECK_EQUAL( int(vecmat3::Zeros<Matrix>::value), 0 );
+  BOOST_CHECK_CLOSE( RotZ(a).det(), 1.0, tol );
+  BOOST_CHECK_CLOSE( Diagonal(u).tr(), 6.0, tol );
+}
+
+BOOST_AUTO_TEST_CASE( batch_eigensystem )
+{
+  DOUBLE tol = 1e-12;
+  const int num = 7;
+  Vector e[num] = { Vector(1, 2, 3), Vector(-1, 5, 0.5), Vector(2, 2, 2),
+                    Vector(4, 1, 4), Vector(1e-10, 1, -1), Vector(0, 0, 0),
+                    Vector(3, -2, 1) };
+  Matrix ms[num], vs[num];
+  Vector ls[num], as[num];
+  vecmat3::MatrixArray<DOUBLE> m(num), v(num);
+  vecmat3::VectorArray<DOUBLE> l(num), a(num);
+  for (int n = 0; n < num; n++) {
+    Matrix R = Rodrigues(Vector(0.3*n, 1, -0.2*n));
+    ms[n] = R*vecmat3::Diagonal(e[n])*Transpose(R);
+    ms[n].yx = ms[n].xy; ms[n].zx = ms[n].xz; ms[n].zy = ms[n].yz;
+    m.set(n, ms[n]);
+  }
+  ms[6] = Matrix(3, 0, 0, 0, -2, 0, 0, 0, 1);  // already diagonal
+  m.set(6, ms[6]);
+  vecmat3::eigensystem(ms, ls, vs, num);
+  vecmat3::eigenvalues(ms, as, num);
+  vecmat3::eigensystem(m, l, v);
+  vecmat3::eigenvalues(m, a);
+  for (int n = 0; n < num; n++) {
+    // sorted eigenvalues
+    Vector sorted = e[n];
+    if (sorted.x > sorted.y) std::swap(sorted.x, sorted.y);
+    if (sorted.y > sorted.z) std::swap(sorted.y, sorted.z);
+    if (sorted.x > sorted.y) std::swap(sorted.x, sorted.y);
+    DOUBLE scale = 1 + ms[n].nrm();
+    BOOST_CHECK( (ls[n] - sorted).nrm() < tol*scale );
+    BOOST_CHECK( (as[n] - sorted).nrm() < 1e-6*scale );
+    // the array kernels agree with the per-matrix ones up to rounding
+    BOOST_CHECK( (l[n] - ls[n]).nrm() < tol*scale );
+    BOOST_CHECK( (a[n] - as[n]).nrm() < 1e-6*scale );
+    // eigenvectors form a rotation matrix that diagonalizes ms[n]; they
+    // are only unique if the eigenvalues are distinct
+    DOUBLE gap = std::min(sorted.y - sorted.x, sorted.z - sorted.y);
+    if (gap > 0.1)
+      BOOST_CHECK( (v[n] - vs[n]).nrm() < 1e-10*scale/gap );
+    Matrix I = Transpose(vs[n])*vs[n];
+    BOOST_CHECK( (I - vecmat3::Identity<DOUBLE>()).nrm() < tol );
+    BOOST_CHECK_CLOSE( vs[n].det(), 1.0, 1e-10 );
+    Matrix back = vs[n]*vecmat3::Diagonal(ls[n])*Transpose(vs[n]);
+    BOOST_CHECK( (back - ms[n]).nrm() < tol*scale );
+    Matrix J = Transpose(v[n])*v[n];
+    BOOST_CHECK( (J - vecmat3::Identity<DOUBLE>()).nrm() < tol );
+    Matrix backa = v[n]*vecmat3::Diagonal(l[n])*Transpose(v[n]);
+    BOOST_CHECK( (backa - ms[n]).nrm() < tol*scale );
+  }
+  // the small eigenvalue has a small relative error with Jacobi
+  BOOST_CHECK_CLOSE( ls[4].y, 1e-10, 1e-4 );
+  // single matrices
+  Vector l1, a1 = vecmat3::eigenvalues(ms[1]);
+  Matrix v1;
+  vecmat3::eigensystem(ms[1], l1, v1);
+  DOUBLE scale1 = 1 + ms[1].nrm();
+  BOOST_CHECK( (l1 - ls[1]).nrm() < tol*scale1 );
+  BOOST_CHECK( (a1 - as[1]).nrm() < 1e-6*scale1 );
+  BOOST_CHECK( (v1 - vs[1]).nrm() < 1e-10*scale1 );
+}
+
+BOOST_AUTO_TEST_CASE( batch_svd_polar )
+{
+  DOUBLE tol = 1e-12;
+  const int num = 6;
+  Matrix ms[num], us[num], vs[num], rs[num], ps[num];
+  Vector ss[num];
+  vecmat3::MatrixArray<DOUBLE> m(num), u(num), v(num), r(num), p(num);
+  vecmat3::VectorArray<DOUBLE> s(num);
+  ms[0] = Matrix(1, 2, 3, 4, 5, 6, 7, 8, 10);
+  ms[1] = Matrix(2, 0, 0, 0, -3, 0, 0, 0, 1);                // reflection
+  ms[2] = Dyadic(Vector(1, 2, 3), Vector(4, 5, 6));           // rank 1
+  ms[3] = Matrix(0);
+  ms[4] = Rodrigues(Vector(0.3, -1, 2));                      // rotation
+  ms[5] = Rodrigues(Vector(1, 2, 3))*vecmat3::Diagonal(Vector(1.5, 0.5, 1));
+  for (int n = 0; n < num; n++)
+    m.set(n, ms[n]);
+  vecmat3::svd(ms, us, ss, vs, num);
+  vecmat3::polar(ms, rs, ps, num);
+  vecmat3::svd(m, u, s, v);
+  vecmat3::polar(m, r, p);
+  for (int n = 0; n < num; n++) {
+    DOUBLE scale = 1 + ms[n].nrm();
+    Matrix back = us[n]*vecmat3::Diagonal(ss[n])*Transpose(vs[n]);
+    BOOST_CHECK( (back - ms[n]).nrm() < tol*scale );
+    BOOST_CHECK( (Transpose(us[n])*us[n] - vecmat3::Identity<DOUBLE>()).nrm() < tol );
+    BOOST_CHECK( (Transpose(vs[n])*vs[n] - vecmat3::Identity<DOUBLE>()).nrm() < tol );
+    BOOST_CHECK_CLOSE( us[n].det(), 1.0, 1e-10 );
+    BOOST_CHECK_CLOSE( vs[n].det(), 1.0, 1e-10 );
+    BOOST_CHECK( ss[n].x >= ss[n].y - tol && ss[n].y >= std::abs(ss[n].z) - tol );
+    BOOST_CHECK( (rs[n]*ps[n] - ms[n]).nrm() < tol*scale );
+    BOOST_CHECK( (Transpose(rs[n])*rs[n] - vecmat3::Identity<DOUBLE>()).nrm() < tol );
+    BOOST_CHECK( (ps[n] - Transpose(ps[n])).nrm() == 0 );
+    // the array kernels may round differently than the single ones
+    BOOST_CHECK( (u[n] - us[n]).nrm() < tol*scale );
+    BOOST_CHECK( (s[n] - ss[n]).nrm() < tol*scale );
+    BOOST_CHECK( (v[n] - vs[n]).nrm() < tol*scale );
+    BOOST_CHECK( (r[n] - rs[n]).nrm() < tol*scale );
+    BOOST_CHECK( (p[n] - ps[n]).nrm() < tol*scale );
+  }
+  // singular values of known matrices; a reflection has s.z < 0
+  BOOST_CHECK( (ss[1] - Vector(3, 2, -1)).nrm() < tol );
+  BOOST_CHECK_CLOSE( ss[2].x, Vector(1, 2, 3).nrm()*Vector(4, 5, 6).nrm(), 1e-10 );
+  BOOST_CHECK( (ss[5] - Vector(1.5, 1, 0.5)).nrm() < tol );
+  // the polar decomposition recovers a rotation and a stretch
+  BOOST_CHECK( (rs[4] - ms[4]).nrm() < tol );
+  BOOST_CHECK( (rs[5] - Rodrigues(Vector(1, 2, 3))).nrm() < tol );
+  BOOST_CHECK( (ps[5] - vecmat3::Diagonal(Vector(1.5, 0.5, 1))).nrm() < tol );
+  // single matrices
+  Matrix u1, v1, r1, p1;
+  Vector s1;
+  vecmat3::svd(2*ms[0], u1, s1, v1);
+  vecmat3::polar(2*ms[0], r1, p1);
+  BOOST_CHECK( (s1 - 2*ss[0]).nrm() < tol*s1.nrm() );
+  BOOST_CHECK( (r1 - rs[0]).nrm() < tol );
+}
+
+BOOST_AUTO_TEST_CASE( batch_reorthogonalize )
+{
+  DOUBLE tol = 1e-14;
+  const int num = 4;
+  Matrix drift(1e-6, -2e-6, 3e-7, 5e-7, 1e-6, -4e-6, 2e-6, 3e-6, -1e-6);
+  Matrix ms[num], gs[num], ns[num], ps[num];
+  vecmat3::MatrixArray<DOUBLE> g(num), p(num);
+  ms[0] = Rodrigues(Vector(0.3, -1, 2)) + drift;
+  ms[1] = Rodrigues(Vector(1, 2, 3)) - drift;
+  ms[2] = vecmat3::Identity<DOUBLE>();                     // already orthogonal
+  ms[3] = Rodrigues(Vector(-2, 0.5, 0.1)) + 10*drift;
+  for (int n = 0; n < num; n++) {
+    gs[n] = ns[n] = ps[n] = ms[n];
+    g.set(n, ms[n]);
+    p.set(n, ms[n]);
+  }
+  BOOST_CHECK_EQUAL( vecmat3::reorthogonalize(gs, num), std::size_t(num) );
+  BOOST_CHECK_EQUAL( vecmat3::reorthogonalize(g), std::size_t(num) );
+  BOOST_CHECK_EQUAL( vecmat3::reorthogonalize(ns, num, vecmat3::NewtonGramSchmidt, tol, 5),
+                     std::size_t(3) );
+  BOOST_CHECK_EQUAL( vecmat3::reorthogonalize(ps, num, vecmat3::PolarProjection), std::size_t(num) );
+  BOOST_CHECK_EQUAL( vecmat3::reorthogonalize(p, vecmat3::PolarProjection, tol), std::size_t(3) );
+  for (int n = 0; n < num; n++) {
+    Matrix m1 = ms[n];
+    m1.reorthogonalize();
+    BOOST_CHECK( vecmat3::orthogonalityError(gs[n]) < tol );
+    BOOST_CHECK( vecmat3::orthogonalityError(ns[n]) < tol );
+    BOOST_CHECK( vecmat3::orthogonalityError(ps[n]) < tol );
+    BOOST_CHECK( vecmat3::orthogonalityError(m1) < tol );
+    BOOST_CHECK_CLOSE( gs[n].det(), 1.0, 1e-12 );
+    BOOST_CHECK_CLOSE( ps[n].det(), 1.0, 1e-12 );
+    BOOST_CHECK( (gs[n] - m1).nrm() < tol );
+    BOOST_CHECK( (ns[n] - m1).nrm() < tol );
+    BOOST_CHECK( (g[n] - gs[n]).nrm() == 0 );
+    BOOST_CHECK( (gs[n] - ms[n]).nrm() < 1e-4 );
+    // the polar projection is the nearest rotation
+    BOOST_CHECK( (ps[n] - ms[n]).nrm() <= (gs[n] - ms[n]).nrm() + tol );
+  }
+  // matrices within the tolerance are left alone
+  BOOST_CHECK( (ns[2] - ms[2]).nrm() == 0 );
+  BOOST_CHECK( (p[2] - ms[2]).nrm() == 0 );
+  for (int n = 0; n < num; n++)
+    BOOST_CHECK( (p[n] - ps[n]).nrm() < tol );
+  BOOST_CHECK( vecmat3::orthogonalityError(2*ms[2]) == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( mixed_precision )
+{
+  // division by an integer
+  Vector v(2, 4, 6);
+  Vector w = v/2;
+  BOOST_CHECK( (w - Vector(1, 2, 3)).nrm() == 0 );
+  Matrix m(2, 4, 6, 8, 10, 12, 14, 16, 18);
+  Matrix half = m/2;
+  BOOST_CHECK_EQUAL( half.xx, 1 );
+  BOOST_CHECK_EQUAL( half.zz, 9 );
+  // float storage, double evaluation
+  vecmat3::Vector<float> pf(1, 2, 3);
+  vecmat3::Vector<double> vel(1e-9, -2e-9, 3e-9);
+  vecmat3::Vector<double> pd = vecmat3::Convert<double>(pf) + 0.5*vel;
+  BOOST_CHECK_EQUAL( pd.x, 1 + 0.5e-9 );
+  for (int i = 0; i < 1000; i++)
+    pf = vecmat3::Convert<float>(vecmat3::Convert<double>(pf) + vel);
+  BOOST_CHECK_EQUAL( pf.x, 1.0f );  // each update is below float precision
+  pf = vecmat3::Convert<float>(vecmat3::Convert<double>(pf) + 1000*vel);
+  BOOST_CHECK_EQUAL( pf.x, float(1 + 1e-6) );
+  BOOST_CHECK_EQUAL( pf.y, float(2 - 2e-6) );
+  vecmat3::Matrix<float> mf = vecmat3::Convert<float>(m);
+  BOOST_CHECK_EQUAL( mf.yz, 12.0f );
+  BOOST_CHECK( (vecmat3::Convert<double>(mf)*Vector(1, 0, 0) - m.column(0)).nrm() == 0 );
+  typedef vecmat3::Matrix<double,vecmat3::Base,vecmat3::IdentityOp,vecmat3::Base> IdentityType;
+  BOOST_CHECK_EQUAL( int(vecmat3::Zeros<vecmat3::Matrix<float,IdentityType,vecmat3::ConvertOp,vecmat3::Base> >::value), 0xEE );
+  vecmat3::Quaternion<float> qf = vecmat3::Convert<float>(vecmat3::Quaternion<double>(1, 0.5, 0.25, 0.125));
+  BOOST_CHECK_EQUAL( qf.z, 0.125f );
+  // arrays with single-precision storage
+  const int num = 1000;
+  vecmat3::VectorArray<float> pos(num), vel2(num);
+  vecmat3::Vector<float> vs[num], vv[num];
+  for (int n = 0; n < num; n++) {
+    pos.set(n, vecmat3::Vector<float>(n, 1, 0.1f));
+    vel2.set(n, vecmat3::Vector<float>(1, -1, n));
+    vs[n] = pos[n];
+    vv[n] = vel2[n];
+  }
+  pos = vecmat3::Convert<float>(vecmat3::Convert<double>(pos) + 0.5*vecmat3::Convert<double>(vel2));
+  BOOST_CHECK_EQUAL( pos.x[10], 10.5f );
+  BOOST_CHECK_EQUAL( pos.z[10], float(0.1f + 5.0) );
+  vecmat3::Vector<double> s = vecmat3::sum<double>(vs, num);
+  BOOST_CHECK_EQUAL( s.x, num*(num - 1)/2.0 );
+  BOOST_CHECK_EQUAL( s.y, num );
+  BOOST_CHECK_CLOSE( s.z, num*double(0.1f), 1e-12 );
+  s = vecmat3::sum<double>(vel2);
+  BOOST_CHECK_EQUAL( s.z, num*(num - 1)/2.0 );
+  BOOST_CHECK_EQUAL( vecmat3::dot<double>(vel2, vel2), 2.0*num + (num - 1)*num*(2*num - 1)/6.0 );
+  BOOST_CHECK_EQUAL( vecmat3::dot<double>(vs, vs, 2), 3 + 2*double(0.1f)*double(0.1f) );
+  // axpy rounds once, like the equivalent expression with Convert
+  vecmat3::VectorArray<float> pos2(num);
+  pos2 = vecmat3::Convert<float>(vecmat3::Convert<double>(pos) + 0.1*vecmat3::Convert<double>(vel2));
+  vecmat3::axpy(0.1, vel2, pos);
+  vecmat3::axpy(0.1, vv, vs, num);
+  for (int n = 0; n < num; n++) {
+    BOOST_CHECK_EQUAL( pos.z[n], pos2.z[n] );
+    BOOST_CHECK_EQUAL( vs[n].z, float(double(0.1f) + 0.1*n) );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( half_precision )
+{
+  using vecmat3::Half;
+  using vecmat3::BFloat16;
+  // every half and bfloat16 survives a round trip through float, with
+  // nans keeping their payload but becoming quiet
+  for (int h = 0; h < 65536; h++) {
+    float f = vecmat3::halfToFloat((unsigned short)h);
+    BOOST_CHECK_EQUAL( vecmat3::floatToHalf(f), f == f ? h : h | 0x200 );
+    BOOST_CHECK_EQUAL( Half(f).bits, vecmat3::floatToHalf(f) );
+    BOOST_CHECK( float(Half(f)) == f or f != f );
+    float b = vecmat3::bfloat16ToFloat((unsigned short)h);
+    if (b == b)
+      BOOST_CHECK_EQUAL( BFloat16(b).bits, h );
+  }
+  // rounding to nearest even, subnormals, overflow and nan
+  BOOST_CHECK_EQUAL( float(Half(1.0f + 1.0f/2048)), 1.0f );
+  BOOST_CHECK_EQUAL( float(Half(1.0f + 3.0f/2048)), 1.0f + 1.0f/512 );
+  BOOST_CHECK_EQUAL( float(Half(1.0f + 1.0f/2048 + 1.0f/65536)), 1.0f + 1.0f/1024 );
+  BOOST_CHECK_EQUAL( float(Half(std::ldexp(1.0f, -24))), std::ldexp(1.0f, -24) );
+  BOOST_CHECK_EQUAL( float(Half(std::ldexp(1.0f, -26))), 0.0f );
+  BOOST_CHECK_EQUAL( float(Half(65504.0f)), 65504.0f );
+  BOOST_CHECK_EQUAL( float(Half(-1e6f)), -std::numeric_limits<float>::infinity() );
+  BOOST_CHECK( float(Half(std::numeric_limits<float>::quiet_NaN())) != float(Half(std::numeric_limits<float>::quiet_NaN())) );
+  BOOST_CHECK_EQUAL( float(BFloat16(1.0f + 1.0f/256)), 1.0f );
+  BOOST_CHECK_EQUAL( float(BFloat16(1.0f + 3.0f/256)), 1.0f + 1.0f/64 );
+  BOOST_CHECK_EQUAL( float(BFloat16(3e38f)), 3.00405527e38f );
+  BOOST_CHECK( float(BFloat16(std::numeric_limits<float>::quiet_NaN())) != float(BFloat16(std::numeric_limits<float>::quiet_NaN())) );
+  // bulk conversions agree with element-wise ones
+  const int num = 1003;
+  vecmat3::VectorArray<float> a(num), b(num), c(num);
+  vecmat3::VectorArray<Half> h(num);
+  vecmat3::VectorArray<BFloat16> g(num);
+  vecmat3::MatrixArray<float> m(num), mb(num);
+  vecmat3::MatrixArray<Half> mh(num);
+  for (int n = 0; n < num; n++) {
+    a.set(n, vecmat3::Vector<float>(0.37f*n, -1.0f/(n + 1), 1e-5f*n*n));
+    m.set(n, vecmat3::Convert<float>(Rodrigues(Vector(0.01*n, 1, -0.5))));
+  }
+  vecmat3::convert(a, h);
+  vecmat3::convert(h, b);
+  vecmat3::convert(a, g);
+  vecmat3::convert(g, c);
+  vecmat3::convert(m, mh);
+  vecmat3::convert(mh, mb);
+  for (int n = 0; n < num; n++) {
+    BOOST_CHECK_EQUAL( h.y[n].bits, Half(a.y[n]).bits );
+    BOOST_CHECK_EQUAL( b.x[n], float(Half(a.x[n])) );
+    BOOST_CHECK_EQUAL( b.z[n], float(Half(a.z[n])) );
+    BOOST_CHECK_EQUAL( c.x[n], float(BFloat16(a.x[n])) );
+    BOOST_CHECK_EQUAL( c.y[n], float(BFloat16(a.y[n])) );
+    BOOST_CHECK_EQUAL( mb.zy[n], float(Half(m.zy[n])) );
+    BOOST_CHECK( std::abs(b.x[n] - a.x[n]) <= std::abs(a.x[n])/2048 );
+    BOOST_CHECK( std::abs(c.y[n] - a.y[n]) <= std::abs(a.y[n])/256 );
+  }
+  // expressions are evaluated in float
+  vecmat3::VectorArray<Half> h2(num);
+  h2 = vecmat3::Convert<Half>(2.0f*vecmat3::Convert<float>(h) - vecmat3::Convert<float>(b));
+  for (int n = 0; n < num; n++)
+    BOOST_CHECK_EQUAL( h2.x[n].bits, h.x[n].bits );
+  vecmat3::Vector<float> v = vecmat3::Convert<float>(mh[7])*vecmat3::Convert<float>(h[7]);
+  BOOST_CHECK_CLOSE( v.nrm(), b[7].nrm(), 0.2 );
+}
+
+BOOST_AUTO_TEST_CASE( buffer_views )
+{
+  typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::RefOp,vecmat3::Base> VectorRef;
+  typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::ConstRefOp,vecmat3::Base> ConstVectorRef;
+  typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::RefOp,vecmat3::Base> MatrixRef;
+  typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::ConstRefOp,vecmat3::Base> ConstMatrixRef;
+  typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::StridedOp,vecmat3::Base> VectorArrayRef;
+  typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::ConstStridedOp,vecmat3::Base> ConstVectorArrayRef;
+  typedef vecmat3::Matrix<DOUBLE,vecmat3::Base,vecmat3::StridedOp,vecmat3::Base> MatrixArrayRef;
+  typedef vecmat3::Vector<DOUBLE,vecmat3::Base,vecmat3::ArrayOp,vecmat3::Base> VectorArray;
+  // records of position, velocity and mass
+  const int num = 5;
+  const int stride = 7;
+  DOUBLE buf[num*stride];
+  for (int i = 0; i < num*stride; i++)
+    buf[i] = 0.5*i - 3;
+  const DOUBLE* cbuf = buf;
+  ConstVectorArrayRef pos(cbuf, num, stride);
+  VectorArrayRef vel(buf + 3, num, stride);
+  BOOST_CHECK_EQUAL( pos.size(), std::size_t(num) );
+  BOOST_CHECK_EQUAL( vel.stride(), std::size_t(stride) );
+  Matrix R(0, -1, 0, 1, 0, 0, 0, 0, 1);
+  // read-only views act like arrays in expressions
+  VectorArray p(num);
+  p = R*pos + 2*vel;
+  for (int n = 0; n < num; n++) {
+    Vector x(buf[n*stride], buf[n*stride+1], buf[n*stride+2]);
+    Vector v(buf[n*stride+3], buf[n*stride+4], buf[n*stride+5]);
+    Vector q = R*x + 2*v;
+    BOOST_CHECK( (p[n] - q).nrm() == 0 );
+    BOOST_CHECK( (pos[n] - x).nrm() == 0 );
+  }
+  // writing through a view changes only the selected elements
+  DOUBLE orig[num*stride];
+  for (int i = 0; i < num*stride; i++)
+    orig[i] = buf[i];
+  vel = R*vel - pos;
+  vel *= 2;
+  for (int n = 0; n < num; n++) {
+    Vector x(orig[n*stride], orig[n*stride+1], orig[n*stride+2]);
+    Vector v(orig[n*stride+3], orig[n*stride+4], orig[n*stride+5]);
+    Vector w = 2*(R*v - x);
+    BOOST_CHECK( (vel[n] - w).nrm() == 0 );
+    BOOST_CHECK( (pos[n] - x).nrm() == 0 );
+    BOOST_CHECK_EQUAL( buf[n*stride+6], orig[n*stride+6] );
+  }
+  // single views
+  VectorRef v1 = vel[1];
+  ConstVectorRef x1 = pos[1];
+  Vector w = v1 ^ x1;
+  v1 = v1 ^ x1;
+  BOOST_CHECK( (Vector(v1) - w).nrm() == 0 );
+  BOOST_CHECK_EQUAL( buf[stride+3], w.x );
+  v1[2] = 8;
+  BOOST_CHECK_EQUAL( buf[stride+5], 8 );
+  // assigning a view copies the elements
+  VectorRef v2 = vel[2];
+  v2 = v1;
+  BOOST_CHECK( v2.data() == buf + 2*stride + 3 );
+  BOOST_CHECK( (Vector(v2) - Vector(v1)).nrm() == 0 );
+  v2 += x1;
+  BOOST_CHECK( (Vector(v2) - (Vector(v1) + Vector(x1))).nrm() == 0 );
+  // matrices stored row by row
+  DOUBLE mbuf[18];
+  for (int i = 0; i < 18; i++)
+    mbuf[i] = i + 1;
+  MatrixRef m0(mbuf);
+  ConstMatrixRef m1(mbuf + 9);
+  Matrix a(m0), b(m1);
+  BOOST_CHECK_EQUAL( m1(1,2), 15 );
+  BOOST_CHECK_EQUAL( m1.det(), b.det() );
+  m0 = m0*m1;
+  BOOST_CHECK( (Matrix(m0) - Matrix(a*b)).nrm() == 0 );
+  m0[2] = Vector(0, 0, 1);
+  m0(0,1) = 4;
+  BOOST_CHECK( mbuf[6] == 0 && mbuf[8] == 1 && mbuf[1] == 4 );
+  MatrixArrayRef ms(mbuf, 2);
+  a = ms[0];
+  ms = Transpose(ms);
+  BOOST_CHECK( (Matrix(ms[0]) - Transpose(a)).nrm() == 0 );
+  BOOST_CHECK( (Matrix(ms[1]) - Transpose(b)).nrm() == 0 );
+}
+
 #ifndef DEBUG
 BOOST_AUTO_TEST_SUITE_END()
 #endif
@@ -41,11 +41,15 @@
 // Handle nonstandard c++ compiler cxx on alpha
 //
 #if defined(__alpha)
+# include <assert.h>
 # include <math.h>
+# include <stddef.h>
 # include <iostream.h>
 # define OSTREAM ostream
 #else
+# include <cassert>
 # include <cmath>
+# include <cstddef>
 # include <iostream>
 # define OSTREAM std::ostream
 #endif
@@ -67,6 +71,48 @@
 # endif
 #endif
 
+//
+// With c++17 or later, CONSTEXPR makes the constructors, element
+// evaluation, expression operators, det(), tr(), Transpose, Dyadic
+// and Inverse usable in constant expressions, e.g.
+//   constexpr Matrix<double> R = Transpose(A)*B;
+// for A and B constexpr as well. Before c++17, CONSTEXPR is empty.
+//
+#if not defined(CONSTEXPR)
+# if __cplusplus >= 201703L
+#   define CONSTEXPR constexpr
+# else
+#   define CONSTEXPR
+# endif
+#endif
+
+//
+// Subexpressions that would be evaluated repeatedly, e.g. the inner
+// product in A*B*C, are materialized into a temporary when that saves
+// at least VECMAT3_MATERIALIZE_COST floating point operations per
+// element. Define it as 0 to never materialize. The temporary is
+// computed each time the expression is evaluated, so an expression
+// stored with 'auto' still sees the current values of its operands.
+//
+#if not defined(VECMAT3_MATERIALIZE_COST)
+# define VECMAT3_MATERIALIZE_COST 3
+#endif
+
+//
+// If VECMAT3_FMA is nonzero, sums of products (in matrix products, in
+// det() and Inverse(), and in '+' and '-' with a product as operand)
+// are computed with fused multiply-adds, which are faster and round
+// only once, but change results in the last bits. It defaults to 0;
+// define it as 1 (with c++11 or later) when the target has FMA
+// instructions, e.g. with -mfma, as std::fma is slow otherwise.
+// Results that do not depend on the hardware also require the
+// compiler not to contract a*b+c on its own, e.g. -ffp-contract=off
+// for g++.
+//
+#if not defined(VECMAT3_FMA)
+# define VECMAT3_FMA 0
+#endif
+
 //
 // Some useful short-hand notational macros (while macros are evil,
 // so is c++'s template notation, and a few abbreviations will
@@ -90,6 +136,9 @@
 #define ANOTHER_MATRIX   Matrix<T,U,V,W>
 #define MATRIX1          Matrix<T,A,B,C>
 #define MATRIX2          Matrix<T,D,E,F>
+#define QUATERNION       Quaternion<T,X,Y,Z>
+#define QUATERNION1      Quaternion<T,A,B,C>
+#define QUATERNION2      Quaternion<T,D,E,F>
 #define TT               T,Base,NoOp,Base
 
 //
@@ -110,6 +159,20 @@ namespace vecmat3 {
         NegativeOp,  // negation operator
         TransposeOp, // matrix transpose (matrix only)
         DyadicOp,    // dyadic of two vectors (vectors only)
+        ArrayOp,     // structure-of-arrays leaf (arrays only)
+        SymmetricOp, // symmetric matrix leaf (matrices only)
+        IdentityOp,  // identity matrix leaf (matrices only)
+        DiagonalOp,  // diagonal matrix leaf (matrices only)
+        SkewOp,      // skew-symmetric matrix of a vector (matrices only)
+        RotXOp,      // rotation about the x axis (matrices only)
+        RotYOp,      // rotation about the y axis (matrices only)
+        RotZOp,      // rotation about the z axis (matrices only)
+        ConjugateOp, // conjugate (quaternions only)
+        ConvertOp,   // conversion to another element type
+        ConstRefOp,  // read-only view of external elements
+        RefOp,       // assignable view of external elements
+        ConstStridedOp, // read-only strided view of external arrays
+        StridedOp,   // assignable strided view of external arrays
         USER         // for user-defined template operations
     };
     
@@ -119,7 +182,132 @@ namespace vecmat3 {
     class Base;  
     template <typename T,typename A=Base,int B=NoOp,typename C=Base> class Vector;
     template <typename T,typename A=Base,int B=NoOp,typename C=Base> class Matrix;
+    template <typename T,typename A=Base,int B=NoOp,typename C=Base> class Quaternion;
     template <typename T> class CommaOp;
+    template <typename E> struct DirectAssign;
+    template <typename D> class NoAlias;
+
+    //
+    // prepared(e) gets the expression e ready for evaluation, by
+    // computing the sub-expressions that it materializes (see Operand),
+    // and returns e. Anything that evaluates the elements of an
+    // expression calls it once beforehand. Leaves need no preparation.
+    //
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR const Vector<T,A,B,C>& prepared( const Vector<T,A,B,C>& e )
+    {
+        e.prepare();
+        return e;
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR const Vector<T,Base,B,Base>& prepared( const Vector<T,Base,B,Base>& e )
+    {
+        return e;
+    }
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR const Matrix<T,A,B,C>& prepared( const Matrix<T,A,B,C>& e )
+    {
+        e.prepare();
+        return e;
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR const Matrix<T,Base,B,Base>& prepared( const Matrix<T,Base,B,Base>& e )
+    {
+        return e;
+    }
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR const Quaternion<T,A,B,C>& prepared( const Quaternion<T,A,B,C>& e )
+    {
+        e.prepare();
+        return e;
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR const Quaternion<T,Base,B,Base>& prepared( const Quaternion<T,Base,B,Base>& e )
+    {
+        return e;
+    }
+
+    //
+    // hasSize(e,num) tells whether all arrays in the expression e have
+    // num elements, as they must when e is assigned to an array of num
+    // elements. Leaves other than arrays and strided views fit any size.
+    //
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR bool hasSize( const Vector<T,A,B,C>& e, std::size_t num )
+    {
+        return e.sized(num);
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR bool hasSize( const Vector<T,Base,B,Base>&, std::size_t )
+    {
+        return true;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Vector<T,Base,ArrayOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Vector<T,Base,ConstStridedOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Vector<T,Base,StridedOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR bool hasSize( const Matrix<T,A,B,C>& e, std::size_t num )
+    {
+        return e.sized(num);
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR bool hasSize( const Matrix<T,Base,B,Base>&, std::size_t )
+    {
+        return true;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Matrix<T,Base,ArrayOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Matrix<T,Base,ConstStridedOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T>
+    INLINE bool hasSize( const Matrix<T,Base,StridedOp,Base>& e, std::size_t num )
+    {
+        return e.size() == num;
+    }
+    template <typename T, typename A, int B, typename C>
+    INLINE CONSTEXPR bool hasSize( const Quaternion<T,A,B,C>& e, std::size_t num )
+    {
+        return e.sized(num);
+    }
+    template <typename T, int B>
+    INLINE CONSTEXPR bool hasSize( const Quaternion<T,Base,B,Base>&, std::size_t )
+    {
+        return true;
+    }
+
+    #if __cplusplus >= 201103L
+    // Shorthand for arrays of vectors and symmetric matrices (older
+    // compilers should spell out e.g. Vector<T,Base,ArrayOp,Base>)
+    template <typename T> using VectorArray = Vector<T,Base,ArrayOp,Base>;
+    template <typename T> using MatrixArray = Matrix<T,Base,ArrayOp,Base>;
+    template <typename T> using SymMatrix   = Matrix<T,Base,SymmetricOp,Base>;
+    template <typename T> using ConstVectorRef = Vector<T,Base,ConstRefOp,Base>;
+    template <typename T> using ConstMatrixRef = Matrix<T,Base,ConstRefOp,Base>;
+    template <typename T> using VectorRef      = Vector<T,Base,RefOp,Base>;
+    template <typename T> using MatrixRef      = Matrix<T,Base,RefOp,Base>;
+    template <typename T> using ConstVectorArrayRef = Vector<T,Base,ConstStridedOp,Base>;
+    template <typename T> using ConstMatrixArrayRef = Matrix<T,Base,ConstStridedOp,Base>;
+    template <typename T> using VectorArrayRef = Vector<T,Base,StridedOp,Base>;
+    template <typename T> using MatrixArrayRef = Matrix<T,Base,StridedOp,Base>;
+    #endif
     
     //
     // Default vector class
@@ -134,9 +322,9 @@ namespace vecmat3 {
         //  Constructors
         //
         EXPRESSION_TEMPLATE_MEMBER 
-        INLINE            Vector( const VECTOR& v );
-        INLINE            Vector() {}  
-        INLINE explicit   Vector( const T x_, const T y_ = 0, const T z_ = 0 ); 
+        INLINE CONSTEXPR          Vector( const VECTOR& v );
+        INLINE                    Vector() {}  
+        INLINE CONSTEXPR explicit Vector( const T x_, const T y_ = 0, const T z_ = 0 ); 
       
         //
         // Assignment operators
@@ -145,8 +333,14 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE const Vector<TT>& operator= ( const VECTOR & v ) 
         {
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< Vector<TT> >(*this) = v;
+                return *this;
+            }
             // No (this!=&m) clause is needed because this is a default vector,
             // and the default vector case is specialized below.
+            prepared(v);
             T yValue = v.template eval<1>();
             T zValue = v.template eval<2>();
             x = v.template eval<0>();
@@ -170,14 +364,16 @@ namespace vecmat3 {
         //  Non-template member functions
         //  
         INLINE T          nrm()  const;  // return the norm of the 3d vector
-        INLINE T          nrm2() const;  // return the squared norm       
+        INLINE CONSTEXPR T nrm2() const;  // return the squared norm       
         INLINE void       zero();        // set this vector to zero
       
         //
-        //  Template evaluation (the work horse of TE)
+        //  Template evaluation (the work horse of TE); the element
+        //  index n is ignored, so that a Vector<TT> acts as a constant
+        //  in expressions involving arrays of vectors
         //
         template <int I> 
-        INLINE T          eval() const;
+        INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
       
         //
         //  Operators
@@ -213,6 +409,12 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE Vector<TT>& operator+= ( const VECTOR& v )
         {
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< Vector<TT> >(*this) += v;
+                return *this;
+            }
+            prepared(v);
             T yValue = v.template eval<1>();
             T zValue = v.template eval<2>();
             x += v.template eval<0>();
@@ -223,6 +425,12 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE Vector<TT>& operator-= ( const VECTOR& v )
         {
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< Vector<TT> >(*this) -= v;
+                return *this;
+            }
+            prepared(v);
             T yValue = v.template eval<1>();
             T zValue = v.template eval<2>();        
             x -= v.template eval<0>();
@@ -248,11 +456,11 @@ namespace vecmat3 {
         // Constructors
         //
         EXPRESSION_TEMPLATE_MEMBER 
-        INLINE            Matrix( const MATRIX& m );
-        INLINE            Matrix() {}
-        INLINE explicit   Matrix( T a,   T b=0, T c=0,
-                                  T d=0, T e=0, T f=0,
-                                  T g=0, T h=0, T i=0);
+        INLINE CONSTEXPR          Matrix( const MATRIX& m );
+        INLINE                    Matrix() {}
+        INLINE CONSTEXPR explicit Matrix( T a,   T b=0, T c=0,
+                                          T d=0, T e=0, T f=0,
+                                          T g=0, T h=0, T i=0);
         //
         // Assignment operators
         // (inline to appease xlC compiler's issues with templated return types)
@@ -260,8 +468,14 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE const Matrix<TT>& operator= ( const MATRIX& m )
         {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< Matrix<TT> >(*this) = m;
+                return *this;
+            }
             // no (this!=&m) clause needed because this is a default matrix,
             // and the default matrix case is specialized below.
+            prepared(m);
             T xxValue = m.template eval<0,0>(); 
             T xyValue = m.template eval<0,1>(); 
             T xzValue = m.template eval<0,2>();
@@ -291,7 +505,7 @@ namespace vecmat3 {
         //
         // Evaluate components
         //
-        template <int I,int J> INLINE T eval() const; 
+        template <int I,int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const; 
 
         //
         // Non-template member functions for getting individual rows or columns
@@ -313,10 +527,10 @@ namespace vecmat3 {
             return *((Vector<TT>*)(&xx+3*i));
         }
 
-        INLINE T         nrm2() const;       // 2-norm squared
+        INLINE CONSTEXPR T nrm2() const;       // 2-norm squared
         INLINE T         nrm()  const;       // norm (=square root of nrm2)
-        INLINE T         tr()   const;       // trace
-        INLINE T         det()  const;       // determinant
+        INLINE CONSTEXPR T tr()   const;       // trace
+        INLINE CONSTEXPR T det()  const;       // determinant
         INLINE void      zero();             // set this matrix to zero
         INLINE void      one();              // set this matrix to the identity matrix
         INLINE void      reorthogonalize();  // make this matrix is orthogonal
@@ -362,6 +576,12 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE Matrix<TT>& operator+= ( const MATRIX& m )
         {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< Matrix<TT> >(*this) += m;
+                return *this;
+            }
+            prepared(m);
             T xxValue = m.template eval<0,0>(); 
             T xyValue = m.template eval<0,1>(); 
             T xzValue = m.template eval<0,2>();
@@ -380,6 +600,12 @@ namespace vecmat3 {
         EXPRESSION_TEMPLATE_MEMBER 
         INLINE Matrix<TT>& operator-= ( const MATRIX& m )
         {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< Matrix<TT> >(*this) -= m;
+                return *this;
+            }
+            prepared(m);
             T xxValue = m.template eval<0,0>(); 
             T xyValue = m.template eval<0,1>(); 
             T xzValue = m.template eval<0,2>();
@@ -417,111 +643,349 @@ namespace vecmat3 {
 
     }; // end default matrix class definition
 
+    //
+    //  The default quaternion class, w + x i + y j + z k, with w the
+    //  scalar part and (x,y,z) the vector part.  Unit quaternions
+    //  represent rotations, which compose with 16 multiplications
+    //  (versus 27 for matrices) and need only a normalization to
+    //  undo round-off errors.
+    //
+    template <typename T> 
+    class Quaternion<TT> 
+    {
+      public:
+        T w, x, y, z;  // elements of the quaternion
+
+        //
+        // Constructors
+        //
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE CONSTEXPR          Quaternion( const QUATERNION& q );
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE CONSTEXPR          Quaternion( const T w_, const VECTOR& v );
+        INLINE                    Quaternion() {}
+        INLINE CONSTEXPR explicit Quaternion( const T w_, const T x_ = 0, 
+                                              const T y_ = 0, const T z_ = 0 );
+
+        //
+        // Assignment operators
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE const Quaternion<TT>& operator= ( const QUATERNION& q )
+        {
+            if (DirectAssign<QUATERNION>::value) {
+                // q never reads an element after it has been assigned
+                NoAlias< Quaternion<TT> >(*this) = q;
+                return *this;
+            }
+            prepared(q);
+            T xValue = q.template eval<1>();
+            T yValue = q.template eval<2>();
+            T zValue = q.template eval<3>();
+            w = q.template eval<0>();
+            x = xValue;
+            y = yValue;
+            z = zValue;
+            return *this;
+        }
+        // Specialize for a default quaternion
+        INLINE const Quaternion<TT>& operator= ( const Quaternion<TT>& q )
+        {
+            if (this != &q) {
+                w = q.w;
+                x = q.x;
+                y = q.y;
+                z = q.z;
+            }
+            return *this;
+        }
+
+        //
+        //  Non-template member functions
+        //  
+        INLINE T          nrm()  const;  // return the norm of the quaternion
+        INLINE CONSTEXPR T nrm2() const;  // return the squared norm
+        INLINE void       zero();        // set this quaternion to zero
+        INLINE void       one();         // set this quaternion to one
+        INLINE void       normalize();   // make this a unit quaternion
+
+        //
+        //  Template evaluation; eval<0> is the scalar part
+        //
+        template <int I> 
+        INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+
+        //
+        //  Operators to access elements, with index 0 for w
+        //
+        INLINE const T&   operator() ( const int i ) const;
+        INLINE T&         operator() ( const int i );
+        INLINE const T&   operator[] ( const int i ) const;
+        INLINE T&         operator[] ( const int i );
+
+        //
+        // Template operators
+        // (inline to appease xlC compiler's issues with templated return types)
+        //  
+        CONVERTIBLE_TEMPLATE 
+        INLINE Quaternion<TT>& operator*= ( const CONVERT a )
+        {
+            w *= a;
+            x *= a;
+            y *= a;
+            z *= a;
+            return *this;
+        }      
+        CONVERTIBLE_TEMPLATE 
+        INLINE Quaternion<TT>& operator/= ( const CONVERT a )
+        {
+            w /= a;
+            x /= a;
+            y /= a;
+            z /= a;
+            return *this;
+        }        
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE Quaternion<TT>& operator+= ( const QUATERNION& q )
+        {
+            if (DirectAssign<QUATERNION>::value) {
+                // q never reads an element after it has been assigned
+                NoAlias< Quaternion<TT> >(*this) += q;
+                return *this;
+            }
+            prepared(q);
+            T xValue = q.template eval<1>();
+            T yValue = q.template eval<2>();
+            T zValue = q.template eval<3>();
+            w += q.template eval<0>();
+            x += xValue;
+            y += yValue;
+            z += zValue;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE Quaternion<TT>& operator-= ( const QUATERNION& q )
+        {
+            if (DirectAssign<QUATERNION>::value) {
+                // q never reads an element after it has been assigned
+                NoAlias< Quaternion<TT> >(*this) -= q;
+                return *this;
+            }
+            prepared(q);
+            T xValue = q.template eval<1>();
+            T yValue = q.template eval<2>();
+            T zValue = q.template eval<3>();
+            w -= q.template eval<0>();
+            x -= xValue;
+            y -= yValue;
+            z -= zValue;
+            return *this;
+        }
+        // Compose: q *= r sets q to q*r
+        EXPRESSION_TEMPLATE_MEMBER 
+        INLINE Quaternion<TT>& operator*= ( const QUATERNION& q )
+        {
+            Quaternion<TT> rhs(q);
+            T wValue = w*rhs.w - x*rhs.x - y*rhs.y - z*rhs.z;
+            T xValue = w*rhs.x + x*rhs.w + y*rhs.z - z*rhs.y;
+            T yValue = w*rhs.y - x*rhs.z + y*rhs.w + z*rhs.x;
+            z        = w*rhs.z + x*rhs.y - y*rhs.x + z*rhs.w;
+            w = wValue;
+            x = xValue;
+            y = yValue;
+            return *this;
+        }
+
+    }; // end default quaternion class definition
+
     //
     // Declarations of vector-matrix operations
     //
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,PlusOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,PlusOp,VECTOR2> 
     operator+ ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 );
 
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,MinusOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,MinusOp,VECTOR2> 
     operator- ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 );
 
     // Template expression for cross product of two vector expressions
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,TimesOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,TimesOp,VECTOR2> 
     operator^ ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 );
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator/ ( const VECTOR & v,  
                 CONVERT a );
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator* ( CONVERT a, 
                 const VECTOR & v );
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator* ( const VECTOR& v, 
                 CONVERT a );
 
     EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,NegativeOp,Base> 
+    INLINE CONSTEXPR Vector<T,VECTOR,NegativeOp,Base> 
     operator- ( const VECTOR & v );
 
     // Inner product of two vector expressions implemented as operator|
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T operator| ( const VECTOR1 & v1, 
+    INLINE CONSTEXPR T operator| ( const VECTOR1 & v1, 
                          const VECTOR2 & v2 );
 
     // Inner product of two vector expressions implemented as operator*
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T operator* ( const VECTOR1 & v1, 
+    INLINE CONSTEXPR T operator* ( const VECTOR1 & v1, 
                          const VECTOR2 & v2);
 
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,PlusOp,MATRIX2> 
+    INLINE CONSTEXPR Matrix<T,MATRIX1,PlusOp,MATRIX2> 
     operator+ ( const MATRIX1 & m1, 
                 const MATRIX2 & m2 );
 
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,MinusOp,MATRIX2> 
+    INLINE CONSTEXPR Matrix<T,MATRIX1,MinusOp,MATRIX2> 
     operator- ( const MATRIX1 & m1, 
                 const MATRIX2 & m2 );
 
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,TimesOp,MATRIX2> 
+    INLINE CONSTEXPR Matrix<T,MATRIX1,TimesOp,MATRIX2> 
     operator* ( const MATRIX1 & m1, 
                 const MATRIX2 & m2);
 
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,MATRIX1,TimesOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,MATRIX1,TimesOp,VECTOR2> 
     operator* ( const MATRIX1 & m, 
                 const VECTOR2 & v );
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator* ( CONVERT a, 
                 const MATRIX & m);
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator* ( const MATRIX & m, 
                 CONVERT a );
 
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator/ ( const MATRIX & m, 
                 CONVERT a );
 
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,NegativeOp,Base> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,NegativeOp,Base> 
     operator- ( const MATRIX & m );
 
     // Matrix expression for the transpose of m
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TransposeOp,Base> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TransposeOp,Base> 
     Transpose ( const MATRIX & m );
 
     // Matrix expression for the dyadic matrix formed by v1 and v2
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,VECTOR1,DyadicOp,VECTOR2> 
+    INLINE CONSTEXPR Matrix<T,VECTOR1,DyadicOp,VECTOR2> 
     Dyadic ( const VECTOR1 & v1, 
              const VECTOR2 & v2 );
 
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,PlusOp,QUATERNION2> 
+    operator+ ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 );
+
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,MinusOp,QUATERNION2> 
+    operator- ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 );
+
+    // Quaternion expression for the (Hamilton) product of q1 and q2
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,TimesOp,QUATERNION2> 
+    operator* ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 );
+
+    // Vector expression for v rotated by the unit quaternion q
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Vector<T,QUATERNION1,TimesOp,VECTOR2> 
+    operator* ( const QUATERNION1 & q, 
+                const VECTOR2 & v );
+
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator* ( CONVERT a, 
+                const QUATERNION & q );
+
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator* ( const QUATERNION & q, 
+                CONVERT a );
+
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator/ ( const QUATERNION & q, 
+                CONVERT a );
+
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,NegativeOp,Base> 
+    operator- ( const QUATERNION & q );
+
+    // Inner product of two quaternion expressions
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR T operator| ( const QUATERNION1 & q1, 
+                         const QUATERNION2 & q2 );
+
+    // Quaternion expression for the conjugate of q (w,-x,-y,-z)
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,ConjugateOp,Base> 
+    Conjugate ( const QUATERNION & q );
+
+    // Compute the inverse of quaternion q
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<TT> Inverse( const QUATERNION & q );
+
+    // Rotation matrix of the unit quaternion q
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Matrix<TT> RotationMatrix ( const QUATERNION & q );
+
+    // Unit quaternion of the rotation matrix m
+    EXPRESSION_TEMPLATE 
+    INLINE Quaternion<TT> RotationQuaternion ( const MATRIX & m );
+
+    // Unit quaternion of the rotation around vector v by an angle v.nrm()
+    EXPRESSION_TEMPLATE 
+    INLINE Quaternion<TT> RodriguesQuaternion ( const VECTOR & v );
+
+    // Rotation vector of the unit quaternion q (inverse of RodriguesQuaternion)
+    EXPRESSION_TEMPLATE 
+    INLINE Vector<TT> RotationVector ( const QUATERNION & q );
+
+    // Normalized linear and spherical linear interpolation between
+    // unit quaternions q1 and q2, along the shortest arc
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE Quaternion<TT> nlerp ( const QUATERNION1 & q1, 
+                                  const QUATERNION2 & q2, 
+                                  T t );
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE Quaternion<TT> slerp ( const QUATERNION1 & q1, 
+                                  const QUATERNION2 & q2, 
+                                  T t );
+
     // Distance between two vectors
     EXPRESSION_TEMPLATE_PAIR 
     INLINE T dist( const VECTOR1 & v1, const VECTOR2 & v2 ); 
 
     // Squared distance between two vectors
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T dist2( const VECTOR1 & v1, 
+    INLINE CONSTEXPR T dist2( const VECTOR1 & v1, 
                     const VECTOR2 & v2 );
 
     // Distance between two vectors with the first one shifted by v3
@@ -532,7 +996,7 @@ namespace vecmat3 {
 
     // Compute the inverse of matrix m
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<TT> Inverse( const MATRIX & m );
+    INLINE CONSTEXPR Matrix<TT> Inverse( const MATRIX & m );
 
     // return the rotation matrix around vector v by an angle v.nrm()
     EXPRESSION_TEMPLATE 
@@ -543,6 +1007,8 @@ namespace vecmat3 {
     INLINE OSTREAM& operator<< ( OSTREAM & o, const VECTOR & v );
     EXPRESSION_TEMPLATE 
     INLINE OSTREAM& operator<< ( OSTREAM & o, const MATRIX & v);
+    EXPRESSION_TEMPLATE 
+    INLINE OSTREAM& operator<< ( OSTREAM & o, const QUATERNION & q);
 
     //
     // Convenient macros:
@@ -575,21 +1041,96 @@ namespace vecmat3 {
     // Auxiliary functions
     //
     template <typename T> 
-    INLINE T sqr(T x) 
+    INLINE CONSTEXPR T sqr(T x) 
     { 
         return x*x; 
     }
 
+    //
+    // Lane-wise helpers: written as selections rather than branches, so
+    // that element types other than scalars (e.g. the SIMD packs of
+    // vecmat3pack.h) can provide their own overloads.
+    //
+    template <typename T> 
+    INLINE T select(bool c, T a, T b) 
+    { 
+        return c?a:b; 
+    }
+
+    INLINE bool any(bool c) 
+    { 
+        return c; 
+    }
+
+    template <typename T> 
+    INLINE T absval(T x) 
+    { 
+        return x<0?-x:x; 
+    }
+
+    template <typename T> 
+    INLINE T maxval(T a, T b) 
+    { 
+        return a>b?a:b; 
+    }
+
+    //
+    // Multiply-add helpers, fused if VECMAT3_FMA is set: fmadd(a,b,c)
+    // is a*b+c, fmsub(a,b,c) is a*b-c, and fnmadd(a,b,c) is c-a*b.
+    // Without fusion, these round exactly like the plain expressions.
+    //
+    template <typename T> 
+    INLINE CONSTEXPR T fmadd(T a, T b, T c) 
+    { 
+        return a*b+c; 
+    }
+
+    template <typename T> 
+    INLINE CONSTEXPR T fmsub(T a, T b, T c) 
+    { 
+        return a*b-c; 
+    }
+
+    template <typename T> 
+    INLINE CONSTEXPR T fnmadd(T a, T b, T c) 
+    { 
+        return c-a*b; 
+    }
+
+    #if VECMAT3_FMA
+    // std::fma is not constexpr before C++23, so in constant expressions
+    // the unfused product is used instead, if the compiler can tell;
+    // otherwise the fused versions are not constexpr.
+    #if defined(__has_builtin)
+    # if __has_builtin(__builtin_is_constant_evaluated)
+    #   define VECMAT3_FMA_CONSTEXPR CONSTEXPR
+    #   define VECMAT3_FMA_OF(a,b,c) \
+          (__builtin_is_constant_evaluated() ? (a)*(b)+(c) : std::fma(a, b, c))
+    # endif
+    #endif
+    #if not defined(VECMAT3_FMA_OF)
+    # define VECMAT3_FMA_CONSTEXPR
+    # define VECMAT3_FMA_OF(a,b,c) std::fma(a, b, c)
+    #endif
+    #define VECMAT3_FUSED(T)                                                              \
+    INLINE VECMAT3_FMA_CONSTEXPR T fmadd(T a, T b, T c)  { return VECMAT3_FMA_OF(a, b, c); }  \
+    INLINE VECMAT3_FMA_CONSTEXPR T fmsub(T a, T b, T c)  { return VECMAT3_FMA_OF(a, b, -c); } \
+    INLINE VECMAT3_FMA_CONSTEXPR T fnmadd(T a, T b, T c) { return VECMAT3_FMA_OF(-a, b, c); }
+    VECMAT3_FUSED(float)
+    VECMAT3_FUSED(double)
+    VECMAT3_FUSED(long double)
+    #undef VECMAT3_FUSED
+    #undef VECMAT3_FMA_OF
+    #undef VECMAT3_FMA_CONSTEXPR
+    #endif
+
     template <typename T> 
     INLINE T absmax(const T* begin, const T* last) 
     {
         const T* p = begin;
-        T max = (*p)<0?-(*p):(*p);
-        for (++p; p<=last; ++p) {
-            T absval = (*p)<0?-(*p):(*p);
-            if (absval > max) 
-            max = absval;
-        }     
+        T max = absval(*p);
+        for (++p; p<=last; ++p) 
+            max = maxval(absval(*p), max);
         return max;
     }
 
@@ -597,14 +1138,14 @@ namespace vecmat3 {
     // Constructors
     //
     template <typename T> 
-    INLINE Vector<TT>::Vector(T x_, T y_, T z_) : 
+    INLINE CONSTEXPR Vector<TT>::Vector(T x_, T y_, T z_) : 
       x(x_), y(y_), z(z_) 
     {}
 
     template <typename T> 
     EXPRESSION_TEMPLATE_MEMBER 
-    INLINE Vector<TT>::Vector(const VECTOR& v) :
-      x(v.template eval<0>()), y(v.template eval<1>()), z(v.template eval<2>())
+    INLINE CONSTEXPR Vector<TT>::Vector(const VECTOR& v) :
+      x(prepared(v).template eval<0>()), y(v.template eval<1>()), z(v.template eval<2>())
     {}
 
     //
@@ -649,19 +1190,19 @@ namespace vecmat3 {
     // Evaluate elements (basis of the template evaluations technique)
     template <typename T> 
      template <int I> 
-    INLINE T Vector<TT>::eval() const 
+    INLINE CONSTEXPR T Vector<TT>::eval( std::size_t ) const 
     { 
         switch(I) {
         case 0: return x; 
         case 1: return y; 
         case 2: return z; 
-        default: return 0;
+        default: return T(0);
         }
     }
 
     // Norm squared
     template <typename T> 
-    INLINE T Vector<TT>::nrm2() const 
+    INLINE CONSTEXPR T Vector<TT>::nrm2() const 
     {
         return x*x+y*y+z*z;
     }
@@ -671,12 +1212,10 @@ namespace vecmat3 {
     INLINE T Vector<TT>::nrm() const 
     {
         T max = absmax(&x,&z);
-        if (max != 0)
-            return max*(T)(sqrt(sqr(x/max)
-                                +sqr(y/max)
-                                +sqr(z/max)));
-        else
-            return 0;
+        T div = select(max != 0, max, T(1));  // all elements are zero if max is
+        return max*(T)(sqrt(sqr(x/div)
+                            +sqr(y/div)
+                            +sqr(z/div)));
     }
 
     //                                           
@@ -687,7 +1226,7 @@ namespace vecmat3 {
     // Constructors
     //
     template <typename T> 
-    INLINE Matrix<TT>::Matrix( T a, T b, T c,
+    INLINE CONSTEXPR Matrix<TT>::Matrix( T a, T b, T c,
                                T d, T e, T f,
                                T g, T h, T i ) :
       xx(a), xy(b), xz(c),
@@ -696,8 +1235,8 @@ namespace vecmat3 {
     {}
     template <typename T> 
     EXPRESSION_TEMPLATE_MEMBER 
-    INLINE Matrix<TT>::Matrix( const MATRIX & m ) :
-      xx(m.template eval<0,0>()), xy(m.template eval<0,1>()), xz(m.template eval<0,2>()),
+    INLINE CONSTEXPR Matrix<TT>::Matrix( const MATRIX & m ) :
+      xx(prepared(m).template eval<0,0>()), xy(m.template eval<0,1>()), xz(m.template eval<0,2>()),
       yx(m.template eval<1,0>()), yy(m.template eval<1,1>()), yz(m.template eval<1,2>()),
       zx(m.template eval<2,0>()), zy(m.template eval<2,1>()), zz(m.template eval<2,2>())
     {}
@@ -724,6 +1263,7 @@ namespace vecmat3 {
     INLINE void Matrix<TT>::setRow( const int i, 
                                     const VECTOR & v ) 
     {
+        prepared(v);
         switch(i) {
         case 0: xx = v.template eval<0>(); xy = v.template eval<1>(); xz = v.template eval<2>(); break;
         case 1: yx = v.template eval<0>(); yy = v.template eval<1>(); yz = v.template eval<2>(); break;
@@ -738,6 +1278,7 @@ namespace vecmat3 {
     INLINE void Matrix<TT>::setColumn( const int j, 
                                        const VECTOR & v ) 
     {
+        prepared(v);
         switch(j) {
         case 0: 
             xx = v.template eval<0>(); 
@@ -778,48 +1319,50 @@ namespace vecmat3 {
     // Passive access to the elements through eval function
     template <typename T> 
     template <int I, int J> 
-    INLINE T Matrix<TT>::eval() const 
+    INLINE CONSTEXPR T Matrix<TT>::eval( std::size_t ) const 
     {
         switch (I) { 
         case 0: switch (J) { 
             case 0: return xx; 
             case 1: return xy; 
             case 2: return xz; 
-            default: return 0; 
+            default: return T(0); 
             } 
         case 1: switch (J) { 
             case 0: return yx; 
             case 1: return yy; 
             case 2: return yz; 
-            default: return 0; 
+            default: return T(0); 
             } 
         case 2: switch (J) { 
             case 0: return zx; 
             case 1: return zy; 
             case 2: return zz; 
-            default: return 0; 
+            default: return T(0); 
             } 
-        default: return 0;
+        default: return T(0);
         }
     }
 
     // Trace
     template <typename T> 
-    INLINE T Matrix<TT>::tr() const 
+    INLINE CONSTEXPR T Matrix<TT>::tr() const 
     { 
         return xx + yy + zz; 
     }
 
     // Determinant
     template <typename T> 
-    INLINE T Matrix<TT>::det() const 
+    INLINE CONSTEXPR T Matrix<TT>::det() const 
     {
-        return xx*(yy*zz-yz*zy)+xy*(yz*zx-yx*zz)+xz*(yx*zy-yy*zx);
+        return fmadd(xz, fmsub(yx,zy, yy*zx),
+                     fmadd(xy, fmsub(yz,zx, yx*zz),
+                           xx*fmsub(yy,zz, yz*zy)));
     }
 
     // Norm squared
     template <typename T> 
-    INLINE T Matrix<TT>::nrm2() const 
+    INLINE CONSTEXPR T Matrix<TT>::nrm2() const 
     { 
         return sqr(xx) + sqr(xy) + sqr(xz) + sqr(yx) + sqr(yy) 
              + sqr(yz) + sqr(zx) + sqr(zy) + sqr(zz); 
@@ -830,61 +1373,173 @@ namespace vecmat3 {
     INLINE T Matrix<TT>::nrm() const 
     {
         T max = absmax(&xx,&zz);
-        if (max!= 0) 
-            return max*(T)(sqrt(sqr(xx/max)+sqr(xy/max)+sqr(xz/max)
-                               +sqr(yx/max)+sqr(yy/max)+sqr(yz/max)
-                               +sqr(zx/max)+sqr(zy/max)+sqr(zz/max)
-                                ));
-        else 
-            return 0;
+        T div = select(max != 0, max, T(1));
+        return max*(T)(sqrt(sqr(xx/div)+sqr(xy/div)+sqr(xz/div)
+                           +sqr(yx/div)+sqr(yy/div)+sqr(yz/div)
+                           +sqr(zx/div)+sqr(zy/div)+sqr(zz/div)
+                            ));
     } 
 
+    //                                           
+    // Member functions of the basic Quaternion type: 
+    //                                           
+
     //
-    // Member functions of Vector and Matrix:
+    // Constructors
     //
+    template <typename T> 
+    INLINE CONSTEXPR Quaternion<TT>::Quaternion(T w_, T x_, T y_, T z_) : 
+      w(w_), x(x_), y(y_), z(z_) 
+    {}
 
-    // Define generic members functions of Vector and Matrix
+    template <typename T> 
+    EXPRESSION_TEMPLATE_MEMBER 
+    INLINE CONSTEXPR Quaternion<TT>::Quaternion(const QUATERNION& q) :
+      w(prepared(q).template eval<0>()), x(q.template eval<1>()), 
+      y(q.template eval<2>()), z(q.template eval<3>())
+    {}
 
-    // To access the elements of a vector expression:
-    #define VECPARENTHESES					\
-        INLINE T operator()(int i) const {			\
-            switch(i){						\
-            case 0: return eval<0>();                           \
-            case 1: return eval<1>();                           \
-            case 2: return eval<2>();                           \
-            default: return 0;                                  \
-            }							\
-        }                                                       \
-        INLINE T operator[](int i) const {			\
-            switch(i){						\
-            case 0: return eval<0>();                           \
-            case 1: return eval<1>();                           \
-            case 2: return eval<2>();                           \
-            default: return 0;                                  \
-            }							\
-        }
-    
-    // To access the elements of a matrix expression
-    #define MATPARENTHESES                                      \
-        INLINE T operator()(int i, int j) const {               \
-            switch(i){                                          \
-            case 0: switch(j){                                  \
-                case 0: return eval<0,0>();                     \
-                case 1: return eval<0,1>();                     \
-                case 2: return eval<0,2>();                     \
-                default: return 0;                              \
-                }                                               \
-            case 1: switch(j){                                  \
-                case 0: return eval<1,0>();                     \
-                case 1: return eval<1,1>();			\
+    // From a scalar and a vector part
+    template <typename T> 
+    EXPRESSION_TEMPLATE_MEMBER 
+    INLINE CONSTEXPR Quaternion<TT>::Quaternion(T w_, const VECTOR& v) :
+      w(w_), x(prepared(v).template eval<0>()), y(v.template eval<1>()), z(v.template eval<2>())
+    {}
+
+    // Set all elements to zero
+    template <typename T> 
+    INLINE void Quaternion<TT>::zero() 
+    {
+        w = x = y = z = 0;
+    }
+
+    // Set to one, i.e., to the identity rotation
+    template <typename T> 
+    INLINE void Quaternion<TT>::one() 
+    {
+        w = 1;
+        x = y = z = 0;
+    }
+
+    // Divide by the norm
+    template <typename T> 
+    INLINE void Quaternion<TT>::normalize() 
+    {
+        T inrm = 1/nrm();
+        w *= inrm;
+        x *= inrm;
+        y *= inrm;
+        z *= inrm;
+    }
+
+    // Access to elements through parentheses for assignment 
+    template <typename T>
+    INLINE T & Quaternion<TT>::operator() ( const int i ) 
+    { 
+        return *(&w+i);
+    }
+
+    // Passive access to elements through parentheses 
+    template <typename T> 
+    INLINE const T& Quaternion<TT>::operator() ( const int i ) const 
+    { 
+        return *(&w+i);
+    }
+
+    // Square bracket access, q[0]=q.w, q[1]=q.x, q[2]=q.y, q[3]=q.z
+    template <typename T> 
+    INLINE T & Quaternion<TT>::operator[] ( const int i ) 
+    { 
+        return *(&w+i);
+    }
+    template <typename T> 
+    INLINE const T & Quaternion<TT>::operator[] ( const int i ) const 
+    { 
+        return *(&w+i);
+    }
+
+    // Evaluate elements
+    template <typename T> 
+     template <int I> 
+    INLINE CONSTEXPR T Quaternion<TT>::eval( std::size_t ) const 
+    { 
+        switch(I) {
+        case 0: return w; 
+        case 1: return x; 
+        case 2: return y; 
+        case 3: return z; 
+        default: return T(0);
+        }
+    }
+
+    // Norm squared
+    template <typename T> 
+    INLINE CONSTEXPR T Quaternion<TT>::nrm2() const 
+    {
+        return w*w+x*x+y*y+z*z;
+    }
+
+    // Norm
+    template <typename T> 
+    INLINE T Quaternion<TT>::nrm() const 
+    {
+        T max = absmax(&w,&z);
+        T div = select(max != 0, max, T(1));
+        return max*(T)(sqrt(sqr(w/div)
+                            +sqr(x/div)
+                            +sqr(y/div)
+                            +sqr(z/div)));
+    }
+
+    //
+    // Member functions of Vector and Matrix:
+    //
+
+    // Define generic members functions of Vector and Matrix
+
+    // To access the elements of a vector expression:
+    #define VECPARENTHESES					\
+        INLINE CONSTEXPR T operator()(int i) const {            \
+            prepared(*this);                                    \
+            switch(i){						\
+            case 0: return eval<0>();                           \
+            case 1: return eval<1>();                           \
+            case 2: return eval<2>();                           \
+            default: return T(0);                                  \
+            }							\
+        }                                                       \
+        INLINE CONSTEXPR T operator[](int i) const {            \
+            prepared(*this);                                    \
+            switch(i){						\
+            case 0: return eval<0>();                           \
+            case 1: return eval<1>();                           \
+            case 2: return eval<2>();                           \
+            default: return T(0);                                  \
+            }							\
+        }
+    
+    // To access the elements of a matrix expression
+    #define MATPARENTHESES                                      \
+        INLINE CONSTEXPR T operator()(int i, int j) const {     \
+            prepared(*this);                                    \
+            switch(i){                                          \
+            case 0: switch(j){                                  \
+                case 0: return eval<0,0>();                     \
+                case 1: return eval<0,1>();                     \
+                case 2: return eval<0,2>();                     \
+                default: return T(0);                              \
+                }                                               \
+            case 1: switch(j){                                  \
+                case 0: return eval<1,0>();                     \
+                case 1: return eval<1,1>();			\
                 case 2: return eval<1,2>();			\
-                default: return 0;                              \
+                default: return T(0);                              \
                 }                                               \
             case 2: switch(j){                                  \
                 case 0: return eval<2,0>();			\
                 case 1: return eval<2,1>();			\
                 case 2: return eval<2,2>();			\
-                default: return 0;				\
+                default: return T(0);				\
                 }                                               \
             default:                                            \
                 return 0;					\
@@ -894,46 +1549,46 @@ namespace vecmat3 {
     // To get the norm of a vector
     #define VECNRM						\
         INLINE T nrm() const {					\
+            prepared(*this);                                    \
             T x[3] = {eval<0>(), eval<1>(), eval<2>()};		\
             T max = absmax(x,x+2);				\
-            if (max!= 0)                                        \
-                return max*(T)(sqrt(sqr(x[0]/max)               \
-                                    +sqr(x[1]/max)              \
-                                    +sqr(x[2]/max)));		\
-            else                                                \
-                return 0;                                       \
+            T div = select(max != 0, max, T(1));                \
+            return max*(T)(sqrt(sqr(x[0]/div)                   \
+                                +sqr(x[1]/div)                  \
+                                +sqr(x[2]/div)));               \
         }
    
     // To get the norm of a matrix
     #define MATNRM						\
         INLINE T nrm() const {                                  \
+            prepared(*this);                                    \
             T x[9] = {eval<0,0>(), eval<0,1>(), eval<0,2>(),	\
                       eval<1,0>(), eval<1,1>(), eval<1,2>(),	\
                       eval<2,0>(), eval<2,1>(), eval<2,2>()};	\
             T max = absmax(x,x+8);                              \
-            if (max!= 0)                                        \
-                return max*(T)(sqrt(sqr(x[0]/max)               \
-                                    +sqr(x[1]/max)              \
-                                    +sqr(x[2]/max)              \
-                                    +sqr(x[3]/max)              \
-                                    +sqr(x[4]/max)              \
-                                    +sqr(x[5]/max)              \
-                                    +sqr(x[6]/max)              \
-                                    +sqr(x[7]/max)              \
-                                    +sqr(x[8]/max)));		\
-            else                                                \
-                return 0;                                       \
+            T div = select(max != 0, max, T(1));                \
+            return max*(T)(sqrt(sqr(x[0]/div)                   \
+                                +sqr(x[1]/div)                  \
+                                +sqr(x[2]/div)                  \
+                                +sqr(x[3]/div)                  \
+                                +sqr(x[4]/div)                  \
+                                +sqr(x[5]/div)                  \
+                                +sqr(x[6]/div)                  \
+                                +sqr(x[7]/div)                  \
+                                +sqr(x[8]/div)));               \
         } 
 
     // To get the norm squared of a vector expression
     #define VECNRM2                                             \
-        INLINE T nrm2() const {                                 \
+        INLINE CONSTEXPR T nrm2() const {                       \
+            prepared(*this);                                    \
             return sqr(eval<0>())+sqr(eval<1>())+sqr(eval<2>());\
         }
 
     // To get the norm squared of a matrix expression
     #define MATNRM2                                                   \
-        INLINE T nrm2() const {   	                              \
+        INLINE CONSTEXPR T nrm2() const {                             \
+            prepared(*this);                                          \
             return sqr(eval<0,0>())+sqr(eval<0,1>())+sqr(eval<0,2>()) \
                   +sqr(eval<1,0>())+sqr(eval<1,1>())+sqr(eval<1,2>()) \
                   +sqr(eval<2,0>())+sqr(eval<2,1>())+sqr(eval<2,2>());\
@@ -941,18 +1596,21 @@ namespace vecmat3 {
     
     // To get the trace of a matrix expression
     #define MATTR                                               \
-        INLINE T tr() const {					\
+        INLINE CONSTEXPR T tr() const {                         \
+            prepared(*this);                                    \
             return eval<0,0>() + eval<1,1>() + eval<2,2>();	\
         }
 
     // To get the determinant of a matrix expression
     #define MATDET                                              \
-        INLINE T det() const {                                  \
+        INLINE CONSTEXPR T det() const {                        \
+            prepared(*this);                                    \
             T xx=eval<0,0>(), xy=eval<0,1>(), xz=eval<0,2>();	\
             T yx=eval<1,0>(), yy=eval<1,1>(), yz=eval<1,2>();	\
             T zx=eval<2,0>(), zy=eval<2,1>(), zz=eval<2,2>();	\
-            return                                              \
-            xx*(yy*zz-yz*zy)+xy*(yz*zx-yx*zz)+xz*(yx*zy-yy*zx);	\
+            return fmadd(xz, fmsub(yx,zy, yy*zx),               \
+                         fmadd(xy, fmsub(yz,zx, yx*zz),         \
+                               xx*fmsub(yy,zz, yz*zy)));        \
         }
     
     // To get the i-th row of a matrix expression
@@ -967,10 +1625,418 @@ namespace vecmat3 {
             return Vector<T,CLASS,ColOp,Base>(*this, j);        \
         }
 
+    // To access the elements of a quaternion expression
+    #define QUATPARENTHESES                                     \
+        INLINE CONSTEXPR T operator()(int i) const {            \
+            prepared(*this);                                    \
+            switch(i){						\
+            case 0: return eval<0>();                           \
+            case 1: return eval<1>();                           \
+            case 2: return eval<2>();                           \
+            case 3: return eval<3>();                           \
+            default: return T(0);                                  \
+            }							\
+        }                                                       \
+        INLINE CONSTEXPR T operator[](int i) const {            \
+            return operator()(i);                               \
+        }
+
+    // To get the norm squared of a quaternion expression
+    #define QUATNRM2                                            \
+        INLINE CONSTEXPR T nrm2() const {                       \
+            prepared(*this);                                    \
+            return sqr(eval<0>())+sqr(eval<1>())                \
+                  +sqr(eval<2>())+sqr(eval<3>());               \
+        }
+
+    // To get the norm of a quaternion expression
+    #define QUATNRM                                             \
+        INLINE T nrm() const {					\
+            prepared(*this);                                    \
+            T x[4] = {eval<0>(), eval<1>(), eval<2>(), eval<3>()};\
+            T max = absmax(x,x+3);				\
+            T div = select(max != 0, max, T(1));                \
+            return max*(T)(sqrt(sqr(x[0]/div)                   \
+                                +sqr(x[1]/div)                  \
+                                +sqr(x[2]/div)                  \
+                                +sqr(x[3]/div)));               \
+        }
+
     #define VECDEFS VECNRM2 VECNRM VECPARENTHESES
     #define MATDEFS MATNRM2 MATNRM MATPARENTHESES MATDET \
                     MATTR MATROW MATCOLUMN
- 
+    #define QUATDEFS QUATNRM2 QUATNRM QUATPARENTHESES
+
+    //
+    // Compile-time cost model: Cost<E>::value estimates the number of
+    // floating point operations needed to evaluate one element of the
+    // expression E, and Cost<E>::array tells whether that element
+    // depends on the array index n. Each expression template class
+    // below specializes Cost; any other class is treated as an array
+    // expression, so that it is never materialized.
+    //
+    template <typename E>
+    struct Cost
+    {
+        static const int  value = 0;
+        static const bool array = true;
+    };
+
+    template <typename T>
+    struct Cost< Vector<TT> >
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct Cost< Matrix<TT> >
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct Cost< Quaternion<TT> >
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    //
+    // DirectAssign<E>::value tells whether E can be assigned by storing
+    // each of its elements straight into the destination, even if the
+    // destination occurs in E. That holds if element I of E depends only
+    // on element I of its operands, or if E only reads operands that it
+    // has materialized. Otherwise, assignment first evaluates all
+    // elements into temporaries.
+    //
+    template <typename E>
+    struct DirectAssign
+    {
+        static const bool value = false;
+    };
+
+    template <typename T>
+    struct DirectAssign< Vector<TT> >
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct DirectAssign< Matrix<TT> >
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct DirectAssign< Quaternion<TT> >
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct DirectAssign< Vector<T,Base,ArrayOp,Base> >
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct DirectAssign< Matrix<T,Base,ArrayOp,Base> >
+    {
+        static const bool value = true;
+    };
+
+    //
+    // Materialized<E>::type is the default class that holds the value
+    // of an expression E, and store(m,e) evaluates a prepared e into m.
+    //
+    template <typename E> struct Materialized;
+
+    EXPRESSION_TEMPLATE
+    struct Materialized< VECTOR >
+    {
+        typedef Vector<TT> type;
+        static INLINE CONSTEXPR void store(type& m, const VECTOR& e)
+        {
+            m.x = e.template eval<0>();
+            m.y = e.template eval<1>();
+            m.z = e.template eval<2>();
+        }
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Materialized< MATRIX >
+    {
+        typedef Matrix<TT> type;
+        static INLINE CONSTEXPR void store(type& m, const MATRIX& e)
+        {
+            m.xx = e.template eval<0,0>();
+            m.xy = e.template eval<0,1>();
+            m.xz = e.template eval<0,2>();
+            m.yx = e.template eval<1,0>();
+            m.yy = e.template eval<1,1>();
+            m.yz = e.template eval<1,2>();
+            m.zx = e.template eval<2,0>();
+            m.zy = e.template eval<2,1>();
+            m.zz = e.template eval<2,2>();
+        }
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Materialized< QUATERNION >
+    {
+        typedef Quaternion<TT> type;
+        static INLINE CONSTEXPR void store(type& m, const QUATERNION& e)
+        {
+            m.w = e.template eval<0>();
+            m.x = e.template eval<1>();
+            m.y = e.template eval<2>();
+            m.z = e.template eval<3>();
+        }
+    };
+
+    //
+    // HoldByValue<E>::value tells whether an expression holds a copy of
+    // its operand E rather than a pointer to it. Expression template
+    // classes are small and are held by value, so that an expression can
+    // be stored (e.g. with 'auto') or returned from a function, and be
+    // evaluated later, or repeatedly. Arrays are always held by pointer.
+    // Vector<TT>, Matrix<TT> and Quaternion<TT> are held by pointer, so
+    // that a stored expression sees their current values, unless
+    // VECMAT3_CAPTURE_LEAVES is defined, in which case expressions are
+    // fully self-contained.
+    //
+    struct CaptureLeaves
+    {
+      #ifdef VECMAT3_CAPTURE_LEAVES
+        static const bool value = true;
+      #else
+        static const bool value = false;
+      #endif
+    };
+
+    template <typename E>
+    struct HoldByValue
+    {
+        static const bool value = true;
+    };
+
+    template <typename T> struct HoldByValue< Vector<TT> >     : CaptureLeaves {};
+    template <typename T> struct HoldByValue< Matrix<TT> >     : CaptureLeaves {};
+    template <typename T> struct HoldByValue< Quaternion<TT> > : CaptureLeaves {};
+
+    template <typename T>
+    struct HoldByValue< Vector<T,Base,ArrayOp,Base> >
+    {
+        static const bool value = false;
+    };
+
+    template <typename T>
+    struct HoldByValue< Matrix<T,Base,ArrayOp,Base> >
+    {
+        static const bool value = false;
+    };
+
+    //
+    // Fused<E>::value tells whether E is a product that can add its
+    // elements to a value c with fused multiply-adds, through the
+    // members evalAdd (c+element) and evalSub (c-element). This is so
+    // when VECMAT3_FMA is set, for the products of a vector or matrix
+    // with a scalar, of two matrices, of a matrix and a vector, and for
+    // Dyadic. The '+' and '-' expressions use Accumulate<E> to combine
+    // an operand E with the value of the other operand.
+    //
+    template <typename E>
+    struct Fused
+    {
+        static const bool value = false;
+    };
+
+    template <typename E, bool FUSED = Fused<E>::value>
+    struct Accumulate
+    {
+        template <int I, typename T>
+        static INLINE CONSTEXPR T add(const E& e, T c, std::size_t n) { return c + e.template eval<I>(n); }
+        template <int I, typename T>
+        static INLINE CONSTEXPR T sub(const E& e, T c, std::size_t n) { return c - e.template eval<I>(n); }
+        template <int I, int J, typename T>
+        static INLINE CONSTEXPR T add(const E& e, T c, std::size_t n) { return c + e.template eval<I,J>(n); }
+        template <int I, int J, typename T>
+        static INLINE CONSTEXPR T sub(const E& e, T c, std::size_t n) { return c - e.template eval<I,J>(n); }
+    };
+
+    template <typename E>
+    struct Accumulate<E,true>
+    {
+        template <int I, typename T>
+        static INLINE CONSTEXPR T add(const E& e, T c, std::size_t n) { return e.template evalAdd<I>(c, n); }
+        template <int I, typename T>
+        static INLINE CONSTEXPR T sub(const E& e, T c, std::size_t n) { return e.template evalSub<I>(c, n); }
+        template <int I, int J, typename T>
+        static INLINE CONSTEXPR T add(const E& e, T c, std::size_t n) { return e.template evalAdd<I,J>(c, n); }
+        template <int I, int J, typename T>
+        static INLINE CONSTEXPR T sub(const E& e, T c, std::size_t n) { return e.template evalSub<I,J>(c, n); }
+    };
+
+    //
+    // Zeros<E>::value marks the elements of a matrix expression E that
+    // are zero by construction, such as the off-diagonal elements of
+    // Identity and Diagonal: bit 3*I+J is set if element (I,J) is
+    // always zero, and Zero<E,I,J>::value tells the same for a single
+    // element. Matrix products use this to leave out terms with a zero
+    // factor, through Dot3.
+    //
+    template <typename E>
+    struct Zeros
+    {
+        static const int value = 0;
+    };
+
+    template <typename E, int I, int J>
+    struct Zero
+    {
+        static const bool value = ((Zeros<E>::value >> (3*I+J)) & 1) != 0;
+    };
+
+    // A term a*b added to or subtracted from c, unless the term is ZERO
+    template <bool ZERO>
+    struct Term
+    {
+        template <typename T>
+        static INLINE CONSTEXPR T add(T a, T b, T c) { return fmadd(a, b, c); }
+        template <typename T>
+        static INLINE CONSTEXPR T sub(T a, T b, T c) { return fnmadd(a, b, c); }
+    };
+
+    template <>
+    struct Term<true>
+    {
+        template <typename T>
+        static INLINE CONSTEXPR T add(T, T, T c) { return c; }
+        template <typename T>
+        static INLINE CONSTEXPR T sub(T, T, T c) { return c; }
+    };
+
+    //
+    // Dot3<Z0,Z1,Z2> evaluates a0*b0+a1*b1+a2*b2 without the terms k
+    // for which Zk is set; 'zero' tells whether all terms are left out.
+    // Without zeros, this is fmadd(a2,b2,fmadd(a1,b1,a0*b0)), as in the
+    // matrix products. RowColumn<L,R,I,J> is the Dot3 for row I of L
+    // times column J of R, RowVector<L,I> that for row I of L times a
+    // vector.
+    //
+    template <bool Z0, bool Z1, bool Z2>
+    struct Dot3
+    {
+        static const bool zero = Z0 && Z1 && Z2;
+        template <typename T>
+        static INLINE CONSTEXPR T eval(T a0, T b0, T a1, T b1, T a2, T b2)
+        {
+            return Z0 ? (Z1 ? (Z2 ? T(0) : a2*b2)
+                            : Term<Z2>::add(a2, b2, a1*b1))
+                      : Term<Z2>::add(a2, b2, Term<Z1>::add(a1, b1, a0*b0));
+        }
+        template <typename T>
+        static INLINE CONSTEXPR T add(T c, T a0, T b0, T a1, T b1, T a2, T b2)
+        {
+            return Term<Z2>::add(a2, b2, Term<Z1>::add(a1, b1, Term<Z0>::add(a0, b0, c)));
+        }
+        template <typename T>
+        static INLINE CONSTEXPR T sub(T c, T a0, T b0, T a1, T b1, T a2, T b2)
+        {
+            return Term<Z2>::sub(a2, b2, Term<Z1>::sub(a1, b1, Term<Z0>::sub(a0, b0, c)));
+        }
+    };
+
+    template <typename L, typename R, int I, int J>
+    struct RowColumn : Dot3<Zero<L,I,0>::value || Zero<R,0,J>::value,
+                            Zero<L,I,1>::value || Zero<R,1,J>::value,
+                            Zero<L,I,2>::value || Zero<R,2,J>::value>
+    {};
+
+    template <typename L, int I>
+    struct RowVector : Dot3<Zero<L,I,0>::value, Zero<L,I,1>::value, Zero<L,I,2>::value>
+    {};
+
+    //
+    // Operand<E,USES,LOOP> is how an expression template class holds a
+    // sub-expression E of which it evaluates each element USES times.
+    // LOOP is set if a sibling operand is an array, so that E will be
+    // evaluated again for every array element. Normally E is held as a
+    // pointer or a copy, according to HoldByValue, but if E does not
+    // depend on the array index and re-evaluating it would cost at least
+    // VECMAT3_MATERIALIZE_COST operations per element, E is held as a
+    // copy together with a Vector<TT>, Matrix<TT> or Quaternion<TT> into
+    // which prepare() evaluates E. Either way, elements are obtained
+    // through '->', 'cost' is the resulting cost of evaluating one
+    // element of the operand, and 'direct' tells whether the operand
+    // allows direct assignment (see DirectAssign). The type of the
+    // expression that is held is 'type', and '*' gives access to it as
+    // a whole. Because prepare() is called each time the expression is
+    // evaluated (see prepared), a stored expression always uses the
+    // current values of its leaves; it should not be evaluated by
+    // several threads at the same time, though.
+    //
+    template <typename E, int USES, bool LOOP=false,
+              bool STORE = (VECMAT3_MATERIALIZE_COST > 0 && !Cost<E>::array
+                            && (LOOP ? Cost<E>::value > 0
+                                : (USES-1)*Cost<E>::value >= VECMAT3_MATERIALIZE_COST)),
+              bool COPY = HoldByValue<E>::value>
+    class Operand
+    {
+      public:
+        static const int  cost = Cost<E>::value;
+        static const bool materialized = false;
+        static const bool direct = DirectAssign<E>::value;
+        typedef E type;
+        INLINE CONSTEXPR Operand(const E& e) : p(&e) {}
+        INLINE CONSTEXPR const E* operator->() const { return p; }
+        INLINE CONSTEXPR const E& operator*() const { return *p; }
+        INLINE CONSTEXPR void prepare() const { prepared(*p); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return hasSize(*p, num); }
+      private:
+        const E* p;
+    };
+
+    template <typename E, int USES, bool LOOP>
+    class Operand<E,USES,LOOP,false,true>
+    {
+      public:
+        static const int  cost = Cost<E>::value;
+        static const bool materialized = false;
+        static const bool direct = DirectAssign<E>::value;
+        typedef E type;
+        INLINE CONSTEXPR Operand(const E& e) : c(e) {}
+        INLINE CONSTEXPR const E* operator->() const { return &c; }
+        INLINE CONSTEXPR const E& operator*() const { return c; }
+        INLINE CONSTEXPR void prepare() const { prepared(c); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return hasSize(c, num); }
+      private:
+        E c;
+    };
+
+    template <typename E, int USES, bool LOOP, bool COPY>
+    class Operand<E,USES,LOOP,true,COPY>
+    {
+      public:
+        static const int  cost = 0;
+        static const bool materialized = true;
+        static const bool direct = true;
+        typedef typename Materialized<E>::type type;
+        INLINE CONSTEXPR Operand(const E& e) : c(e), m(0) {}
+        INLINE CONSTEXPR const type* operator->() const { return &m; }
+        INLINE CONSTEXPR const type& operator*() const { return m; }
+        INLINE CONSTEXPR void prepare() const 
+        {
+            Materialized<E>::store(m, prepared(c));
+        }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return hasSize(c, num); }
+      private:
+        E c;
+        mutable typename Materialized<E>::type m;
+    };
+
     // Expression template class for '+'  between two Vector expressions
 
     #define CLASS Vector<T,VECTOR1,PlusOp,VECTOR2> 
@@ -979,22 +2045,46 @@ namespace vecmat3 {
     {
       public:
         VECDEFS
-        template <int I> INLINE T eval() const;
-        INLINE Vector ( const VECTOR1 & left, 
+        typedef Operand<VECTOR1,1,Cost<VECTOR2>::array> Left;
+        typedef Operand<VECTOR2,1,Cost<VECTOR1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector ( const VECTOR1 & left, 
                         const VECTOR2 & right ) : 
-          l(&left), 
-          r(&right)
+          l(left), 
+          r(right)
         {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
       private:
-        const VECTOR1* l;  
-        const VECTOR2* r;
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<VECTOR1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
     template <int I> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     { 
-        return l->template eval<I>() + r->template eval<I>(); 
+        typedef typename Left::type  L;
+        typedef typename Right::type R;
+        if (Fused<R>::value)
+            return Accumulate<R>::template add<I>(*r, l->template eval<I>(n), n);
+        else if (Fused<L>::value)
+            return Accumulate<L>::template add<I>(*l, r->template eval<I>(n), n);
+        else
+            return l->template eval<I>(n) + r->template eval<I>(n); 
     }
 
     #undef CLASS
@@ -1007,18 +2097,42 @@ namespace vecmat3 {
     {
       public:
         VECDEFS
-        template <int I> INLINE T eval() const;
-        INLINE Vector(const VECTOR1& left, const VECTOR2& right) : l(&left), r(&right) {}
+        typedef Operand<VECTOR1,1,Cost<VECTOR2>::array> Left;
+        typedef Operand<VECTOR2,1,Cost<VECTOR1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const VECTOR1& left, const VECTOR2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
       private:
-        const VECTOR1* l;
-        const VECTOR2* r;
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<VECTOR1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
     template <int I> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-        return l->template eval<I>() - r->template eval<I>(); 
+        typedef typename Left::type  L;
+        typedef typename Right::type R;
+        if (Fused<R>::value)
+            return Accumulate<R>::template sub<I>(*r, l->template eval<I>(n), n);
+        else if (Fused<L>::value)
+            return Accumulate<L>::template add<I>(*l, -r->template eval<I>(n), n);
+        else
+            return l->template eval<I>(n) - r->template eval<I>(n); 
     }
 
     #undef CLASS
@@ -1031,26 +2145,43 @@ namespace vecmat3 {
     {
       public:
        VECDEFS
-       template <int I> INLINE T eval() const;
-       INLINE Vector(const VECTOR1& left, const VECTOR2& right) : l(&left), r(&right) {}
+       typedef Operand<VECTOR1,2,Cost<VECTOR2>::array> Left;
+       typedef Operand<VECTOR2,2,Cost<VECTOR1>::array> Right;
+       template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+       INLINE CONSTEXPR Vector(const VECTOR1& left, const VECTOR2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
       private:
-       const VECTOR1* l;  // pointers to the sub-expressions
-       const VECTOR2* r;
+       Left  l;  // the sub-expressions, see Operand
+       Right r;
     };
 
-    EXPRESSION_TEMPLATE_PAIR 
-    template <int I> 
-    INLINE T CLASS::eval() const  
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
     {
-       switch (I) {
+        static const int  value = 2*CLASS::Left::cost + 2*CLASS::Right::cost + 3;
+        static const bool array = Cost<VECTOR1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const  
+    {
+       switch (I) {
           case 0:
-             return l->template eval<1>() * r->template eval<2>() - l->template eval<2>() * r->template eval<1>();
+             return l->template eval<1>(n) * r->template eval<2>(n) - l->template eval<2>(n) * r->template eval<1>(n);
              break;
           case 1:
-             return l->template eval<2>() * r->template eval<0>() - l->template eval<0>() * r->template eval<2>();
+             return l->template eval<2>(n) * r->template eval<0>(n) - l->template eval<0>(n) * r->template eval<2>(n);
              break;
           case 2:
-             return l->template eval<0>() * r->template eval<1>() - l->template eval<1>() * r->template eval<0>();
+             return l->template eval<0>(n) * r->template eval<1>(n) - l->template eval<1>(n) * r->template eval<0>(n);
              break;
           default: 
              return 0;
@@ -1068,7 +2199,9 @@ namespace vecmat3 {
     {
       public:
         VECDEFS
-        template <int I> INLINE T eval() const;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        template <int I> INLINE CONSTEXPR T evalAdd(T c, std::size_t n=0) const;
+        template <int I> INLINE CONSTEXPR T evalSub(T c, std::size_t n=0) const;
         CONVERTIBLE_TEMPLATE 
         INLINE Vector& operator*(CONVERT c)
         // optimize a second multiplication with T
@@ -1083,9 +2216,11 @@ namespace vecmat3 {
             r /= c;
             return *this;
         }
-        INLINE Vector(const VECTOR& left, T right) : l(&left), r(right) {}
+        INLINE CONSTEXPR Vector(const VECTOR& left, T right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
       private:
-        const VECTOR* l; 
+        Operand<VECTOR,1> l;  // the sub-expression, see Operand
         T r;
         // befriend operators that optimize further T multiplication
         CONVERTIBLE_ANOTHER_EXPRESSION_TEMPLATE  
@@ -1093,10 +2228,41 @@ namespace vecmat3 {
             operator*(CONVERT b, Vector<T,ANOTHER_VECTOR,TimesOp,T>& a);
     };
 
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<VECTOR>::value + 1;
+        static const bool array = Cost<VECTOR>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign<VECTOR>::value;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Fused<CLASS>
+    {
+        static const bool value = VECMAT3_FMA;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int I> INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        return l->template eval<I>(n) * r; 
+    }
+
+    EXPRESSION_TEMPLATE 
+    template <int I> INLINE CONSTEXPR T CLASS::evalAdd(T c, std::size_t n) const 
+    {
+        return fmadd(l->template eval<I>(n), r, c); 
+    }
+
     EXPRESSION_TEMPLATE 
-    template <int I> INLINE T CLASS::eval() const 
+    template <int I> INLINE CONSTEXPR T CLASS::evalSub(T c, std::size_t n) const 
     {
-        return l->template eval<I>() * r; 
+        return fnmadd(l->template eval<I>(n), r, c); 
     }
 
     #undef CLASS
@@ -1110,17 +2276,32 @@ namespace vecmat3 {
     {
       public:      
         VECDEFS
-        template <int I> INLINE T eval() const;
-        INLINE Vector(const VECTOR& left) : l(&left) {}
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const VECTOR& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
       private:
-        const VECTOR* l;
+        Operand<VECTOR,1> l;  // the sub-expression, see Operand
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<VECTOR>::value + 1;
+        static const bool array = Cost<VECTOR>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign<VECTOR>::value;
     };
 
     EXPRESSION_TEMPLATE 
     template <int I> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-        return - l->template eval<I>();
+        return - l->template eval<I>(n);
     }
 
     #undef CLASS
@@ -1134,18 +2315,48 @@ namespace vecmat3 {
     {
       public:
         MATDEFS
-        template <int I, int J> INLINE T eval() const;
-        INLINE Matrix(const MATRIX1& left, const MATRIX2& right) : l(&left), r(&right) {}
+        typedef Operand<MATRIX1,1,Cost<MATRIX2>::array> Left;
+        typedef Operand<MATRIX2,1,Cost<MATRIX1>::array> Right;
+        template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Matrix(const MATRIX1& left, const MATRIX2& right) : l(left), r(right) {}
+      INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+      INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
     private:
-       const MATRIX1* l;
-       const MATRIX2* r;
+       Left  l;  // the sub-expressions, see Operand
+       Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<MATRIX1>::array || Cost<MATRIX2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Zeros<CLASS>
+    {
+        static const int value = Zeros<MATRIX1>::value & Zeros<MATRIX2>::value;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
     template <int I,int J> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     { 
-       return l->template eval<I,J>() + r->template eval<I,J>(); 
+       typedef typename Left::type  L;
+       typedef typename Right::type R;
+       if (Fused<R>::value)
+          return Accumulate<R>::template add<I,J>(*r, l->template eval<I,J>(n), n);
+       else if (Fused<L>::value)
+          return Accumulate<L>::template add<I,J>(*l, r->template eval<I,J>(n), n);
+       else
+          return l->template eval<I,J>(n) + r->template eval<I,J>(n); 
     }
 
     #undef CLASS
@@ -1154,257 +2365,2618 @@ namespace vecmat3 {
 
     #define CLASS Matrix<T,MATRIX1,MinusOp,MATRIX2> 
 
-    EXPRESSION_TEMPLATE_PAIR 
-    class CLASS
+    EXPRESSION_TEMPLATE_PAIR 
+    class CLASS
+    {
+    public:
+       MATDEFS
+       typedef Operand<MATRIX1,1,Cost<MATRIX2>::array> Left;
+       typedef Operand<MATRIX2,1,Cost<MATRIX1>::array> Right;
+       template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+       INLINE CONSTEXPR Matrix(const MATRIX1& left, const MATRIX2& right): l(left), r(right) {}
+      INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+      INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+    private:
+       Left  l;  // the sub-expressions, see Operand
+       Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<MATRIX1>::array || Cost<MATRIX2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Zeros<CLASS>
+    {
+        static const int value = Zeros<MATRIX1>::value & Zeros<MATRIX2>::value;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I,int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    { 
+       typedef typename Left::type  L;
+       typedef typename Right::type R;
+       if (Fused<R>::value)
+          return Accumulate<R>::template sub<I,J>(*r, l->template eval<I,J>(n), n);
+       else if (Fused<L>::value)
+          return Accumulate<L>::template add<I,J>(*l, -r->template eval<I,J>(n), n);
+       else
+          return l->template eval<I,J>(n) - r->template eval<I,J>(n); 
+    }
+
+    #undef CLASS
+
+    // Expression template class for '*' between a Matrix and a T
+
+    #define CLASS Matrix<T,MATRIX,TimesOp,T>
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+    public:
+       MATDEFS
+       INLINE CONSTEXPR Matrix(const MATRIX& left, T right) : l(left), r(right) {}
+       template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+       template <int I, int J> INLINE CONSTEXPR T evalAdd(T c, std::size_t n=0) const;
+       template <int I, int J> INLINE CONSTEXPR T evalSub(T c, std::size_t n=0) const;
+       CONVERTIBLE_TEMPLATE INLINE Matrix& operator*(CONVERT c);
+       // further multiplication with a constant
+       CONVERTIBLE_TEMPLATE INLINE Matrix& operator/(CONVERT c);
+       // further division by a constant
+      INLINE CONSTEXPR void prepare() const { l.prepare(); }
+      INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+    private:
+       Operand<MATRIX,1> l;  // the sub-expression, see Operand
+       T r;
+       // be-friend operators that optimize further T multiplication
+       CONVERTIBLE_ANOTHER_EXPRESSION_TEMPLATE 
+       friend Matrix<T,ANOTHER_MATRIX,TimesOp,T>& operator*(CONVERT b, Matrix<T,ANOTHER_MATRIX,TimesOp,T>& a);
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<MATRIX>::value + 1;
+        static const bool array = Cost<MATRIX>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign<MATRIX>::value;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Zeros<CLASS>
+    {
+        static const int value = Zeros<MATRIX>::value;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Fused<CLASS>
+    {
+        static const bool value = VECMAT3_FMA;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int I,int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    { 
+       return l->template eval<I,J>(n) * r; 
+    }
+
+    EXPRESSION_TEMPLATE 
+    template <int I,int J> 
+    INLINE CONSTEXPR T CLASS::evalAdd(T c, std::size_t n) const 
+    { 
+       return fmadd(l->template eval<I,J>(n), r, c); 
+    }
+
+    EXPRESSION_TEMPLATE 
+    template <int I,int J> 
+    INLINE CONSTEXPR T CLASS::evalSub(T c, std::size_t n) const 
+    { 
+       return fnmadd(l->template eval<I,J>(n), r, c); 
+    }
+
+    EXPRESSION_TEMPLATE 
+    CONVERTIBLE_TEMPLATE 
+    INLINE CLASS& CLASS::operator*(CONVERT c) 
+    {
+       r *= c;
+       return *this;
+    }
+
+    EXPRESSION_TEMPLATE 
+    CONVERTIBLE_TEMPLATE 
+    INLINE CLASS& CLASS::operator/(CONVERT c) 
+    {
+       r /= c;
+       return *this;
+    }
+
+    #undef CLASS
+
+    // Expression template class for '*' between two Matrix expressions
+
+    #define CLASS Matrix<T,MATRIX1,TimesOp,MATRIX2>
+    EXPRESSION_TEMPLATE_PAIR 
+    class CLASS
+    {
+      public:
+        MATDEFS
+        typedef Operand<MATRIX1,3,Cost<MATRIX2>::array> Left;
+        typedef Operand<MATRIX2,3,Cost<MATRIX1>::array> Right;
+        template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        template <int I, int J> INLINE CONSTEXPR T evalAdd(T c, std::size_t n=0) const;
+        template <int I, int J> INLINE CONSTEXPR T evalSub(T c, std::size_t n=0) const;
+        INLINE CONSTEXPR Matrix(const MATRIX1& left, const MATRIX2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:       
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = 3*CLASS::Left::cost + 3*CLASS::Right::cost + 5;
+        static const bool array = Cost<MATRIX1>::array || Cost<MATRIX2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Fused<CLASS>
+    {
+        static const bool value = VECMAT3_FMA;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Zeros<CLASS>
+    {
+        static const int value =
+            RowColumn<MATRIX1,MATRIX2,0,0>::zero      | RowColumn<MATRIX1,MATRIX2,0,1>::zero << 1 |
+            RowColumn<MATRIX1,MATRIX2,0,2>::zero << 2 | RowColumn<MATRIX1,MATRIX2,1,0>::zero << 3 |
+            RowColumn<MATRIX1,MATRIX2,1,1>::zero << 4 | RowColumn<MATRIX1,MATRIX2,1,2>::zero << 5 |
+            RowColumn<MATRIX1,MATRIX2,2,0>::zero << 6 | RowColumn<MATRIX1,MATRIX2,2,1>::zero << 7 |
+            RowColumn<MATRIX1,MATRIX2,2,2>::zero << 8;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       return RowColumn<MATRIX1,MATRIX2,I,J>::eval(l->template eval<I,0>(n), r->template eval<0,J>(n),
+                                                   l->template eval<I,1>(n), r->template eval<1,J>(n),
+                                                   l->template eval<I,2>(n), r->template eval<2,J>(n));
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::evalAdd(T c, std::size_t n) const 
+    {
+       return RowColumn<MATRIX1,MATRIX2,I,J>::add(c, l->template eval<I,0>(n), r->template eval<0,J>(n),
+                                                     l->template eval<I,1>(n), r->template eval<1,J>(n),
+                                                     l->template eval<I,2>(n), r->template eval<2,J>(n));
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::evalSub(T c, std::size_t n) const 
+    {
+       return RowColumn<MATRIX1,MATRIX2,I,J>::sub(c, l->template eval<I,0>(n), r->template eval<0,J>(n),
+                                                     l->template eval<I,1>(n), r->template eval<1,J>(n),
+                                                     l->template eval<I,2>(n), r->template eval<2,J>(n));
+    }
+
+    #undef CLASS
+
+    // Expression template class for unary '-' acting on a Matrix expression 
+
+    #define CLASS Matrix<T,MATRIX,NegativeOp,Base>
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+      public:
+        MATDEFS
+        template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Matrix(const MATRIX& right) : r(right) {}
+        INLINE CONSTEXPR void prepare() const { r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return r.sized(num); }
+      private:
+        Operand<MATRIX,1> r;  // the sub-expression, see Operand
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<MATRIX>::value + 1;
+        static const bool array = Cost<MATRIX>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign<MATRIX>::value;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Zeros<CLASS>
+    {
+        static const int value = Zeros<MATRIX>::value;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       return - r->template eval<I,J>(n);
+    }
+
+    #undef CLASS
+
+    // Expression template class for transpose function:
+
+    #define CLASS Matrix<T,MATRIX,TransposeOp,Base>
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+    public:
+       MATDEFS
+       template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+       INLINE CONSTEXPR Matrix (const MATRIX& left) : l(left) {}
+      INLINE CONSTEXPR void prepare() const { l.prepare(); }
+      INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+    private:
+       Operand<MATRIX,1> l;  // the sub-expression, see Operand
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<MATRIX>::value;
+        static const bool array = Cost<MATRIX>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Zeros<CLASS>
+    {
+        static const int value =
+            Zero<MATRIX,0,0>::value      | Zero<MATRIX,1,0>::value << 1 | Zero<MATRIX,2,0>::value << 2 |
+            Zero<MATRIX,0,1>::value << 3 | Zero<MATRIX,1,1>::value << 4 | Zero<MATRIX,2,1>::value << 5 |
+            Zero<MATRIX,0,2>::value << 6 | Zero<MATRIX,1,2>::value << 7 | Zero<MATRIX,2,2>::value << 8;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       return l->template eval<J,I>(n);
+    }
+
+    #undef CLASS
+
+    // Expression template class for Dyadic operation between two Vectors
+
+    #define CLASS Matrix<T,VECTOR1,DyadicOp,VECTOR2>
+
+    EXPRESSION_TEMPLATE_PAIR
+    class CLASS
+    {
+      public:
+        MATDEFS
+        typedef Operand<VECTOR1,3,Cost<VECTOR2>::array> Left;
+        typedef Operand<VECTOR2,3,Cost<VECTOR1>::array> Right;
+        template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        template <int I, int J> INLINE CONSTEXPR T evalAdd(T c, std::size_t n=0) const;
+        template <int I, int J> INLINE CONSTEXPR T evalSub(T c, std::size_t n=0) const;
+        INLINE CONSTEXPR Matrix(const VECTOR1& left, const VECTOR2& right) :l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<VECTOR1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Fused<CLASS>
+    {
+        static const bool value = VECMAT3_FMA;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       return l->template eval<I>(n) * r->template eval<J>(n);
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::evalAdd(T c, std::size_t n) const 
+    {
+       return fmadd(l->template eval<I>(n), r->template eval<J>(n), c);
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::evalSub(T c, std::size_t n) const 
+    {
+       return fnmadd(l->template eval<I>(n), r->template eval<J>(n), c);
+    }
+
+    #undef CLASS
+
+    // Expression template class for row operation acting on a Matrix expression 
+
+    #define CLASS Vector<T,MATRIX,RowOp,Base> 
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+      public:
+        VECDEFS
+        template <int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const MATRIX& left, int _i) : l(left), i(_i) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Operand<MATRIX,1> l;  // the sub-expression, see Operand
+        const int  i;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<MATRIX>::value;
+        static const bool array = Cost<MATRIX>::array;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       switch(i) {
+          case 0: return l->template eval<0,J>(n);
+          case 1: return l->template eval<1,J>(n);
+          case 2: return l->template eval<2,J>(n);
+          default: return T(0);
+       }
+    }
+
+    #undef CLASS
+
+    // Expression template for the column op acting on a Matrix expression:
+
+    #define CLASS Vector<T,MATRIX,ColOp,Base> 
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+      public:       
+        VECDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const MATRIX& left, int _j) : l(left), j(_j) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Operand<MATRIX,1> l;  // the sub-expression, see Operand
+        const int  j;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<MATRIX>::value;
+        static const bool array = Cost<MATRIX>::array;
+    };
+
+    EXPRESSION_TEMPLATE 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        switch(j) {
+        case 0: return l->template eval<I,0>(n);
+        case 1: return l->template eval<I,1>(n);
+        case 2: return l->template eval<I,2>(n);
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    // Expression template for '*' between a Matrix and a Vector 
+
+    #define CLASS Vector<T,MATRIX1,TimesOp,VECTOR2> 
+
+    EXPRESSION_TEMPLATE_PAIR
+    class CLASS
+    {
+      public:
+        VECDEFS
+        typedef Operand<MATRIX1,1,Cost<VECTOR2>::array> Left;
+        typedef Operand<VECTOR2,3,Cost<MATRIX1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        template <int I> INLINE CONSTEXPR T evalAdd(T c, std::size_t n=0) const;
+        template <int I> INLINE CONSTEXPR T evalSub(T c, std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const MATRIX1& left, const VECTOR2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = 3*CLASS::Left::cost + 3*CLASS::Right::cost + 5;
+        static const bool array = Cost<MATRIX1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Fused<CLASS>
+    {
+        static const bool value = VECMAT3_FMA;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+       return RowVector<MATRIX1,I>::eval(l->template eval<I,0>(n), r->template eval<0>(n),
+                                         l->template eval<I,1>(n), r->template eval<1>(n),
+                                         l->template eval<I,2>(n), r->template eval<2>(n));
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::evalAdd(T c, std::size_t n) const 
+    {
+       return RowVector<MATRIX1,I>::add(c, l->template eval<I,0>(n), r->template eval<0>(n),
+                                           l->template eval<I,1>(n), r->template eval<1>(n),
+                                           l->template eval<I,2>(n), r->template eval<2>(n));
+    }
+
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::evalSub(T c, std::size_t n) const 
+    {
+       return RowVector<MATRIX1,I>::sub(c, l->template eval<I,0>(n), r->template eval<0>(n),
+                                           l->template eval<I,1>(n), r->template eval<1>(n),
+                                           l->template eval<I,2>(n), r->template eval<2>(n));
+    }
+
+    #undef CLASS
+
+    //
+    // Array of vectors in structure-of-arrays layout, i.e., with
+    // separate streams x[], y[] and z[]. Element n of this vector
+    // expression is (x[n],y[n],z[n]).  Assigning an expression to it
+    // evaluates that expression for all elements in a single loop, in
+    // which Vector<TT>, Matrix<TT> and T operands act as constants,
+    // e.g.  pos = pos + dt*vel;
+    //
+    #define CLASS Vector<T,Base,ArrayOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        T* x;  // separate streams for each component
+        T* y;
+        T* z;
+
+        //
+        // Constructors and destructor
+        //
+        INLINE explicit Vector( std::size_t num_ = 0 );
+        INLINE          Vector( const CLASS& v );
+        INLINE         ~Vector();
+
+        INLINE std::size_t size() const;  // number of vectors
+
+        //
+        // Template evaluation of element n
+        //
+        template <int I> INLINE T eval( std::size_t n = 0 ) const;
+
+        //
+        // Element access 
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        INLINE Vector<TT> operator[] ( std::size_t n ) const
+        {
+            return Vector<TT>(x[n], y[n], z[n]);
+        }
+        // Element n of an array expression v is stored in element n
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE void set( std::size_t n, const VECTOR& v )
+        {
+            prepared(v);
+            T yValue = v.template eval<1>(n);
+            T zValue = v.template eval<2>(n);
+            x[n] = v.template eval<0>(n);
+            y[n] = yValue;
+            z[n] = zValue;
+        }
+
+        //
+        // Assignment operators: element n of an expression only depends
+        // on element n of its array operands, so these can be done in
+        // place, and the loops are simple enough to be vectorized.
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const VECTOR& v )
+        {
+            assert(hasSize(v, num));
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) = v;
+                return *this;
+            }
+            prepared(v);
+            T* const px = x;
+            T* const py = y;
+            T* const pz = z;
+            for (std::size_t n = 0; n < num; n++) {
+                T yValue = v.template eval<1>(n);
+                T zValue = v.template eval<2>(n);
+                px[n] = v.template eval<0>(n);
+                py[n] = yValue;
+                pz[n] = zValue;
+            }
+            return *this;
+        }
+        // Specialize for arrays; copying an array of a different size reallocates
+        INLINE const CLASS& operator= ( const CLASS& v );
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const VECTOR& v )
+        {
+            assert(hasSize(v, num));
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) += v;
+                return *this;
+            }
+            prepared(v);
+            T* const px = x;
+            T* const py = y;
+            T* const pz = z;
+            for (std::size_t n = 0; n < num; n++) {
+                T yValue = v.template eval<1>(n);
+                T zValue = v.template eval<2>(n);
+                px[n] += v.template eval<0>(n);
+                py[n] += yValue;
+                pz[n] += zValue;
+            }
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const VECTOR& v )
+        {
+            assert(hasSize(v, num));
+            if (DirectAssign<VECTOR>::value) {
+                // v never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) -= v;
+                return *this;
+            }
+            prepared(v);
+            T* const px = x;
+            T* const py = y;
+            T* const pz = z;
+            for (std::size_t n = 0; n < num; n++) {
+                T yValue = v.template eval<1>(n);
+                T zValue = v.template eval<2>(n);
+                px[n] -= v.template eval<0>(n);
+                py[n] -= yValue;
+                pz[n] -= zValue;
+            }
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            for (std::size_t n = 0; n < num; n++) {
+                x[n] *= a;
+                y[n] *= a;
+                z[n] *= a;
+            }
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            for (std::size_t n = 0; n < num; n++) {
+                x[n] /= a;
+                y[n] /= a;
+                z[n] /= a;
+            }
+            return *this;
+        }
+
+      private:
+        std::size_t num;  // number of elements in each stream
+        INLINE void allocate( std::size_t num_ );
+    };
+
+    // Allocate one block holding the x, y and z streams; an empty
+    // array has null streams
+    template <typename T>
+    INLINE void CLASS::allocate( std::size_t num_ )
+    {
+        T* block = num_ > 0 ? new T[3*num_] : 0;
+        num = num_;
+        x = block;
+        y = x + num_;
+        z = y + num_;
+    }
+
+    template <typename T>
+    INLINE CLASS::Vector( std::size_t num_ )
+    {
+        allocate(num_);
+    }
+
+    template <typename T>
+    INLINE CLASS::Vector( const CLASS& v )
+    {
+        allocate(v.num);
+        *this = v;
+    }
+
+    template <typename T>
+    INLINE CLASS::~Vector()
+    {
+        delete[] x;
+    }
+
+    template <typename T>
+    INLINE std::size_t CLASS::size() const
+    {
+        return num;
+    }
+
+    template <typename T>
+    INLINE const CLASS& CLASS::operator= ( const CLASS& v )
+    {
+        if (this != &v) {
+            if (num != v.num) {
+                // allocate first, so this array is intact if that fails
+                T* old = x;
+                allocate(v.num);
+                delete[] old;
+            }
+            for (std::size_t n = 0; n < num; n++) {
+                x[n] = v.x[n];
+                y[n] = v.y[n];
+                z[n] = v.z[n];
+            }
+        }
+        return *this;
+    }
+
+    template <typename T>
+    template <int I>
+    INLINE T CLASS::eval( std::size_t n ) const
+    {
+        switch(I) {
+        case 0: return x[n];
+        case 1: return y[n];
+        case 2: return z[n];
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    //
+    // Array of matrices in structure-of-arrays layout, i.e., with nine
+    // separate streams xx[], xy[], ..., zz[]. As for arrays of vectors,
+    // assigning a matrix expression evaluates it for all elements in a
+    // single loop, with Matrix<TT>, Vector<TT> and T operands acting as
+    // constants.  Multiplying it with an array of vectors gives the
+    // array of the element-wise products, e.g. x = R*x;
+    //
+    #define CLASS Matrix<T,Base,ArrayOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        T* xx; T* xy; T* xz;  // separate streams for each element
+        T* yx; T* yy; T* yz;
+        T* zx; T* zy; T* zz;
+
+        //
+        // Constructors and destructor
+        //
+        INLINE explicit Matrix( std::size_t num_ = 0 );
+        INLINE          Matrix( const CLASS& m );
+        INLINE         ~Matrix();
+
+        INLINE std::size_t size() const;  // number of matrices
+
+        //
+        // Template evaluation of element n
+        //
+        template <int I, int J> INLINE T eval( std::size_t n = 0 ) const;
+
+        //
+        // Element access
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        INLINE Matrix<TT> operator[] ( std::size_t n ) const
+        {
+            return Matrix<TT>(xx[n], xy[n], xz[n],
+                              yx[n], yy[n], yz[n],
+                              zx[n], zy[n], zz[n]);
+        }
+        // Element n of an array expression m is stored in element n
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE void set( std::size_t n, const MATRIX& m )
+        {
+            prepared(m);
+            T xxValue = m.template eval<0,0>(n);
+            T xyValue = m.template eval<0,1>(n);
+            T xzValue = m.template eval<0,2>(n);
+            T yxValue = m.template eval<1,0>(n);
+            T yyValue = m.template eval<1,1>(n);
+            T yzValue = m.template eval<1,2>(n);
+            T zxValue = m.template eval<2,0>(n);
+            T zyValue = m.template eval<2,1>(n);
+            zz[n] = m.template eval<2,2>(n);
+            xx[n] = xxValue; xy[n] = xyValue; xz[n] = xzValue;
+            yx[n] = yxValue; yy[n] = yyValue; yz[n] = yzValue;
+            zx[n] = zxValue; zy[n] = zyValue;
+        }
+
+        //
+        // Assignment operators; as for a Matrix<TT>, all nine elements
+        // are evaluated before any is stored, in case the expression
+        // contains this array.
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const MATRIX& m )
+        {
+            assert(hasSize(m, num));
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) = m;
+                return *this;
+            }
+            prepared(m);
+            T* const pxx = xx; T* const pxy = xy; T* const pxz = xz;
+            T* const pyx = yx; T* const pyy = yy; T* const pyz = yz;
+            T* const pzx = zx; T* const pzy = zy; T* const pzz = zz;
+            for (std::size_t n = 0; n < num; n++) {
+                T xxValue = m.template eval<0,0>(n);
+                T xyValue = m.template eval<0,1>(n);
+                T xzValue = m.template eval<0,2>(n);
+                T yxValue = m.template eval<1,0>(n);
+                T yyValue = m.template eval<1,1>(n);
+                T yzValue = m.template eval<1,2>(n);
+                T zxValue = m.template eval<2,0>(n);
+                T zyValue = m.template eval<2,1>(n);
+                pzz[n] = m.template eval<2,2>(n);
+                pxx[n] = xxValue; pxy[n] = xyValue; pxz[n] = xzValue;
+                pyx[n] = yxValue; pyy[n] = yyValue; pyz[n] = yzValue;
+                pzx[n] = zxValue; pzy[n] = zyValue;
+            }
+            return *this;
+        }
+        // Specialize for arrays; copying an array of a different size reallocates
+        INLINE const CLASS& operator= ( const CLASS& m );
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const MATRIX& m )
+        {
+            return *this = *this + m;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const MATRIX& m )
+        {
+            return *this = *this - m;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            for (std::size_t n = 0; n < num; n++) {
+                xx[n] *= a; xy[n] *= a; xz[n] *= a;
+                yx[n] *= a; yy[n] *= a; yz[n] *= a;
+                zx[n] *= a; zy[n] *= a; zz[n] *= a;
+            }
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            for (std::size_t n = 0; n < num; n++) {
+                xx[n] /= a; xy[n] /= a; xz[n] /= a;
+                yx[n] /= a; yy[n] /= a; yz[n] /= a;
+                zx[n] /= a; zy[n] /= a; zz[n] /= a;
+            }
+            return *this;
+        }
+
+      private:
+        std::size_t num;  // number of elements in each stream
+        INLINE void allocate( std::size_t num_ );
+    };
+
+    // Allocate one block holding all nine streams; an empty array has
+    // null streams
+    template <typename T>
+    INLINE void CLASS::allocate( std::size_t num_ )
+    {
+        T* block = num_ > 0 ? new T[9*num_] : 0;
+        num = num_;
+        xx = block;
+        xy = xx + num_; xz = xy + num_;
+        yx = xz + num_; yy = yx + num_; yz = yy + num_;
+        zx = yz + num_; zy = zx + num_; zz = zy + num_;
+    }
+
+    template <typename T>
+    INLINE CLASS::Matrix( std::size_t num_ )
+    {
+        allocate(num_);
+    }
+
+    template <typename T>
+    INLINE CLASS::Matrix( const CLASS& m )
+    {
+        allocate(m.num);
+        *this = m;
+    }
+
+    template <typename T>
+    INLINE CLASS::~Matrix()
+    {
+        delete[] xx;
+    }
+
+    template <typename T>
+    INLINE std::size_t CLASS::size() const
+    {
+        return num;
+    }
+
+    template <typename T>
+    INLINE const CLASS& CLASS::operator= ( const CLASS& m )
+    {
+        if (this != &m) {
+            if (num != m.num) {
+                // allocate first, so this array is intact if that fails
+                T* old = xx;
+                allocate(m.num);
+                delete[] old;
+            }
+            for (std::size_t n = 0; n < 9*num; n++)
+                xx[n] = m.xx[n];
+        }
+        return *this;
+    }
+
+    template <typename T>
+    template <int I, int J>
+    INLINE T CLASS::eval( std::size_t n ) const
+    {
+        switch (I) {
+        case 0: switch (J) {
+            case 0: return xx[n];
+            case 1: return xy[n];
+            case 2: return xz[n];
+            default: return T(0);
+            }
+        case 1: switch (J) {
+            case 0: return yx[n];
+            case 1: return yy[n];
+            case 2: return yz[n];
+            default: return T(0);
+            }
+        case 2: switch (J) {
+            case 0: return zx[n];
+            case 1: return zy[n];
+            case 2: return zz[n];
+            default: return T(0);
+            }
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    //
+    // Symmetric matrix, which only stores the six elements on and above
+    // the diagonal. It can be used in matrix expressions like a
+    // Matrix<TT>. Assigning an expression to it evaluates only those six
+    // elements, so that e.g. S += Dyadic(v,v) takes six multiplications.
+    // The expression is assumed to be symmetric: its elements below the
+    // diagonal are not used.
+    //
+    #define CLASS Matrix<T,Base,SymmetricOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        T xx, xy, xz;  // elements on and above the diagonal
+        T     yy, yz;
+        T         zz;
+
+        MATDEFS
+
+        //
+        // Constructors; the elements are given as xx, xy, xz, yy, yz, zz
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CONSTEXPR          Matrix( const MATRIX& m );
+        INLINE                    Matrix() {}
+        INLINE CONSTEXPR explicit Matrix( T a,   T b=0, T c=0,
+                                                 T d=0, T e=0,
+                                                        T f=0 );
+
+        //
+        // Template evaluation; element (J,I) is element (I,J)
+        //
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+
+        // Assignable access; setting element (i,j) also sets (j,i)
+        INLINE T& operator() ( const int i, const int j )
+        {
+            static const int k[9] = { 0, 1, 2, 1, 3, 4, 2, 4, 5 };
+            return *(&xx+k[3*i+j]);
+        }
+
+        //
+        // Assignment operators; unless the expression allows direct
+        // assignment, all six elements are evaluated before any is stored.
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const MATRIX& m )
+        {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) = m;
+                return *this;
+            }
+            prepared(m);
+            T xxValue = m.template eval<0,0>();
+            T xyValue = m.template eval<0,1>();
+            T xzValue = m.template eval<0,2>();
+            T yyValue = m.template eval<1,1>();
+            T yzValue = m.template eval<1,2>();
+            zz = m.template eval<2,2>();
+            xx = xxValue; xy = xyValue; xz = xzValue;
+            yy = yyValue; yz = yzValue;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const MATRIX& m )
+        {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) += m;
+                return *this;
+            }
+            prepared(m);
+            T xxValue = m.template eval<0,0>();
+            T xyValue = m.template eval<0,1>();
+            T xzValue = m.template eval<0,2>();
+            T yyValue = m.template eval<1,1>();
+            T yzValue = m.template eval<1,2>();
+            zz += m.template eval<2,2>();
+            xx += xxValue; xy += xyValue; xz += xzValue;
+            yy += yyValue; yz += yzValue;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const MATRIX& m )
+        {
+            if (DirectAssign<MATRIX>::value) {
+                // m never reads an element after it has been assigned
+                NoAlias< CLASS >(*this) -= m;
+                return *this;
+            }
+            prepared(m);
+            T xxValue = m.template eval<0,0>();
+            T xyValue = m.template eval<0,1>();
+            T xzValue = m.template eval<0,2>();
+            T yyValue = m.template eval<1,1>();
+            T yzValue = m.template eval<1,2>();
+            zz -= m.template eval<2,2>();
+            xx -= xxValue; xy -= xyValue; xz -= xzValue;
+            yy -= yyValue; yz -= yzValue;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            xx *= a; xy *= a; xz *= a;
+            yy *= a; yz *= a;
+            zz *= a;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            xx /= a; xy /= a; xz /= a;
+            yy /= a; yz /= a;
+            zz /= a;
+            return *this;
+        }
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T> struct HoldByValue<CLASS> : CaptureLeaves {};
+
+    template <typename T>
+    EXPRESSION_TEMPLATE_MEMBER
+    INLINE CONSTEXPR CLASS::Matrix( const MATRIX& m ) :
+      xx(prepared(m).template eval<0,0>()), xy(m.template eval<0,1>()), xz(m.template eval<0,2>()),
+      yy(m.template eval<1,1>()), yz(m.template eval<1,2>()),
+      zz(m.template eval<2,2>())
+    {}
+
+    template <typename T>
+    INLINE CONSTEXPR CLASS::Matrix( T a, T b, T c,
+                                         T d, T e,
+                                              T f ) :
+      xx(a), xy(b), xz(c),
+      yy(d), yz(e),
+      zz(f)
+    {}
+
+    template <typename T>
+    template <int I, int J>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t ) const
+    {
+        switch (I <= J ? 3*I+J : 3*J+I) {
+        case 0: return xx;
+        case 1: return xy;
+        case 2: return xz;
+        case 4: return yy;
+        case 5: return yz;
+        case 8: return zz;
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    //
+    // Views of vectors and matrices stored elsewhere, e.g. in a buffer
+    // of interleaved coordinates from a file reader or another library.
+    // A view holds only a pointer to the first element, so it is not
+    // copied when used in an expression, and changes through the view
+    // change the buffer. Copying a view gives another view of the same
+    // elements. The 'Const' views are read-only; the others derive from
+    // them and can also be assigned to.
+    //
+    // Read-only view of a vector stored as three consecutive elements
+    //
+    #define CLASS Vector<T,Base,ConstRefOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        VECDEFS
+
+        INLINE CONSTEXPR explicit Vector( const T* p_ ) : p(p_) {}
+        INLINE CONSTEXPR          Vector( const CLASS& v ) : p(v.p) {}
+
+        //
+        // Template evaluation
+        //
+        template <int I>
+        INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+
+        INLINE CONSTEXPR const T* data() const { return p; }
+
+      protected:
+        const T* p;  // the elements x, y and z
+
+      private:
+        CLASS& operator= ( const CLASS& );  // not assignable
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    template <int I>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t ) const
+    {
+        return p[I];
+    }
+
+    #undef CLASS
+
+    //
+    // Assignable view of a vector stored as three consecutive elements
+    //
+    #define CLASS Vector<T,Base,RefOp,Base>
+
+    template <typename T>
+    class CLASS : public Vector<T,Base,ConstRefOp,Base>
+    {
+      public:
+        INLINE CONSTEXPR explicit Vector( T* p_ ) : Vector<T,Base,ConstRefOp,Base>(p_) {}
+        INLINE CONSTEXPR          Vector( const CLASS& v ) : Vector<T,Base,ConstRefOp,Base>(v) {}
+
+        INLINE T* data() const { return const_cast<T*>(this->p); }
+
+        // Assignable access
+        INLINE T& operator() ( const int i ) const { return data()[i]; }
+        INLINE T& operator[] ( const int i ) const { return data()[i]; }
+
+        //
+        // Assignment operators; all elements are evaluated before any
+        // is stored, so the expression may contain this view. Assigning
+        // a view copies the elements, not the pointer.
+        // (inline to appease xlC compiler's issues with templated
+        // return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const VECTOR& v )
+        {
+            prepared(v);
+            T xValue = v.template eval<0>();
+            T yValue = v.template eval<1>();
+            T zValue = v.template eval<2>();
+            T* const q = data();
+            q[0] = xValue;
+            q[1] = yValue;
+            q[2] = zValue;
+            return *this;
+        }
+        INLINE const CLASS& operator= ( const CLASS& v )
+        {
+            return *this = static_cast<const Vector<T,Base,ConstRefOp,Base>&>(v);
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const VECTOR& v )
+        {
+            *this = *this + v;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const VECTOR& v )
+        {
+            *this = *this - v;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            T* const q = data();
+            q[0] *= a;
+            q[1] *= a;
+            q[2] *= a;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            T* const q = data();
+            q[0] /= a;
+            q[1] /= a;
+            q[2] /= a;
+            return *this;
+        }
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    #undef CLASS
+
+    //
+    // Read-only view of a matrix stored as nine consecutive elements,
+    // row by row
+    //
+    #define CLASS Matrix<T,Base,ConstRefOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        MATDEFS
+
+        INLINE CONSTEXPR explicit Matrix( const T* p_ ) : p(p_) {}
+        INLINE CONSTEXPR          Matrix( const CLASS& m ) : p(m.p) {}
+
+        //
+        // Template evaluation
+        //
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+
+        INLINE CONSTEXPR const T* data() const { return p; }
+
+        // View of row i
+        INLINE CONSTEXPR Vector<T,Base,ConstRefOp,Base> operator[] ( const int i ) const
+        {
+            return Vector<T,Base,ConstRefOp,Base>(p + 3*i);
+        }
+
+      protected:
+        const T* p;  // the elements xx, xy, xz, yx, ..., zz
+
+      private:
+        CLASS& operator= ( const CLASS& );  // not assignable
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    template <int I, int J>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t ) const
+    {
+        return p[3*I+J];
+    }
+
+    #undef CLASS
+
+    //
+    // Assignable view of a matrix stored as nine consecutive elements,
+    // row by row
+    //
+    #define CLASS Matrix<T,Base,RefOp,Base>
+
+    template <typename T>
+    class CLASS : public Matrix<T,Base,ConstRefOp,Base>
+    {
+      public:
+        INLINE CONSTEXPR explicit Matrix( T* p_ ) : Matrix<T,Base,ConstRefOp,Base>(p_) {}
+        INLINE CONSTEXPR          Matrix( const CLASS& m ) : Matrix<T,Base,ConstRefOp,Base>(m) {}
+
+        INLINE T* data() const { return const_cast<T*>(this->p); }
+
+        // Assignable access, and assignable view of row i
+        INLINE T& operator() ( const int i, const int j ) const { return data()[3*i+j]; }
+        INLINE Vector<T,Base,RefOp,Base> operator[] ( const int i ) const
+        {
+            return Vector<T,Base,RefOp,Base>(data() + 3*i);
+        }
+
+        //
+        // Assignment operators; all elements are evaluated before any
+        // is stored. (inline to appease xlC compiler's issues with
+        // templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const MATRIX& m )
+        {
+            prepared(m);
+            T xxValue = m.template eval<0,0>();
+            T xyValue = m.template eval<0,1>();
+            T xzValue = m.template eval<0,2>();
+            T yxValue = m.template eval<1,0>();
+            T yyValue = m.template eval<1,1>();
+            T yzValue = m.template eval<1,2>();
+            T zxValue = m.template eval<2,0>();
+            T zyValue = m.template eval<2,1>();
+            T zzValue = m.template eval<2,2>();
+            T* const q = data();
+            q[0] = xxValue; q[1] = xyValue; q[2] = xzValue;
+            q[3] = yxValue; q[4] = yyValue; q[5] = yzValue;
+            q[6] = zxValue; q[7] = zyValue; q[8] = zzValue;
+            return *this;
+        }
+        INLINE const CLASS& operator= ( const CLASS& m )
+        {
+            return *this = static_cast<const Matrix<T,Base,ConstRefOp,Base>&>(m);
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const MATRIX& m )
+        {
+            *this = *this + m;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const MATRIX& m )
+        {
+            *this = *this - m;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (int i = 0; i < 9; i++)
+                q[i] *= a;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (int i = 0; i < 9; i++)
+                q[i] /= a;
+            return *this;
+        }
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    #undef CLASS
+
+    //
+    // Read-only view of an array of vectors stored elsewhere, where
+    // vector n consists of the elements p[n*stride], p[n*stride+1] and
+    // p[n*stride+2]. The stride is 3 for a buffer of xyz triplets, and
+    // larger if other data is stored between the vectors, e.g. 7 for
+    // x,y,z,vx,vy,vz,m records. Like Vector<T,Base,ArrayOp,Base>, it
+    // is an array expression.
+    //
+    #define CLASS Vector<T,Base,ConstStridedOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        INLINE Vector( const T* p_, std::size_t num_, std::size_t stride_ = 3 ) :
+          p(p_), num(num_), s(stride_)
+        {}
+        INLINE Vector( const CLASS& v ) : p(v.p), num(v.num), s(v.s) {}
+
+        INLINE std::size_t size() const { return num; }    // number of vectors
+        INLINE std::size_t stride() const { return s; }
+        INLINE const T* data() const { return p; }
+
+        //
+        // Template evaluation of element n
+        //
+        template <int I> INLINE T eval( std::size_t n = 0 ) const;
+
+        // View of element n
+        INLINE Vector<T,Base,ConstRefOp,Base> operator[] ( std::size_t n ) const
+        {
+            return Vector<T,Base,ConstRefOp,Base>(p + n*s);
+        }
+
+      protected:
+        const T* p;       // first element of the first vector
+        std::size_t num;  // number of vectors
+        std::size_t s;    // number of elements from one vector to the next
+
+      private:
+        CLASS& operator= ( const CLASS& );  // not assignable
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    template <int I>
+    INLINE T CLASS::eval( std::size_t n ) const
+    {
+        return p[n*s+I];
+    }
+
+    #undef CLASS
+
+    //
+    // Assignable view of an array of vectors. Assigning an array
+    // expression evaluates the three elements of each vector before
+    // storing them, so the expression may contain this view, but not
+    // another view of overlapping but different elements.
+    //
+    #define CLASS Vector<T,Base,StridedOp,Base>
+
+    template <typename T>
+    class CLASS : public Vector<T,Base,ConstStridedOp,Base>
+    {
+      public:
+        INLINE Vector( T* p_, std::size_t num_, std::size_t stride_ = 3 ) :
+          Vector<T,Base,ConstStridedOp,Base>(p_, num_, stride_)
+        {}
+        INLINE Vector( const CLASS& v ) : Vector<T,Base,ConstStridedOp,Base>(v) {}
+
+        INLINE T* data() const { return const_cast<T*>(this->p); }
+
+        // Assignable view of element n
+        INLINE Vector<T,Base,RefOp,Base> operator[] ( std::size_t n ) const
+        {
+            return Vector<T,Base,RefOp,Base>(data() + n*this->s);
+        }
+
+        //
+        // Assignment operators
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const VECTOR& v )
+        {
+            assert(hasSize(v, this->num));
+            prepared(v);
+            T* const q = data();
+            const std::size_t num = this->num;
+            const std::size_t s = this->s;
+            for (std::size_t n = 0; n < num; n++) {
+                T xValue = v.template eval<0>(n);
+                T yValue = v.template eval<1>(n);
+                q[n*s+2] = v.template eval<2>(n);
+                q[n*s]   = xValue;
+                q[n*s+1] = yValue;
+            }
+            return *this;
+        }
+        INLINE const CLASS& operator= ( const CLASS& v )
+        {
+            return *this = static_cast<const Vector<T,Base,ConstStridedOp,Base>&>(v);
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const VECTOR& v )
+        {
+            *this = *this + v;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const VECTOR& v )
+        {
+            *this = *this - v;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (std::size_t n = 0; n < this->num; n++) {
+                q[n*this->s]   *= a;
+                q[n*this->s+1] *= a;
+                q[n*this->s+2] *= a;
+            }
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (std::size_t n = 0; n < this->num; n++) {
+                q[n*this->s]   /= a;
+                q[n*this->s+1] /= a;
+                q[n*this->s+2] /= a;
+            }
+            return *this;
+        }
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    #undef CLASS
+
+    //
+    // Read-only view of an array of matrices stored elsewhere, where
+    // matrix n consists of the nine elements from p[n*stride] on, row
+    // by row
+    //
+    #define CLASS Matrix<T,Base,ConstStridedOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        INLINE Matrix( const T* p_, std::size_t num_, std::size_t stride_ = 9 ) :
+          p(p_), num(num_), s(stride_)
+        {}
+        INLINE Matrix( const CLASS& m ) : p(m.p), num(m.num), s(m.s) {}
+
+        INLINE std::size_t size() const { return num; }    // number of matrices
+        INLINE std::size_t stride() const { return s; }
+        INLINE const T* data() const { return p; }
+
+        //
+        // Template evaluation of element n
+        //
+        template <int I, int J> INLINE T eval( std::size_t n = 0 ) const;
+
+        // View of element n
+        INLINE Matrix<T,Base,ConstRefOp,Base> operator[] ( std::size_t n ) const
+        {
+            return Matrix<T,Base,ConstRefOp,Base>(p + n*s);
+        }
+
+      protected:
+        const T* p;       // first element of the first matrix
+        std::size_t num;  // number of matrices
+        std::size_t s;    // number of elements from one matrix to the next
+
+      private:
+        CLASS& operator= ( const CLASS& );  // not assignable
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    template <int I, int J>
+    INLINE T CLASS::eval( std::size_t n ) const
+    {
+        return p[n*s+3*I+J];
+    }
+
+    #undef CLASS
+
+    //
+    // Assignable view of an array of matrices; as for vectors, all
+    // elements of each matrix are evaluated before any is stored.
+    //
+    #define CLASS Matrix<T,Base,StridedOp,Base>
+
+    template <typename T>
+    class CLASS : public Matrix<T,Base,ConstStridedOp,Base>
+    {
+      public:
+        INLINE Matrix( T* p_, std::size_t num_, std::size_t stride_ = 9 ) :
+          Matrix<T,Base,ConstStridedOp,Base>(p_, num_, stride_)
+        {}
+        INLINE Matrix( const CLASS& m ) : Matrix<T,Base,ConstStridedOp,Base>(m) {}
+
+        INLINE T* data() const { return const_cast<T*>(this->p); }
+
+        // Assignable view of element n
+        INLINE Matrix<T,Base,RefOp,Base> operator[] ( std::size_t n ) const
+        {
+            return Matrix<T,Base,RefOp,Base>(data() + n*this->s);
+        }
+
+        //
+        // Assignment operators
+        // (inline to appease xlC compiler's issues with templated return types)
+        //
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE const CLASS& operator= ( const MATRIX& m )
+        {
+            assert(hasSize(m, this->num));
+            prepared(m);
+            T* const q = data();
+            const std::size_t num = this->num;
+            const std::size_t s = this->s;
+            for (std::size_t n = 0; n < num; n++) {
+                T xxValue = m.template eval<0,0>(n);
+                T xyValue = m.template eval<0,1>(n);
+                T xzValue = m.template eval<0,2>(n);
+                T yxValue = m.template eval<1,0>(n);
+                T yyValue = m.template eval<1,1>(n);
+                T yzValue = m.template eval<1,2>(n);
+                T zxValue = m.template eval<2,0>(n);
+                T zyValue = m.template eval<2,1>(n);
+                T zzValue = m.template eval<2,2>(n);
+                T* const qn = q + n*s;
+                qn[0] = xxValue; qn[1] = xyValue; qn[2] = xzValue;
+                qn[3] = yxValue; qn[4] = yyValue; qn[5] = yzValue;
+                qn[6] = zxValue; qn[7] = zyValue; qn[8] = zzValue;
+            }
+            return *this;
+        }
+        INLINE const CLASS& operator= ( const CLASS& m )
+        {
+            return *this = static_cast<const Matrix<T,Base,ConstStridedOp,Base>&>(m);
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator+= ( const MATRIX& m )
+        {
+            *this = *this + m;
+            return *this;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE CLASS& operator-= ( const MATRIX& m )
+        {
+            *this = *this - m;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator*= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (std::size_t n = 0; n < this->num; n++)
+                for (int i = 0; i < 9; i++)
+                    q[n*this->s+i] *= a;
+            return *this;
+        }
+        CONVERTIBLE_TEMPLATE
+        INLINE CLASS& operator/= ( const CONVERT a )
+        {
+            T* const q = data();
+            for (std::size_t n = 0; n < this->num; n++)
+                for (int i = 0; i < 9; i++)
+                    q[n*this->s+i] /= a;
+            return *this;
+        }
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    #undef CLASS
+
+    //
+    // Structured matrices, whose zero elements are known at compile
+    // time (see Zeros), so that products with them leave out the terms
+    // with a zero factor: Identity<T>(), Diagonal(v), Skew(w), which
+    // gives Skew(w)*v == (w^v), and RotX(a), RotY(a) and RotZ(a) for a
+    // rotation over an angle a about a coordinate axis.  They hold at
+    // most three numbers and are read-only.
+    //
+    #define CLASS Matrix<T,Base,IdentityOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        MATDEFS
+        INLINE CONSTEXPR Matrix() {}
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct Zeros<CLASS>
+    {
+        static const int value = 0xEE; // off-diagonal
+    };
+
+    template <typename T>
+    template <int I, int J>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t ) const
+    {
+        return I == J ? T(1) : T(0);
+    }
+
+    #undef CLASS
+
+    #define CLASS Matrix<T,Base,DiagonalOp,Base>
+
+    template <typename T>
+    class CLASS
+    {
+      public:
+        T xx, yy, zz;  // diagonal elements
+        MATDEFS
+        INLINE CONSTEXPR Matrix( T a, T b, T c ) : xx(a), yy(b), zz(c) {}
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+    };
+
+    template <typename T>
+    struct Cost<CLASS>
+    {
+        static const int  value = 0;
+        static const bool array = false;
+    };
+
+    template <typename T>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = true;
+    };
+
+    template <typename T>
+    struct Zeros<CLASS>
+    {
+        static const int value = 0xEE; // off-diagonal
+    };
+
+    template <typename T>
+    template <int I, int J>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t ) const
+    {
+        switch (3*I+J) {
+        case 0: return xx;
+        case 4: return yy;
+        case 8: return zz;
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    #define CLASS Matrix<T,VECTOR,SkewOp,Base>
+
+    EXPRESSION_TEMPLATE
+    class CLASS
+    {
+      public:
+        MATDEFS
+        typedef Operand<VECTOR,2> Left;
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t n = 0 ) const;
+        INLINE CONSTEXPR Matrix( const VECTOR& left ) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Left l;  // the sub-expression, see Operand
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + 1;
+        static const bool array = Cost<VECTOR>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Zeros<CLASS>
+    {
+        static const int value = 0x111; // diagonal
+    };
+
+    EXPRESSION_TEMPLATE
+    template <int I, int J>
+    INLINE CONSTEXPR T CLASS::eval( std::size_t n ) const
+    {
+        switch (3*I+J) {
+        case 1: return -l->template eval<2>(n);
+        case 2: return  l->template eval<1>(n);
+        case 3: return  l->template eval<2>(n);
+        case 5: return -l->template eval<0>(n);
+        case 6: return -l->template eval<1>(n);
+        case 7: return  l->template eval<0>(n);
+        default: return T(0);
+        }
+    }
+
+    #undef CLASS
+
+    //
+    // Rotations about axis AXIS, with c and s the cosine and sine of
+    // the angle. With P and Q the next two axes in cyclic order, the
+    // nonzero elements are (AXIS,AXIS)=1, (P,P)=(Q,Q)=c and (Q,P)=-(P,Q)=s.
+    //
+    #define ROTATION(OP,AXIS)                                                   \
+    template <typename T>                                                       \
+    class Matrix<T,Base,OP,Base>                                                \
+    {                                                                           \
+      public:                                                                   \
+        T c, s;  /* cosine and sine of the angle */                            \
+        MATDEFS                                                                 \
+        INLINE CONSTEXPR Matrix( T cosine, T sine ) : c(cosine), s(sine) {}     \
+        template <int I, int J> INLINE CONSTEXPR T eval( std::size_t = 0 ) const \
+        {                                                                       \
+            return I == AXIS && J == AXIS ? T(1)                                \
+                : I == AXIS || J == AXIS ? T(0)                                 \
+                : I == J ? c                                                    \
+                : J == (AXIS+2)%3 ? -s                                          \
+                : s;                                                            \
+        }                                                                       \
+    };                                                                          \
+                                                                                \
+    template <typename T>                                                       \
+    struct Cost< Matrix<T,Base,OP,Base> >                                       \
+    {                                                                           \
+        static const int  value = 0;                                            \
+        static const bool array = false;                                        \
+    };                                                                          \
+                                                                                \
+    template <typename T>                                                       \
+    struct DirectAssign< Matrix<T,Base,OP,Base> >                               \
+    {                                                                           \
+        static const bool value = true;                                         \
+    };                                                                          \
+                                                                                \
+    template <typename T>                                                       \
+    struct Zeros< Matrix<T,Base,OP,Base> >                                      \
+    {                                                                           \
+        static const int value = 1 << (3*AXIS+(AXIS+1)%3) | 1 << (3*AXIS+(AXIS+2)%3) \
+                               | 1 << (3*((AXIS+1)%3)+AXIS) | 1 << (3*((AXIS+2)%3)+AXIS); \
+    };
+
+    #define CLASS Matrix<T,Base,RotXOp,Base>
+    ROTATION(RotXOp,0)
+    #undef CLASS
+    #define CLASS Matrix<T,Base,RotYOp,Base>
+    ROTATION(RotYOp,1)
+    #undef CLASS
+    #define CLASS Matrix<T,Base,RotZOp,Base>
+    ROTATION(RotZOp,2)
+    #undef CLASS
+    #undef ROTATION
+
+    //
+    // Conversion of the elements of an expression with elements of
+    // type U to elements of type T, e.g. Convert<double>(v) for a
+    // Vector<float> v. This allows storing vectors and matrices in
+    // single precision, which halves the memory traffic, while
+    // evaluating expressions in double precision:
+    //   pos = Convert<float>(Convert<double>(pos) + dt*vel);
+    // rounds each element of pos only once. The conversion is done
+    // element by element when the expression is evaluated, so no
+    // temporaries are made, and it works for array expressions too.
+    //
+    #define CLASS Vector<T,Vector<U,X,Y,Z>,ConvertOp,Base>
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    class CLASS
+    {
+      public:
+        VECDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const Vector<U,X,Y,Z>& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Operand<Vector<U,X,Y,Z>,1> l;  // the sub-expression, see Operand
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost< Vector<U,X,Y,Z> >::value + 1;
+        static const bool array = Cost< Vector<U,X,Y,Z> >::array;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign< Vector<U,X,Y,Z> >::value;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        return T(l->template eval<I>(n));
+    }
+
+    #undef CLASS
+
+    #define CLASS Matrix<T,Matrix<U,X,Y,Z>,ConvertOp,Base>
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    class CLASS
+    {
+      public:
+        MATDEFS
+        template <int I, int J> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Matrix(const Matrix<U,X,Y,Z>& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Operand<Matrix<U,X,Y,Z>,1> l;  // the sub-expression, see Operand
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost< Matrix<U,X,Y,Z> >::value + 1;
+        static const bool array = Cost< Matrix<U,X,Y,Z> >::array;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign< Matrix<U,X,Y,Z> >::value;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct Zeros<CLASS>
+    {
+        static const int value = Zeros< Matrix<U,X,Y,Z> >::value;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    template <int I, int J> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        return T(l->template eval<I,J>(n));
+    }
+
+    #undef CLASS
+
+    #define CLASS Quaternion<T,Quaternion<U,X,Y,Z>,ConvertOp,Base>
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    class CLASS
+    {
+      public:
+        QUATDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const Quaternion<U,X,Y,Z>& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
+      private:
+        Operand<Quaternion<U,X,Y,Z>,1> l;  // the sub-expression, see Operand
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost< Quaternion<U,X,Y,Z> >::value + 1;
+        static const bool array = Cost< Quaternion<U,X,Y,Z> >::array;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign< Quaternion<U,X,Y,Z> >::value;
+    };
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        return T(l->template eval<I>(n));
+    }
+
+    #undef CLASS
+
+    //
+    // noalias(d) = e stores each element of the expression e straight
+    // into d, instead of first evaluating all elements of e into
+    // temporaries. This is only correct if e does not read an element
+    // of d after it has been assigned, i.e., if d does not occur in e
+    // as the operand of a cross, matrix, dyadic or quaternion product,
+    // a transpose, a row or a column. Plain assignment already stores
+    // directly when it can tell at compile time that this is safe (see
+    // DirectAssign). The same holds for '+=' and '-='.
+    //
+    template <typename D>
+    INLINE NoAlias<D> noalias( D& d )
+    {
+        return NoAlias<D>(d);
+    }
+
+    template <typename T>
+    class NoAlias< Vector<TT> >
+    {
+      public:
+        INLINE explicit NoAlias( Vector<TT>& v ) : d(v) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<TT>& operator= ( const VECTOR& v )
+        {
+            prepared(v);
+            d.x = v.template eval<0>();
+            d.y = v.template eval<1>();
+            d.z = v.template eval<2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<TT>& operator+= ( const VECTOR& v )
+        {
+            prepared(v);
+            d.x += v.template eval<0>();
+            d.y += v.template eval<1>();
+            d.z += v.template eval<2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<TT>& operator-= ( const VECTOR& v )
+        {
+            prepared(v);
+            d.x -= v.template eval<0>();
+            d.y -= v.template eval<1>();
+            d.z -= v.template eval<2>();
+            return d;
+        }
+      private:
+        Vector<TT>& d;  // the destination
+    };
+
+    template <typename T>
+    class NoAlias< Matrix<TT> >
+    {
+      public:
+        INLINE explicit NoAlias( Matrix<TT>& m ) : d(m) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<TT>& operator= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx = m.template eval<0,0>(); d.xy = m.template eval<0,1>(); d.xz = m.template eval<0,2>();
+            d.yx = m.template eval<1,0>(); d.yy = m.template eval<1,1>(); d.yz = m.template eval<1,2>();
+            d.zx = m.template eval<2,0>(); d.zy = m.template eval<2,1>(); d.zz = m.template eval<2,2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<TT>& operator+= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx += m.template eval<0,0>(); d.xy += m.template eval<0,1>(); d.xz += m.template eval<0,2>();
+            d.yx += m.template eval<1,0>(); d.yy += m.template eval<1,1>(); d.yz += m.template eval<1,2>();
+            d.zx += m.template eval<2,0>(); d.zy += m.template eval<2,1>(); d.zz += m.template eval<2,2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<TT>& operator-= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx -= m.template eval<0,0>(); d.xy -= m.template eval<0,1>(); d.xz -= m.template eval<0,2>();
+            d.yx -= m.template eval<1,0>(); d.yy -= m.template eval<1,1>(); d.yz -= m.template eval<1,2>();
+            d.zx -= m.template eval<2,0>(); d.zy -= m.template eval<2,1>(); d.zz -= m.template eval<2,2>();
+            return d;
+        }
+      private:
+        Matrix<TT>& d;
+    };
+
+    template <typename T>
+    class NoAlias< Matrix<T,Base,SymmetricOp,Base> >
+    {
+      public:
+        INLINE explicit NoAlias( Matrix<T,Base,SymmetricOp,Base>& s ) : d(s) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,SymmetricOp,Base>& operator= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx = m.template eval<0,0>(); d.xy = m.template eval<0,1>(); d.xz = m.template eval<0,2>();
+            d.yy = m.template eval<1,1>(); d.yz = m.template eval<1,2>(); d.zz = m.template eval<2,2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,SymmetricOp,Base>& operator+= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx += m.template eval<0,0>(); d.xy += m.template eval<0,1>(); d.xz += m.template eval<0,2>();
+            d.yy += m.template eval<1,1>(); d.yz += m.template eval<1,2>(); d.zz += m.template eval<2,2>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,SymmetricOp,Base>& operator-= ( const MATRIX& m )
+        {
+            prepared(m);
+            d.xx -= m.template eval<0,0>(); d.xy -= m.template eval<0,1>(); d.xz -= m.template eval<0,2>();
+            d.yy -= m.template eval<1,1>(); d.yz -= m.template eval<1,2>(); d.zz -= m.template eval<2,2>();
+            return d;
+        }
+      private:
+        Matrix<T,Base,SymmetricOp,Base>& d;
+    };
+
+    template <typename T>
+    class NoAlias< Quaternion<TT> >
+    {
+      public:
+        INLINE explicit NoAlias( Quaternion<TT>& q ) : d(q) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Quaternion<TT>& operator= ( const QUATERNION& q )
+        {
+            prepared(q);
+            d.w = q.template eval<0>();
+            d.x = q.template eval<1>();
+            d.y = q.template eval<2>();
+            d.z = q.template eval<3>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Quaternion<TT>& operator+= ( const QUATERNION& q )
+        {
+            prepared(q);
+            d.w += q.template eval<0>();
+            d.x += q.template eval<1>();
+            d.y += q.template eval<2>();
+            d.z += q.template eval<3>();
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Quaternion<TT>& operator-= ( const QUATERNION& q )
+        {
+            prepared(q);
+            d.w -= q.template eval<0>();
+            d.x -= q.template eval<1>();
+            d.y -= q.template eval<2>();
+            d.z -= q.template eval<3>();
+            return d;
+        }
+      private:
+        Quaternion<TT>& d;
+    };
+
+    template <typename T>
+    class NoAlias< Vector<T,Base,ArrayOp,Base> >
+    {
+      public:
+        INLINE explicit NoAlias( Vector<T,Base,ArrayOp,Base>& v ) : d(v) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<T,Base,ArrayOp,Base>& operator= ( const VECTOR& v )
+        {
+            assert(hasSize(v, d.size()));
+            prepared(v);
+            T* const px = d.x;
+            T* const py = d.y;
+            T* const pz = d.z;
+            const std::size_t num = d.size();
+            for (std::size_t n = 0; n < num; n++) {
+                px[n] = v.template eval<0>(n);
+                py[n] = v.template eval<1>(n);
+                pz[n] = v.template eval<2>(n);
+            }
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<T,Base,ArrayOp,Base>& operator+= ( const VECTOR& v )
+        {
+            assert(hasSize(v, d.size()));
+            prepared(v);
+            T* const px = d.x;
+            T* const py = d.y;
+            T* const pz = d.z;
+            const std::size_t num = d.size();
+            for (std::size_t n = 0; n < num; n++) {
+                px[n] += v.template eval<0>(n);
+                py[n] += v.template eval<1>(n);
+                pz[n] += v.template eval<2>(n);
+            }
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Vector<T,Base,ArrayOp,Base>& operator-= ( const VECTOR& v )
+        {
+            assert(hasSize(v, d.size()));
+            prepared(v);
+            T* const px = d.x;
+            T* const py = d.y;
+            T* const pz = d.z;
+            const std::size_t num = d.size();
+            for (std::size_t n = 0; n < num; n++) {
+                px[n] -= v.template eval<0>(n);
+                py[n] -= v.template eval<1>(n);
+                pz[n] -= v.template eval<2>(n);
+            }
+            return d;
+        }
+      private:
+        Vector<T,Base,ArrayOp,Base>& d;
+    };
+
+    template <typename T>
+    class NoAlias< Matrix<T,Base,ArrayOp,Base> >
+    {
+      public:
+        INLINE explicit NoAlias( Matrix<T,Base,ArrayOp,Base>& m ) : d(m) {}
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,ArrayOp,Base>& operator= ( const MATRIX& m )
+        {
+            assert(hasSize(m, d.size()));
+            prepared(m);
+            T* const pxx = d.xx; T* const pxy = d.xy; T* const pxz = d.xz;
+            T* const pyx = d.yx; T* const pyy = d.yy; T* const pyz = d.yz;
+            T* const pzx = d.zx; T* const pzy = d.zy; T* const pzz = d.zz;
+            const std::size_t num = d.size();
+            for (std::size_t n = 0; n < num; n++) {
+                pxx[n] = m.template eval<0,0>(n);
+                pxy[n] = m.template eval<0,1>(n);
+                pxz[n] = m.template eval<0,2>(n);
+                pyx[n] = m.template eval<1,0>(n);
+                pyy[n] = m.template eval<1,1>(n);
+                pyz[n] = m.template eval<1,2>(n);
+                pzx[n] = m.template eval<2,0>(n);
+                pzy[n] = m.template eval<2,1>(n);
+                pzz[n] = m.template eval<2,2>(n);
+            }
+            return d;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,ArrayOp,Base>& operator+= ( const MATRIX& m )
+        {
+            return *this = d + m;
+        }
+        EXPRESSION_TEMPLATE_MEMBER
+        INLINE Matrix<T,Base,ArrayOp,Base>& operator-= ( const MATRIX& m )
+        {
+            return *this = d - m;
+        }
+      private:
+        Matrix<T,Base,ArrayOp,Base>& d;
+    };
+
+    // Expression template class for '+' between two Quaternion expressions
+
+    #define CLASS Quaternion<T,QUATERNION1,PlusOp,QUATERNION2> 
+    EXPRESSION_TEMPLATE_PAIR
+    class CLASS
+    {
+      public:
+        QUATDEFS
+        typedef Operand<QUATERNION1,1,Cost<QUATERNION2>::array> Left;
+        typedef Operand<QUATERNION2,1,Cost<QUATERNION1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION1& left, const QUATERNION2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<QUATERNION1>::array || Cost<QUATERNION2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
     {
-    public:
-       MATDEFS
-       template <int I, int J> INLINE T eval() const;
-       INLINE Matrix(const MATRIX1& left, const MATRIX2& right): l (&left), r(&right) {}
-    private:
-       const MATRIX1* l; // pointers to the sub-expressions
-       const MATRIX2* r;
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
-    template <int I,int J> 
-    INLINE T CLASS::eval() const 
-    { 
-       return l->template eval<I,J>() - r->template eval<I,J>(); 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
+    {
+        return l->template eval<I>(n) + r->template eval<I>(n); 
     }
 
     #undef CLASS
 
-    // Expression template class for '*' between a Matrix and a T
-
-    #define CLASS Matrix<T,MATRIX,TimesOp,T>
+    // Expression template class for '-' between two Quaternion expressions
 
-    EXPRESSION_TEMPLATE
+    #define CLASS Quaternion<T,QUATERNION1,MinusOp,QUATERNION2> 
+    EXPRESSION_TEMPLATE_PAIR
     class CLASS
     {
-    public:
-       MATDEFS
-       INLINE Matrix(const MATRIX& left, T right) : l(&left), r(right) {}
-       template <int I, int J> INLINE T eval() const;
-       CONVERTIBLE_TEMPLATE INLINE Matrix& operator*(CONVERT c);
-       // further multiplication with a constant
-       CONVERTIBLE_TEMPLATE INLINE Matrix& operator/(CONVERT c);
-       // further division by a constant
-    private:
-       const MATRIX* l;
-       T r;
-       // be-friend operators that optimize further T multiplication
-       CONVERTIBLE_ANOTHER_EXPRESSION_TEMPLATE 
-       friend Matrix<T,ANOTHER_MATRIX,TimesOp,T>& operator*(CONVERT b, Matrix<T,ANOTHER_MATRIX,TimesOp,T>& a);
+      public:
+        QUATDEFS
+        typedef Operand<QUATERNION1,1,Cost<QUATERNION2>::array> Left;
+        typedef Operand<QUATERNION2,1,Cost<QUATERNION1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION1& left, const QUATERNION2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
     };
 
-    EXPRESSION_TEMPLATE 
-    template <int I,int J> 
-    INLINE T CLASS::eval() const 
-    { 
-       return l->template eval<I,J>() * r; 
-    }
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = CLASS::Left::cost + CLASS::Right::cost + 1;
+        static const bool array = Cost<QUATERNION1>::array || Cost<QUATERNION2>::array;
+    };
 
-    EXPRESSION_TEMPLATE 
-    CONVERTIBLE_TEMPLATE 
-    INLINE CLASS& CLASS::operator*(CONVERT c) 
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
     {
-       r *= c;
-       return *this;
-    }
+        static const bool value = CLASS::Left::direct && CLASS::Right::direct;
+    };
 
-    EXPRESSION_TEMPLATE 
-    CONVERTIBLE_TEMPLATE 
-    INLINE CLASS& CLASS::operator/(CONVERT c) 
+    EXPRESSION_TEMPLATE_PAIR 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-       r /= c;
-       return *this;
+        return l->template eval<I>(n) - r->template eval<I>(n); 
     }
 
     #undef CLASS
 
-    // Expression template class for '*' between two Matrix expressions
+    // Expression template class for '*' between two Quaternion
+    // expressions (the Hamilton product, 4 multiplications per element)
 
-    #define CLASS Matrix<T,MATRIX1,TimesOp,MATRIX2>
-    EXPRESSION_TEMPLATE_PAIR 
+    #define CLASS Quaternion<T,QUATERNION1,TimesOp,QUATERNION2> 
+    EXPRESSION_TEMPLATE_PAIR
     class CLASS
     {
       public:
-        MATDEFS
-        template <int I, int J> INLINE T eval() const;
-        INLINE Matrix(const MATRIX1& left, const MATRIX2& right) : l (&left), r(&right) {}
-      private:       
-        const MATRIX1* l;
-        const MATRIX2* r;
+        QUATDEFS
+        typedef Operand<QUATERNION1,4,Cost<QUATERNION2>::array> Left;
+        typedef Operand<QUATERNION2,4,Cost<QUATERNION1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION1& left, const QUATERNION2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
+      private:
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = 4*CLASS::Left::cost + 4*CLASS::Right::cost + 7;
+        static const bool array = Cost<QUATERNION1>::array || Cost<QUATERNION2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
-    template <int I, int J> 
-    INLINE T CLASS::eval() const 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-       return l->template eval<I,0>() * r->template eval<0,J>()
-          + l->template eval<I,1>() * r->template eval<1,J>()
-          + l->template eval<I,2>() * r->template eval<2,J>();
+        T lw = l->template eval<0>(n), lx = l->template eval<1>(n);
+        T ly = l->template eval<2>(n), lz = l->template eval<3>(n);
+        T rw = r->template eval<0>(n), rx = r->template eval<1>(n);
+        T ry = r->template eval<2>(n), rz = r->template eval<3>(n);
+        switch (I) {
+        case 0: return lw*rw - lx*rx - ly*ry - lz*rz;
+        case 1: return lw*rx + lx*rw + ly*rz - lz*ry;
+        case 2: return lw*ry - lx*rz + ly*rw + lz*rx;
+        case 3: return lw*rz + lx*ry - ly*rx + lz*rw;
+        default: return T(0);
+        }
     }
 
     #undef CLASS
 
-    // Expression template class for unary '-' acting on a Matrix expression 
-
-    #define CLASS Matrix<T,MATRIX,NegativeOp,Base>
+    // Expression template class for '*' between a Quaternion and a T
 
+    #define CLASS Quaternion<T,QUATERNION,TimesOp,T> 
     EXPRESSION_TEMPLATE
     class CLASS
     {
       public:
-        MATDEFS
-        template <int I, int J> INLINE  T eval() const;
-        INLINE Matrix(const MATRIX& right) : r(&right) {}
+        QUATDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION& left, T right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
       private:
-        const MATRIX* r;
+        Operand<QUATERNION,1> l;  // the sub-expression, see Operand
+        T r;
     };
 
-    EXPRESSION_TEMPLATE 
-    template <int I, int J> 
-    INLINE T CLASS::eval() const 
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
     {
-       return - r->template eval<I,J>();
-    }
-
-    #undef CLASS
-
-    // Expression template class for transpose function:
-
-    #define CLASS Matrix<T,MATRIX,TransposeOp,Base>
+        static const int  value = Cost<QUATERNION>::value + 1;
+        static const bool array = Cost<QUATERNION>::array;
+    };
 
     EXPRESSION_TEMPLATE
-    class CLASS
+    struct DirectAssign<CLASS>
     {
-    public:
-       MATDEFS
-       template <int I, int J> INLINE T eval() const;
-       INLINE Matrix (const MATRIX& left) : l(&left) {}
-    private:
-       const MATRIX* l;
+        static const bool value = DirectAssign<QUATERNION>::value;
     };
 
     EXPRESSION_TEMPLATE 
-    template <int I, int J> 
-    INLINE T CLASS::eval() const 
+    template <int I> INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-       return l->template eval<J,I>();
+        return l->template eval<I>(n) * r; 
     }
 
     #undef CLASS
 
-    // Expression template class for Dyadic operation between two Vectors
-
-    #define CLASS Matrix<T,VECTOR1,DyadicOp,VECTOR2>
+    // Expression template class for unary '-' acting on a Quaternion
 
-    EXPRESSION_TEMPLATE_PAIR
+    #define CLASS Quaternion<T,QUATERNION,NegativeOp,Base> 
+    EXPRESSION_TEMPLATE
     class CLASS
     {
-      public:
-        MATDEFS
-        template <int I, int J> INLINE T eval() const;
-        INLINE Matrix(const VECTOR1& left, const VECTOR2& right) :l (&left), r(&right) {}
+      public:      
+        QUATDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
       private:
-        const VECTOR1* l;
-        const VECTOR2* r;
+        Operand<QUATERNION,1> l;  // the sub-expression, see Operand
     };
 
-    EXPRESSION_TEMPLATE_PAIR 
-    template <int I, int J> 
-    INLINE T CLASS::eval() const 
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
     {
-       return l->template eval<I>() * r->template eval<J>();
-    }
-
-    #undef CLASS
-
-    // Expression template class for row operation acting on a Matrix expression 
-
-    #define CLASS Vector<T,MATRIX,RowOp,Base> 
+        static const int  value = Cost<QUATERNION>::value + 1;
+        static const bool array = Cost<QUATERNION>::array;
+    };
 
     EXPRESSION_TEMPLATE
-    class CLASS
+    struct DirectAssign<CLASS>
     {
-      public:
-        VECDEFS
-        template <int J> INLINE T eval() const;
-        INLINE Vector(const MATRIX& left, int _i) : l(&left), i(_i) {}
-      private:
-        const MATRIX* l;
-        const int  i;
+        static const bool value = DirectAssign<QUATERNION>::value;
     };
 
     EXPRESSION_TEMPLATE 
-    template <int J> 
-    INLINE T CLASS::eval() const 
+    template <int I> 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-       switch(i) {
-          case 0: return l->template eval<0,J>();
-          case 1: return l->template eval<1,J>();
-          case 2: return l->template eval<2,J>();
-          default: return 0;
-       }
+        return - l->template eval<I>(n);
     }
 
     #undef CLASS
 
-    // Expression template for the column op acting on a Matrix expression:
-
-    #define CLASS Vector<T,MATRIX,ColOp,Base> 
+    // Expression template class for the conjugate of a Quaternion
 
+    #define CLASS Quaternion<T,QUATERNION,ConjugateOp,Base> 
     EXPRESSION_TEMPLATE
     class CLASS
     {
-      public:       
-        VECDEFS
-        template <int I> INLINE T eval() const;
-        INLINE Vector(const MATRIX& left, int _j) : l(&left), j(_j) {}
+      public:      
+        QUATDEFS
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Quaternion(const QUATERNION& left) : l(left) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num); }
       private:
-        const MATRIX* l;
-        const int  j;
+        Operand<QUATERNION,1> l;  // the sub-expression, see Operand
+    };
+
+    EXPRESSION_TEMPLATE
+    struct Cost<CLASS>
+    {
+        static const int  value = Cost<QUATERNION>::value + 1;
+        static const bool array = Cost<QUATERNION>::array;
+    };
+
+    EXPRESSION_TEMPLATE
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = DirectAssign<QUATERNION>::value;
     };
 
     EXPRESSION_TEMPLATE 
     template <int I> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-        switch(j) {
-        case 0: return l->template eval<I,0>();
-        case 1: return l->template eval<I,1>();
-        case 2: return l->template eval<I,2>();
-        default: return 0;
-        }
+        return I == 0 ? l->template eval<I>(n) : - l->template eval<I>(n);
     }
 
     #undef CLASS
 
-    // Expression template for '*' between a Matrix and a Vector 
-
-    #define CLASS Vector<T,MATRIX1,TimesOp,VECTOR2> 
+    // Expression template for '*' between a Quaternion and a Vector,
+    // i.e. the rotation q v q* by a unit quaternion q, computed as
+    // v + w t + u^t with t = 2 u^v and u the vector part of q, without
+    // forming a matrix
 
+    #define CLASS Vector<T,QUATERNION1,TimesOp,VECTOR2> 
     EXPRESSION_TEMPLATE_PAIR
     class CLASS
     {
       public:
         VECDEFS
-        template <int I> INLINE T eval() const;
-        INLINE Vector(const MATRIX1& left, const VECTOR2& right) : l (&left), r(&right) {}
+        typedef Operand<QUATERNION1,3,Cost<VECTOR2>::array> Left;
+        typedef Operand<VECTOR2,3,Cost<QUATERNION1>::array> Right;
+        template <int I> INLINE CONSTEXPR T eval(std::size_t n=0) const;
+        INLINE CONSTEXPR Vector(const QUATERNION1& left, const VECTOR2& right) : l(left), r(right) {}
+        INLINE CONSTEXPR void prepare() const { l.prepare(); r.prepare(); }
+        INLINE CONSTEXPR bool sized( std::size_t num ) const { return l.sized(num) && r.sized(num); }
       private:
-        const MATRIX1* l;
-        const VECTOR2* r;
+        Left  l;  // the sub-expressions, see Operand
+        Right r;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct Cost<CLASS>
+    {
+        static const int  value = 4*CLASS::Left::cost + 3*CLASS::Right::cost + 12;
+        static const bool array = Cost<QUATERNION1>::array || Cost<VECTOR2>::array;
+    };
+
+    EXPRESSION_TEMPLATE_PAIR
+    struct DirectAssign<CLASS>
+    {
+        static const bool value = CLASS::Left::materialized && CLASS::Right::materialized;
     };
 
     EXPRESSION_TEMPLATE_PAIR 
     template <int I> 
-    INLINE T CLASS::eval() const 
+    INLINE CONSTEXPR T CLASS::eval(std::size_t n) const 
     {
-       return l->template eval<I,0>() * r->template eval<0>()
-          + l->template eval<I,1>() * r->template eval<1>()
-          + l->template eval<I,2>() * r->template eval<2>();
+        T w = l->template eval<0>(n), ux = l->template eval<1>(n);
+        T uy = l->template eval<2>(n), uz = l->template eval<3>(n);
+        T vx = r->template eval<0>(n), vy = r->template eval<1>(n);
+        T vz = r->template eval<2>(n);
+        T tx = 2*(uy*vz - uz*vy);
+        T ty = 2*(uz*vx - ux*vz);
+        T tz = 2*(ux*vy - uy*vx);
+        switch (I) {
+        case 0: return vx + w*tx + uy*tz - uz*ty;
+        case 1: return vy + w*ty + uz*tx - ux*tz;
+        case 2: return vz + w*tz + ux*ty - uy*tx;
+        default: return T(0);
+        }
     }
 
     #undef CLASS
@@ -1469,7 +5041,7 @@ namespace vecmat3 {
 
     // Vector + Vector
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,PlusOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,PlusOp,VECTOR2> 
     operator+ ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 ) 
     { 
@@ -1478,7 +5050,7 @@ namespace vecmat3 {
 
     // Vector - Vector
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,MinusOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,MinusOp,VECTOR2> 
     operator- ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 ) 
     { 
@@ -1487,7 +5059,7 @@ namespace vecmat3 {
 
     // Vector ^ Vector (cross product)
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,VECTOR1,TimesOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,VECTOR1,TimesOp,VECTOR2> 
     operator^ ( const VECTOR1 & v1, 
                 const VECTOR2 & v2 ) 
     { 
@@ -1496,7 +5068,7 @@ namespace vecmat3 {
 
     // T * Vector
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator* ( CONVERT a, 
                 const VECTOR & v ) 
     { 
@@ -1505,7 +5077,7 @@ namespace vecmat3 {
 
     // Vector * T
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator* ( const VECTOR & v, 
                 CONVERT a ) 
     { 
@@ -1514,11 +5086,11 @@ namespace vecmat3 {
 
     // Vector / T
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,TimesOp,T> 
+    INLINE CONSTEXPR Vector<T,VECTOR,TimesOp,T> 
     operator/ ( const VECTOR & v, 
                 CONVERT a ) 
     { 
-        return Vector<T,VECTOR,TimesOp,T>(v, 1/a);
+        return Vector<T,VECTOR,TimesOp,T>(v, T(1)/a);
     }
 
     // Vector * T * T
@@ -1543,7 +5115,7 @@ namespace vecmat3 {
 
     // - Vector
     EXPRESSION_TEMPLATE 
-    INLINE Vector<T,VECTOR,NegativeOp,Base> 
+    INLINE CONSTEXPR Vector<T,VECTOR,NegativeOp,Base> 
     operator- ( const VECTOR & v ) 
     { 
         return Vector<T,VECTOR,NegativeOp,Base>(v);
@@ -1551,9 +5123,10 @@ namespace vecmat3 {
 
     // Vector | Vector (inner product)
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T operator|( const VECTOR1 & v1,
+    INLINE CONSTEXPR T operator|( const VECTOR1 & v1,
                         const VECTOR2 & v2 ) 
     {
+        prepared(v1); prepared(v2);
         return v1.template eval<0>()*v2.template eval<0>() 
              + v1.template eval<1>()*v2.template eval<1>() 
              + v1.template eval<2>()*v2.template eval<2>();
@@ -1561,10 +5134,11 @@ namespace vecmat3 {
 
     // Vector * Vector (inner product)
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T 
+    INLINE CONSTEXPR T 
     operator*( const VECTOR1 & v1, 
                const VECTOR2 & v2 ) 
     {
+        prepared(v1); prepared(v2);
         return v1.template eval<0>()*v2.template eval<0>() 
              + v1.template eval<1>()*v2.template eval<1>() 
              + v1.template eval<2>()*v2.template eval<2>();
@@ -1572,7 +5146,7 @@ namespace vecmat3 {
 
     // Matrix + Matrix
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,PlusOp,MATRIX2> 
+    INLINE CONSTEXPR Matrix<T,MATRIX1,PlusOp,MATRIX2> 
     operator+ ( const MATRIX1 & v1, 
                 const MATRIX2 & v2 ) 
     { 
@@ -1581,7 +5155,7 @@ namespace vecmat3 {
 
     // Matrix - Matrix
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,MinusOp,MATRIX2>
+    INLINE CONSTEXPR Matrix<T,MATRIX1,MinusOp,MATRIX2>
     operator-( const MATRIX1 & v1, 
                const MATRIX2 & v2 ) 
     { 
@@ -1590,7 +5164,7 @@ namespace vecmat3 {
 
     // T * Matrix
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator* ( CONVERT a, const MATRIX & m ) 
     { 
         return Matrix<T,MATRIX,TimesOp,T>(m, a);
@@ -1598,7 +5172,7 @@ namespace vecmat3 {
 
     // Matrix * T
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator* ( const MATRIX & m, CONVERT a ) 
     { 
         return Matrix<T,MATRIX,TimesOp,T>(m, a);
@@ -1606,11 +5180,11 @@ namespace vecmat3 {
 
     // Matrix / T
     CONVERTIBLE_EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TimesOp,T> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TimesOp,T> 
     operator/ ( const MATRIX & m, 
                 CONVERT a ) 
     { 
-        return Matrix<T,MATRIX,TimesOp,T>(m, 1.0/a);
+        return Matrix<T,MATRIX,TimesOp,T>(m, T(1)/a);
     }
 
     // Matrix * T * T
@@ -1635,7 +5209,7 @@ namespace vecmat3 {
 
     // Matrix * Matrix
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,MATRIX1,TimesOp,MATRIX2> 
+    INLINE CONSTEXPR Matrix<T,MATRIX1,TimesOp,MATRIX2> 
     operator* ( const MATRIX1 & a, const MATRIX2 & b ) 
     { 
         return Matrix<T,MATRIX1,TimesOp,MATRIX2>(a, b);
@@ -1643,7 +5217,7 @@ namespace vecmat3 {
 
     // -Matrix 
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,NegativeOp,Base> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,NegativeOp,Base> 
     operator- ( const MATRIX & m ) 
     { 
         return Matrix<T,MATRIX,NegativeOp,Base>(m);
@@ -1651,20 +5225,104 @@ namespace vecmat3 {
 
     // Matrix * Vector
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Vector<T,MATRIX1,TimesOp,VECTOR2> 
+    INLINE CONSTEXPR Vector<T,MATRIX1,TimesOp,VECTOR2> 
     operator* ( const MATRIX1 & m, 
                 const VECTOR2 & v ) 
     { 
         return Vector<T,MATRIX1,TimesOp,VECTOR2> (m, v);
     }
 
+    // Quaternion + Quaternion
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,PlusOp,QUATERNION2> 
+    operator+ ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 ) 
+    { 
+        return Quaternion<T,QUATERNION1,PlusOp,QUATERNION2>(q1, q2);
+    }
+
+    // Quaternion - Quaternion
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,MinusOp,QUATERNION2> 
+    operator- ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 ) 
+    { 
+        return Quaternion<T,QUATERNION1,MinusOp,QUATERNION2>(q1, q2);
+    }
+
+    // Quaternion * Quaternion
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION1,TimesOp,QUATERNION2> 
+    operator* ( const QUATERNION1 & q1, 
+                const QUATERNION2 & q2 ) 
+    { 
+        return Quaternion<T,QUATERNION1,TimesOp,QUATERNION2>(q1, q2);
+    }
+
+    // Quaternion * Vector (rotation)
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR Vector<T,QUATERNION1,TimesOp,VECTOR2> 
+    operator* ( const QUATERNION1 & q, 
+                const VECTOR2 & v ) 
+    { 
+        return Vector<T,QUATERNION1,TimesOp,VECTOR2>(q, v);
+    }
+
+    // T * Quaternion
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator* ( CONVERT a, 
+                const QUATERNION & q ) 
+    { 
+        return Quaternion<T,QUATERNION,TimesOp,T>(q, a);
+    }
+
+    // Quaternion * T
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator* ( const QUATERNION & q, 
+                CONVERT a ) 
+    { 
+        return Quaternion<T,QUATERNION,TimesOp,T>(q, a);
+    }
+
+    // Quaternion / T
+    CONVERTIBLE_EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,TimesOp,T> 
+    operator/ ( const QUATERNION & q, 
+                CONVERT a ) 
+    { 
+        return Quaternion<T,QUATERNION,TimesOp,T>(q, T(1)/a);
+    }
+
+    // - Quaternion
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,NegativeOp,Base> 
+    operator- ( const QUATERNION & q ) 
+    { 
+        return Quaternion<T,QUATERNION,NegativeOp,Base>(q);
+    }
+
+    // Quaternion | Quaternion (inner product)
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE CONSTEXPR T operator|( const QUATERNION1 & q1,
+                        const QUATERNION2 & q2 ) 
+    {
+        prepared(q1); prepared(q2);
+        return q1.template eval<0>()*q2.template eval<0>() 
+             + q1.template eval<1>()*q2.template eval<1>() 
+             + q1.template eval<2>()*q2.template eval<2>()
+             + q1.template eval<3>()*q2.template eval<3>();
+    }
+
     // Reorthogonalize rows using Gramm-Schmidt orthogonalization of the rows
+    // (for arrays of matrices, see reorthogonalize in vecmat3batch.h)
     template <typename T> 
     INLINE void Matrix<TT>::reorthogonalize() 
     {
         T z;
         int num = 10;
-        while ( fabs(det()-1)> 1E-16 and --num ) {
+        while ( any(absval(det()-1) > 1E-16) and --num ) {
             z = 1/row(0).nrm();   
             xx *= z;    
             xy *= z;    
@@ -1696,25 +5354,24 @@ namespace vecmat3 {
     INLINE T dist( const VECTOR1 & v1, 
                    const VECTOR2 & v2 ) 
     {
+        prepared(v1); prepared(v2);
         T x[3] = {v1.template eval<0>() - v2.template eval<0>(),
                   v1.template eval<1>() - v2.template eval<1>(),
                   v1.template eval<2>() - v2.template eval<2>()};
         T max = absmax(x,x+2);  
-        if (max != 0) {
-            x[0] /= max;
-            x[1] /= max;
-            x[2] /= max;
-            return max*sqrt(x[0]*x[0]+x[1]*x[1]+x[2]*x[2]);
-        }
-        else 
-            return 0;
+        T div = select(max != 0, max, T(1));
+        x[0] /= div;
+        x[1] /= div;
+        x[2] /= div;
+        return max*sqrt(x[0]*x[0]+x[1]*x[1]+x[2]*x[2]);
     }
 
     // Return (a-b)|(a-b)
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE T dist2( const VECTOR1 & v1, 
+    INLINE CONSTEXPR T dist2( const VECTOR1 & v1, 
                     const VECTOR2 & v2 ) 
     {
+        prepared(v1); prepared(v2);
         T  d = v1.template eval<0>() - v2.template eval<0>();
         T  c = d * d;
         d = v1.template eval<1>() - v2.template eval<1>();
@@ -1729,33 +5386,29 @@ namespace vecmat3 {
                             const VECTOR2 & v2, 
                             const VECTOR3 & v3 ) 
     {
-        T  x = fabs(v3.template eval<0>()+v1.template eval<0>()-v2.template eval<0>());
-        T  y = fabs(v3.template eval<1>()+v1.template eval<1>()-v2.template eval<1>());
-        T  z = fabs(v3.template eval<2>()+v1.template eval<2>()-v2.template eval<2>());
-        T  max = x;
-        if (y>max) max = y;
-        if (z>max) max = z;   
-        if (max != 0) {
-            x /= max;
-            y /= max;
-            z /= max;
-            return max*sqrt(x*x+y*y+z*z);
-        }
-        else 
-            return 0;
+        prepared(v1); prepared(v2); prepared(v3);
+        T  x = absval(v3.template eval<0>()+v1.template eval<0>()-v2.template eval<0>());
+        T  y = absval(v3.template eval<1>()+v1.template eval<1>()-v2.template eval<1>());
+        T  z = absval(v3.template eval<2>()+v1.template eval<2>()-v2.template eval<2>());
+        T  max = maxval(z, maxval(y, x));
+        T  div = select(max != 0, max, T(1));
+        x /= div;
+        y /= div;
+        z /= div;
+        return max*sqrt(x*x+y*y+z*z);
     }
     
     // Inverse of a matrix
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<TT> 
+    INLINE CONSTEXPR Matrix<TT> 
     Inverse(const MATRIX& me) 
     {
         Matrix<TT> m = me;
         T s = 1/m.det();
         return Matrix<TT>(
-            (m.yy*m.zz-m.yz*m.zy)*s, -(m.xy*m.zz-m.xz*m.zy)*s,  (m.xy*m.yz-m.xz*m.yy)*s,
-            -(m.yx*m.zz-m.yz*m.zx)*s,  (m.xx*m.zz-m.xz*m.zx)*s, -(m.xx*m.yz-m.xz*m.yx)*s,
-             (m.yx*m.zy-m.yy*m.zx)*s, -(m.xx*m.zy-m.xy*m.zx)*s,  (m.xx*m.yy-m.xy*m.yx)*s);
+            fmsub(m.yy,m.zz, m.yz*m.zy)*s, -fmsub(m.xy,m.zz, m.xz*m.zy)*s,  fmsub(m.xy,m.yz, m.xz*m.yy)*s,
+           -fmsub(m.yx,m.zz, m.yz*m.zx)*s,  fmsub(m.xx,m.zz, m.xz*m.zx)*s, -fmsub(m.xx,m.yz, m.xz*m.yx)*s,
+            fmsub(m.yx,m.zy, m.yy*m.zx)*s, -fmsub(m.xx,m.zy, m.xy*m.zx)*s,  fmsub(m.xx,m.yy, m.xy*m.yx)*s);
     }
 
     // Build rotation matrix using the Rodrigues formula
@@ -1763,38 +5416,108 @@ namespace vecmat3 {
     INLINE Matrix<TT> 
     Rodrigues(const VECTOR& ve) 
     {
+        // No branch is needed for theta=0: then s=0, c=1 and w=0, which
+        // gives the identity matrix.
         Vector<TT> v = ve;
         T theta = v.nrm();
-        if (theta != 0) {
-            T s, c;
-            #ifdef SINCOS
-            SINCOS(theta, &s, &c);
-            #else
-            s = sin(theta);
-            c = cos(theta);
-            #endif
-            T inrm = 1/theta;
-            T wx = v.x*inrm;
-            T wy = v.y*inrm;
-            T wz = v.z*inrm;
-            T oneminusc = 1-c;
-            T wxwy1mc = wx*wy*oneminusc;
-            T wxwz1mc = wx*wz*oneminusc;
-            T wywz1mc = wy*wz*oneminusc;
-            T wxs = wx*s;
-            T wys = wy*s;
-            T wzs = wz*s;
-            return Matrix<TT>(c+wx*wx*oneminusc, wxwy1mc-wzs,       wxwz1mc+wys,
-                              wxwy1mc+wzs,       c+wy*wy*oneminusc, wywz1mc-wxs,
-                              wxwz1mc-wys,       wywz1mc+wxs,       c+wz*wz*oneminusc);
-        } else {
-            return Matrix<TT>(1,0,0,0,1,0,0,0,1);
-        }
+        T s, c;
+        #ifdef SINCOS
+        SINCOS(theta, &s, &c);
+        #else
+        s = sin(theta);
+        c = cos(theta);
+        #endif
+        T inrm = 1/select(theta != 0, theta, T(1));
+        T wx = v.x*inrm;
+        T wy = v.y*inrm;
+        T wz = v.z*inrm;
+        T oneminusc = 1-c;
+        T wxwy1mc = wx*wy*oneminusc;
+        T wxwz1mc = wx*wz*oneminusc;
+        T wywz1mc = wy*wz*oneminusc;
+        T wxs = wx*s;
+        T wys = wy*s;
+        T wzs = wz*s;
+        return Matrix<TT>(c+wx*wx*oneminusc, wxwy1mc-wzs,       wxwz1mc+wys,
+                          wxwy1mc+wzs,       c+wy*wy*oneminusc, wywz1mc-wxs,
+                          wxwz1mc-wys,       wywz1mc+wxs,       c+wz*wz*oneminusc);
+    }
+
+    // Identity matrix, e.g. Identity<double>()
+    template <typename T>
+    INLINE CONSTEXPR Matrix<T,Base,IdentityOp,Base>
+    Identity()
+    {
+        return Matrix<T,Base,IdentityOp,Base>();
+    }
+
+    // Diagonal matrix with the elements of v on its diagonal
+    EXPRESSION_TEMPLATE
+    INLINE CONSTEXPR Matrix<T,Base,DiagonalOp,Base>
+    Diagonal( const VECTOR & v )
+    {
+        prepared(v);
+        return Matrix<T,Base,DiagonalOp,Base>(v.template eval<0>(),
+                                              v.template eval<1>(),
+                                              v.template eval<2>());
+    }
+
+    // Skew-symmetric matrix of w, for which Skew(w)*v equals w^v
+    EXPRESSION_TEMPLATE
+    INLINE CONSTEXPR Matrix<T,VECTOR,SkewOp,Base>
+    Skew( const VECTOR & w )
+    {
+        return Matrix<T,VECTOR,SkewOp,Base>(w);
+    }
+
+    // Rotation matrices over an angle theta about the x, y or z axis
+    #ifdef SINCOS
+    #define ROTATION(NAME,OP)                                  \
+    template <typename T>                                      \
+    INLINE Matrix<T,Base,OP,Base> NAME( T theta )              \
+    {                                                          \
+        T s, c;                                                \
+        SINCOS(theta, &s, &c);                                 \
+        return Matrix<T,Base,OP,Base>(c, s);                   \
+    }
+    #else
+    #define ROTATION(NAME,OP)                                  \
+    template <typename T>                                      \
+    INLINE Matrix<T,Base,OP,Base> NAME( T theta )              \
+    {                                                          \
+        return Matrix<T,Base,OP,Base>(cos(theta), sin(theta)); \
+    }
+    #endif
+    ROTATION(RotX,RotXOp)
+    ROTATION(RotY,RotYOp)
+    ROTATION(RotZ,RotZOp)
+    #undef ROTATION
+
+    // Elements of v, m or q converted to type T, e.g. Convert<double>(v)
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    INLINE CONSTEXPR Vector<T,Vector<U,X,Y,Z>,ConvertOp,Base>
+    Convert( const Vector<U,X,Y,Z> & v )
+    {
+        return Vector<T,Vector<U,X,Y,Z>,ConvertOp,Base>(v);
+    }
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    INLINE CONSTEXPR Matrix<T,Matrix<U,X,Y,Z>,ConvertOp,Base>
+    Convert( const Matrix<U,X,Y,Z> & m )
+    {
+        return Matrix<T,Matrix<U,X,Y,Z>,ConvertOp,Base>(m);
+    }
+
+    template <typename T, typename U, ENODE(X,Y,Z)>
+    INLINE CONSTEXPR Quaternion<T,Quaternion<U,X,Y,Z>,ConvertOp,Base>
+    Convert( const Quaternion<U,X,Y,Z> & q )
+    {
+        return Quaternion<T,Quaternion<U,X,Y,Z>,ConvertOp,Base>(q);
     }
 
     // Transpose matrix
     EXPRESSION_TEMPLATE 
-    INLINE Matrix<T,MATRIX,TransposeOp,Base> 
+    INLINE CONSTEXPR Matrix<T,MATRIX,TransposeOp,Base> 
     Transpose( const MATRIX & m ) 
     { 
         return Matrix<T,MATRIX,TransposeOp,Base>(m);
@@ -1802,13 +5525,153 @@ namespace vecmat3 {
 
     // Dyadic product of two vectors
     EXPRESSION_TEMPLATE_PAIR 
-    INLINE Matrix<T,VECTOR1,DyadicOp,VECTOR2> 
+    INLINE CONSTEXPR Matrix<T,VECTOR1,DyadicOp,VECTOR2> 
     Dyadic( const VECTOR1 & a, 
             const VECTOR2 & b ) 
     {
         return Matrix<T,VECTOR1,DyadicOp,VECTOR2> (a,b);
     }
 
+    // Conjugate quaternion
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<T,QUATERNION,ConjugateOp,Base> 
+    Conjugate( const QUATERNION & q ) 
+    { 
+        return Quaternion<T,QUATERNION,ConjugateOp,Base>(q);
+    }
+
+    // Inverse of a quaternion
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Quaternion<TT> 
+    Inverse( const QUATERNION & qe ) 
+    {
+        Quaternion<TT> q = qe;
+        T s = 1/q.nrm2();
+        return Quaternion<TT>(q.w*s, -q.x*s, -q.y*s, -q.z*s);
+    }
+
+    // Rotation matrix of a unit quaternion
+    EXPRESSION_TEMPLATE 
+    INLINE CONSTEXPR Matrix<TT> 
+    RotationMatrix( const QUATERNION & qe ) 
+    {
+        Quaternion<TT> q = qe;
+        T x2 = 2*q.x, y2 = 2*q.y, z2 = 2*q.z;
+        T wx = q.w*x2, wy = q.w*y2, wz = q.w*z2;
+        T xx = q.x*x2, xy = q.x*y2, xz = q.x*z2;
+        T yy = q.y*y2, yz = q.y*z2, zz = q.z*z2;
+        return Matrix<TT>(1-yy-zz, xy-wz,   xz+wy,
+                          xy+wz,   1-xx-zz, yz-wx,
+                          xz-wy,   yz+wx,   1-xx-yy);
+    }
+
+    // Unit quaternion of a rotation matrix. The four diagonal
+    // combinations d0..d3 are 4w^2, 4x^2, 4y^2 and 4z^2; the largest
+    // one is used to obtain the other elements, which is accurate for
+    // all rotations (Shepperd's method, with selections instead of
+    // branches)
+    EXPRESSION_TEMPLATE 
+    INLINE Quaternion<TT> 
+    RotationQuaternion( const MATRIX & me ) 
+    {
+        Matrix<TT> m = me;
+        T d0 = 1 + m.xx + m.yy + m.zz;
+        T d1 = 1 + m.xx - m.yy - m.zz;
+        T d2 = 1 - m.xx + m.yy - m.zz;
+        T d3 = 1 - m.xx - m.yy + m.zz;
+        T a = m.zy - m.yz;   // 4wx
+        T b = m.xz - m.zx;   // 4wy
+        T c = m.yx - m.xy;   // 4wz
+        T e = m.xy + m.yx;   // 4xy
+        T f = m.xz + m.zx;   // 4xz
+        T g = m.yz + m.zy;   // 4yz
+        T dmax = d0, w = d0, x = a, y = b, z = c;
+        w = select(d1 > dmax, a, w); 
+        x = select(d1 > dmax, d1, x); 
+        y = select(d1 > dmax, e, y); 
+        z = select(d1 > dmax, f, z);
+        dmax = maxval(d1, dmax);
+        w = select(d2 > dmax, b, w); 
+        x = select(d2 > dmax, e, x); 
+        y = select(d2 > dmax, d2, y); 
+        z = select(d2 > dmax, g, z);
+        dmax = maxval(d2, dmax);
+        w = select(d3 > dmax, c, w); 
+        x = select(d3 > dmax, f, x); 
+        y = select(d3 > dmax, g, y); 
+        z = select(d3 > dmax, d3, z);
+        dmax = maxval(d3, dmax);
+        T s = T(0.5)/sqrt(dmax);
+        return Quaternion<TT>(w*s, x*s, y*s, z*s);
+    }
+
+    // Unit quaternion of the rotation around v by an angle v.nrm()
+    EXPRESSION_TEMPLATE 
+    INLINE Quaternion<TT> 
+    RodriguesQuaternion( const VECTOR & ve ) 
+    {
+        // As in Rodrigues, no branch is needed for theta=0
+        Vector<TT> v = ve;
+        T theta = v.nrm();
+        T s, c;
+        #ifdef SINCOS
+        SINCOS(theta/2, &s, &c);
+        #else
+        s = sin(theta/2);
+        c = cos(theta/2);
+        #endif
+        T f = s/select(theta != 0, theta, T(1));
+        return Quaternion<TT>(c, f*v.x, f*v.y, f*v.z);
+    }
+
+    // Rotation vector of a quaternion, with an angle between 0 and pi
+    EXPRESSION_TEMPLATE 
+    INLINE Vector<TT> 
+    RotationVector( const QUATERNION & qe ) 
+    {
+        Quaternion<TT> q = qe;
+        T sign = select(q.w < 0, T(-1), T(1));
+        T s = sqrt(q.x*q.x + q.y*q.y + q.z*q.z);   // |q| sin(theta/2)
+        T theta = 2*atan2(s, sign*q.w);
+        T f = sign*theta/select(s != 0, s, T(1));
+        return Vector<TT>(f*q.x, f*q.y, f*q.z);
+    }
+
+    // Normalized linear interpolation
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE Quaternion<TT> 
+    nlerp( const QUATERNION1 & q1, 
+           const QUATERNION2 & q2, 
+           T t ) 
+    {
+        Quaternion<TT> a = q1;
+        Quaternion<TT> b = q2;
+        T sign = select((a|b) < 0, T(-1), T(1));
+        Quaternion<TT> q = (1-t)*a + (sign*t)*b;
+        q.normalize();
+        return q;
+    }
+
+    // Spherical linear interpolation; the angle between q1 and q2 is
+    // computed with atan2 rather than acos, which is accurate for
+    // nearby quaternions as well
+    EXPRESSION_TEMPLATE_PAIR 
+    INLINE Quaternion<TT> 
+    slerp( const QUATERNION1 & q1, 
+           const QUATERNION2 & q2, 
+           T t ) 
+    {
+        Quaternion<TT> a = q1;
+        Quaternion<TT> b = q2;
+        b *= select((a|b) < 0, T(-1), T(1));
+        T phi = 2*atan2((a-b).nrm(), (a+b).nrm());
+        T s = sin(phi);
+        T div = select(s != 0, s, T(1));
+        T wa = select(s != 0, sin((1-t)*phi)/div, 1-t);
+        T wb = select(s != 0, sin(t*phi)/div, t);
+        return Quaternion<TT>(wa*a + wb*b);
+    }
+
     //
     // Output
     //
@@ -1818,6 +5681,7 @@ namespace vecmat3 {
     INLINE OSTREAM& operator<< ( OSTREAM & o, 
                                  const VECTOR & v) 
     {
+        prepared(v);
         return o << v.template eval<0>() << " " 
                  << v.template eval<1>() << " " 
                  << v.template eval<2>();
@@ -1828,6 +5692,7 @@ namespace vecmat3 {
     INLINE OSTREAM & operator<< ( OSTREAM & o, 
                            const MATRIX & m ) 
     {
+        prepared(m);
         return o << "\n"<< m.template eval<0,0>() 
                  << " " << m.template eval<0,1>() 
                  << " " << m.template eval<0,2>()
@@ -1840,6 +5705,18 @@ namespace vecmat3 {
                  << "\n";
     }
 
+    // Quaternions
+    EXPRESSION_TEMPLATE 
+    INLINE OSTREAM& operator<< ( OSTREAM & o, 
+                                 const QUATERNION & q) 
+    {
+        prepared(q);
+        return o << q.template eval<0>() << " " 
+                 << q.template eval<1>() << " " 
+                 << q.template eval<2>() << " " 
+                 << q.template eval<3>();
+    }
+
 }  // end namespace vecmat3
 
 #undef VECNRM
@@ -1854,6 +5731,10 @@ namespace vecmat3 {
 #undef MATROW
 #undef MATCOLUMN
 #undef MATDEFS
+#undef QUATNRM
+#undef QUATNRM2
+#undef QUATPARENTHESES
+#undef QUATDEFS
 #undef OSTREAM
 #undef EXPRESSION_TEMPLATE     
 #undef ANOTHER_EXPRESSION_TEMPLATE 
@@ -1870,6 +5751,9 @@ namespace vecmat3 {
 #undef MATRIX 
 #undef MATRIX1
 #undef MATRIX2
+#undef QUATERNION
+#undef QUATERNION1
+#undef QUATERNION2
 #undef TT
 #undef ENODE
 
@@ -1896,7 +5780,9 @@ typedef vecmat3::Matrix<DOUBLE> Matrix;
 //  'c.x = a.x+b.x; c.y = a.y+b.y; c.z = a.z+b.z;',
 //  an expression template class is defined with the following properties:
 // 
-//  - It contains pointers to the vectors 'a' and 'b'.
+//  - It contains pointers to the vectors 'a' and 'b'. Operands that
+//    are themselves expressions are held by value, and so are 'a' and
+//    'b' if VECMAT3_CAPTURE_LEAVES is defined (see Operand).
 // 
 //  - The constructor of this class sets up these pointers
 // 
@@ -1912,6 +5798,12 @@ typedef vecmat3::Matrix<DOUBLE> Matrix;
 // 
 //  - The 'operator= ' is overloaded to call the 'eval<I>()' function.
 // 
+//  - 'eval<I>(n)' takes an optional element index n, which is ignored
+//    by all but the array classes Vector<T,Base,ArrayOp,Base> and the
+//    array views Vector<T,Base,StridedOp,Base>. The
+//    operator= of the latter loops over n, so that the same expression
+//    classes work for single vectors and for arrays of vectors.
+// 
 //  - Two class template-parameters are needed to specify the operant types.
 //    This way one can distinguish different operations, e.g. vector-vector 
 //    multiplication from vector-double multiplication. 
@@ -0,0 +1,1658 @@
+//
+// vecmat3batch.h - Kernels applying vecmat3 operations to large arrays
+//                  of vectors and matrices
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// NOTES:
+//
+// - The kernels in this file work either on plain arrays of Vector<T>
+//   and Matrix<T> (array-of-structures layout), or on VectorArray<T>
+//   and MatrixArray<T> (structure-of-arrays layout). The loops are
+//   written such that compilers can vectorize them.
+//
+// - When compiled with OpenMP (e.g. -fopenmp), loops over more than
+//   VECMAT3_PARALLEL_MIN elements are divided over threads.
+//
+// - Output arrays may be the same as input arrays, but may not
+//   overlap with them otherwise.
+//
+// - Loops that take square roots are only vectorized by gcc if errno
+//   need not be set, i.e., with -fno-math-errno (implied by
+//   -ffast-math).
+//
+
+#ifndef _VECMAT3BATCH_
+#define _VECMAT3BATCH_
+
+#include "vecmat3.h"
+#include <cfloat>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#if defined(__SSE2__)
+# include <immintrin.h>
+#endif
+
+#ifndef VECMAT3_PARALLEL_MIN
+#define VECMAT3_PARALLEL_MIN 16384
+#endif
+
+// Pragmas for the loops of the kernels here and in the other vecmat3
+// headers, which run over 'num' elements (and count in 'count', or sum
+// in 'sumx', 'sumy' and 'sumz'). The loops have no dependencies
+// between iterations, which is stated explicitly because with many
+// input and output arrays, compilers do not check for overlap at run
+// time and do not vectorize
+#if defined(_OPENMP)
+# define VECMAT3_PARALLEL_LOOP _Pragma("omp parallel for simd schedule(static) if(parallel: parallel(num))")
+# define VECMAT3_PARALLEL_COUNT_LOOP _Pragma("omp parallel for simd schedule(static) reduction(+:count) if(parallel: parallel(num))")
+# define VECMAT3_PARALLEL_SUM_LOOP _Pragma("omp parallel for simd schedule(static) reduction(+:sumx,sumy,sumz) if(parallel: parallel(num))")
+#elif defined(__clang__)
+# define VECMAT3_PARALLEL_LOOP _Pragma("clang loop vectorize(assume_safety)")
+# define VECMAT3_PARALLEL_COUNT_LOOP VECMAT3_PARALLEL_LOOP
+# define VECMAT3_PARALLEL_SUM_LOOP VECMAT3_PARALLEL_LOOP
+#elif defined(__GNUC__)
+# define VECMAT3_PARALLEL_LOOP _Pragma("GCC ivdep")
+# define VECMAT3_PARALLEL_COUNT_LOOP VECMAT3_PARALLEL_LOOP
+# define VECMAT3_PARALLEL_SUM_LOOP VECMAT3_PARALLEL_LOOP
+#else
+# define VECMAT3_PARALLEL_LOOP
+# define VECMAT3_PARALLEL_COUNT_LOOP
+# define VECMAT3_PARALLEL_SUM_LOOP
+#endif
+
+// The same for loops that are already inside a parallel region
+#if defined(_OPENMP)
+# define VECMAT3_SIMD_LOOP _Pragma("omp simd")
+#elif defined(__clang__)
+# define VECMAT3_SIMD_LOOP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+# define VECMAT3_SIMD_LOOP _Pragma("GCC ivdep")
+#else
+# define VECMAT3_SIMD_LOOP
+#endif
+
+// Other OpenMP directives, e.g. VECMAT3_OMP_PRAGMA(omp atomic)
+#if defined(_OPENMP)
+# define VECMAT3_OMP_PRAGMA(x) _Pragma(#x)
+#else
+# define VECMAT3_OMP_PRAGMA(x)
+#endif
+
+// Number of sweeps of the cyclic Jacobi method in eigensystem; each
+// sweep roughly squares the relative size of the off-diagonal
+// elements, so four suffice for double precision
+#ifndef VECMAT3_JACOBI_SWEEPS
+#define VECMAT3_JACOBI_SWEEPS 4
+#endif
+
+// Number of rows and columns of the tiles of the all-pairs kernels
+#ifndef VECMAT3_TILE_ROWS
+#define VECMAT3_TILE_ROWS 64
+#endif
+#ifndef VECMAT3_TILE_COLUMNS
+#define VECMAT3_TILE_COLUMNS 512
+#endif
+
+// Number of elements of the result of the all-pairs kernels from which
+// it is written with non-temporal stores, as it will not fit in the
+// cache anyway
+#ifndef VECMAT3_STREAM_MIN
+#define VECMAT3_STREAM_MIN 1048576
+#endif
+
+namespace vecmat3 {
+
+    // Whether a loop over num elements is worth dividing over threads
+    INLINE bool parallel( std::size_t num )
+    {
+        return num >= VECMAT3_PARALLEL_MIN;
+    }
+
+    //
+    // Matrix-vector products over arrays of vectors: rotate computes
+    // out[n] = m*in[n] and unrotate computes out[n] = Transpose(m)*in[n],
+    // which for a rotation matrix m undoes the rotation. Either m is a
+    // single matrix (expression), which is evaluated once, or there is
+    // a matrix for each element.
+    //
+
+    // Single matrix, arrays of vectors
+    template <typename T, typename A, int B, typename C>
+    INLINE void rotate( const Matrix<T,A,B,C>& m,
+                        const Vector<T>* in,
+                        Vector<T>* out,
+                        std::size_t num )
+    {
+        const Matrix<T> r(m);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = in[n].x, y = in[n].y, z = in[n].z;
+            out[n].x = r.xx*x + r.xy*y + r.xz*z;
+            out[n].y = r.yx*x + r.yy*y + r.yz*z;
+            out[n].z = r.zx*x + r.zy*y + r.zz*z;
+        }
+    }
+
+    template <typename T, typename A, int B, typename C>
+    INLINE void unrotate( const Matrix<T,A,B,C>& m,
+                          const Vector<T>* in,
+                          Vector<T>* out,
+                          std::size_t num )
+    {
+        rotate(Transpose(m), in, out, num);
+    }
+
+    // Array of matrices, arrays of vectors
+    template <typename T>
+    INLINE void rotate( const Matrix<T>* m,
+                        const Vector<T>* in,
+                        Vector<T>* out,
+                        std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = in[n].x, y = in[n].y, z = in[n].z;
+            out[n].x = m[n].xx*x + m[n].xy*y + m[n].xz*z;
+            out[n].y = m[n].yx*x + m[n].yy*y + m[n].yz*z;
+            out[n].z = m[n].zx*x + m[n].zy*y + m[n].zz*z;
+        }
+    }
+
+    template <typename T>
+    INLINE void unrotate( const Matrix<T>* m,
+                          const Vector<T>* in,
+                          Vector<T>* out,
+                          std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = in[n].x, y = in[n].y, z = in[n].z;
+            out[n].x = m[n].xx*x + m[n].yx*y + m[n].zx*z;
+            out[n].y = m[n].xy*x + m[n].yy*y + m[n].zy*z;
+            out[n].z = m[n].xz*x + m[n].yz*y + m[n].zz*z;
+        }
+    }
+
+    // Single matrix, structure-of-arrays vectors
+    template <typename T, typename A, int B, typename C>
+    INLINE void rotate( const Matrix<T,A,B,C>& m,
+                        const Vector<T,Base,ArrayOp,Base>& in,
+                        Vector<T,Base,ArrayOp,Base>& out )
+    {
+        const Matrix<T> r(m);
+        const T* ix = in.x; const T* iy = in.y; const T* iz = in.z;
+        T* ox = out.x; T* oy = out.y; T* oz = out.z;
+        std::size_t num = in.size();
+        assert(out.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = ix[n], y = iy[n], z = iz[n];
+            ox[n] = r.xx*x + r.xy*y + r.xz*z;
+            oy[n] = r.yx*x + r.yy*y + r.yz*z;
+            oz[n] = r.zx*x + r.zy*y + r.zz*z;
+        }
+    }
+
+    template <typename T, typename A, int B, typename C>
+    INLINE void unrotate( const Matrix<T,A,B,C>& m,
+                          const Vector<T,Base,ArrayOp,Base>& in,
+                          Vector<T,Base,ArrayOp,Base>& out )
+    {
+        rotate(Transpose(m), in, out);
+    }
+
+    // Structure-of-arrays matrices and vectors
+    template <typename T>
+    INLINE void rotate( const Matrix<T,Base,ArrayOp,Base>& m,
+                        const Vector<T,Base,ArrayOp,Base>& in,
+                        Vector<T,Base,ArrayOp,Base>& out )
+    {
+        const T* ix = in.x; const T* iy = in.y; const T* iz = in.z;
+        T* ox = out.x; T* oy = out.y; T* oz = out.z;
+        std::size_t num = in.size();
+        assert(m.size() == num && out.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = ix[n], y = iy[n], z = iz[n];
+            ox[n] = m.xx[n]*x + m.xy[n]*y + m.xz[n]*z;
+            oy[n] = m.yx[n]*x + m.yy[n]*y + m.yz[n]*z;
+            oz[n] = m.zx[n]*x + m.zy[n]*y + m.zz[n]*z;
+        }
+    }
+
+    template <typename T>
+    INLINE void unrotate( const Matrix<T,Base,ArrayOp,Base>& m,
+                          const Vector<T,Base,ArrayOp,Base>& in,
+                          Vector<T,Base,ArrayOp,Base>& out )
+    {
+        const T* ix = in.x; const T* iy = in.y; const T* iz = in.z;
+        T* ox = out.x; T* oy = out.y; T* oz = out.z;
+        std::size_t num = in.size();
+        assert(m.size() == num && out.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = ix[n], y = iy[n], z = iz[n];
+            ox[n] = m.xx[n]*x + m.yx[n]*y + m.zx[n]*z;
+            oy[n] = m.xy[n]*x + m.yy[n]*y + m.zy[n]*z;
+            oz[n] = m.xz[n]*x + m.yz[n]*y + m.zz[n]*z;
+        }
+    }
+
+    //
+    // Mixed precision: kernels for arrays of vectors that compute in
+    // a type S, which may be more precise than the element type T, so
+    // that e.g. positions can be stored as Vector<float> and updated
+    // in double precision. sum<S>(v) gives the sum of all v[n], dot<S>
+    // the sum of the inner products a[n]|b[n], and axpy(a, x, y) adds
+    // a*x[n] to y[n]. Sums only vectorize if compiled with OpenMP (or
+    // -ffast-math), because vectorizing them changes the order of the
+    // additions. Other elementwise updates can be written with
+    // Convert, e.g. pos = Convert<float>(Convert<double>(pos) + dt*vel);
+    //
+    template <typename S, typename T>
+    INLINE Vector<S> sum( const Vector<T>* v,
+                          std::size_t num )
+    {
+        S sumx = 0, sumy = 0, sumz = 0;
+        VECMAT3_PARALLEL_SUM_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            sumx += S(v[n].x);
+            sumy += S(v[n].y);
+            sumz += S(v[n].z);
+        }
+        return Vector<S>(sumx, sumy, sumz);
+    }
+
+    template <typename S, typename T>
+    INLINE Vector<S> sum( const Vector<T,Base,ArrayOp,Base>& v )
+    {
+        const T* vx = v.x; const T* vy = v.y; const T* vz = v.z;
+        std::size_t num = v.size();
+        S sumx = 0, sumy = 0, sumz = 0;
+        VECMAT3_PARALLEL_SUM_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            sumx += S(vx[n]);
+            sumy += S(vy[n]);
+            sumz += S(vz[n]);
+        }
+        return Vector<S>(sumx, sumy, sumz);
+    }
+
+    template <typename S, typename T>
+    INLINE S dot( const Vector<T>* a,
+                  const Vector<T>* b,
+                  std::size_t num )
+    {
+        S sumx = 0, sumy = 0, sumz = 0;
+        VECMAT3_PARALLEL_SUM_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            sumx += S(a[n].x)*S(b[n].x);
+            sumy += S(a[n].y)*S(b[n].y);
+            sumz += S(a[n].z)*S(b[n].z);
+        }
+        return sumx + sumy + sumz;
+    }
+
+    template <typename S, typename T>
+    INLINE S dot( const Vector<T,Base,ArrayOp,Base>& a,
+                  const Vector<T,Base,ArrayOp,Base>& b )
+    {
+        const T* ax = a.x; const T* ay = a.y; const T* az = a.z;
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        std::size_t num = a.size();
+        assert(b.size() == num);
+        S sumx = 0, sumy = 0, sumz = 0;
+        VECMAT3_PARALLEL_SUM_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            sumx += S(ax[n])*S(bx[n]);
+            sumy += S(ay[n])*S(by[n]);
+            sumz += S(az[n])*S(bz[n]);
+        }
+        return sumx + sumy + sumz;
+    }
+
+    // y[n] += a*x[n], evaluated in the type S of a and rounded once to
+    // the element type T
+    template <typename S, typename T>
+    INLINE void axpy( S a,
+                      const Vector<T>* x,
+                      Vector<T>* y,
+                      std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            y[n].x = T(fmadd(a, S(x[n].x), S(y[n].x)));
+            y[n].y = T(fmadd(a, S(x[n].y), S(y[n].y)));
+            y[n].z = T(fmadd(a, S(x[n].z), S(y[n].z)));
+        }
+    }
+
+    template <typename S, typename T>
+    INLINE void axpy( S a,
+                      const Vector<T,Base,ArrayOp,Base>& x,
+                      Vector<T,Base,ArrayOp,Base>& y )
+    {
+        const T* ix = x.x; const T* iy = x.y; const T* iz = x.z;
+        T* ox = y.x; T* oy = y.y; T* oz = y.z;
+        std::size_t num = x.size();
+        assert(y.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            ox[n] = T(fmadd(a, S(ix[n]), S(ox[n])));
+            oy[n] = T(fmadd(a, S(iy[n]), S(oy[n])));
+            oz[n] = T(fmadd(a, S(iz[n]), S(oz[n])));
+        }
+    }
+
+    //
+    // Inverses and linear solves for structure-of-arrays matrices. A
+    // matrix counts as singular when its determinant is at most tol
+    // times the product of the norms of its rows, which bounds the
+    // determinant from above. Instead of producing inf or nan, the
+    // result for a singular matrix is zero. If singular is not null,
+    // singular[n] tells whether m[n] was singular. The functions
+    // return the number of singular matrices.
+    //
+
+    // Default relative tolerance below which a matrix is singular
+    template <typename T>
+    INLINE T singularTolerance()
+    {
+        return 100*std::numeric_limits<T>::epsilon();
+    }
+
+    // Kernel of invert; whether singular is written is a template
+    // parameter because a test inside the loop prevents vectorization
+    template <typename T, bool MASK>
+    INLINE std::size_t invertKernel( const Matrix<T,Base,ArrayOp,Base>& m,
+                                     Matrix<T,Base,ArrayOp,Base>& out,
+                                     bool* singular,
+                                     T tol )
+    {
+        const T tol2 = tol*tol;
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myx = m.yx; const T* myy = m.yy; const T* myz = m.yz;
+        const T* mzx = m.zx; const T* mzy = m.zy; const T* mzz = m.zz;
+        T* oxx = out.xx; T* oxy = out.xy; T* oxz = out.xz;
+        T* oyx = out.yx; T* oyy = out.yy; T* oyz = out.yz;
+        T* ozx = out.zx; T* ozy = out.zy; T* ozz = out.zz;
+        std::size_t num = m.size();
+        assert(out.size() == num);
+        std::size_t count = 0;
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T xx = mxx[n], xy = mxy[n], xz = mxz[n];
+            T yx = myx[n], yy = myy[n], yz = myz[n];
+            T zx = mzx[n], zy = mzy[n], zz = mzz[n];
+            T cx = yy*zz-yz*zy, cy = yz*zx-yx*zz, cz = yx*zy-yy*zx;
+            T det = xx*cx + xy*cy + xz*cz;
+            T bound = (xx*xx+xy*xy+xz*xz)*(yx*yx+yy*yy+yz*yz)
+                     *(zx*zx+zy*zy+zz*zz);
+            bool bad = not (det*det > tol2*bound);
+            T s = select(bad, T(0), 1/select(bad, T(1), det));
+            oxx[n] = cx*s;
+            oxy[n] = (xz*zy-xy*zz)*s;
+            oxz[n] = (xy*yz-xz*yy)*s;
+            oyx[n] = cy*s;
+            oyy[n] = (xx*zz-xz*zx)*s;
+            oyz[n] = (xz*yx-xx*yz)*s;
+            ozx[n] = cz*s;
+            ozy[n] = (xy*zx-xx*zy)*s;
+            ozz[n] = (xx*yy-xy*yx)*s;
+            if (MASK)
+                singular[n] = bad;
+            count += bad;
+        }
+        return count;
+    }
+
+    // Sets out[n] = Inverse(m[n])
+    template <typename T>
+    INLINE std::size_t invert( const Matrix<T,Base,ArrayOp,Base>& m,
+                               Matrix<T,Base,ArrayOp,Base>& out,
+                               bool* singular = 0,
+                               T tol = singularTolerance<T>() )
+    {
+        if (singular)
+            return invertKernel<T,true>(m, out, singular, tol);
+        else
+            return invertKernel<T,false>(m, out, singular, tol);
+    }
+
+    // Kernel of solve, see invertKernel
+    template <typename T, bool MASK>
+    INLINE std::size_t solveKernel( const Matrix<T,Base,ArrayOp,Base>& m,
+                                    const Vector<T,Base,ArrayOp,Base>& b,
+                                    Vector<T,Base,ArrayOp,Base>& x,
+                                    bool* singular,
+                                    T tol )
+    {
+        const T tol2 = tol*tol;
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myx = m.yx; const T* myy = m.yy; const T* myz = m.yz;
+        const T* mzx = m.zx; const T* mzy = m.zy; const T* mzz = m.zz;
+        const T* ix = b.x; const T* iy = b.y; const T* iz = b.z;
+        T* ox = x.x; T* oy = x.y; T* oz = x.z;
+        std::size_t num = m.size();
+        assert(b.size() == num && x.size() == num);
+        std::size_t count = 0;
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T xx = mxx[n], xy = mxy[n], xz = mxz[n];
+            T yx = myx[n], yy = myy[n], yz = myz[n];
+            T zx = mzx[n], zy = mzy[n], zz = mzz[n];
+            T bx = ix[n], by = iy[n], bz = iz[n];
+            T ux = yy*zz-zy*yz, uy = zy*xz-xy*zz, uz = xy*yz-yy*xz; // c2^c3
+            T vx = yz*zx-zz*yx, vy = zz*xx-xz*zx, vz = xz*yx-yz*xx; // c3^c1
+            T wx = yx*zy-zx*yy, wy = zx*xy-xx*zy, wz = xx*yy-yx*xy; // c1^c2
+            T det = xx*ux + yx*uy + zx*uz;
+            T bound = (xx*xx+xy*xy+xz*xz)*(yx*yx+yy*yy+yz*yz)
+                     *(zx*zx+zy*zy+zz*zz);
+            bool bad = not (det*det > tol2*bound);
+            T s = select(bad, T(0), 1/select(bad, T(1), det));
+            ox[n] = (bx*ux + by*uy + bz*uz)*s;
+            oy[n] = (bx*vx + by*vy + bz*vz)*s;
+            oz[n] = (bx*wx + by*wy + bz*wz)*s;
+            if (MASK)
+                singular[n] = bad;
+            count += bad;
+        }
+        return count;
+    }
+
+    // Solves m[n]*x[n] = b[n] for x[n] by Cramer's rule, without
+    // forming the inverse: with c1, c2 and c3 the columns of m[n],
+    // x[n] = (b.(c2^c3), b.(c3^c1), b.(c1^c2))/c1.(c2^c3).
+    template <typename T>
+    INLINE std::size_t solve( const Matrix<T,Base,ArrayOp,Base>& m,
+                              const Vector<T,Base,ArrayOp,Base>& b,
+                              Vector<T,Base,ArrayOp,Base>& x,
+                              bool* singular = 0,
+                              T tol = singularTolerance<T>() )
+    {
+        if (singular)
+            return solveKernel<T,true>(m, b, x, singular, tol);
+        else
+            return solveKernel<T,false>(m, b, x, singular, tol);
+    }
+
+    //
+    // Rotation matrices from arrays of rotation vectors, i.e., the
+    // Rodrigues formula applied to each element. Written as
+    // 
+    //   R = cos(t) I + sinc(t) W + (1-cos(t))/t^2 v v^T
+    //
+    // with t = |v| and W the cross product matrix of v, such that v
+    // need not be normalized. The loops do not branch: both factors are
+    // computed from the sine and cosine of t/2 as sinc(t) =
+    // sinc(t/2)cos(t/2) and (1-cos(t))/t^2 = sinc(t/2)^2/2, and a
+    // series is used for sinc(t/2) for small angles.
+    //
+
+    // Nearest integer and largest integer not above x, as a T. Adding
+    // and subtracting 1.5/epsilon leaves x rounded to an integer (ties
+    // to even), which unlike nearbyint and floor is vectorized for any
+    // SSE2 target, and takes half the time of a conversion to int and
+    // back; |x| should be less than 0.5/epsilon, i.e., 2^51 for double
+    // and 2^22 for float. Compilers that reassociate sums (-ffast-math,
+    // icpc) or evaluate them in a wider type would drop the rounding,
+    // so these convert to int instead, and |x| should be less than 2^31.
+    #if defined(__FAST_MATH__) || defined(__INTEL_COMPILER) \
+        || (defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0)
+    template <typename T>
+    INLINE T roundInt( T x )
+    {
+        return T(int(x + select(x < 0, T(-0.5), T(0.5))));
+    }
+
+    template <typename T>
+    INLINE T floorInt( T x )
+    {
+        T t = T(int(x));
+        return select(t > x, t - 1, t);
+    }
+    #else
+    template <typename T>
+    INLINE T roundInt( T x )
+    {
+        const T shift = T(1.5)/std::numeric_limits<T>::epsilon();
+        return (x + shift) - shift;
+    }
+
+    template <typename T>
+    INLINE T floorInt( T x )
+    {
+        T t = roundInt(x);
+        return select(t > x, t - 1, t);
+    }
+    #endif
+
+    // Subtraction of r times pi/2 from x, with pi/2 split in parts
+    // whose products with integers r are exact in T
+    template <typename T>
+    struct HalfPiReduction
+    {
+        static INLINE T reduce( T x, T r )
+        {
+            return (((x - r*T(1.5703125)) - r*T(4.837512969970703125E-4))
+                    - r*T(7.549790126404332E-8)) - r*T(-1.7151244994428829E-15);
+        }
+    };
+
+    template <>
+    struct HalfPiReduction<float>
+    {
+        static INLINE float reduce( float x, float r )
+        {
+            return ((x - r*1.5703125f) - r*4.837512969970703125E-4f)
+                   - r*7.54978995489188216E-8f;
+        }
+    };
+
+    // Sine and cosine computed with polynomials, which, unlike sin and
+    // cos from the standard library, can be vectorized by compilers. x
+    // is reduced to [-pi/4,pi/4] by subtracting a multiple of pi/2
+    // represented in parts, so results are accurate to the last bit or
+    // so for |x| up to about 1E5 (about 8000 for float). Beyond 1E9,
+    // and for inf and nan, the results are meaningless (nan for the
+    // latter two), but the quadrant still fits in an int.
+    template <typename T>
+    INLINE void polySincos( T x, T& s, T& c )
+    {
+        T k = x*T(0.63661977236758134308);   // 2/pi
+        k = std::min(T(1E9), std::max(T(-1E9), k));   // also for nan
+        int q = int(k + select(k < 0, T(-0.5), T(0.5)));
+        T r = HalfPiReduction<T>::reduce(x, T(q));
+        T z = r*r;
+        T sr = r + r*z*((((((T(1.58962301576546568060E-10)*z
+                            - T(2.50507477628578072866E-8))*z
+                            + T(2.75573136213857245213E-6))*z
+                            - T(1.98412698295895385996E-4))*z
+                            + T(8.33333333332211858878E-3))*z
+                            - T(1.66666666666666307295E-1)));
+        T cr = 1 - T(0.5)*z + z*z*((((((T(-1.13585365213876817300E-11)*z
+                                      + T(2.08757008419747316778E-9))*z
+                                      - T(2.75573141792967388112E-7))*z
+                                      + T(2.48015872888517045348E-5))*z
+                                      - T(1.38888888888730564116E-3))*z
+                                      + T(4.16666666666665929218E-2)));
+        // quadrant q mod 4: (s,c) = (sr,cr), (cr,-sr), (-sr,-cr), (-cr,sr)
+        bool swap = (q & 1) != 0;
+        T ss = select(swap, cr, sr);
+        T cc = select(swap, sr, cr);
+        s = select((q & 2) != 0, -ss, ss);
+        c = select(((q+1) & 2) != 0, -cc, cc);
+    }
+
+    // Rotation matrix for the rotation vector (x,y,z)
+    template <typename T>
+    INLINE Matrix<T> rodriguesKernel( T x, T y, T z )
+    {
+        T h2 = T(0.25)*(x*x + y*y + z*z);    // (t/2)^2
+        T h = sqrt(h2);
+        T sh, ch;
+        polySincos(h, sh, ch);
+        // for t/2<1E-2, the next term of the series is below 1E-21
+        bool small = h2 < T(1E-4);
+        T sinch = select(small,
+                         1 - h2*(T(1)/6 - h2*(T(1)/120 - h2*(T(1)/5040))),
+                         sh/select(small, T(1), h));
+        T a = sinch*ch;                      // sin(t)/t
+        T b = T(0.5)*sinch*sinch;            // (1-cos(t))/t^2
+        T c = 1 - 2*sh*sh;                   // cos(t)
+        T bxy = b*x*y, bxz = b*x*z, byz = b*y*z;
+        T ax = a*x, ay = a*y, az = a*z;
+        return Matrix<T>(c+b*x*x, bxy-az,  bxz+ay,
+                         bxy+az,  c+b*y*y, byz-ax,
+                         bxz-ay,  byz+ax,  c+b*z*z);
+    }
+
+    // Sets out[n] = Rodrigues(v[n]) for arrays of vectors and matrices
+    template <typename T>
+    INLINE void Rodrigues( const Vector<T>* v,
+                           Matrix<T>* out,
+                           std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = rodriguesKernel(v[n].x, v[n].y, v[n].z);
+    }
+
+    // Sets out[n] = Rodrigues(v[n]) for structure-of-arrays vectors
+    // and matrices
+    template <typename T>
+    INLINE void Rodrigues( const Vector<T,Base,ArrayOp,Base>& v,
+                           Matrix<T,Base,ArrayOp,Base>& out )
+    {
+        const T* vx = v.x; const T* vy = v.y; const T* vz = v.z;
+        T* oxx = out.xx; T* oxy = out.xy; T* oxz = out.xz;
+        T* oyx = out.yx; T* oyy = out.yy; T* oyz = out.yz;
+        T* ozx = out.zx; T* ozy = out.zy; T* ozz = out.zz;
+        std::size_t num = v.size();
+        assert(out.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> r = rodriguesKernel(vx[n], vy[n], vz[n]);
+            oxx[n] = r.xx; oxy[n] = r.xy; oxz[n] = r.xz;
+            oyx[n] = r.yx; oyy[n] = r.yy; oyz[n] = r.yz;
+            ozx[n] = r.zx; ozy[n] = r.zy; ozz[n] = r.zz;
+        }
+    }
+
+    // Arctangent computed with a rational approximation, which can be
+    // vectorized by compilers. As in the Cephes library, x is reduced
+    // to |x| < 0.66 using atan(x) = pi/2 + atan(-1/x) for |x| >
+    // tan(3pi/8) and atan(x) = pi/4 + atan((x-1)/(x+1)) for |x| > 0.66.
+    template <typename T>
+    INLINE T polyAtan( T x )
+    {
+        T ax = absval(x);
+        bool big = ax > T(2.41421356237309504880);
+        bool mid = ax > T(0.66);
+        T r = select(big, T(-1), select(mid, ax-1, ax))
+            / select(big, ax, select(mid, ax+1, T(1)));
+        T y = select(big, T(1.57079632679489661923) + T(6.123233995736765886130E-17),
+                     select(mid, T(0.78539816339744830962) + T(3.061616997868382943065E-17), 
+                            T(0)));
+        T z = r*r;
+        T p = (((T(-8.750608600031904122785E-1)*z 
+                 - T(1.615753718733365076637E1))*z
+                 - T(7.500855792314704667340E1))*z
+                 - T(1.228866684490136173410E2))*z
+                 - T(6.485021904942025371773E1);
+        T q = ((((z + T(2.485846490142306297962E1))*z
+                    + T(1.650270098316988542046E2))*z
+                    + T(4.328810604912902668951E2))*z
+                    + T(4.853903996359136964868E2))*z
+                    + T(1.945506571482613964425E2);
+        T a = y + (r + r*z*p/q);
+        return select(x < 0, -a, a);
+    }
+
+    //
+    // Interpolation between arrays of unit quaternions, along the
+    // shortest arc: out[n] is the quaternion a fraction t (or t[n]) of
+    // the way from q1[n] to q2[n]. nlerp interpolates linearly and
+    // normalizes, which is cheaper but does not have a constant angular
+    // velocity, slerp interpolates along the great circle. Both
+    // vectorize.
+    //
+
+    // Quaternion interpolated linearly between a and b and normalized
+    template <typename T>
+    INLINE Quaternion<T> nlerpKernel( const Quaternion<T>& a,
+                                      const Quaternion<T>& b,
+                                      T t )
+    {
+        T wb = select((a|b) < 0, -t, t);
+        T wa = 1 - t;
+        T w = wa*a.w + wb*b.w, x = wa*a.x + wb*b.x;
+        T y = wa*a.y + wb*b.y, z = wa*a.z + wb*b.z;
+        T s = 1/sqrt(w*w + x*x + y*y + z*z);
+        return Quaternion<T>(w*s, x*s, y*s, z*s);
+    }
+
+    // Quaternion interpolated between a and b along the great circle
+    template <typename T>
+    INLINE Quaternion<T> slerpKernel( const Quaternion<T>& a,
+                                      const Quaternion<T>& b,
+                                      T t )
+    {
+        T sign = select((a|b) < 0, T(-1), T(1));
+        T bw = sign*b.w, bx = sign*b.x, by = sign*b.y, bz = sign*b.z;
+        // the angle phi between a and b follows from |a-b|=2sin(phi/2)
+        // and |a+b|=2cos(phi/2), with |a+b|>=sqrt(2)
+        T dm = sqr(a.w-bw) + sqr(a.x-bx) + sqr(a.y-by) + sqr(a.z-bz);
+        T dp = sqr(a.w+bw) + sqr(a.x+bx) + sqr(a.y+by) + sqr(a.z+bz);
+        T phi = 2*polyAtan(sqrt(dm/dp));
+        T s, c, sa, sb;
+        polySincos(phi, s, c);
+        polySincos((1-t)*phi, sa, c);
+        polySincos(t*phi, sb, c);
+        bool zero = s == 0;
+        T div = select(zero, T(1), s);
+        T wa = select(zero, 1-t, sa/div);
+        T wb = select(zero, t, sb/div);
+        return Quaternion<T>(wa*a.w + wb*bw, wa*a.x + wb*bx,
+                             wa*a.y + wb*by, wa*a.z + wb*bz);
+    }
+
+    // nlerp with the same t for all elements
+    template <typename T>
+    INLINE void nlerp( const Quaternion<T>* q1,
+                       const Quaternion<T>* q2,
+                       T t,
+                       Quaternion<T>* out,
+                       std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = nlerpKernel(q1[n], q2[n], t);
+    }
+
+    // nlerp with a t for each element
+    template <typename T>
+    INLINE void nlerp( const Quaternion<T>* q1,
+                       const Quaternion<T>* q2,
+                       const T* t,
+                       Quaternion<T>* out,
+                       std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = nlerpKernel(q1[n], q2[n], t[n]);
+    }
+
+    // slerp with the same t for all elements
+    template <typename T>
+    INLINE void slerp( const Quaternion<T>* q1,
+                       const Quaternion<T>* q2,
+                       T t,
+                       Quaternion<T>* out,
+                       std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = slerpKernel(q1[n], q2[n], t);
+    }
+
+    // slerp with a t for each element
+    template <typename T>
+    INLINE void slerp( const Quaternion<T>* q1,
+                       const Quaternion<T>* q2,
+                       const T* t,
+                       Quaternion<T>* out,
+                       std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = slerpKernel(q1[n], q2[n], t[n]);
+    }
+
+    //
+    // Eigenvalues and eigenvectors of symmetric matrices, of which only
+    // the elements on and above the diagonal are used. eigenvalues
+    // solves the characteristic equation in closed form, which is fast
+    // but not accurate for eigenvalues that are small compared to the
+    // largest one, nor for nearly equal ones, whose error can be of
+    // the order of the square root of the machine precision. eigensystem
+    // instead diagonalizes with VECMAT3_JACOBI_SWEEPS sweeps of the
+    // cyclic Jacobi method, which is also accurate for small
+    // eigenvalues, and returns the eigenvectors as the columns of a
+    // rotation matrix. The eigenvalues are sorted in increasing order.
+    // The kernels do not branch, so that the array versions vectorize.
+    //
+
+    // Eigenvalues of the symmetric matrix with upper triangle xx..zz.
+    // With q the mean of the eigenvalues and p their standard deviation,
+    // the eigenvalues are q+2p*cos(phi+2k*pi/3), where cos(3*phi) =
+    // det((m-qI)/p)/2.
+    template <typename T>
+    INLINE Vector<T> eigenvaluesKernel( T xx, T xy, T xz,
+                                              T yy, T yz,
+                                                    T zz )
+    {
+        T q = (xx + yy + zz)/3;
+        T dx = xx - q, dy = yy - q, dz = zz - q;
+        T p2 = (dx*dx + dy*dy + dz*dz + 2*(xy*xy + xz*xz + yz*yz))/6;
+        bool zero = not (p2 > 0);
+        T p = sqrt(p2);
+        T ip = select(zero, T(0), 1/select(zero, T(1), p));
+        T bx = dx*ip, by = dy*ip, bz = dz*ip;
+        T bxy = xy*ip, bxz = xz*ip, byz = yz*ip;
+        T r = T(0.5)*(bx*(by*bz - byz*byz) - bxy*(bxy*bz - byz*bxz)
+                      + bxz*(bxy*byz - by*bxz));
+        r = select(r < -1, T(-1), select(r > 1, T(1), r));
+        // acos(r) = 2*atan(sqrt((1-r)/(1+r))), with 1+r kept positive
+        const T tiny = std::numeric_limits<T>::min();
+        T phi = T(2)/3*polyAtan(sqrt((1 - r)/select(1 + r > tiny, 1 + r, tiny)));
+        T s, c;
+        polySincos(phi, s, c);
+        T largest = q + 2*p*c;
+        T smallest = q - p*(c + T(1.73205080756887729353)*s);
+        return Vector<T>(smallest, 3*q - largest - smallest, largest);
+    }
+
+    // Jacobi rotation in the (p,q) plane that zeroes element apq of a
+    // symmetric matrix, with arp and arq the other elements in row r.
+    // The rotation is accumulated in columns p and q of v, whose
+    // elements in row k are vkp and vkq.
+    template <typename T>
+    INLINE void jacobiRotation( T& app, T& aqq, T& apq, T& arp, T& arq,
+                                T& v0p, T& v0q, T& v1p, T& v1q, T& v2p, T& v2q )
+    {
+        // t = tan(theta) of the smaller of the angles that work
+        T d = aqq - app;
+        T den = absval(d) + sqrt(d*d + 4*apq*apq);
+        bool zero = not (den > 0);
+        T t = select(zero, T(0), 2*apq/select(zero, T(1), den));
+        t = select(d < 0, -t, t);
+        T c = 1/sqrt(1 + t*t);
+        T s = t*c;
+        app -= t*apq;
+        aqq += t*apq;
+        apq = 0;
+        T rp = arp, rq = arq;
+        arp = c*rp - s*rq;
+        arq = s*rp + c*rq;
+        T kp, kq;
+        kp = v0p; kq = v0q; v0p = c*kp - s*kq; v0q = s*kp + c*kq;
+        kp = v1p; kq = v1q; v1p = c*kp - s*kq; v1q = s*kp + c*kq;
+        kp = v2p; kq = v2q; v2p = c*kp - s*kq; v2q = s*kp + c*kq;
+    }
+
+    // N sweeps of Jacobi rotations over the three off-diagonal
+    // elements, written out rather than as a loop, so that the loops
+    // over arrays of matrices vectorize
+    template <int N>
+    struct JacobiSweeps
+    {
+        template <typename T>
+        static INLINE void apply( T& xx, T& xy, T& xz, T& yy, T& yz, T& zz, Matrix<T>& v )
+        {
+            jacobiRotation(xx, yy, xy, xz, yz, v.xx, v.xy, v.yx, v.yy, v.zx, v.zy);
+            jacobiRotation(xx, zz, xz, xy, yz, v.xx, v.xz, v.yx, v.yz, v.zx, v.zz);
+            jacobiRotation(yy, zz, yz, xy, xz, v.xy, v.xz, v.yy, v.yz, v.zy, v.zz);
+            JacobiSweeps<N-1>::apply(xx, xy, xz, yy, yz, zz, v);
+        }
+    };
+
+    template <>
+    struct JacobiSweeps<0>
+    {
+        template <typename T>
+        static INLINE void apply( T&, T&, T&, T&, T&, T&, Matrix<T>& ) {}
+    };
+
+    // Swaps eigenvalues a and b, and columns va and vb of the
+    // eigenvectors, if a > b
+    template <typename T>
+    INLINE void eigenSort( T& a, T& b, T& va0, T& vb0, T& va1, T& vb1, T& va2, T& vb2 )
+    {
+        bool swap = a > b;
+        T t;
+        t = a;   a   = select(swap, b,   a);   b   = select(swap, t, b);
+        t = va0; va0 = select(swap, vb0, va0); vb0 = select(swap, t, vb0);
+        t = va1; va1 = select(swap, vb1, va1); vb1 = select(swap, t, vb1);
+        t = va2; va2 = select(swap, vb2, va2); vb2 = select(swap, t, vb2);
+    }
+
+    // Eigenvalues and eigenvectors of the symmetric matrix with upper
+    // triangle xx..zz, by the cyclic Jacobi method
+    template <typename T>
+    INLINE void eigensystemKernel( T xx, T xy, T xz,
+                                         T yy, T yz,
+                                               T zz,
+                                   Vector<T>& values,
+                                   Matrix<T>& v )
+    {
+        v = Matrix<T>(1, 0, 0,
+                      0, 1, 0,
+                      0, 0, 1);
+        JacobiSweeps<VECMAT3_JACOBI_SWEEPS>::apply(xx, xy, xz, yy, yz, zz, v);
+        eigenSort(xx, yy, v.xx, v.xy, v.yx, v.yy, v.zx, v.zy);
+        eigenSort(yy, zz, v.xy, v.xz, v.yy, v.yz, v.zy, v.zz);
+        eigenSort(xx, yy, v.xx, v.xy, v.yx, v.yy, v.zx, v.zy);
+        // sorting may have made v a reflection
+        T det = v.xz*(v.yx*v.zy - v.zx*v.yy) + v.yz*(v.zx*v.xy - v.xx*v.zy)
+              + v.zz*(v.xx*v.yy - v.yx*v.xy);
+        T sign = select(det < 0, T(-1), T(1));
+        v.xz *= sign; v.yz *= sign; v.zz *= sign;
+        values = Vector<T>(xx, yy, zz);
+    }
+
+    // Eigenvalues of the symmetric matrix (expression) m
+    template <typename T, typename A, int B, typename C>
+    INLINE Vector<T> eigenvalues( const Matrix<T,A,B,C>& m )
+    {
+        prepared(m);
+        return eigenvaluesKernel(m.template eval<0,0>(), m.template eval<0,1>(), m.template eval<0,2>(),
+                                 m.template eval<1,1>(), m.template eval<1,2>(),
+                                 m.template eval<2,2>());
+    }
+
+    // Eigenvalues and eigenvectors, the columns of 'vectors', of the
+    // symmetric matrix (expression) m, i.e., m = vectors*Diagonal(values)*Transpose(vectors)
+    template <typename T, typename A, int B, typename C>
+    INLINE void eigensystem( const Matrix<T,A,B,C>& m,
+                             Vector<T>& values,
+                             Matrix<T>& vectors )
+    {
+        prepared(m);
+        eigensystemKernel(m.template eval<0,0>(), m.template eval<0,1>(), m.template eval<0,2>(),
+                          m.template eval<1,1>(), m.template eval<1,2>(),
+                          m.template eval<2,2>(), values, vectors);
+    }
+
+    // Sets values[n] to the eigenvalues of m[n], for arrays of matrices
+    template <typename T>
+    INLINE void eigenvalues( const Matrix<T>* m,
+                             Vector<T>* values,
+                             std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            values[n] = eigenvaluesKernel(m[n].xx, m[n].xy, m[n].xz,
+                                          m[n].yy, m[n].yz, m[n].zz);
+    }
+
+    // Sets values[n] and vectors[n] to the eigenvalues and eigenvectors
+    // of m[n], for arrays of matrices
+    template <typename T>
+    INLINE void eigensystem( const Matrix<T>* m,
+                             Vector<T>* values,
+                             Matrix<T>* vectors,
+                             std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Vector<T> e;
+            Matrix<T> v;
+            eigensystemKernel(m[n].xx, m[n].xy, m[n].xz,
+                              m[n].yy, m[n].yz, m[n].zz, e, v);
+            values[n] = e;
+            vectors[n] = v;
+        }
+    }
+
+    // The same for structure-of-arrays matrices and vectors
+    template <typename T>
+    INLINE void eigenvalues( const Matrix<T,Base,ArrayOp,Base>& m,
+                             Vector<T,Base,ArrayOp,Base>& values )
+    {
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myy = m.yy; const T* myz = m.yz; const T* mzz = m.zz;
+        T* ox = values.x; T* oy = values.y; T* oz = values.z;
+        std::size_t num = m.size();
+        assert(values.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Vector<T> e = eigenvaluesKernel(mxx[n], mxy[n], mxz[n],
+                                            myy[n], myz[n], mzz[n]);
+            ox[n] = e.x; oy[n] = e.y; oz[n] = e.z;
+        }
+    }
+
+    template <typename T>
+    INLINE void eigensystem( const Matrix<T,Base,ArrayOp,Base>& m,
+                             Vector<T,Base,ArrayOp,Base>& values,
+                             Matrix<T,Base,ArrayOp,Base>& vectors )
+    {
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myy = m.yy; const T* myz = m.yz; const T* mzz = m.zz;
+        T* ox = values.x; T* oy = values.y; T* oz = values.z;
+        T* oxx = vectors.xx; T* oxy = vectors.xy; T* oxz = vectors.xz;
+        T* oyx = vectors.yx; T* oyy = vectors.yy; T* oyz = vectors.yz;
+        T* ozx = vectors.zx; T* ozy = vectors.zy; T* ozz = vectors.zz;
+        std::size_t num = m.size();
+        assert(values.size() == num && vectors.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Vector<T> e;
+            Matrix<T> v;
+            eigensystemKernel(mxx[n], mxy[n], mxz[n],
+                              myy[n], myz[n], mzz[n], e, v);
+            ox[n] = e.x; oy[n] = e.y; oz[n] = e.z;
+            oxx[n] = v.xx; oxy[n] = v.xy; oxz[n] = v.xz;
+            oyx[n] = v.yx; oyy[n] = v.yy; oyz[n] = v.yz;
+            ozx[n] = v.zx; ozy[n] = v.zy; ozz[n] = v.zz;
+        }
+    }
+
+    //
+    // Singular value and polar decompositions. svd writes a matrix a
+    // as u*Diagonal(s)*Transpose(v), with u and v rotation matrices and
+    // s.x >= s.y >= |s.z|, where s.z < 0 if det(a) < 0. The columns of
+    // v are the eigenvectors of Transpose(a)*a, found with the Jacobi
+    // kernel of eigensystem, and u and s follow from a QR
+    // decomposition of a*v by Givens rotations, as in McAdams et al.,
+    // "Computing the singular value decomposition of 3x3 matrices with
+    // minimal branching and elementary floating point operations"
+    // (2011). Small singular values have an absolute accuracy of order
+    // the machine precision times s.x. polar writes a as r*p, with r
+    // the rotation matrix closest to a and p symmetric, so that for a
+    // deformation gradient, r is the rotation and p the stretch.
+    //
+
+    // Givens rotation that zeroes element (q,k) of b against (p,k),
+    // applied to rows p and q of b and accumulated in columns p and q
+    // of u, so that u*b stays the same. The arguments are rows p and q
+    // of b and columns p and q of u.
+    template <typename T>
+    INLINE void givensRotation( T& bp0, T& bp1, T& bp2, T& bq0, T& bq1, T& bq2,
+                                T& u0p, T& u1p, T& u2p, T& u0q, T& u1q, T& u2q,
+                                T bpk, T bqk )
+    {
+        T rho2 = bpk*bpk + bqk*bqk;
+        bool zero = not (rho2 > std::numeric_limits<T>::min());
+        T ir = 1/sqrt(select(zero, T(1), rho2));
+        T c = select(zero, T(1), bpk*ir);
+        T s = select(zero, T(0), bqk*ir);
+        T p, q;
+        p = bp0; q = bq0; bp0 = c*p + s*q; bq0 = c*q - s*p;
+        p = bp1; q = bq1; bp1 = c*p + s*q; bq1 = c*q - s*p;
+        p = bp2; q = bq2; bp2 = c*p + s*q; bq2 = c*q - s*p;
+        p = u0p; q = u0q; u0p = c*p + s*q; u0q = c*q - s*p;
+        p = u1p; q = u1q; u1p = c*p + s*q; u1q = c*q - s*p;
+        p = u2p; q = u2q; u2p = c*p + s*q; u2q = c*q - s*p;
+    }
+
+    // Singular value decomposition a = u*Diagonal(s)*Transpose(v)
+    template <typename T>
+    INLINE void svdKernel( const Matrix<T>& a, Matrix<T>& u, Vector<T>& s, Matrix<T>& v )
+    {
+        // eigenvectors of a^T a, in order of decreasing eigenvalue; the
+        // middle column changes sign to keep v a rotation
+        Vector<T> l;
+        Matrix<T> w;
+        eigensystemKernel(a.xx*a.xx + a.yx*a.yx + a.zx*a.zx,
+                          a.xx*a.xy + a.yx*a.yy + a.zx*a.zy,
+                          a.xx*a.xz + a.yx*a.yz + a.zx*a.zz,
+                          a.xy*a.xy + a.yy*a.yy + a.zy*a.zy,
+                          a.xy*a.xz + a.yy*a.yz + a.zy*a.zz,
+                          a.xz*a.xz + a.yz*a.yz + a.zz*a.zz, l, w);
+        v = Matrix<T>(w.xz, -w.xy, w.xx,
+                      w.yz, -w.yy, w.yx,
+                      w.zz, -w.zy, w.zx);
+        // the columns of b = a*v are orthogonal, with decreasing norms;
+        // the QR decomposition b = u*r then has a diagonal r
+        Matrix<T> b = a*v;
+        u = Matrix<T>(1, 0, 0,
+                      0, 1, 0,
+                      0, 0, 1);
+        givensRotation(b.xx, b.xy, b.xz, b.yx, b.yy, b.yz,
+                       u.xx, u.yx, u.zx, u.xy, u.yy, u.zy, b.xx, b.yx);
+        givensRotation(b.xx, b.xy, b.xz, b.zx, b.zy, b.zz,
+                       u.xx, u.yx, u.zx, u.xz, u.yz, u.zz, b.xx, b.zx);
+        givensRotation(b.yx, b.yy, b.yz, b.zx, b.zy, b.zz,
+                       u.xy, u.yy, u.zy, u.xz, u.yz, u.zz, b.yy, b.zy);
+        s = Vector<T>(b.xx, b.yy, b.zz);
+    }
+
+    // Polar decomposition a = r*p, from the singular value decomposition
+    template <typename T>
+    INLINE void polarKernel( const Matrix<T>& a, Matrix<T>& r, Matrix<T>& p )
+    {
+        Matrix<T> u, v;
+        Vector<T> s;
+        svdKernel(a, u, s, v);
+        r = u*Transpose(v);
+        Vector<T> sx = s.x*v.column(0), sy = s.y*v.column(1), sz = s.z*v.column(2);
+        p.xx = sx.x*v.xx + sy.x*v.xy + sz.x*v.xz;
+        p.xy = sx.x*v.yx + sy.x*v.yy + sz.x*v.yz;
+        p.xz = sx.x*v.zx + sy.x*v.zy + sz.x*v.zz;
+        p.yy = sx.y*v.yx + sy.y*v.yy + sz.y*v.yz;
+        p.yz = sx.y*v.zx + sy.y*v.zy + sz.y*v.zz;
+        p.zz = sx.z*v.zx + sy.z*v.zy + sz.z*v.zz;
+        p.yx = p.xy; p.zx = p.xz; p.zy = p.yz;
+    }
+
+    // Singular value decomposition of the matrix (expression) m
+    template <typename T, typename A, int B, typename C>
+    INLINE void svd( const Matrix<T,A,B,C>& m,
+                     Matrix<T>& u,
+                     Vector<T>& s,
+                     Matrix<T>& v )
+    {
+        svdKernel(Matrix<T>(m), u, s, v);
+    }
+
+    // Polar decomposition of the matrix (expression) m
+    template <typename T, typename A, int B, typename C>
+    INLINE void polar( const Matrix<T,A,B,C>& m,
+                       Matrix<T>& r,
+                       Matrix<T>& p )
+    {
+        polarKernel(Matrix<T>(m), r, p);
+    }
+
+    // Sets u[n], s[n] and v[n] to the singular value decomposition of
+    // m[n], for arrays of matrices
+    template <typename T>
+    INLINE void svd( const Matrix<T>* m,
+                     Matrix<T>* u,
+                     Vector<T>* s,
+                     Matrix<T>* v,
+                     std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> un, vn;
+            Vector<T> sn;
+            svdKernel(m[n], un, sn, vn);
+            u[n] = un;
+            s[n] = sn;
+            v[n] = vn;
+        }
+    }
+
+    // Sets r[n] and p[n] to the polar decomposition of m[n], for arrays
+    // of matrices
+    template <typename T>
+    INLINE void polar( const Matrix<T>* m,
+                       Matrix<T>* r,
+                       Matrix<T>* p,
+                       std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> rn, pn;
+            polarKernel(m[n], rn, pn);
+            r[n] = rn;
+            p[n] = pn;
+        }
+    }
+
+    // The same for structure-of-arrays matrices and vectors
+    template <typename T>
+    INLINE void svd( const Matrix<T,Base,ArrayOp,Base>& m,
+                     Matrix<T,Base,ArrayOp,Base>& u,
+                     Vector<T,Base,ArrayOp,Base>& s,
+                     Matrix<T,Base,ArrayOp,Base>& v )
+    {
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myx = m.yx; const T* myy = m.yy; const T* myz = m.yz;
+        const T* mzx = m.zx; const T* mzy = m.zy; const T* mzz = m.zz;
+        T* uxx = u.xx; T* uxy = u.xy; T* uxz = u.xz;
+        T* uyx = u.yx; T* uyy = u.yy; T* uyz = u.yz;
+        T* uzx = u.zx; T* uzy = u.zy; T* uzz = u.zz;
+        T* sx = s.x; T* sy = s.y; T* sz = s.z;
+        T* vxx = v.xx; T* vxy = v.xy; T* vxz = v.xz;
+        T* vyx = v.yx; T* vyy = v.yy; T* vyz = v.yz;
+        T* vzx = v.zx; T* vzy = v.zy; T* vzz = v.zz;
+        std::size_t num = m.size();
+        assert(u.size() == num && s.size() == num && v.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> un, vn;
+            Vector<T> sn;
+            svdKernel(Matrix<T>(mxx[n], mxy[n], mxz[n],
+                                myx[n], myy[n], myz[n],
+                                mzx[n], mzy[n], mzz[n]), un, sn, vn);
+            uxx[n] = un.xx; uxy[n] = un.xy; uxz[n] = un.xz;
+            uyx[n] = un.yx; uyy[n] = un.yy; uyz[n] = un.yz;
+            uzx[n] = un.zx; uzy[n] = un.zy; uzz[n] = un.zz;
+            sx[n] = sn.x; sy[n] = sn.y; sz[n] = sn.z;
+            vxx[n] = vn.xx; vxy[n] = vn.xy; vxz[n] = vn.xz;
+            vyx[n] = vn.yx; vyy[n] = vn.yy; vyz[n] = vn.yz;
+            vzx[n] = vn.zx; vzy[n] = vn.zy; vzz[n] = vn.zz;
+        }
+    }
+
+    template <typename T>
+    INLINE void polar( const Matrix<T,Base,ArrayOp,Base>& m,
+                       Matrix<T,Base,ArrayOp,Base>& r,
+                       Matrix<T,Base,ArrayOp,Base>& p )
+    {
+        const T* mxx = m.xx; const T* mxy = m.xy; const T* mxz = m.xz;
+        const T* myx = m.yx; const T* myy = m.yy; const T* myz = m.yz;
+        const T* mzx = m.zx; const T* mzy = m.zy; const T* mzz = m.zz;
+        T* rxx = r.xx; T* rxy = r.xy; T* rxz = r.xz;
+        T* ryx = r.yx; T* ryy = r.yy; T* ryz = r.yz;
+        T* rzx = r.zx; T* rzy = r.zy; T* rzz = r.zz;
+        T* pxx = p.xx; T* pxy = p.xy; T* pxz = p.xz;
+        T* pyx = p.yx; T* pyy = p.yy; T* pyz = p.yz;
+        T* pzx = p.zx; T* pzy = p.zy; T* pzz = p.zz;
+        std::size_t num = m.size();
+        assert(r.size() == num && p.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> rn, pn;
+            polarKernel(Matrix<T>(mxx[n], mxy[n], mxz[n],
+                                  myx[n], myy[n], myz[n],
+                                  mzx[n], mzy[n], mzz[n]), rn, pn);
+            rxx[n] = rn.xx; rxy[n] = rn.xy; rxz[n] = rn.xz;
+            ryx[n] = rn.yx; ryy[n] = rn.yy; ryz[n] = rn.yz;
+            rzx[n] = rn.zx; rzy[n] = rn.zy; rzz[n] = rn.zz;
+            pxx[n] = pn.xx; pxy[n] = pn.xy; pxz[n] = pn.xz;
+            pyx[n] = pn.yx; pyy[n] = pn.yy; pyz[n] = pn.yz;
+            pzx[n] = pn.zx; pzy[n] = pn.zy; pzz[n] = pn.zz;
+        }
+    }
+
+    //
+    // Reorthogonalization of arrays of rotation matrices, which drift
+    // away from orthogonality by round-off when they are updated many
+    // times. The method is one of
+    //
+    //   GramSchmidt       normalize the first row, orthogonalize the
+    //                     second row to it and normalize it, and set
+    //                     the third row to their cross product, as
+    //                     one pass of Matrix::reorthogonalize(), which
+    //                     repeats such passes until the determinant is
+    //                     one;
+    //   NewtonGramSchmidt the same, but normalizing with rsqrtNearOne,
+    //                     which takes no square root or division; this
+    //                     only works for rows whose norms are close to
+    //                     one, and each pass squares their deviation;
+    //   PolarProjection   replace each matrix by the rotation of its
+    //                     polar decomposition, the nearest orthogonal
+    //                     matrix, using the SVD (slower, but it does not
+    //                     favour the first row).
+    //
+    // If the tolerance tol is positive, matrices whose orthogonality
+    // error (see orthogonalityError) is at most tol are left as they
+    // are, and passes stop once no matrix exceeds tol; otherwise,
+    // exactly 'iterations' passes are made over all matrices. Either
+    // way, the loops have no branches and vectorize. The functions
+    // return the number of matrices that exceeded the tolerance (or
+    // the number of matrices if tol is not positive).
+    //
+    enum Reorthogonalization { GramSchmidt, NewtonGramSchmidt, PolarProjection };
+
+    // 1/sqrt(x) for x close to one, by a Newton step starting from
+    // one; the relative error is about 3/8*(x-1)^2
+    template <typename T>
+    INLINE T rsqrtNearOne( T x )
+    {
+        return T(1.5) - T(0.5)*x;
+    }
+
+    // Largest deviation of the elements of m*Transpose(m) from those
+    // of the identity matrix
+    template <typename T>
+    INLINE T orthogonalityError( const Matrix<T>& m )
+    {
+        T xx = m.xx*m.xx + m.xy*m.xy + m.xz*m.xz;
+        T yy = m.yx*m.yx + m.yy*m.yy + m.yz*m.yz;
+        T zz = m.zx*m.zx + m.zy*m.zy + m.zz*m.zz;
+        T xy = m.xx*m.yx + m.xy*m.yy + m.xz*m.yz;
+        T xz = m.xx*m.zx + m.xy*m.zy + m.xz*m.zz;
+        T yz = m.yx*m.zx + m.yy*m.zy + m.yz*m.zz;
+        return maxval(maxval(maxval(absval(xx-1), absval(yy-1)),
+                             maxval(absval(zz-1), absval(xy))),
+                      maxval(absval(xz), absval(yz)));
+    }
+
+    // The same for a matrix expression
+    template <typename T, typename A, int B, typename C>
+    INLINE T orthogonalityError( const Matrix<T,A,B,C>& m )
+    {
+        return orthogonalityError(Matrix<T>(m));
+    }
+
+    // One pass of the given method on a single matrix
+    template <typename T, Reorthogonalization METHOD>
+    INLINE Matrix<T> reorthogonalizeKernel( const Matrix<T>& m )
+    {
+        if (METHOD == PolarProjection) {
+            Matrix<T> r, p;
+            polarKernel(m, r, p);
+            return r;
+        }
+        T xx = m.xx, xy = m.xy, xz = m.xz;
+        T yx = m.yx, yy = m.yy, yz = m.yz;
+        T z = xx*xx + xy*xy + xz*xz;
+        z = (METHOD == NewtonGramSchmidt) ? rsqrtNearOne(z) : 1/sqrt(z);
+        xx *= z; xy *= z; xz *= z;
+        z = xx*yx + xy*yy + xz*yz;
+        yx -= z*xx; yy -= z*xy; yz -= z*xz;
+        z = yx*yx + yy*yy + yz*yz;
+        z = (METHOD == NewtonGramSchmidt) ? rsqrtNearOne(z) : 1/sqrt(z);
+        yx *= z; yy *= z; yz *= z;
+        return Matrix<T>(xx, xy, xz,
+                         yx, yy, yz,
+                         xy*yz - xz*yy, xz*yx - xx*yz, xx*yy - xy*yx);
+    }
+
+    // One pass over an array; whether the tolerance is checked is a
+    // template parameter, as in invertKernel
+    template <typename T, Reorthogonalization METHOD, bool CHECK>
+    INLINE std::size_t reorthogonalizePass( Matrix<T>* m,
+                                            std::size_t num,
+                                            T tol )
+    {
+        std::size_t count = 0;
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> a = m[n];
+            Matrix<T> r = reorthogonalizeKernel<T,METHOD>(a);
+            bool bad = true;
+            if (CHECK) {
+                bad = orthogonalityError(a) > tol;
+                count += bad;
+            }
+            m[n] = Matrix<T>(select(bad, r.xx, a.xx), select(bad, r.xy, a.xy), select(bad, r.xz, a.xz),
+                             select(bad, r.yx, a.yx), select(bad, r.yy, a.yy), select(bad, r.yz, a.yz),
+                             select(bad, r.zx, a.zx), select(bad, r.zy, a.zy), select(bad, r.zz, a.zz));
+        }
+        return CHECK ? count : num;
+    }
+
+    template <typename T, Reorthogonalization METHOD, bool CHECK>
+    INLINE std::size_t reorthogonalizePass( Matrix<T,Base,ArrayOp,Base>& m,
+                                            std::size_t num,
+                                            T tol )
+    {
+        T* mxx = m.xx; T* mxy = m.xy; T* mxz = m.xz;
+        T* myx = m.yx; T* myy = m.yy; T* myz = m.yz;
+        T* mzx = m.zx; T* mzy = m.zy; T* mzz = m.zz;
+        std::size_t count = 0;
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            Matrix<T> a(mxx[n], mxy[n], mxz[n],
+                        myx[n], myy[n], myz[n],
+                        mzx[n], mzy[n], mzz[n]);
+            Matrix<T> r = reorthogonalizeKernel<T,METHOD>(a);
+            bool bad = true;
+            if (CHECK) {
+                bad = orthogonalityError(a) > tol;
+                count += bad;
+            }
+            mxx[n] = select(bad, r.xx, a.xx); mxy[n] = select(bad, r.xy, a.xy); mxz[n] = select(bad, r.xz, a.xz);
+            myx[n] = select(bad, r.yx, a.yx); myy[n] = select(bad, r.yy, a.yy); myz[n] = select(bad, r.yz, a.yz);
+            mzx[n] = select(bad, r.zx, a.zx); mzy[n] = select(bad, r.zy, a.zy); mzz[n] = select(bad, r.zz, a.zz);
+        }
+        return CHECK ? count : num;
+    }
+
+    // Passes of one method over an array of either layout
+    template <Reorthogonalization METHOD, typename T, typename ARRAY>
+    INLINE std::size_t reorthogonalizeIterations( ARRAY& m,
+                                                  std::size_t num,
+                                                  T tol,
+                                                  int iterations )
+    {
+        std::size_t count = 0;
+        for (int i = 0; i < iterations; i++) {
+            std::size_t left = (tol > 0)
+                ? reorthogonalizePass<T,METHOD,true>(m, num, tol)
+                : reorthogonalizePass<T,METHOD,false>(m, num, tol);
+            if (i == 0)
+                count = left;
+            if (left == 0)
+                break;
+        }
+        return count;
+    }
+
+    // Reorthogonalizes the matrices m[n], for arrays of matrices
+    template <typename T>
+    INLINE std::size_t reorthogonalize( Matrix<T>* m,
+                                        std::size_t num,
+                                        Reorthogonalization method = GramSchmidt,
+                                        T tol = 0,
+                                        int iterations = 1 )
+    {
+        switch (method) {
+            case NewtonGramSchmidt:
+                return reorthogonalizeIterations<NewtonGramSchmidt>(m, num, tol, iterations);
+            case PolarProjection:
+                return reorthogonalizeIterations<PolarProjection>(m, num, tol, iterations);
+            default:
+                return reorthogonalizeIterations<GramSchmidt>(m, num, tol, iterations);
+        }
+    }
+
+    // The same for structure-of-arrays matrices
+    template <typename T>
+    INLINE std::size_t reorthogonalize( Matrix<T,Base,ArrayOp,Base>& m,
+                                        Reorthogonalization method = GramSchmidt,
+                                        T tol = 0,
+                                        int iterations = 1 )
+    {
+        std::size_t num = m.size();
+        switch (method) {
+            case NewtonGramSchmidt:
+                return reorthogonalizeIterations<NewtonGramSchmidt>(m, num, tol, iterations);
+            case PolarProjection:
+                return reorthogonalizeIterations<PolarProjection>(m, num, tol, iterations);
+            default:
+                return reorthogonalizeIterations<GramSchmidt>(m, num, tol, iterations);
+        }
+    }
+
+    //
+    // All-pairs distances between the vectors of two arrays a and b,
+    // computed in tiles of VECMAT3_TILE_ROWS elements of a and
+    // VECMAT3_TILE_COLUMNS elements of b, so that the part of b in a
+    // tile stays in the cache. The loops within a tile vectorize, and
+    // tiles are divided over threads when compiled with OpenMP. The
+    // kernels take a box type with a member nearestImage(x,y,z), like
+    // those in vecmat3pbc.h, or NoBox for plain differences.
+    //
+
+    // Differences without periodic boundaries
+    template <typename T>
+    struct NoBox
+    {
+        INLINE void nearestImage( T&, T&, T& ) const {}
+    };
+
+    // Index of element (i,j), i < j, of an n by n matrix stored as its
+    // upper triangle without diagonal, row by row
+    INLINE std::size_t packedIndex( std::size_t i, std::size_t j, std::size_t n )
+    {
+        return i*n - i*(i + 1)/2 + j - i - 1;
+    }
+
+    // Sets out[n] to the squared distance, or with ROOT the distance,
+    // between (x,y,z) and element n of the arrays bx, by and bz
+    template <bool ROOT, class BOX, typename T>
+    INLINE void distanceRow( const BOX& box, T x, T y, T z,
+                             const T* bx, const T* by, const T* bz,
+                             T* out, std::size_t num )
+    {
+        const BOX pbc(box);
+        VECMAT3_SIMD_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T dx = x - bx[n], dy = y - by[n], dz = z - bz[n];
+            pbc.nearestImage(dx, dy, dz);
+            T r2 = dx*dx + dy*dy + dz*dz;
+            out[n] = ROOT ? std::sqrt(r2) : r2;
+        }
+    }
+
+    // Copies the 64 bytes at line to the 64-byte aligned cache line at
+    // out. For float and double with SSE2 or AVX, this uses non-temporal
+    // stores, which bypass the cache, so that out is not read from
+    // memory first. Call streamFence() before out is read by another
+    // thread.
+    template <typename T>
+    INLINE void streamLine( const T* line, T* out )
+    {
+        for (std::size_t n = 0; n < 64/sizeof(T); n++)
+            out[n] = line[n];
+    }
+
+    #if defined(__SSE2__)
+    #if defined(__AVX__)
+    # define VECMAT3_STREAM(T,SUF) VECMAT3_STREAM_OF(T,SUF,_mm256,32)
+    #else
+    # define VECMAT3_STREAM(T,SUF) VECMAT3_STREAM_OF(T,SUF,_mm,16)
+    #endif
+    #define VECMAT3_STREAM_OF(T,SUF,PRE,BYTES)                                   \
+    INLINE void streamLine( const T* line, T* out )                              \
+    {                                                                            \
+        for (std::size_t n = 0; n < 64/sizeof(T); n += BYTES/sizeof(T))          \
+            PRE##_stream_##SUF(out + n, PRE##_loadu_##SUF(line + n));            \
+    }
+    VECMAT3_STREAM(float,ps)
+    VECMAT3_STREAM(double,pd)
+    #undef VECMAT3_STREAM_OF
+    #undef VECMAT3_STREAM
+    #endif
+
+    INLINE void streamFence()
+    {
+      #if defined(__SSE2__)
+        _mm_sfence();
+      #endif
+    }
+
+    // As distanceRow, but the whole cache lines of out are computed one
+    // at a time and written with streamLine
+    template <bool ROOT, class BOX, typename T>
+    INLINE void distanceRowStream( const BOX& box, T x, T y, T z,
+                                   const T* bx, const T* by, const T* bz,
+                                   T* out, std::size_t num )
+    {
+        const std::size_t width = 64/sizeof(T);
+        std::size_t n = std::min(num, (64 - reinterpret_cast<std::size_t>(out)%64)%64/sizeof(T));
+        distanceRow<ROOT>(box, x, y, z, bx, by, bz, out, n);
+        for (; n + width <= num; n += width) {
+            T line[64/sizeof(T)];
+            distanceRow<ROOT>(box, x, y, z, bx + n, by + n, bz + n, line, width);
+            streamLine(line, out + n);
+        }
+        distanceRow<ROOT>(box, x, y, z, bx + n, by + n, bz + n, out + n, num - n);
+    }
+
+    // Distances between all a[i] and b[j], stored in out[i*b.size()+j],
+    // or, if packed, between all a[i] and a[j] with i < j, stored in
+    // out[packedIndex(i,j,a.size())]. A result of at least
+    // VECMAT3_STREAM_MIN elements is written with distanceRowStream.
+    template <bool ROOT, class BOX, typename T>
+    INLINE void distanceMatrix( const BOX& box,
+                                const Vector<T,Base,ArrayOp,Base>& a,
+                                const Vector<T,Base,ArrayOp,Base>& b,
+                                T* out,
+                                bool packed )
+    {
+        const std::size_t na = a.size(), nb = b.size();
+        const bool stream = (packed ? na*(na - 1)/2 : na*nb) >= VECMAT3_STREAM_MIN;
+        const std::size_t rows = VECMAT3_TILE_ROWS, columns = VECMAT3_TILE_COLUMNS;
+        const std::size_t tilerows = (na + rows - 1)/rows;
+        const std::size_t tilecolumns = (nb + columns - 1)/columns;
+        // Tiles first[r] up to first[r+1] are in tile row r; if packed,
+        // the tiles left of the one holding element (i0,i0+1) are skipped
+        std::vector<std::size_t> first(tilerows + 1, 0);
+        for (std::size_t r = 0; r < tilerows; r++)
+            first[r + 1] = first[r] + tilecolumns - (packed ? (r*rows + 1)/columns : 0);
+        const std::size_t tiles = first[tilerows];
+        const T* ax = a.x; const T* ay = a.y; const T* az = a.z;
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        VECMAT3_OMP_PRAGMA(omp parallel if(parallel(na*nb)))
+        {
+            VECMAT3_OMP_PRAGMA(omp for schedule(dynamic))
+            for (std::size_t t = 0; t < tiles; t++) {
+                const std::size_t r = std::upper_bound(first.begin(), first.end(), t) - first.begin() - 1;
+                const std::size_t i0 = r*rows;
+                const std::size_t j0 = (t - first[r] + (packed ? (i0 + 1)/columns : 0))*columns;
+                const std::size_t i1 = std::min(i0 + rows, na), j1 = std::min(j0 + columns, nb);
+                for (std::size_t i = i0; i < i1; i++) {
+                    const std::size_t j = packed ? std::max(j0, i + 1) : j0;
+                    if (j >= j1)
+                        continue;
+                    T* o = out + (packed ? packedIndex(i, j, na) : i*nb + j);
+                    if (stream) {
+                        distanceRowStream<ROOT>(box, ax[i], ay[i], az[i], bx + j, by + j, bz + j,
+                                                o, j1 - j);
+                    } else {
+                        distanceRow<ROOT>(box, ax[i], ay[i], az[i], bx + j, by + j, bz + j,
+                                          o, j1 - j);
+                    }
+                }
+            }
+            if (stream)
+                streamFence();
+        }
+    }
+
+    // Distances between all a[i] and b[j] computed tile by tile, and
+    // passed to f(i0, j0, ni, nj, d), where d[i*nj+j] is the distance
+    // between a[i0+i] and b[j0+j], for i < ni and j < nj. With OpenMP,
+    // f is called by several threads at the same time.
+    template <bool ROOT, class BOX, typename T, class F>
+    INLINE F distanceTiles( const BOX& box,
+                            const Vector<T,Base,ArrayOp,Base>& a,
+                            const Vector<T,Base,ArrayOp,Base>& b,
+                            F f )
+    {
+        const std::size_t na = a.size(), nb = b.size();
+        const std::size_t rows = VECMAT3_TILE_ROWS, columns = VECMAT3_TILE_COLUMNS;
+        const std::size_t tilecolumns = (nb + columns - 1)/columns;
+        const std::size_t tiles = ((na + rows - 1)/rows)*tilecolumns;
+        const T* ax = a.x; const T* ay = a.y; const T* az = a.z;
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        VECMAT3_OMP_PRAGMA(omp parallel if(parallel(na*nb)))
+        {
+            std::vector<T> tile(rows*columns);
+            VECMAT3_OMP_PRAGMA(omp for schedule(dynamic))
+            for (std::size_t t = 0; t < tiles; t++) {
+                const std::size_t i0 = (t/tilecolumns)*rows, j0 = (t%tilecolumns)*columns;
+                const std::size_t ni = std::min(rows, na - i0), nj = std::min(columns, nb - j0);
+                for (std::size_t i = 0; i < ni; i++)
+                    distanceRow<ROOT>(box, ax[i0 + i], ay[i0 + i], az[i0 + i],
+                                      bx + j0, by + j0, bz + j0, &tile[i*nj], nj);
+                f(i0, j0, ni, nj, (const T*)&tile[0]);
+            }
+        }
+        return f;
+    }
+
+    // Squared distances and distances between all a[i] and b[j], in
+    // d2[i*b.size()+j] and d[i*b.size()+j]
+    template <typename T>
+    INLINE void dist2Matrix( const Vector<T,Base,ArrayOp,Base>& a,
+                             const Vector<T,Base,ArrayOp,Base>& b,
+                             T* d2 )
+    {
+        distanceMatrix<false>(NoBox<T>(), a, b, d2, false);
+    }
+
+    template <typename T>
+    INLINE void distMatrix( const Vector<T,Base,ArrayOp,Base>& a,
+                            const Vector<T,Base,ArrayOp,Base>& b,
+                            T* d )
+    {
+        distanceMatrix<true>(NoBox<T>(), a, b, d, false);
+    }
+
+    // Squared distances and distances between all a[i] and a[j] with
+    // i < j, in d2[packedIndex(i,j,a.size())] and d[packedIndex(i,j,a.size())]
+    template <typename T>
+    INLINE void dist2Matrix( const Vector<T,Base,ArrayOp,Base>& a,
+                             T* d2 )
+    {
+        distanceMatrix<false>(NoBox<T>(), a, a, d2, true);
+    }
+
+    template <typename T>
+    INLINE void distMatrix( const Vector<T,Base,ArrayOp,Base>& a,
+                            T* d )
+    {
+        distanceMatrix<true>(NoBox<T>(), a, a, d, true);
+    }
+
+    // Squared distances and distances between all a[i] and b[j] passed
+    // to f tile by tile, as in distanceTiles
+    template <typename T, class F>
+    INLINE F dist2Tiles( const Vector<T,Base,ArrayOp,Base>& a,
+                         const Vector<T,Base,ArrayOp,Base>& b,
+                         F f )
+    {
+        return distanceTiles<false>(NoBox<T>(), a, b, f);
+    }
+
+    template <typename T, class F>
+    INLINE F distTiles( const Vector<T,Base,ArrayOp,Base>& a,
+                        const Vector<T,Base,ArrayOp,Base>& b,
+                        F f )
+    {
+        return distanceTiles<true>(NoBox<T>(), a, b, f);
+    }
+
+} // end namespace vecmat3
+
+#endif
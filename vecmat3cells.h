@@ -0,0 +1,739 @@
+//
+// vecmat3cells.h - Cell and Verlet lists for finding pairs of nearby
+//                  vectors in a periodic box
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// NOTES:
+//
+// - A CellList divides a periodic box (a Box or TriclinicBox from
+//   vecmat3pbc.h) into a grid of cells that are at least as wide as
+//   a cutoff distance, and sorts the positions of particles into
+//   these cells. All pairs of particles closer than the cutoff are
+//   then in the same or in adjacent cells, so finding them takes a
+//   time proportional to the number of particles.
+//
+// - The indices of the particles in each cell are stored contiguously,
+//   in a slot of fixed capacity per cell, so that particles that move
+//   to another cell can be moved in constant time by update().
+//
+// - A VerletList stores, for each particle, the particles within the
+//   cutoff plus a skin distance, and is only built again (using a
+//   CellList) once a particle has moved more than half the skin.
+//
+// - Building the lists is divided over threads when compiled with
+//   OpenMP, for more than VECMAT3_PARALLEL_MIN particles.
+//
+
+#ifndef _VECMAT3CELLS_
+#define _VECMAT3CELLS_
+
+#include "vecmat3pbc.h"
+#include <vector>
+#include <algorithm>
+
+namespace vecmat3 {
+
+    // Pointer to the elements of v, which may be empty
+    template <typename U>
+    INLINE U* dataOf( std::vector<U>& v )
+    {
+        return v.empty() ? 0 : &v[0];
+    }
+
+    template <typename U>
+    INLINE const U* dataOf( const std::vector<U>& v )
+    {
+        return v.empty() ? 0 : &v[0];
+    }
+
+    //
+    // Cell list for particles in a periodic box of type BOX, which is
+    // Box<T> or TriclinicBox<T>. Cells are numbered as
+    // (ix*ny + iy)*nz + iz, where ix, iy and iz number the cells along
+    // the three edges of the box in the direction of increasing
+    // fractional coordinates.
+    //
+    template <class BOX>
+    class CellList
+    {
+      public:
+        typedef typename BOX::value_type T;
+
+        INLINE          CellList() : num(0), cap(0) { n[0] = n[1] = n[2] = 0; }
+        INLINE          CellList( const BOX& box, T cutoff ) : num(0), cap(0) { setBox(box, cutoff); }
+
+        // Set the box and the cutoff, which determine the grid of cells;
+        // the list should be built again after this
+        INLINE void     setBox( const BOX& box, T cutoff );
+
+        // Sort all particles into cells
+        INLINE void     build( const Vector<T,Base,ArrayOp,Base>& r );
+        INLINE void     build( const Vector<T>* r, std::size_t num );
+
+        // Move the particles that have left their cell since the last
+        // build or update, and return their number. Builds the list
+        // again when many particles have moved or a cell is full.
+        INLINE std::size_t update( const Vector<T,Base,ArrayOp,Base>& r );
+        INLINE std::size_t update( const Vector<T>* r, std::size_t num );
+
+        INLINE const BOX&  box()      const { return pbc; }
+        INLINE T           cutoff()   const { return rc; }
+        INLINE std::size_t size()     const { return num; }   // number of particles
+        INLINE std::size_t gridSize( int d ) const { return n[d]; }  // cells along edge d
+        INLINE std::size_t numCells() const { return n[0]*n[1]*n[2]; }
+
+        // Cell of particle i, and the number and indices of the
+        // particles in cell c
+        INLINE std::size_t cellOf( std::size_t i )  const { return incell[i]; }
+        INLINE std::size_t count( std::size_t c )   const { return ncell[c]; }
+        INLINE const std::size_t* members( std::size_t c ) const { return dataOf(list) + c*cap; }
+        INLINE std::size_t capacity() const { return cap; }  // members of a cell are members(c)[k] for k < capacity()
+
+        // Store in nb the cells adjacent to cell c, including c itself,
+        // each once, and return their number, which is at most 27.
+        INLINE std::size_t adjacentCells( std::size_t c, std::size_t* nb ) const;
+
+        // The same for only the adjacent cells with a larger index than
+        // c, of which there are at most 26
+        INLINE std::size_t neighbourCells( std::size_t c, std::size_t* nb ) const;
+
+        // Call f(i,j) for each pair of particles i and j in the same
+        // or in adjacent cells, which includes all pairs closer than
+        // the cutoff. Each pair is visited once.
+        template <class F>
+        INLINE F        forEachPair( F f ) const;
+
+        // The same pairs stored in two arrays of indices, for use in
+        // the pair kernels of vecmat3pbc.h; returns their number
+        INLINE std::size_t pairs( std::vector<std::size_t>& i,
+                                  std::vector<std::size_t>& j ) const;
+
+      private:
+        BOX         pbc;      // periodic box
+        T           rc;       // cutoff
+        std::size_t n[3];     // number of cells along each edge
+        std::size_t num;      // number of particles
+        std::size_t cap;      // capacity of each cell
+        std::vector<std::size_t> incell;   // cell of each particle
+        std::vector<std::size_t> atslot;   // position of each particle in its cell
+        std::vector<std::size_t> ncell;    // number of particles in each cell
+        std::vector<std::size_t> list;     // particles in each cell, cap per cell
+        std::vector<std::size_t> moved;    // new cell of each particle, for update
+
+        INLINE void locate( const T* x, const T* y, const T* z,
+                            std::size_t stride, std::size_t* cell ) const;
+        INLINE void fill();
+        INLINE std::size_t move();
+    };
+
+    template <class BOX>
+    INLINE void CellList<BOX>::setBox( const BOX& box, T cutoff )
+    {
+        pbc = box;
+        rc = cutoff;
+        Vector<T> w = box.width();
+        for (int d = 0; d < 3; d++) {
+            std::size_t nd = std::size_t(w[d]/cutoff);
+            n[d] = nd > 0 ? nd : 1;
+        }
+        num = 0;
+        cap = 0;
+        ncell.assign(numCells(), 0);
+        list.clear();
+    }
+
+    // Compute the cells of num positions with components x[n*stride],
+    // y[n*stride] and z[n*stride]
+    template <class BOX>
+    INLINE void CellList<BOX>::locate( const T* x, const T* y, const T* z,
+                                       std::size_t stride, std::size_t* cell ) const
+    {
+        const BOX box(pbc);
+        const int nx = int(n[0]), ny = int(n[1]), nz = int(n[2]);
+        const T fx = T(nx), fy = T(ny), fz = T(nz);
+        std::size_t num = this->num;
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t k = 0; k < num; k++) {
+            Vector<T> s = box.fractional(Vector<T>(x[k*stride], y[k*stride], z[k*stride]));
+            int ix = int((s.x - floorInt(s.x))*fx);
+            int iy = int((s.y - floorInt(s.y))*fy);
+            int iz = int((s.z - floorInt(s.z))*fz);
+            ix = select(ix < nx, ix, nx - 1);  // for s slightly below an integer
+            iy = select(iy < ny, iy, ny - 1);
+            iz = select(iz < nz, iz, nz - 1);
+            cell[k] = std::size_t((ix*ny + iy)*nz + iz);
+        }
+    }
+
+    // Sort all particles into cells given incell
+    template <class BOX>
+    INLINE void CellList<BOX>::fill()
+    {
+        const std::size_t cells = numCells();
+        std::size_t* counts = dataOf(ncell);
+        const std::size_t* cell = dataOf(incell);
+        std::fill(ncell.begin(), ncell.end(), std::size_t(0));
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t k = 0; k < num; k++) {
+            VECMAT3_OMP_PRAGMA(omp atomic)
+            counts[cell[k]]++;
+        }
+        // leave room for fluctuations in the number of particles per cell
+        std::size_t most = *std::max_element(ncell.begin(), ncell.end());
+        cap = most + most/4 + 4;
+        list.resize(cells*cap);
+        atslot.resize(num);
+        std::fill(ncell.begin(), ncell.end(), std::size_t(0));
+        std::size_t* members = dataOf(list);
+        std::size_t* slot = dataOf(atslot);
+        const std::size_t capacity = cap;
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t k = 0; k < num; k++) {
+            std::size_t c = cell[k], s;
+            VECMAT3_OMP_PRAGMA(omp atomic capture)
+            s = counts[c]++;
+            members[c*capacity + s] = k;
+        }
+        // with threads, the order within cells depends on timing, so
+        // sort each cell to make the order of the pairs reproducible
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t c = 0; c < cells; c++) {
+            std::size_t* m = members + c*capacity;
+            std::sort(m, m + counts[c]);
+            for (std::size_t s = 0; s < counts[c]; s++)
+                slot[m[s]] = s;
+        }
+    }
+
+    template <class BOX>
+    INLINE void CellList<BOX>::build( const Vector<T,Base,ArrayOp,Base>& r )
+    {
+        num = r.size();
+        incell.resize(num);
+        locate(r.x, r.y, r.z, 1, dataOf(incell));
+        fill();
+    }
+
+    template <class BOX>
+    INLINE void CellList<BOX>::build( const Vector<T>* r, std::size_t num )
+    {
+        this->num = num;
+        incell.resize(num);
+        if (num > 0)
+            locate(&r[0].x, &r[0].y, &r[0].z, 3, &incell[0]);
+        fill();
+    }
+
+    // Move the particles whose cell in moved differs from incell
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::move()
+    {
+        std::size_t count = 0;
+        const std::size_t* cell = dataOf(incell);
+        const std::size_t* next = dataOf(moved);
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t k = 0; k < num; k++)
+            count += (cell[k] != next[k]);
+        if (count > num/8) {
+            incell.swap(moved);
+            fill();
+            return count;
+        }
+        for (std::size_t k = 0; k < num; k++) {
+            std::size_t to = moved[k];
+            std::size_t from = incell[k];
+            if (to == from)
+                continue;
+            if (ncell[to] == cap) {
+                incell.swap(moved);
+                fill();
+                return count;
+            }
+            // fill the hole with the last particle in the old cell
+            std::size_t last = list[from*cap + --ncell[from]];
+            list[from*cap + atslot[k]] = last;
+            atslot[last] = atslot[k];
+            atslot[k] = ncell[to];
+            list[to*cap + ncell[to]++] = k;
+            incell[k] = to;
+        }
+        return count;
+    }
+
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::update( const Vector<T,Base,ArrayOp,Base>& r )
+    {
+        if (r.size() != num) {
+            build(r);
+            return num;
+        }
+        moved.resize(num);
+        locate(r.x, r.y, r.z, 1, dataOf(moved));
+        return move();
+    }
+
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::update( const Vector<T>* r, std::size_t num )
+    {
+        if (num != this->num) {
+            build(r, num);
+            return num;
+        }
+        moved.resize(num);
+        if (num > 0)
+            locate(&r[0].x, &r[0].y, &r[0].z, 3, &moved[0]);
+        return move();
+    }
+
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::adjacentCells( std::size_t c, std::size_t* nb ) const
+    {
+        const std::size_t nx = n[0], ny = n[1], nz = n[2];
+        const std::size_t ix = c/(ny*nz), iy = (c/nz)%ny, iz = c%nz;
+        std::size_t count = 0;
+        // adding n-1 instead of subtracting 1 keeps the indices unsigned
+        for (std::size_t dx = 0; dx < 3; dx++)
+            for (std::size_t dy = 0; dy < 3; dy++)
+                for (std::size_t dz = 0; dz < 3; dz++) {
+                    std::size_t d = (((ix + dx + nx - 1)%nx)*ny
+                                     + (iy + dy + ny - 1)%ny)*nz
+                                     + (iz + dz + nz - 1)%nz;
+                    if (std::find(nb, nb + count, d) == nb + count)
+                        nb[count++] = d;
+                }
+        return count;
+    }
+
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::neighbourCells( std::size_t c, std::size_t* nb ) const
+    {
+        std::size_t all[27];
+        std::size_t numall = adjacentCells(c, all);
+        std::size_t count = 0;
+        for (std::size_t m = 0; m < numall; m++)
+            if (all[m] > c)
+                nb[count++] = all[m];
+        return count;
+    }
+
+    template <class BOX>
+    template <class F>
+    INLINE F CellList<BOX>::forEachPair( F f ) const
+    {
+        const std::size_t cells = numCells();
+        std::size_t nb[26];
+        for (std::size_t c = 0; c < cells; c++) {
+            const std::size_t* a = members(c);
+            const std::size_t na = ncell[c];
+            if (na == 0)
+                continue;
+            for (std::size_t k = 0; k < na; k++)
+                for (std::size_t l = k + 1; l < na; l++)
+                    f(a[k], a[l]);
+            std::size_t numnb = neighbourCells(c, nb);
+            for (std::size_t m = 0; m < numnb; m++) {
+                const std::size_t* b = members(nb[m]);
+                const std::size_t nbm = ncell[nb[m]];
+                for (std::size_t k = 0; k < na; k++)
+                    for (std::size_t l = 0; l < nbm; l++)
+                        f(a[k], b[l]);
+            }
+        }
+        return f;
+    }
+
+    template <class BOX>
+    INLINE std::size_t CellList<BOX>::pairs( std::vector<std::size_t>& i,
+                                             std::vector<std::size_t>& j ) const
+    {
+        // count the pairs of each cell first, so that the cells can be
+        // filled in independently, in the order of forEachPair
+        const std::size_t cells = numCells();
+        std::vector<std::size_t> offset(cells + 1);
+        offset[0] = 0;
+        std::size_t nb[26];
+        for (std::size_t c = 0; c < cells; c++) {
+            std::size_t na = ncell[c], total = na*(na - 1)/2;
+            if (na > 0) {
+                std::size_t numnb = neighbourCells(c, nb);
+                for (std::size_t m = 0; m < numnb; m++)
+                    total += na*ncell[nb[m]];
+            }
+            offset[c + 1] = offset[c] + total;
+        }
+        std::size_t num = offset[cells];
+        i.resize(num);
+        j.resize(num);
+        if (num == 0)
+            return 0;
+        std::size_t* pi = &i[0];
+        std::size_t* pj = &j[0];
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(dynamic,64) private(nb) if(parallel(num)))
+        for (std::size_t c = 0; c < cells; c++) {
+            const std::size_t* a = members(c);
+            const std::size_t na = ncell[c];
+            if (na == 0)
+                continue;
+            std::size_t p = offset[c];
+            for (std::size_t k = 0; k < na; k++)
+                for (std::size_t l = k + 1; l < na; l++, p++) {
+                    pi[p] = a[k];
+                    pj[p] = a[l];
+                }
+            std::size_t numnb = neighbourCells(c, nb);
+            for (std::size_t m = 0; m < numnb; m++) {
+                const std::size_t* b = members(nb[m]);
+                const std::size_t nbm = ncell[nb[m]];
+                for (std::size_t k = 0; k < na; k++)
+                    for (std::size_t l = 0; l < nbm; l++, p++) {
+                        pi[p] = a[k];
+                        pj[p] = b[l];
+                    }
+            }
+        }
+        return num;
+    }
+
+    //
+    // Verlet list of the pairs of particles closer than a cutoff plus
+    // a skin distance, found with a cell list. The neighbours of
+    // particle i are neighbours()[k] for offsets()[i] <= k <
+    // offsets()[i+1] (compressed sparse row format), in increasing
+    // order. By default, the list is a half list, which has each pair
+    // once, for one of the two particles; a full list has each pair for
+    // both particles.
+    // The list contains all pairs closer than the cutoff until a
+    // particle has moved more than half the skin, which update()
+    // checks before building the list again.
+    //
+    template <class BOX>
+    class VerletList
+    {
+      public:
+        typedef typename BOX::value_type T;
+
+        INLINE          VerletList() : rc(0), rs(0), half(true), num(0), builds(0), stale(true) {}
+        INLINE          VerletList( const BOX& box, T cutoff, T skin, bool half = true );
+
+        // Change the box, after which update() builds the list again
+        INLINE void     setBox( const BOX& box );
+
+        // Build the list for positions r
+        INLINE void     build( const Vector<T,Base,ArrayOp,Base>& r );
+        INLINE void     build( const Vector<T>* r, std::size_t num );
+
+        // Number of particles that moved more than half the skin since
+        // the last build
+        INLINE std::size_t numMoved( const Vector<T,Base,ArrayOp,Base>& r ) const;
+        INLINE std::size_t numMoved( const Vector<T>* r, std::size_t num ) const;
+
+        // Build the list if any particle moved more than half the skin,
+        // or if the box or number of particles changed; returns whether
+        // it did
+        INLINE bool     update( const Vector<T,Base,ArrayOp,Base>& r );
+        INLINE bool     update( const Vector<T>* r, std::size_t num );
+
+        INLINE const BOX&  box()       const { return cells.box(); }
+        INLINE T           cutoff()    const { return rc; }
+        INLINE T           skin()      const { return rs; }
+        INLINE std::size_t size()      const { return num; }      // number of particles
+        INLINE std::size_t numBuilds() const { return builds; }
+        INLINE std::size_t numPairs()  const { return nbr.size(); }
+
+        // Neighbours of particle i, and all of them
+        INLINE std::size_t count( std::size_t i ) const { return start[i + 1] - start[i]; }
+        INLINE const std::size_t* neighbours( std::size_t i ) const { return dataOf(nbr) + start[i]; }
+        INLINE const std::size_t* offsets()    const { return dataOf(start); }
+        INLINE const std::size_t* neighbours() const { return dataOf(nbr); }
+
+        // Call f(i,j) for each pair in the list
+        template <class F>
+        INLINE F        forEachPair( F f ) const;
+
+      private:
+        CellList<BOX> cells;  // with cutoff rc+rs
+        T           rc;       // cutoff
+        T           rs;       // skin
+        bool        half;     // whether to store each pair once
+        std::size_t num;      // number of particles
+        std::size_t builds;   // number of builds
+        bool        stale;    // whether the box changed since the last build
+        std::vector<T> x0, y0, z0;       // positions at the last build
+        std::vector<T> cx, cy, cz;       // the same in the order of the cells
+        std::vector<std::size_t> start;  // offsets of the neighbours of each particle
+        std::vector<std::size_t> nbr;    // neighbours
+
+        INLINE void store( const T* x, const T* y, const T* z, std::size_t stride );
+        INLINE std::size_t moved( const T* x, const T* y, const T* z, std::size_t stride ) const;
+        INLINE std::size_t search( const BOX& box, std::size_t i, std::size_t k,
+                                   const std::size_t* nb, std::size_t numnb,
+                                   std::size_t* out ) const;
+        INLINE std::size_t searchCells( std::size_t c, std::size_t* nb ) const;
+        INLINE void fill();
+    };
+
+    template <class BOX>
+    INLINE VerletList<BOX>::VerletList( const BOX& box, T cutoff, T skin, bool half )
+      : cells(box, cutoff + skin), rc(cutoff), rs(skin), half(half), num(0), builds(0), stale(true)
+    {}
+
+    template <class BOX>
+    INLINE void VerletList<BOX>::setBox( const BOX& box )
+    {
+        cells.setBox(box, rc + rs);
+        stale = true;
+    }
+
+    // Keep the positions with components x[n*stride], y[n*stride] and
+    // z[n*stride] to detect later displacements
+    template <class BOX>
+    INLINE void VerletList<BOX>::store( const T* x, const T* y, const T* z, std::size_t stride )
+    {
+        x0.resize(num);
+        y0.resize(num);
+        z0.resize(num);
+        T* px = dataOf(x0); T* py = dataOf(y0); T* pz = dataOf(z0);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            px[n] = x[n*stride];
+            py[n] = y[n*stride];
+            pz[n] = z[n*stride];
+        }
+    }
+
+    // Count the particles that moved more than half the skin, using
+    // the minimum image so that wrapping positions into the box does
+    // not count as moving
+    template <class BOX>
+    INLINE std::size_t VerletList<BOX>::moved( const T* x, const T* y, const T* z, std::size_t stride ) const
+    {
+        const BOX box(cells.box());
+        const T lim2 = rs*rs/4;
+        if (x0.empty())
+            return 0;
+        const T* px = &x0[0]; const T* py = &y0[0]; const T* pz = &z0[0];
+        std::size_t num = this->num;
+        std::size_t count = 0;
+        VECMAT3_PARALLEL_COUNT_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T dx = x[n*stride] - px[n], dy = y[n*stride] - py[n], dz = z[n*stride] - pz[n];
+            box.nearestImage(dx, dy, dz);
+            count += (Vector<T>(dx, dy, dz).nrm2() > lim2);
+        }
+        return count;
+    }
+
+    // Store the neighbours of particle i, which is member k of cell
+    // nb[0], in out and return their number. The neighbours are looked
+    // for among the members of cells nb, except for the members of
+    // nb[0] up to k for a half list. The positions are taken in the
+    // order of the cells, cx[c*capacity + l] being the x component of
+    // particle cells.members(c)[l], so that the loops run over
+    // contiguous memory. The loops do not branch: each candidate is
+    // written to out and kept by increasing the count, so out needs
+    // room for all candidates plus one. If out is null, only the
+    // number is returned.
+    template <class BOX>
+    INLINE std::size_t VerletList<BOX>::search( const BOX& pbc,
+                                                std::size_t i, std::size_t k,
+                                                const std::size_t* nb, std::size_t numnb,
+                                                std::size_t* out ) const
+    {
+        const BOX box(pbc);
+        const T lim2 = (rc + rs)*(rc + rs);
+        const T xi = x0[i], yi = y0[i], zi = z0[i];
+        const std::size_t capacity = cells.capacity();
+        std::size_t count = 0;
+        for (std::size_t m = 0; m < numnb; m++) {
+            const std::size_t* a = cells.members(nb[m]);
+            const T* px = &cx[nb[m]*capacity];
+            const T* py = &cy[nb[m]*capacity];
+            const T* pz = &cz[nb[m]*capacity];
+            const std::size_t first = (half && m == 0) ? k + 1 : 0;
+            const std::size_t na = cells.count(nb[m]);
+            if (out) {
+                for (std::size_t l = first; l < na; l++) {
+                    T dx = px[l] - xi, dy = py[l] - yi, dz = pz[l] - zi;
+                    box.nearestImage(dx, dy, dz);
+                    out[count] = a[l];
+                    count += (dx*dx + dy*dy + dz*dz < lim2) & (a[l] != i);
+                }
+            } else {
+                for (std::size_t l = first; l < na; l++) {
+                    T dx = px[l] - xi, dy = py[l] - yi, dz = pz[l] - zi;
+                    box.nearestImage(dx, dy, dz);
+                    count += (dx*dx + dy*dy + dz*dz < lim2) & (a[l] != i);
+                }
+            }
+        }
+        return count;
+    }
+
+    // Cells in which to look for the neighbours of the particles in
+    // cell c: c itself, followed by the adjacent cells with a larger
+    // index for a half list, or all other adjacent cells for a full
+    // list. Returns their number.
+    template <class BOX>
+    INLINE std::size_t VerletList<BOX>::searchCells( std::size_t c, std::size_t* nb ) const
+    {
+        nb[0] = c;
+        if (half)
+            return 1 + cells.neighbourCells(c, nb + 1);
+        std::size_t all[27];
+        std::size_t numall = cells.adjacentCells(c, all);
+        std::size_t count = 1;
+        for (std::size_t m = 0; m < numall; m++)
+            if (all[m] != c)
+                nb[count++] = all[m];
+        return count;
+    }
+
+    // Build the list from the stored positions and the cell list,
+    // counting the neighbours of all particles first, so that the
+    // cells can be done in parallel. Going through the particles cell
+    // by cell keeps the positions in adjacent cells in the cache.
+    template <class BOX>
+    INLINE void VerletList<BOX>::fill()
+    {
+        const BOX box(cells.box());
+        const std::size_t capacity = cells.capacity();
+        const std::size_t numcells = cells.numCells();
+        cx.resize(numcells*capacity);
+        cy.resize(numcells*capacity);
+        cz.resize(numcells*capacity);
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t c = 0; c < numcells; c++) {
+            const std::size_t* a = cells.members(c);
+            for (std::size_t k = 0; k < cells.count(c); k++) {
+                cx[c*capacity + k] = x0[a[k]];
+                cy[c*capacity + k] = y0[a[k]];
+                cz[c*capacity + k] = z0[a[k]];
+            }
+        }
+        start.resize(num + 1);
+        std::size_t* offset = &start[0];
+        offset[0] = 0;
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(dynamic,16) if(parallel(num)))
+        for (std::size_t c = 0; c < numcells; c++) {
+            std::size_t nb[27];
+            std::size_t numnb = searchCells(c, nb);
+            const std::size_t* a = cells.members(c);
+            for (std::size_t k = 0; k < cells.count(c); k++)
+                offset[a[k] + 1] = search(box, a[k], k, nb, numnb, 0);
+        }
+        for (std::size_t i = 0; i < num; i++)
+            offset[i + 1] += offset[i];
+        nbr.resize(offset[num]);
+        std::size_t* out = dataOf(nbr);
+        VECMAT3_OMP_PRAGMA(omp parallel if(parallel(num)))
+        {
+            // one buffer per thread, large enough for the members of 27 cells
+            std::vector<std::size_t> found(27*capacity + 1);
+            VECMAT3_OMP_PRAGMA(omp for schedule(dynamic,16))
+            for (std::size_t c = 0; c < numcells; c++) {
+                std::size_t nb[27];
+                std::size_t numnb = searchCells(c, nb);
+                const std::size_t* a = cells.members(c);
+                for (std::size_t k = 0; k < cells.count(c); k++) {
+                    std::size_t i = a[k];
+                    search(box, i, k, nb, numnb, &found[0]);
+                    std::copy(found.begin(), found.begin() + (offset[i + 1] - offset[i]), out + offset[i]);
+                    std::sort(out + offset[i], out + offset[i + 1]);
+                }
+            }
+        }
+        builds++;
+        stale = false;
+    }
+
+    template <class BOX>
+    INLINE void VerletList<BOX>::build( const Vector<T,Base,ArrayOp,Base>& r )
+    {
+        num = r.size();
+        store(r.x, r.y, r.z, 1);
+        cells.update(r);
+        fill();
+    }
+
+    template <class BOX>
+    INLINE void VerletList<BOX>::build( const Vector<T>* r, std::size_t num )
+    {
+        this->num = num;
+        if (num > 0)
+            store(&r[0].x, &r[0].y, &r[0].z, 3);
+        else
+            store(0, 0, 0, 3);
+        cells.update(r, num);
+        fill();
+    }
+
+    template <class BOX>
+    INLINE std::size_t VerletList<BOX>::numMoved( const Vector<T,Base,ArrayOp,Base>& r ) const
+    {
+        if (r.size() != num)
+            return r.size();
+        return moved(r.x, r.y, r.z, 1);
+    }
+
+    template <class BOX>
+    INLINE std::size_t VerletList<BOX>::numMoved( const Vector<T>* r, std::size_t num ) const
+    {
+        if (num != this->num)
+            return num;
+        if (num == 0)
+            return 0;
+        return moved(&r[0].x, &r[0].y, &r[0].z, 3);
+    }
+
+    template <class BOX>
+    INLINE bool VerletList<BOX>::update( const Vector<T,Base,ArrayOp,Base>& r )
+    {
+        if (stale || r.size() != num || numMoved(r) > 0) {
+            build(r);
+            return true;
+        }
+        return false;
+    }
+
+    template <class BOX>
+    INLINE bool VerletList<BOX>::update( const Vector<T>* r, std::size_t num )
+    {
+        if (stale || num != this->num || numMoved(r, num) > 0) {
+            build(r, num);
+            return true;
+        }
+        return false;
+    }
+
+    template <class BOX>
+    template <class F>
+    INLINE F VerletList<BOX>::forEachPair( F f ) const
+    {
+        for (std::size_t i = 0; i < num; i++)
+            for (std::size_t k = start[i]; k < start[i + 1]; k++)
+                f(i, nbr[k]);
+        return f;
+    }
+
+} // end namespace vecmat3
+
+#endif
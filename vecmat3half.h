@@ -0,0 +1,280 @@
+//
+// vecmat3half.h - 16-bit floating point storage types for arrays of
+//                 vecmat3 vectors and matrices
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// NOTES:
+//
+// - Half (IEEE 754 binary16: 11 significant bits, up to 65504) and
+//   BFloat16 (8 significant bits, the range of float) are storage
+//   types: they only convert to and from float, and are meant as the
+//   element type of arrays, e.g. VectorArray<Half>, which take a
+//   quarter of the memory of VectorArray<double>.
+//
+// - Expressions are evaluated in float by converting with Convert
+//   from vecmat3.h, which rounds once when storing the result:
+//     VectorArray<Half> f(num);
+//     f = Convert<Half>(Convert<float>(f) + dt*Convert<float>(g));
+//
+// - Large arrays are converted most efficiently with convert(in,out),
+//   which uses the F16C or AVX-512F instructions (e.g. with -mf16c or
+//   -march=native) for Half if available. Otherwise, and for BFloat16,
+//   it uses loops without branches; for Half, gcc only vectorizes these
+//   with -fno-trapping-math.
+//
+
+#ifndef _VECMAT3HALF_
+#define _VECMAT3HALF_
+
+#include "vecmat3batch.h"
+#include <cstring>
+#if defined(__F16C__) || defined(__AVX512F__)
+# include <immintrin.h>
+#endif
+
+namespace vecmat3 {
+
+    //
+    // Bit-level conversions, rounding to nearest even and giving the
+    // same results as the F16C and AVX-512 instructions, also for nan.
+    // These are written for 32-bit unsigned ints and IEEE floats, after
+    // F. Giesen's public domain half<->float conversions, but without
+    // branches.
+    //
+    INLINE unsigned int floatBits( float f )
+    {
+        unsigned int u;
+        std::memcpy(&u, &f, sizeof(u));
+        return u;
+    }
+
+    INLINE float bitsFloat( unsigned int u )
+    {
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    INLINE float halfToFloat( unsigned short h )
+    {
+        const unsigned int shiftedExp = 0x7c00u << 13;     // exponent mask after shift
+        unsigned int o = (h & 0x7fffu) << 13;              // exponent and mantissa
+        unsigned int exp = shiftedExp & o;
+        unsigned int normal = o + ((127 - 15) << 23);      // rebias the exponent
+        unsigned int infnan = (o + ((255 - 31) << 23))     // inf or nan, quieted
+                            | select<unsigned int>(h & 0x3ffu, 0x400000u, 0u);
+        unsigned int subnormal = floatBits(bitsFloat(o + (113u << 23)) - bitsFloat(113u << 23));
+        o = select(exp == shiftedExp, infnan, select(exp == 0, subnormal, normal));
+        return bitsFloat(o | (h & 0x8000u) << 16);
+    }
+
+    INLINE unsigned short floatToHalf( float f )
+    {
+        const unsigned int denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        unsigned int u = floatBits(f);
+        unsigned int sign = u & 0x80000000u;
+        u ^= sign;
+        unsigned int normal = (u + ((15u - 127u) << 23) + 0xfff + ((u >> 13) & 1)) >> 13;
+        unsigned int subnormal = floatBits(bitsFloat(u) + bitsFloat(denormMagic)) - denormMagic;
+        unsigned int infnan = select(u > 255u << 23, 0x7e00 | ((u >> 13) & 0x3ff), 0x7c00u);
+        unsigned int o = select(u >= (127 + 16) << 23, infnan,      // overflow, inf or quiet nan
+                                select(u < 113u << 23, subnormal, normal));
+        return (unsigned short)(o | sign >> 16);
+    }
+
+    INLINE float bfloat16ToFloat( unsigned short b )
+    {
+        return bitsFloat((unsigned int)b << 16);
+    }
+
+    INLINE unsigned short floatToBfloat16( float f )
+    {
+        unsigned int u = floatBits(f);
+        unsigned int rounded = (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+        unsigned int quiet = (u >> 16) | 0x40;             // nan stays nan
+        return (unsigned short)select((u & 0x7fffffffu) > 0x7f800000u, quiet, rounded);
+    }
+
+    //
+    // Storage types; explicit construction from float rounds to the
+    // nearest representable value
+    //
+    class Half
+    {
+      public:
+        unsigned short bits;
+        INLINE Half() {}
+        INLINE explicit Half( float f )
+        {
+          #if defined(__F16C__)
+            bits = _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+          #else
+            bits = floatToHalf(f);
+          #endif
+        }
+        INLINE operator float() const
+        {
+          #if defined(__F16C__)
+            return _cvtsh_ss(bits);
+          #else
+            return halfToFloat(bits);
+          #endif
+        }
+    };
+
+    class BFloat16
+    {
+      public:
+        unsigned short bits;
+        INLINE BFloat16() {}
+        INLINE explicit BFloat16( float f ) : bits(floatToBfloat16(f)) {}
+        INLINE operator float() const { return bfloat16ToFloat(bits); }
+    };
+
+    //
+    // Conversion of num numbers from in to out. The generic version
+    // converts one by one; those between float and the 16-bit types
+    // use SIMD instructions when available.
+    //
+    template <typename S, typename T>
+    INLINE void convertStream( const S* in, T* out, std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = T(in[n]);
+    }
+
+  #if defined(__F16C__) || defined(__AVX512F__)
+
+    // Number of 16-bit numbers converted per instruction
+    #if defined(__AVX512F__)
+    # define VECMAT3_HALF_BLOCK 16
+    // The unmasked AVX-512 conversions start from an undefined register,
+    // which GCC 12 warns about; all-ones zero-masking avoids that.
+    # define VECMAT3_HALF_MASK ((__mmask16)0xffff)
+    #else
+    # define VECMAT3_HALF_BLOCK 8
+    #endif
+
+    INLINE void convertStream( const Half* in, float* out, std::size_t num )
+    {
+        const std::size_t blocks = num/VECMAT3_HALF_BLOCK;
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t b = 0; b < blocks; b++) {
+            const std::size_t n = b*VECMAT3_HALF_BLOCK;
+          #if defined(__AVX512F__)
+            _mm512_storeu_ps(out + n, _mm512_maskz_cvtph_ps(VECMAT3_HALF_MASK,
+                                                          _mm256_loadu_si256((const __m256i*)(in + n))));
+          #else
+            _mm256_storeu_ps(out + n, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + n))));
+          #endif
+        }
+        for (std::size_t n = blocks*VECMAT3_HALF_BLOCK; n < num; n++)
+            out[n] = float(in[n]);
+    }
+
+    INLINE void convertStream( const float* in, Half* out, std::size_t num )
+    {
+        const std::size_t blocks = num/VECMAT3_HALF_BLOCK;
+        VECMAT3_OMP_PRAGMA(omp parallel for schedule(static) if(parallel(num)))
+        for (std::size_t b = 0; b < blocks; b++) {
+            const std::size_t n = b*VECMAT3_HALF_BLOCK;
+          #if defined(__AVX512F__)
+            _mm256_storeu_si256((__m256i*)(out + n),
+                                _mm512_maskz_cvtps_ph(VECMAT3_HALF_MASK, _mm512_loadu_ps(in + n),
+                                                      _MM_FROUND_TO_NEAREST_INT));
+          #else
+            _mm_storeu_si128((__m128i*)(out + n),
+                             _mm256_cvtps_ph(_mm256_loadu_ps(in + n), _MM_FROUND_TO_NEAREST_INT));
+          #endif
+        }
+        for (std::size_t n = blocks*VECMAT3_HALF_BLOCK; n < num; n++)
+            out[n] = Half(in[n]);
+    }
+
+    #undef VECMAT3_HALF_BLOCK
+    #undef VECMAT3_HALF_MASK
+
+  #else
+
+    INLINE void convertStream( const Half* in, float* out, std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = halfToFloat(in[n].bits);
+    }
+
+    INLINE void convertStream( const float* in, Half* out, std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n].bits = floatToHalf(in[n]);
+    }
+
+  #endif
+
+    // Widening a bfloat16 is a shift, which vectorizes as it is
+    INLINE void convertStream( const BFloat16* in, float* out, std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n] = bfloat16ToFloat(in[n].bits);
+    }
+
+    // The AVX-512 BF16 instruction flushes subnormals to zero, so this
+    // loop is used instead to give the same results as BFloat16(float)
+    INLINE void convertStream( const float* in, BFloat16* out, std::size_t num )
+    {
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++)
+            out[n].bits = floatToBfloat16(in[n]);
+    }
+
+    //
+    // Conversion of arrays of vectors and matrices of equal size, e.g.
+    // from VectorArray<Half> to VectorArray<float> and back
+    //
+    template <typename S, typename T>
+    INLINE void convert( const Vector<S,Base,ArrayOp,Base>& in,
+                         Vector<T,Base,ArrayOp,Base>& out )
+    {
+        const std::size_t num = in.size();
+        assert(out.size() == num);
+        convertStream(in.x, out.x, num);
+        convertStream(in.y, out.y, num);
+        convertStream(in.z, out.z, num);
+    }
+
+    template <typename S, typename T>
+    INLINE void convert( const Matrix<S,Base,ArrayOp,Base>& in,
+                         Matrix<T,Base,ArrayOp,Base>& out )
+    {
+        const std::size_t num = in.size();
+        assert(out.size() == num);
+        convertStream(in.xx, out.xx, num); convertStream(in.xy, out.xy, num); convertStream(in.xz, out.xz, num);
+        convertStream(in.yx, out.yx, num); convertStream(in.yy, out.yy, num); convertStream(in.yz, out.yz, num);
+        convertStream(in.zx, out.zx, num); convertStream(in.zy, out.zy, num); convertStream(in.zz, out.zz, num);
+    }
+
+} // end namespace vecmat3
+
+#endif
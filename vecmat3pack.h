@@ -0,0 +1,424 @@
+//
+// vecmat3pack.h - SIMD packs to be used as the element type of the
+//                 vecmat3 Vector and Matrix classes
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// NOTES:
+//
+// - A Pack<T,N> holds N values of type T that are operated on
+//   simultaneously. It can be used as the element type of Vector and
+//   Matrix, so that e.g. Vector<Pack<double,4> > holds four vectors,
+//   and a cross product, Matrix*Vector product or Inverse() of such
+//   types computes four results at once.
+//
+// - Comparisons of packs yield a Pack<T,N>::Mask, which can be used
+//   with select(mask,a,b), any(mask) and all(mask).
+//
+// - The lane-wise operations are implemented in PackTraits<T,N>. The
+//   generic version uses loops that compilers can vectorize. When
+//   compiled with SSE2, AVX or AVX-512F support (e.g. -mavx), the
+//   packs of matching register width use intrinsics instead.
+//
+
+#ifndef _VECMAT3PACK_
+#define _VECMAT3PACK_
+
+#include "vecmat3.h"
+#include <cmath>
+#include <iostream>
+#if defined(__SSE2__) || defined(__AVX__) || defined(__AVX512F__)
+# include <immintrin.h>
+#endif
+
+namespace vecmat3 {
+
+    //
+    // Generic implementation of the lane-wise operations
+    //
+    template <typename T, int N>
+    struct PackTraits
+    {
+        struct reg  { T v[N]; };
+        struct mask { bool v[N]; };
+
+        #define PACKLOOP(RESULT,EXPR) \
+            RESULT c; for (int i = 0; i < N; i++) c.v[i] = (EXPR); return c;
+
+        static INLINE reg  set1  ( T a )              { PACKLOOP(reg, a) }
+        static INLINE reg  load  ( const T* p )       { PACKLOOP(reg, p[i]) }
+        static INLINE void store ( T* p, reg a )      { for (int i = 0; i < N; i++) p[i] = a.v[i]; }
+        static INLINE reg  add   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]+b.v[i]) }
+        static INLINE reg  sub   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]-b.v[i]) }
+        static INLINE reg  mul   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]*b.v[i]) }
+        static INLINE reg  div   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]/b.v[i]) }
+        static INLINE reg  fma   ( reg a, reg b, reg d ) { PACKLOOP(reg, fmadd(a.v[i], b.v[i], d.v[i])) }
+        static INLINE reg  neg   ( reg a )            { PACKLOOP(reg, -a.v[i]) }
+        static INLINE reg  abs   ( reg a )            { PACKLOOP(reg, a.v[i]<0?-a.v[i]:a.v[i]) }
+        static INLINE reg  min   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]<b.v[i]?a.v[i]:b.v[i]) }
+        static INLINE reg  max   ( reg a, reg b )     { PACKLOOP(reg, a.v[i]>b.v[i]?a.v[i]:b.v[i]) }
+        static INLINE reg  sqrt  ( reg a )            { PACKLOOP(reg, (T)std::sqrt(a.v[i])) }
+        static INLINE mask lt    ( reg a, reg b )     { PACKLOOP(mask, a.v[i]<b.v[i]) }
+        static INLINE mask le    ( reg a, reg b )     { PACKLOOP(mask, a.v[i]<=b.v[i]) }
+        static INLINE mask eq    ( reg a, reg b )     { PACKLOOP(mask, a.v[i]==b.v[i]) }
+        static INLINE mask ne    ( reg a, reg b )     { PACKLOOP(mask, a.v[i]!=b.v[i]) }
+        static INLINE mask land  ( mask a, mask b )   { PACKLOOP(mask, a.v[i] and b.v[i]) }
+        static INLINE mask lor   ( mask a, mask b )   { PACKLOOP(mask, a.v[i] or b.v[i]) }
+        static INLINE mask lnot  ( mask a )           { PACKLOOP(mask, not a.v[i]) }
+        static INLINE reg  select( mask m, reg a, reg b ) { PACKLOOP(reg, m.v[i]?a.v[i]:b.v[i]) }
+        static INLINE bool any   ( mask m )
+        {
+            bool result = false;
+            for (int i = 0; i < N; i++) result = result or m.v[i];
+            return result;
+        }
+        static INLINE bool all   ( mask m )
+        {
+            bool result = true;
+            for (int i = 0; i < N; i++) result = result and m.v[i];
+            return result;
+        }
+
+        #undef PACKLOOP
+    };
+
+    //
+    // Specializations using SSE2 or AVX intrinsics. These only differ
+    // in prefix, suffix and the form of the comparison intrinsics.
+    //
+    #define SSECMP(PRE,SUF,a,b,OP,PRED) PRE##_cmp##OP##_##SUF(a,b)
+    #define AVXCMP(PRE,SUF,a,b,OP,PRED) PRE##_cmp_##SUF(a,b,PRED)
+    #if VECMAT3_FMA && defined(__FMA__)
+    #define PACKFMA(PRE,SUF,a,b,c) PRE##_fmadd_##SUF(a,b,c)
+    #else
+    #define PACKFMA(PRE,SUF,a,b,c) PRE##_add_##SUF(PRE##_mul_##SUF(a,b),c)
+    #endif
+
+    #define PACKTRAITS(T,N,REG,PRE,SUF,CMP)                                                        \
+    template <>                                                                                    \
+    struct PackTraits<T,N>                                                                         \
+    {                                                                                              \
+        typedef REG reg;                                                                           \
+        typedef REG mask;                                                                          \
+        static INLINE reg  set1  ( T a )              { return PRE##_set1_##SUF(a); }              \
+        static INLINE reg  load  ( const T* p )       { return PRE##_loadu_##SUF(p); }             \
+        static INLINE void store ( T* p, reg a )      { PRE##_storeu_##SUF(p, a); }                \
+        static INLINE reg  add   ( reg a, reg b )     { return PRE##_add_##SUF(a, b); }            \
+        static INLINE reg  sub   ( reg a, reg b )     { return PRE##_sub_##SUF(a, b); }            \
+        static INLINE reg  mul   ( reg a, reg b )     { return PRE##_mul_##SUF(a, b); }            \
+        static INLINE reg  div   ( reg a, reg b )     { return PRE##_div_##SUF(a, b); }            \
+        static INLINE reg  fma   ( reg a, reg b, reg d ) { return PACKFMA(PRE,SUF,a,b,d); }        \
+        static INLINE reg  neg   ( reg a )            { return PRE##_xor_##SUF(PRE##_set1_##SUF(-T(0)), a); }    \
+        static INLINE reg  abs   ( reg a )            { return PRE##_andnot_##SUF(PRE##_set1_##SUF(-T(0)), a); } \
+        static INLINE reg  min   ( reg a, reg b )     { return PRE##_min_##SUF(a, b); }            \
+        static INLINE reg  max   ( reg a, reg b )     { return PRE##_max_##SUF(a, b); }            \
+        static INLINE reg  sqrt  ( reg a )            { return PRE##_sqrt_##SUF(a); }              \
+        static INLINE mask lt    ( reg a, reg b )     { return CMP(PRE,SUF,a,b,lt,_CMP_LT_OQ); }   \
+        static INLINE mask le    ( reg a, reg b )     { return CMP(PRE,SUF,a,b,le,_CMP_LE_OQ); }   \
+        static INLINE mask eq    ( reg a, reg b )     { return CMP(PRE,SUF,a,b,eq,_CMP_EQ_OQ); }   \
+        static INLINE mask ne    ( reg a, reg b )     { return CMP(PRE,SUF,a,b,neq,_CMP_NEQ_UQ); } \
+        static INLINE mask land  ( mask a, mask b )   { return PRE##_and_##SUF(a, b); }            \
+        static INLINE mask lor   ( mask a, mask b )   { return PRE##_or_##SUF(a, b); }             \
+        static INLINE mask lnot  ( mask a )                                                        \
+        {                                                                                          \
+            reg zero = PRE##_setzero_##SUF();                                                      \
+            return PRE##_andnot_##SUF(a, CMP(PRE,SUF,zero,zero,eq,_CMP_EQ_OQ));                    \
+        }                                                                                          \
+        static INLINE reg  select( mask m, reg a, reg b )                                          \
+        {                                                                                          \
+            return PRE##_or_##SUF(PRE##_and_##SUF(m, a), PRE##_andnot_##SUF(m, b));                \
+        }                                                                                          \
+        static INLINE bool any   ( mask m )           { return PRE##_movemask_##SUF(m) != 0; }     \
+        static INLINE bool all   ( mask m )           { return PRE##_movemask_##SUF(m) == (1<<N)-1; } \
+    };
+
+    #if defined(__SSE2__)
+    PACKTRAITS(double, 2, __m128d, _mm,    pd, SSECMP)
+    PACKTRAITS(float,  4, __m128,  _mm,    ps, SSECMP)
+    #endif
+    #if defined(__AVX__)
+    PACKTRAITS(double, 4, __m256d, _mm256, pd, AVXCMP)
+    PACKTRAITS(float,  8, __m256,  _mm256, ps, AVXCMP)
+    #endif
+
+    #undef PACKTRAITS
+    #undef SSECMP
+    #undef AVXCMP
+    #undef PACKFMA
+
+    //
+    // Specializations using AVX-512F intrinsics, for which comparisons
+    // yield bit masks rather than registers.
+    //
+    #if VECMAT3_FMA
+    #define PACKFMA512(SUF,a,b,c) _mm512_fmadd_##SUF(a,b,c)
+    #else
+    #define PACKFMA512(SUF,a,b,c) _mm512_add_##SUF(_mm512_mul_##SUF(a,b),c)
+    #endif
+
+    #define PACKTRAITS512(T,N,REG,SUF,MASK,EPI,SIGN)                                               \
+    template <>                                                                                    \
+    struct PackTraits<T,N>                                                                         \
+    {                                                                                              \
+        typedef REG reg;                                                                           \
+        typedef MASK mask;                                                                         \
+        static INLINE reg  set1  ( T a )              { return _mm512_set1_##SUF(a); }             \
+        static INLINE reg  load  ( const T* p )       { return _mm512_loadu_##SUF(p); }            \
+        static INLINE void store ( T* p, reg a )      { _mm512_storeu_##SUF(p, a); }               \
+        static INLINE reg  add   ( reg a, reg b )     { return _mm512_add_##SUF(a, b); }           \
+        static INLINE reg  sub   ( reg a, reg b )     { return _mm512_sub_##SUF(a, b); }           \
+        static INLINE reg  mul   ( reg a, reg b )     { return _mm512_mul_##SUF(a, b); }           \
+        static INLINE reg  div   ( reg a, reg b )     { return _mm512_div_##SUF(a, b); }           \
+        static INLINE reg  fma   ( reg a, reg b, reg d ) { return PACKFMA512(SUF,a,b,d); }         \
+        static INLINE reg  neg   ( reg a )                                                         \
+        {                                                                                          \
+            return _mm512_castsi512_##SUF(_mm512_xor_si512(_mm512_cast##SUF##_si512(a),            \
+                                                           _mm512_set1_##EPI(SIGN)));              \
+        }                                                                                          \
+        static INLINE reg  abs   ( reg a )            { return _mm512_abs_##SUF(a); }              \
+        static INLINE reg  min   ( reg a, reg b )     { return _mm512_min_##SUF(a, b); }           \
+        static INLINE reg  max   ( reg a, reg b )     { return _mm512_max_##SUF(a, b); }           \
+        static INLINE reg  sqrt  ( reg a )            { return _mm512_sqrt_##SUF(a); }             \
+        static INLINE mask lt    ( reg a, reg b )     { return _mm512_cmp_##SUF##_mask(a, b, _CMP_LT_OQ); }  \
+        static INLINE mask le    ( reg a, reg b )     { return _mm512_cmp_##SUF##_mask(a, b, _CMP_LE_OQ); }  \
+        static INLINE mask eq    ( reg a, reg b )     { return _mm512_cmp_##SUF##_mask(a, b, _CMP_EQ_OQ); }  \
+        static INLINE mask ne    ( reg a, reg b )     { return _mm512_cmp_##SUF##_mask(a, b, _CMP_NEQ_UQ); } \
+        static INLINE mask land  ( mask a, mask b )   { return a & b; }                            \
+        static INLINE mask lor   ( mask a, mask b )   { return a | b; }                            \
+        static INLINE mask lnot  ( mask a )           { return (mask)~a; }                         \
+        static INLINE reg  select( mask m, reg a, reg b ) { return _mm512_mask_blend_##SUF(m, b, a); } \
+        static INLINE bool any   ( mask m )           { return m != 0; }                           \
+        static INLINE bool all   ( mask m )           { return m == (mask)~0; }                    \
+    };
+
+    #if defined(__AVX512F__)
+    PACKTRAITS512(double, 8, __m512d, pd, __mmask8,  epi64, (long long)0x8000000000000000ULL)
+    PACKTRAITS512(float, 16, __m512,  ps, __mmask16, epi32, (int)0x80000000U)
+    #endif
+
+    #undef PACKTRAITS512
+    #undef PACKFMA512
+
+    //
+    // The pack class
+    //
+    template <typename T, int N>
+    class Pack
+    {
+      public:
+        typedef PackTraits<T,N>        Traits;
+        typedef typename Traits::reg   Reg;
+        typedef T                      value_type;
+        enum { lanes = N };
+
+        //
+        // Result of comparisons between packs
+        //
+        class Mask
+        {
+          public:
+            typename Traits::mask m;
+            INLINE explicit Mask( typename Traits::mask m_ ) : m(m_) {}
+            friend INLINE Mask operator&& ( const Mask& a, const Mask& b ) { return Mask(Traits::land(a.m, b.m)); }
+            friend INLINE Mask operator|| ( const Mask& a, const Mask& b ) { return Mask(Traits::lor(a.m, b.m)); }
+            friend INLINE Mask operator!  ( const Mask& a )                { return Mask(Traits::lnot(a.m)); }
+            friend INLINE bool any ( const Mask& a ) { return Traits::any(a.m); }
+            friend INLINE bool all ( const Mask& a ) { return Traits::all(a.m); }
+        };
+
+        Reg r;  // the register (or array) holding the lanes
+
+        //
+        // Constructors; a T is broadcast to all lanes
+        //
+        INLINE          Pack() {}
+        INLINE          Pack( T a ) : r(Traits::set1(a)) {}
+        INLINE explicit Pack( Reg a ) : r(a) {}
+
+        //
+        // Loading and storing N consecutive values
+        //
+        static INLINE Pack load( const T* p ) { return Pack(Traits::load(p)); }
+        INLINE void        store( T* p ) const { Traits::store(p, r); }
+
+        //
+        // Access to individual lanes
+        //
+        INLINE const T& operator[] ( const int i ) const { return reinterpret_cast<const T*>(&r)[i]; }
+        INLINE T&       operator[] ( const int i )       { return reinterpret_cast<T*>(&r)[i]; }
+
+        //
+        // Arithmetic assignment operators
+        //
+        INLINE Pack& operator+= ( const Pack& a ) { r = Traits::add(r, a.r); return *this; }
+        INLINE Pack& operator-= ( const Pack& a ) { r = Traits::sub(r, a.r); return *this; }
+        INLINE Pack& operator*= ( const Pack& a ) { r = Traits::mul(r, a.r); return *this; }
+        INLINE Pack& operator/= ( const Pack& a ) { r = Traits::div(r, a.r); return *this; }
+
+        //
+        // Lane-wise operators and functions. As friends defined in the
+        // class, they are only found for arguments of type Pack, so they
+        // do not hide e.g. ::sqrt(double) inside namespace vecmat3.
+        //
+        friend INLINE Pack operator- ( const Pack& a )                { return Pack(Traits::neg(a.r)); }
+        friend INLINE Pack operator+ ( const Pack& a, const Pack& b ) { return Pack(Traits::add(a.r, b.r)); }
+        friend INLINE Pack operator- ( const Pack& a, const Pack& b ) { return Pack(Traits::sub(a.r, b.r)); }
+        friend INLINE Pack operator* ( const Pack& a, const Pack& b ) { return Pack(Traits::mul(a.r, b.r)); }
+        friend INLINE Pack operator/ ( const Pack& a, const Pack& b ) { return Pack(Traits::div(a.r, b.r)); }
+
+        friend INLINE Mask operator<  ( const Pack& a, const Pack& b ) { return Mask(Traits::lt(a.r, b.r)); }
+        friend INLINE Mask operator<= ( const Pack& a, const Pack& b ) { return Mask(Traits::le(a.r, b.r)); }
+        friend INLINE Mask operator>  ( const Pack& a, const Pack& b ) { return Mask(Traits::lt(b.r, a.r)); }
+        friend INLINE Mask operator>= ( const Pack& a, const Pack& b ) { return Mask(Traits::le(b.r, a.r)); }
+        friend INLINE Mask operator== ( const Pack& a, const Pack& b ) { return Mask(Traits::eq(a.r, b.r)); }
+        friend INLINE Mask operator!= ( const Pack& a, const Pack& b ) { return Mask(Traits::ne(a.r, b.r)); }
+
+        friend INLINE Pack select ( const Mask& m, const Pack& a, const Pack& b )
+        {
+            return Pack(Traits::select(m.m, a.r, b.r));
+        }
+        friend INLINE Pack absval ( const Pack& a )                { return Pack(Traits::abs(a.r)); }
+        friend INLINE Pack fabs   ( const Pack& a )                { return Pack(Traits::abs(a.r)); }
+        friend INLINE Pack maxval ( const Pack& a, const Pack& b ) { return Pack(Traits::max(a.r, b.r)); }
+        friend INLINE Pack minval ( const Pack& a, const Pack& b ) { return Pack(Traits::min(a.r, b.r)); }
+        friend INLINE Pack sqrt   ( const Pack& a )                { return Pack(Traits::sqrt(a.r)); }
+
+        // There are no vector intrinsics for these, so they go lane by lane
+        friend INLINE Pack sin ( const Pack& a )
+        {
+            Pack c;
+            for (int i = 0; i < N; i++) c[i] = std::sin(a[i]);
+            return c;
+        }
+        friend INLINE Pack cos ( const Pack& a )
+        {
+            Pack c;
+            for (int i = 0; i < N; i++) c[i] = std::cos(a[i]);
+            return c;
+        }
+
+        // Output as (a,b,...)
+        friend INLINE std::ostream& operator<< ( std::ostream& o, const Pack& a )
+        {
+            o << "(" << a[0];
+            for (int i = 1; i < N; i++) o << "," << a[i];
+            return o << ")";
+        }
+    };
+
+    //
+    // Lane-wise multiply-adds, fused if VECMAT3_FMA is set. Unlike the
+    // functions above, these overload the generic versions in vecmat3.h,
+    // so they are also found as vecmat3::fmadd etc.
+    //
+    template <typename T, int N>
+    INLINE Pack<T,N> fmadd( const Pack<T,N>& a, const Pack<T,N>& b, const Pack<T,N>& c )
+    {
+        return Pack<T,N>(PackTraits<T,N>::fma(a.r, b.r, c.r));
+    }
+
+    template <typename T, int N>
+    INLINE Pack<T,N> fmsub( const Pack<T,N>& a, const Pack<T,N>& b, const Pack<T,N>& c )
+    {
+        return Pack<T,N>(PackTraits<T,N>::fma(a.r, b.r, PackTraits<T,N>::neg(c.r)));
+    }
+
+    template <typename T, int N>
+    INLINE Pack<T,N> fnmadd( const Pack<T,N>& a, const Pack<T,N>& b, const Pack<T,N>& c )
+    {
+        return Pack<T,N>(PackTraits<T,N>::fma(PackTraits<T,N>::neg(a.r), b.r, c.r));
+    }
+
+    //
+    // Conversion between packed vectors or matrices and N ordinary
+    // ones, or N consecutive elements of a VectorArray.
+    //
+
+    // Gather N vectors into a vector of packs
+    template <int N, typename T>
+    INLINE Vector<Pack<T,N> > gather( const Vector<T>* v )
+    {
+        Vector<Pack<T,N> > p;
+        for (int i = 0; i < N; i++) {
+            p.x[i] = v[i].x;
+            p.y[i] = v[i].y;
+            p.z[i] = v[i].z;
+        }
+        return p;
+    }
+
+    // Gather elements n, n+1, ..., n+N-1 of an array of vectors
+    template <int N, typename T>
+    INLINE Vector<Pack<T,N> > gather( const Vector<T,Base,ArrayOp,Base>& a,
+                                      std::size_t n )
+    {
+        return Vector<Pack<T,N> >(Pack<T,N>::load(a.x+n),
+                                  Pack<T,N>::load(a.y+n),
+                                  Pack<T,N>::load(a.z+n));
+    }
+
+    // Gather N matrices into a matrix of packs
+    template <int N, typename T>
+    INLINE Matrix<Pack<T,N> > gather( const Matrix<T>* m )
+    {
+        Matrix<Pack<T,N> > p;
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < 9; j++)
+                (&p.xx)[j][i] = (&m[i].xx)[j];
+        return p;
+    }
+
+    // Scatter a vector of packs into N vectors
+    template <typename T, int N>
+    INLINE void scatter( const Vector<Pack<T,N> >& p,
+                         Vector<T>* v )
+    {
+        for (int i = 0; i < N; i++) {
+            v[i].x = p.x[i];
+            v[i].y = p.y[i];
+            v[i].z = p.z[i];
+        }
+    }
+
+    // Scatter a vector of packs into elements n, ..., n+N-1 of an array
+    template <typename T, int N>
+    INLINE void scatter( const Vector<Pack<T,N> >& p,
+                         Vector<T,Base,ArrayOp,Base>& a,
+                         std::size_t n )
+    {
+        p.x.store(a.x+n);
+        p.y.store(a.y+n);
+        p.z.store(a.z+n);
+    }
+
+    // Scatter a matrix of packs into N matrices
+    template <typename T, int N>
+    INLINE void scatter( const Matrix<Pack<T,N> >& p,
+                         Matrix<T>* m )
+    {
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < 9; j++)
+                (&m[i].xx)[j] = (&p.xx)[j][i];
+    }
+
+} // end namespace vecmat3
+
+#endif
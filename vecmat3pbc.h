@@ -0,0 +1,735 @@
+//
+// vecmat3pbc.h - Periodic boundary conditions for vecmat3 vectors
+//
+// Copyright (c) 2007-2013  Ramses van Zon
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// NOTES:
+//
+// - The member functions of the box classes in this file work on
+//   single vectors or vector expressions. The non-member functions
+//   that take a box as their first argument work on arrays of
+//   vectors, with loops that compilers can vectorize and that are
+//   divided over threads when compiled with OpenMP, as in
+//   vecmat3batch.h.
+//
+// - Images are found by rounding rather than by comparisons, so
+//   vectors may be any number of box lengths away, as long as that
+//   number is less than 2^31.
+//
+
+#ifndef _VECMAT3PBC_
+#define _VECMAT3PBC_
+
+#include "vecmat3batch.h"
+
+namespace vecmat3 {
+
+    // Minimum image of a component d for a box length l with inverse il
+    template <typename T>
+    INLINE T minimumImage( T d, T l, T il )
+    {
+        return d - l*roundInt(d*il);
+    }
+
+    // Image of a component r in [0,l)
+    template <typename T>
+    INLINE T wrapped( T r, T l, T il )
+    {
+        T w = r - l*floorInt(r*il);
+        return select(w < l, w, w - l); // for r slightly below zero, w=l
+    }
+
+    //
+    // Orthorhombic periodic box with edge lengths lx, ly and lz, with
+    // one corner at the origin.
+    //
+    template <typename T>
+    class Box
+    {
+      public:
+        typedef T value_type;
+
+        INLINE          Box() {}
+        INLINE explicit Box( T lx, T ly, T lz ) { setSize(lx, ly, lz); }
+
+        INLINE void     setSize( T lx, T ly, T lz );
+        INLINE const Vector<T>& size()    const { return l; }   // edge lengths
+        INLINE const Vector<T>& invSize() const { return il; }  // their inverses
+        INLINE T        volume()          const { return l.x*l.y*l.z; }
+        INLINE const Vector<T>& width()   const { return l; }   // distances between opposite faces
+
+        // Shift s such that a+s-b is the minimum image of a-b, to be
+        // used e.g. in distwithshift(a,b,s)
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> shift( const Vector<T,A,B,C>& a,
+                                const Vector<T,D,E,F>& b ) const;
+
+        // Minimum image of a-b
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> displacement( const Vector<T,A,B,C>& a,
+                                       const Vector<T,D,E,F>& b ) const;
+
+        // Minimum image distance between a and b, and its square
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE T dist( const Vector<T,A,B,C>& a,
+                       const Vector<T,D,E,F>& b ) const;
+
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE T dist2( const Vector<T,A,B,C>& a,
+                        const Vector<T,D,E,F>& b ) const;
+
+        // Image of r inside the box
+        template <typename A,int B,typename C>
+        INLINE Vector<T> wrap( const Vector<T,A,B,C>& r ) const;
+
+        // Image of r closest to ref, e.g. to undo wrapping along a
+        // trajectory, with ref the previous unwrapped position
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> unwrap( const Vector<T,A,B,C>& r,
+                                 const Vector<T,D,E,F>& ref ) const;
+
+        // Fractional coordinates of r, and the inverse transformation
+        template <typename A,int B,typename C>
+        INLINE Vector<T> fractional( const Vector<T,A,B,C>& r ) const;
+
+        template <typename A,int B,typename C>
+        INLINE Vector<T> cartesian( const Vector<T,A,B,C>& s ) const;
+
+        // Replace the components of a difference vector by those of
+        // its minimum image, and of a position by those of its image
+        // inside the box, as used in the kernels for arrays below
+        INLINE void nearestImage( T& x, T& y, T& z ) const
+        {
+            x = minimumImage(x, l.x, il.x);
+            y = minimumImage(y, l.y, il.y);
+            z = minimumImage(z, l.z, il.z);
+        }
+        INLINE void insideImage( T& x, T& y, T& z ) const
+        {
+            x = wrapped(x, l.x, il.x);
+            y = wrapped(y, l.y, il.y);
+            z = wrapped(z, l.z, il.z);
+        }
+
+      private:
+        Vector<T> l;   // edge lengths
+        Vector<T> il;  // inverse edge lengths
+    };
+
+    template <typename T>
+    INLINE void Box<T>::setSize( T lx, T ly, T lz )
+    {
+        l = Vector<T>(lx, ly, lz);
+        il = Vector<T>(1/lx, 1/ly, 1/lz);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> Box<T>::shift( const Vector<T,A,B,C>& a,
+                                    const Vector<T,D,E,F>& b ) const
+    {
+        Vector<T> d = a - b;
+        return Vector<T>(-l.x*roundInt(d.x*il.x),
+                         -l.y*roundInt(d.y*il.y),
+                         -l.z*roundInt(d.z*il.z));
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> Box<T>::displacement( const Vector<T,A,B,C>& a,
+                                           const Vector<T,D,E,F>& b ) const
+    {
+        Vector<T> d = a - b;
+        nearestImage(d.x, d.y, d.z);
+        return d;
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE T Box<T>::dist( const Vector<T,A,B,C>& a,
+                           const Vector<T,D,E,F>& b ) const
+    {
+        return distwithshift(a, b, shift(a, b));
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE T Box<T>::dist2( const Vector<T,A,B,C>& a,
+                            const Vector<T,D,E,F>& b ) const
+    {
+        return displacement(a, b).nrm2();
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> Box<T>::wrap( const Vector<T,A,B,C>& re ) const
+    {
+        Vector<T> r = re;
+        insideImage(r.x, r.y, r.z);
+        return r;
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> Box<T>::unwrap( const Vector<T,A,B,C>& r,
+                                     const Vector<T,D,E,F>& ref ) const
+    {
+        return ref + displacement(r, ref);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> Box<T>::fractional( const Vector<T,A,B,C>& re ) const
+    {
+        Vector<T> r = re;
+        return Vector<T>(r.x*il.x, r.y*il.y, r.z*il.z);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> Box<T>::cartesian( const Vector<T,A,B,C>& se ) const
+    {
+        Vector<T> s = se;
+        return Vector<T>(s.x*l.x, s.y*l.y, s.z*l.z);
+    }
+
+
+    //
+    // Triclinic periodic box, spanned by the columns a, b and c of
+    // the upper triangular matrix
+    //
+    //       ( ax bx cx )
+    //   h = (  0 by cy )
+    //       (  0  0 cz )
+    //
+    // with one corner at the origin, i.e., a lies along the x axis and
+    // b in the xy plane. Positions r have fractional coordinates
+    // s = Inverse(h)*r, and images are found by rounding s. This gives
+    // the minimum image whenever the minimum image distance is less
+    // than half the smallest width of the box, which holds for all
+    // pairs within an interaction cutoff less than that.
+    //
+    template <typename T>
+    class TriclinicBox
+    {
+      public:
+        typedef T value_type;
+
+        INLINE          TriclinicBox() {}
+        template <typename A,int B,typename C>
+        INLINE explicit TriclinicBox( const Matrix<T,A,B,C>& h ) { setShape(h); }
+        INLINE          TriclinicBox( T ax, T by, T cz, T bx, T cx, T cy );
+
+        // Elements of h below the diagonal are taken to be zero
+        template <typename A,int B,typename C>
+        INLINE void     setShape( const Matrix<T,A,B,C>& h );
+        INLINE Matrix<T> shape()    const;                       // h
+        INLINE Matrix<T> invShape() const;                       // Inverse(h)
+        INLINE T        volume()    const { return hxx*hyy*hzz; }
+        INLINE Vector<T> width()    const;   // distances between opposite faces
+
+        // Shift s such that a+s-b is the minimum image of a-b
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> shift( const Vector<T,A,B,C>& a,
+                                const Vector<T,D,E,F>& b ) const;
+
+        // Minimum image of a-b
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> displacement( const Vector<T,A,B,C>& a,
+                                       const Vector<T,D,E,F>& b ) const;
+
+        // Minimum image distance between a and b, and its square
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE T dist( const Vector<T,A,B,C>& a,
+                       const Vector<T,D,E,F>& b ) const;
+
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE T dist2( const Vector<T,A,B,C>& a,
+                        const Vector<T,D,E,F>& b ) const;
+
+        // Image of r inside the box, i.e., with fractional coordinates
+        // in [0,1)
+        template <typename A,int B,typename C>
+        INLINE Vector<T> wrap( const Vector<T,A,B,C>& r ) const;
+
+        // Image of r closest to ref
+        template <typename A,int B,typename C,typename D,int E,typename F>
+        INLINE Vector<T> unwrap( const Vector<T,A,B,C>& r,
+                                 const Vector<T,D,E,F>& ref ) const;
+
+        // Fractional coordinates Inverse(h)*r of r, and the inverse
+        // transformation h*s
+        template <typename A,int B,typename C>
+        INLINE Vector<T> fractional( const Vector<T,A,B,C>& r ) const;
+
+        template <typename A,int B,typename C>
+        INLINE Vector<T> cartesian( const Vector<T,A,B,C>& s ) const;
+
+        // In-place versions for the components, as in Box
+        INLINE void nearestImage( T& x, T& y, T& z ) const
+        {
+            T nx = roundInt(gxx*x + gxy*y + gxz*z);
+            T ny = roundInt(gyy*y + gyz*z);
+            T nz = roundInt(gzz*z);
+            x -= hxx*nx + hxy*ny + hxz*nz;
+            y -= hyy*ny + hyz*nz;
+            z -= hzz*nz;
+        }
+        INLINE void insideImage( T& x, T& y, T& z ) const
+        {
+            T sx = gxx*x + gxy*y + gxz*z;
+            T sy = gyy*y + gyz*z;
+            T sz = gzz*z;
+            sx -= floorInt(sx); sx = select(sx < 1, sx, sx - 1);
+            sy -= floorInt(sy); sy = select(sy < 1, sy, sy - 1);
+            sz -= floorInt(sz); sz = select(sz < 1, sz, sz - 1);
+            x = hxx*sx + hxy*sy + hxz*sz;
+            y = hyy*sy + hyz*sz;
+            z = hzz*sz;
+        }
+
+      private:
+        // the non-zero elements of h and of its inverse g, which is
+        // upper triangular as well
+        T hxx, hxy, hxz, hyy, hyz, hzz;
+        T gxx, gxy, gxz, gyy, gyz, gzz;
+    };
+
+    template <typename T>
+    INLINE TriclinicBox<T>::TriclinicBox( T ax, T by, T cz, T bx, T cx, T cy )
+    {
+        setShape(Matrix<T>(ax, bx, cx,
+                           0,  by, cy,
+                           0,  0,  cz));
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE void TriclinicBox<T>::setShape( const Matrix<T,A,B,C>& he )
+    {
+        Matrix<T> h = he;
+        hxx = h.xx; hxy = h.xy; hxz = h.xz;
+        hyy = h.yy; hyz = h.yz;
+        hzz = h.zz;
+        gxx = 1/hxx;
+        gyy = 1/hyy;
+        gzz = 1/hzz;
+        gxy = -hxy*gxx*gyy;
+        gyz = -hyz*gyy*gzz;
+        gxz = (hxy*hyz - hxz*hyy)*gxx*gyy*gzz;
+    }
+
+    template <typename T>
+    INLINE Matrix<T> TriclinicBox<T>::shape() const
+    {
+        return Matrix<T>(hxx, hxy, hxz,
+                         0,   hyy, hyz,
+                         0,   0,   hzz);
+    }
+
+    template <typename T>
+    INLINE Matrix<T> TriclinicBox<T>::invShape() const
+    {
+        return Matrix<T>(gxx, gxy, gxz,
+                         0,   gyy, gyz,
+                         0,   0,   gzz);
+    }
+
+    template <typename T>
+    INLINE Vector<T> TriclinicBox<T>::width() const
+    {
+        // one over the lengths of the rows of the inverse
+        return Vector<T>(1/sqrt(gxx*gxx + gxy*gxy + gxz*gxz),
+                         1/sqrt(gyy*gyy + gyz*gyz),
+                         hzz);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> TriclinicBox<T>::shift( const Vector<T,A,B,C>& a,
+                                             const Vector<T,D,E,F>& b ) const
+    {
+        Vector<T> d = a - b;
+        T nx = roundInt(gxx*d.x + gxy*d.y + gxz*d.z);
+        T ny = roundInt(gyy*d.y + gyz*d.z);
+        T nz = roundInt(gzz*d.z);
+        return Vector<T>(-hxx*nx - hxy*ny - hxz*nz,
+                         -hyy*ny - hyz*nz,
+                         -hzz*nz);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> TriclinicBox<T>::displacement( const Vector<T,A,B,C>& a,
+                                                    const Vector<T,D,E,F>& b ) const
+    {
+        Vector<T> d = a - b;
+        nearestImage(d.x, d.y, d.z);
+        return d;
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE T TriclinicBox<T>::dist( const Vector<T,A,B,C>& a,
+                                    const Vector<T,D,E,F>& b ) const
+    {
+        return distwithshift(a, b, shift(a, b));
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE T TriclinicBox<T>::dist2( const Vector<T,A,B,C>& a,
+                                     const Vector<T,D,E,F>& b ) const
+    {
+        return displacement(a, b).nrm2();
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> TriclinicBox<T>::wrap( const Vector<T,A,B,C>& re ) const
+    {
+        Vector<T> r = re;
+        insideImage(r.x, r.y, r.z);
+        return r;
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C,typename D,int E,typename F>
+    INLINE Vector<T> TriclinicBox<T>::unwrap( const Vector<T,A,B,C>& r,
+                                              const Vector<T,D,E,F>& ref ) const
+    {
+        return ref + displacement(r, ref);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> TriclinicBox<T>::fractional( const Vector<T,A,B,C>& re ) const
+    {
+        Vector<T> r = re;
+        return Vector<T>(gxx*r.x + gxy*r.y + gxz*r.z,
+                         gyy*r.y + gyz*r.z,
+                         gzz*r.z);
+    }
+
+    template <typename T>
+    template <typename A,int B,typename C>
+    INLINE Vector<T> TriclinicBox<T>::cartesian( const Vector<T,A,B,C>& se ) const
+    {
+        Vector<T> s = se;
+        return Vector<T>(hxx*s.x + hxy*s.y + hxz*s.z,
+                         hyy*s.y + hyz*s.z,
+                         hzz*s.z);
+    }
+
+    //
+    // Kernels for arrays of vectors, for either kind of box. The box
+    // is copied into a local variable so its elements stay in
+    // registers throughout the loops.
+    //
+
+    // Sets d[n] to the minimum image of a[n]-b[n]
+    template <class BOX,typename T>
+    INLINE void displacement( const BOX& box,
+                              const Vector<T,Base,ArrayOp,Base>& a,
+                              const Vector<T,Base,ArrayOp,Base>& b,
+                              Vector<T,Base,ArrayOp,Base>& d )
+    {
+        const BOX pbc(box);
+        const T* ax = a.x; const T* ay = a.y; const T* az = a.z;
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        T* dx = d.x; T* dy = d.y; T* dz = d.z;
+        std::size_t num = a.size();
+        assert(b.size() == num && d.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = ax[n] - bx[n], y = ay[n] - by[n], z = az[n] - bz[n];
+            pbc.nearestImage(x, y, z);
+            dx[n] = x;
+            dy[n] = y;
+            dz[n] = z;
+        }
+    }
+
+    // The same for arrays of Vector<T>
+    template <class BOX,typename T>
+    INLINE void displacement( const BOX& box,
+                              const Vector<T>* a,
+                              const Vector<T>* b,
+                              Vector<T>* d,
+                              std::size_t num )
+    {
+        const BOX pbc(box);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = a[n].x - b[n].x, y = a[n].y - b[n].y, z = a[n].z - b[n].z;
+            pbc.nearestImage(x, y, z);
+            d[n].x = x;
+            d[n].y = y;
+            d[n].z = z;
+        }
+    }
+
+    // Sets d[n] to the minimum image of r[i[n]]-r[j[n]] for the pairs
+    // (i[n],j[n]), n < d.size()
+    template <class BOX,typename T>
+    INLINE void displacement( const BOX& box,
+                              const Vector<T,Base,ArrayOp,Base>& r,
+                              const std::size_t* i,
+                              const std::size_t* j,
+                              Vector<T,Base,ArrayOp,Base>& d )
+    {
+        const BOX pbc(box);
+        const T* rx = r.x; const T* ry = r.y; const T* rz = r.z;
+        T* dx = d.x; T* dy = d.y; T* dz = d.z;
+        std::size_t num = d.size();
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            std::size_t in = i[n], jn = j[n];
+            T x = rx[in] - rx[jn], y = ry[in] - ry[jn], z = rz[in] - rz[jn];
+            pbc.nearestImage(x, y, z);
+            dx[n] = x;
+            dy[n] = y;
+            dz[n] = z;
+        }
+    }
+
+    // The same for arrays of Vector<T>, with num pairs
+    template <class BOX,typename T>
+    INLINE void displacement( const BOX& box,
+                              const Vector<T>* r,
+                              const std::size_t* i,
+                              const std::size_t* j,
+                              Vector<T>* d,
+                              std::size_t num )
+    {
+        const BOX pbc(box);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            const Vector<T>& ri = r[i[n]];
+            const Vector<T>& rj = r[j[n]];
+            T x = ri.x - rj.x, y = ri.y - rj.y, z = ri.z - rj.z;
+            pbc.nearestImage(x, y, z);
+            d[n].x = x;
+            d[n].y = y;
+            d[n].z = z;
+        }
+    }
+
+    // Sets d2[n] to the squared minimum image distance between a[n]
+    // and b[n]
+    template <class BOX,typename T>
+    INLINE void dist2( const BOX& box,
+                       const Vector<T,Base,ArrayOp,Base>& a,
+                       const Vector<T,Base,ArrayOp,Base>& b,
+                       T* d2 )
+    {
+        const BOX pbc(box);
+        const T* ax = a.x; const T* ay = a.y; const T* az = a.z;
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        std::size_t num = a.size();
+        assert(b.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = ax[n] - bx[n], y = ay[n] - by[n], z = az[n] - bz[n];
+            pbc.nearestImage(x, y, z);
+            d2[n] = x*x + y*y + z*z;
+        }
+    }
+
+    // Sets d2[n] to the squared minimum image distance between a and
+    // b[n], which is the inner loop of pair interactions
+    template <class BOX,typename T,typename A,int B,typename C>
+    INLINE void dist2( const BOX& box,
+                       const Vector<T,A,B,C>& ae,
+                       const Vector<T,Base,ArrayOp,Base>& b,
+                       T* d2 )
+    {
+        const BOX pbc(box);
+        const Vector<T> a(ae);
+        const T* bx = b.x; const T* by = b.y; const T* bz = b.z;
+        std::size_t num = b.size();
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = a.x - bx[n], y = a.y - by[n], z = a.z - bz[n];
+            pbc.nearestImage(x, y, z);
+            d2[n] = x*x + y*y + z*z;
+        }
+    }
+
+    // Sets d2[n] to the squared minimum image distance between r[i[n]]
+    // and r[j[n]] for num pairs
+    template <class BOX,typename T>
+    INLINE void dist2( const BOX& box,
+                       const Vector<T,Base,ArrayOp,Base>& r,
+                       const std::size_t* i,
+                       const std::size_t* j,
+                       T* d2,
+                       std::size_t num )
+    {
+        const BOX pbc(box);
+        const T* rx = r.x; const T* ry = r.y; const T* rz = r.z;
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            std::size_t in = i[n], jn = j[n];
+            T x = rx[in] - rx[jn], y = ry[in] - ry[jn], z = rz[in] - rz[jn];
+            pbc.nearestImage(x, y, z);
+            d2[n] = x*x + y*y + z*z;
+        }
+    }
+
+    // The same for arrays of Vector<T>
+    template <class BOX,typename T>
+    INLINE void dist2( const BOX& box,
+                       const Vector<T>* r,
+                       const std::size_t* i,
+                       const std::size_t* j,
+                       T* d2,
+                       std::size_t num )
+    {
+        const BOX pbc(box);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            const Vector<T>& ri = r[i[n]];
+            const Vector<T>& rj = r[j[n]];
+            T x = ri.x - rj.x, y = ri.y - rj.y, z = ri.z - rj.z;
+            pbc.nearestImage(x, y, z);
+            d2[n] = x*x + y*y + z*z;
+        }
+    }
+
+    // Puts all r[n] inside the box
+    template <class BOX,typename T>
+    INLINE void wrap( const BOX& box,
+                      Vector<T,Base,ArrayOp,Base>& r )
+    {
+        const BOX pbc(box);
+        T* rx = r.x; T* ry = r.y; T* rz = r.z;
+        std::size_t num = r.size();
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = rx[n], y = ry[n], z = rz[n];
+            pbc.insideImage(x, y, z);
+            rx[n] = x;
+            ry[n] = y;
+            rz[n] = z;
+        }
+    }
+
+    // The same for arrays of Vector<T>
+    template <class BOX,typename T>
+    INLINE void wrap( const BOX& box,
+                      Vector<T>* r,
+                      std::size_t num )
+    {
+        const BOX pbc(box);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = r[n].x, y = r[n].y, z = r[n].z;
+            pbc.insideImage(x, y, z);
+            r[n].x = x;
+            r[n].y = y;
+            r[n].z = z;
+        }
+    }
+
+    // Sets out[n] to the image of r[n] closest to ref[n]
+    template <class BOX,typename T>
+    INLINE void unwrap( const BOX& box,
+                        const Vector<T,Base,ArrayOp,Base>& r,
+                        const Vector<T,Base,ArrayOp,Base>& ref,
+                        Vector<T,Base,ArrayOp,Base>& out )
+    {
+        const BOX pbc(box);
+        const T* rx = r.x; const T* ry = r.y; const T* rz = r.z;
+        const T* fx = ref.x; const T* fy = ref.y; const T* fz = ref.z;
+        T* ox = out.x; T* oy = out.y; T* oz = out.z;
+        std::size_t num = r.size();
+        assert(ref.size() == num && out.size() == num);
+        VECMAT3_PARALLEL_LOOP
+        for (std::size_t n = 0; n < num; n++) {
+            T x = rx[n] - fx[n], y = ry[n] - fy[n], z = rz[n] - fz[n];
+            pbc.nearestImage(x, y, z);
+            ox[n] = fx[n] + x;
+            oy[n] = fy[n] + y;
+            oz[n] = fz[n] + z;
+        }
+    }
+
+    //
+    // All-pairs minimum image distances, as the kernels of the same
+    // names in vecmat3batch.h
+    //
+
+    template <class BOX,typename T>
+    INLINE void dist2Matrix( const BOX& box,
+                             const Vector<T,Base,ArrayOp,Base>& a,
+                             const Vector<T,Base,ArrayOp,Base>& b,
+                             T* d2 )
+    {
+        distanceMatrix<false>(box, a, b, d2, false);
+    }
+
+    template <class BOX,typename T>
+    INLINE void distMatrix( const BOX& box,
+                            const Vector<T,Base,ArrayOp,Base>& a,
+                            const Vector<T,Base,ArrayOp,Base>& b,
+                            T* d )
+    {
+        distanceMatrix<true>(box, a, b, d, false);
+    }
+
+    template <class BOX,typename T>
+    INLINE void dist2Matrix( const BOX& box,
+                             const Vector<T,Base,ArrayOp,Base>& a,
+                             T* d2 )
+    {
+        distanceMatrix<false>(box, a, a, d2, true);
+    }
+
+    template <class BOX,typename T>
+    INLINE void distMatrix( const BOX& box,
+                            const Vector<T,Base,ArrayOp,Base>& a,
+                            T* d )
+    {
+        distanceMatrix<true>(box, a, a, d, true);
+    }
+
+    template <class BOX,typename T,class F>
+    INLINE F dist2Tiles( const BOX& box,
+                         const Vector<T,Base,ArrayOp,Base>& a,
+                         const Vector<T,Base,ArrayOp,Base>& b,
+                         F f )
+    {
+        return distanceTiles<false>(box, a, b, f);
+    }
+
+    template <class BOX,typename T,class F>
+    INLINE F distTiles( const BOX& box,
+                        const Vector<T,Base,ArrayOp,Base>& a,
+                        const Vector<T,Base,ArrayOp,Base>& b,
+                        F f )
+    {
+        return distanceTiles<true>(box, a, b, f);
+    }
+
+} // end namespace vecmat3
+
+#endif